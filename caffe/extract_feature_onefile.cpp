@@ -27,8 +27,11 @@
 #include "caffe/net.hpp"
 #include "caffe/vision_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/bfloat16.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/image_io.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 #define uint unsigned int
 
@@ -44,29 +47,47 @@ int main(int argc, char** argv) {
 template<typename Dtype>
 bool append_blob_to_binary(FILE* f, Blob<Dtype>* blob, int num_index)
 {
-	float *buff;
-	int n, c, l, w, h;
+	const Dtype *buff;
+	int n, c, l, w, h, offset;
 	if (f == NULL)
 		return false;
 
 	if (num_index<0){
 		n = blob->num();
-		buff = blob->mutable_cpu_data();
+		offset = 0;
 	}
 	else{
 		n = 1;
-		buff = blob->mutable_cpu_data() + blob->offset(num_index);
+		offset = blob->offset(num_index);
 	}
 	c = blob->channels();
 	l = blob->length();
 	h = blob->height();
 	w = blob->width();
+	// features are always written in full precision
+	vector<Dtype> decoded;
+	if (blob->bfloat16_storage()) {
+		decoded.resize(n * c * l * h * w);
+		bfloat16_decode_cpu(n * c * l * h * w,
+			blob->cpu_bfloat16_data() + offset, &decoded[0]);
+		buff = &decoded[0];
+	}
+	else{
+		buff = blob->cpu_data() + offset;
+	}
 
 	fwrite(&n, sizeof(int), 1, f);
 	fwrite(&c, sizeof(int), 1, f);
 	fwrite(&l, sizeof(int), 1, f);
 	fwrite(&h, sizeof(int), 1, f);
 	fwrite(&w, sizeof(int), 1, f);
+	if (blob->layout() == NLHWC) {
+		// features are always written in NCLHW order
+		vector<Dtype> converted(n * c * l * h * w);
+		convert_layout_cpu<Dtype>(buff, n, c, l * h * w, NLHWC, &converted[0]);
+		fwrite(&converted[0], sizeof(Dtype), n * c * l * h * w, f);
+		return true;
+	}
 	fwrite(buff, sizeof(Dtype), n * c * l * h * w, f);
 	return true;
 }
@@ -91,8 +112,15 @@ int feature_extraction_pipeline(int argc, char** argv) {
 		LOG(ERROR) << "Using CPU";
 	}
 
+	// The feature blobs are read after Forward, so a net with plan_memory must
+	// not reuse their memory.
+	NetParameter feature_extraction_param;
+	ReadNetParamsFromTextFileOrDie(string(net_proto), &feature_extraction_param);
+	for (int k = 7; k < argc; k++){
+		feature_extraction_param.add_keep_blob(string(argv[k]));
+	}
 	boost::shared_ptr<Net<Dtype> > feature_extraction_net(
-		new Net<Dtype>(string(net_proto)));
+		new Net<Dtype>(feature_extraction_param));
 	feature_extraction_net->CopyTrainedLayersFrom(string(pretrained_model));
 
 	for (int i = 7; i<argc; i++){
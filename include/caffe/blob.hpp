@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/bfloat16.hpp"
 
 namespace caffe {
 
@@ -13,8 +14,8 @@ template <typename Dtype>
 class Blob {
  public:
   Blob()
-       : num_(0), channels_(0), length_(0), height_(0), width_(0), count_(0), data_(),
-       diff_() {}
+       : num_(0), channels_(0), length_(0), height_(0), width_(0), count_(0),
+       layout_(NCLHW), bfloat16_storage_(false), data_(), diff_() {}
   explicit Blob(const int num, const int channels, const int length, const int height,
     const int width);
 
@@ -28,6 +29,7 @@ class Blob {
   void Reshape(const int num, const int channels, const int height,
     const int width);
 
+  // Reshapes to the shape and the layout of other.
   void ReshapeLike(const Blob& other);
   inline int num() const { return num_; }
   inline int channels() const { return channels_; }
@@ -35,6 +37,18 @@ class Blob {
   inline int height() const { return height_; }
   inline int width() const { return width_; }
   inline int count() const {return count_; }
+  // The memory order of the elements (NCLHW unless set otherwise). The shape
+  // accessors above and offset() always take the logical num, channels,
+  // length, height and width, whatever the layout. Reshape keeps the layout.
+  inline Layout layout() const { return layout_; }
+  inline void set_layout(const Layout layout) { layout_ = layout; }
+  // Whether the data is stored as bfloat16, in half the memory of float (see
+  // NetParameter.bfloat16_storage). It is then read and written through
+  // cpu_bfloat16_data() and mutable_cpu_bfloat16_data() only, and the layers
+  // that support it compute in Dtype; the diff stays in Dtype. Changing the
+  // storage reallocates the data; Reshape keeps it.
+  inline bool bfloat16_storage() const { return bfloat16_storage_; }
+  void set_bfloat16_storage(const bool bfloat16_storage);
 
   // for backward compatibility
   inline int offset(const int n){
@@ -57,6 +71,9 @@ class Blob {
     CHECK_LE(h, height_);
     CHECK_GE(w, 0);
     CHECK_LE(w, width_);
+    if (layout_ == NLHWC) {
+      return (((n * length_ + l) * height_ + h) * width_ + w) * channels_ + c;
+    }
     return (((n * channels_ + c) * length_ + l) * height_ + h) * width_ + w;
   }
 
@@ -65,7 +82,8 @@ class Blob {
 	  return offset(n, c, 0, h, w);
   }
   // Copy from source. If copy_diff is false, we copy the data; if copy_diff
-  // is true, we copy the diff.
+  // is true, we copy the diff. Data is converted on the CPU between bfloat16
+  // and Dtype storage; reshape does not change the storage of this blob.
   void CopyFrom(const Blob<Dtype>& source, bool copy_diff = false,
       bool reshape = false);
 
@@ -101,6 +119,8 @@ class Blob {
 
   const Dtype* cpu_data() const;
   void set_cpu_data(Dtype* data);
+  const bfloat16* cpu_bfloat16_data() const;
+  bfloat16* mutable_cpu_bfloat16_data();
   const Dtype* gpu_data() const;
   const Dtype* cpu_diff() const;
   const Dtype* gpu_diff() const;
@@ -111,13 +131,17 @@ class Blob {
   void Update();
   void FromProto(const BlobProto& proto);
   void Lift3DFromProto(const BlobProto& proto, const int l);
-  void ToProto(BlobProto* proto, bool write_diff = false) const;
+  // With sparse, the data is written as its nonzero values and their
+  // positions (see BlobProto.sparse_gap).
+  void ToProto(BlobProto* proto, bool write_diff = false,
+      bool sparse = false) const;
 
   // Set the data_/diff_ shared_ptr to point to the SyncedMemory holding the
   // data_/diff_ of Blob other -- useful in layers which simply perform a copy
   // in their forward or backward pass.
   // This deallocates the SyncedMemory holding this blob's data/diff, as
   // shared_ptr calls its destructor when reset with the = operator.
+  // ShareData also takes the storage type of other.
   void ShareData(const Blob& other);
   void ShareDiff(const Blob& other);
 
@@ -130,6 +154,8 @@ class Blob {
   int height_;
   int width_;
   int count_;
+  Layout layout_;
+  bool bfloat16_storage_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
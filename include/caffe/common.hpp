@@ -3,6 +3,8 @@
 #ifndef CAFFE_COMMON_HPP_
 #define CAFFE_COMMON_HPP_
 
+#include <pthread.h>
+
 #include <boost/shared_ptr.hpp>
 #include <cublas_v2.h>
 #include <cuda.h>
@@ -10,6 +12,8 @@
 #include <driver_types.h>  // cuda driver types
 #include <glog/logging.h>
 
+#include <vector>
+
 // Disable the copy and assignment operator for a class.
 #define DISABLE_COPY_AND_ASSIGN(classname) \
 private:\
@@ -67,6 +71,7 @@ namespace caffe {
 // because cuda does not work (at least now) well with C++11 features.
 using boost::shared_ptr;
 
+class ThreadPool;
 
 // A singleton class to hold common caffe stuff, such as the handler that
 // caffe is going to use for cublas, curand, etc.
@@ -121,6 +126,18 @@ class Caffe {
   inline static void set_mode(Brew mode) { Get().mode_ = mode; }
   // Sets the phase.
   inline static void set_phase(Phase phase) { Get().phase_ = phase; }
+  // Returns the number of threads the CPU code of the layers may use.
+  inline static int cpu_threads() { return Get().cpu_threads_; }
+  // Sets the number of CPU threads. 1 (the default) keeps everything on the
+  // calling thread. Note that this is independent of the threads of the BLAS
+  // library, which should usually be limited to 1 when cpu_threads > 1.
+  static void set_cpu_threads(const int cpu_threads);
+  // The pool of cpu_threads() threads the layers run their CPU code on. A
+  // thread bound to a NUMA node (see NumaBindThread) gets a pool of its own
+  // whose workers are bound to the same node, so that one Net replica per
+  // node can run concurrently; there is one pool per node and one for the
+  // unbound threads.
+  static ThreadPool& thread_pool();
   // Sets the random seed of both boost and curand
   static void set_random_seed(const unsigned int seed);
   // Sets the device. Since we have cublas and curand stuff, set device also
@@ -136,6 +153,11 @@ class Caffe {
 
   Brew mode_;
   Phase phase_;
+  int cpu_threads_;
+  // indexed by NUMA node + 1; the pools are created on first use by any
+  // thread, so thread_pools_mutex_ guards creating and resetting them
+  std::vector<shared_ptr<ThreadPool> > thread_pools_;
+  pthread_mutex_t thread_pools_mutex_;
   static shared_ptr<Caffe> singleton_;
 
  private:
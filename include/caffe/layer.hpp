@@ -7,6 +7,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/workspace.hpp"
 
 using std::vector;
 
@@ -53,11 +54,35 @@ class Layer {
   // Writes the layer parameter to a protocol buffer
   virtual void ToProto(LayerParameter* param, bool write_diff = false);
 
+  // Bytes of scratch memory the layer takes from its workspace during
+  // Forward and Backward in the current mode, known after SetUp.
+  virtual size_t workspace_size() { return 0; }
+  // Shares the scratch memory with other layers that never run at the same
+  // time, e.g. all layers of a Net. By default a layer has its own.
+  void set_workspace(const shared_ptr<Workspace>& workspace) {
+    workspace_ = workspace;
+  }
+  // Bytes of intermediate results the layer can keep from Forward so that
+  // Backward does not recompute them, 0 if it has none. Keeping them is
+  // turned on and off with set_cache_columns.
+  virtual size_t column_cache_size() { return 0; }
+  virtual void set_cache_columns(const bool cache_columns) {}
+  virtual bool cache_columns() { return false; }
+
  protected:
   // The protobuf that stores the layer parameters
   LayerParameter layer_param_;
   // The vector that stores the parameters as a set of blobs.
   vector<shared_ptr<Blob<Dtype> > > blobs_;
+  // Scratch memory, see set_workspace.
+  shared_ptr<Workspace> workspace_;
+
+  Workspace* workspace() {
+    if (!workspace_) {
+      workspace_.reset(new Workspace());
+    }
+    return workspace_.get();
+  }
 
   // Forward functions: compute the layer output
   // (and loss layers return the loss; other layers return the dummy value 0.)
@@ -124,8 +149,11 @@ void Layer<Dtype>::ToProto(LayerParameter* param, bool write_diff) {
   param->Clear();
   param->CopyFrom(layer_param_);
   param->clear_blobs();
+  // the weights of pruned layers are written sparse
+  const bool sparse = layer_param_.has_sparsity_param() &&
+      layer_param_.sparsity_param().sparse_snapshot();
   for (int i = 0; i < blobs_.size(); ++i) {
-    blobs_[i]->ToProto(param->add_blobs(), write_diff);
+    blobs_[i]->ToProto(param->add_blobs(), write_diff, sparse && i == 0);
   }
 }
 
@@ -4,6 +4,7 @@
 #define CAFFE_NET_HPP_
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -11,8 +12,11 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/dag_executor.hpp"
+#include "caffe/util/rng.hpp"
 
 using std::map;
+using std::set;
 using std::vector;
 using std::string;
 
@@ -99,11 +103,41 @@ class Net {
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name);
   bool has_layer(const string& layer_name);
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name);
+  // the scratch memory shared by all layers, see Layer::set_workspace
+  inline const shared_ptr<Workspace>& workspace() { return workspace_; }
 
  protected:
   // Function to get misc parameters, e.g. the learning rate multiplier and
   // weight decay.
   void GetLearningRateAndWeightDecay();
+  // Lets the layers keep their forward columns for Backward, see
+  // NetParameter.column_cache_limit.
+  void CacheColumns(const size_t limit);
+  // Hands the workspace of the net to every layer and sizes it for the
+  // largest of them.
+  void ShareWorkspace();
+  // Sets blob_group[i] to the same value for the blobs i sharing their data,
+  // the tops and the bottom of a SPLIT or a FLATTEN included.
+  void GroupSharedBlobs(vector<int>* blob_group);
+  // Puts the data of the blobs with disjoint lifetimes in shared buffers,
+  // except for the inputs, the outputs and keep_blobs, see
+  // NetParameter.plan_memory.
+  void PlanMemory(const set<string>& keep_blobs);
+  // Splits the layers into segments and puts the blobs used within a single
+  // segment in a buffer shared by all segments, see
+  // NetParameter.gradient_checkpointing.
+  void SetUpCheckpoints(const NetParameter& param);
+  // Runs again the Forward of the layers of a segment writing the blobs it
+  // does not keep, with the random numbers they drew in Forward.
+  void RecomputeSegment(const int segment);
+  // Builds the dependency graphs of the layers in Forward and Backward and
+  // gives the layers that may run at the same time workspaces of their own,
+  // see NetParameter.parallel_branches.
+  void SetUpBranches(const NetParameter& param);
+  // The tasks of the graphs: the Forward of layer i, and the Backward of the
+  // i-th layer from the end.
+  void ForwardLayer(const int i);
+  void BackwardLayer(const int i);
 
   // Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
@@ -136,6 +170,26 @@ class Net {
   vector<float> params_lr_;
   // the weight decay multipliers
   vector<float> params_weight_decay_;
+  // scratch memory of the layers
+  shared_ptr<Workspace> workspace_;
+  // the buffers holding the data of the planned blobs
+  vector<shared_ptr<SyncedMemory> > activation_buffers_;
+  // gradient checkpointing: the first layer of each segment followed by the
+  // number of layers, the layers each segment recomputes before its
+  // Backward, the random number generator before each of them in Forward,
+  // and the buffer of the blobs that are not kept
+  vector<int> checkpoint_begin_;
+  vector<vector<int> > checkpoint_recompute_;
+  vector<bool> layer_recomputed_;
+  vector<rng_t> checkpoint_rng_;
+  shared_ptr<SyncedMemory> checkpoint_buffer_;
+  // parallel branches: the executors of Forward and Backward, the loss of
+  // every layer, summed in order after Forward, and the workspaces of the
+  // layers that may run alongside those using workspace_
+  shared_ptr<DagExecutor> forward_executor_;
+  shared_ptr<DagExecutor> backward_executor_;
+  vector<Dtype> layer_loss_;
+  vector<shared_ptr<Workspace> > branch_workspaces_;
   DISABLE_COPY_AND_ASSIGN(Net);
 };
 
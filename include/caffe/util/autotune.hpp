@@ -0,0 +1,65 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_AUTOTUNE_H_
+#define CAFFE_UTIL_AUTOTUNE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+using std::string;
+using std::vector;
+
+namespace caffe {
+
+// The brand string of the CPU (from cpuid on x86), used to key the tuning
+// cache so that a cache copied to another host is not trusted there.
+string CpuModelName();
+
+// Picks the CPU algorithm of the convolution layers of a Net (see
+// NetParameter.autotune_convolution) by timing every candidate on the shape
+// of the layer, and remembers the winners in a ConvolutionTuningCache file.
+template <typename Dtype>
+class ConvolutionTuner {
+ public:
+  // An empty cache_file keeps the winners in memory only.
+  explicit ConvolutionTuner(const string& cache_file);
+
+  // If param is a CONVOLUTION3D, DECONVOLUTION3D or CONVOLUTION layer with
+  // engine DEFAULT and more than one candidate, sets tuned_param to param
+  // with the fastest candidate for bottom and top (taken from the cache or
+  // timed on blobs of the same shape, layout and storage) and returns true.
+  bool Tune(const LayerParameter& param, const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top, LayerParameter* tuned_param);
+  // Writes the cache file if new winners were timed.
+  void Save();
+
+  // The cache key of the layer: its type, shape, parameters that change the
+  // algorithms, storage, phase, the CPU model and cpu_threads.
+  static string Key(const LayerParameter& param, const Blob<Dtype>& bottom,
+      const Blob<Dtype>& top);
+  // The candidates of the layer, param with the engine and clips_per_gemm
+  // of each algorithm applicable to its shape.
+  static void Candidates(const LayerParameter& param,
+      const Blob<Dtype>& bottom, vector<LayerParameter>* candidates);
+
+ protected:
+  // Best time in milliseconds over a few runs of the layer.
+  float Time(const LayerParameter& param, const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  string cache_file_;
+  ConvolutionTuningCache cache_;
+  std::map<string, int> entry_index_;
+  bool updated_;
+
+  DISABLE_COPY_AND_ASSIGN(ConvolutionTuner);
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_AUTOTUNE_H_
@@ -0,0 +1,96 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_BFLOAT16_H_
+#define CAFFE_UTIL_BFLOAT16_H_
+
+#include <stdint.h>
+
+#include <cstring>
+#include <set>
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// bfloat16, the upper half of an IEEE float: the same 8-bit exponent and
+// range, 8 bits of precision. Blobs whose data is stored as bfloat16 (see
+// NetParameter.bfloat16_storage) take half the memory of float blobs; the
+// layers that read and write them convert on load and store and compute in
+// Dtype.
+struct bfloat16 {
+  uint16_t bits;
+};
+
+// Rounds to the nearest bfloat16, ties to even. NaNs stay (quiet) NaNs.
+inline bfloat16 float_to_bfloat16(const float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bfloat16 y;
+  if ((bits & 0x7fffffffu) > 0x7f800000u) {
+    y.bits = static_cast<uint16_t>((bits >> 16) | 0x0040u);
+  } else {
+    y.bits = static_cast<uint16_t>(
+        (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16);
+  }
+  return y;
+}
+
+inline float bfloat16_to_float(const bfloat16 x) {
+  const uint32_t bits = static_cast<uint32_t>(x.bits) << 16;
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  return y;
+}
+
+// storage_value(x) is the value of a stored element to compute with, and
+// storage_store(value, y) stores a Dtype value as the type of *y, so that a
+// kernel templated on its input and output types reads and writes Dtype and
+// bfloat16 blobs alike.
+template <typename Dtype>
+inline Dtype storage_value(const Dtype x) {
+  return x;
+}
+
+inline float storage_value(const bfloat16 x) {
+  return bfloat16_to_float(x);
+}
+
+template <typename Dtype>
+inline void storage_store(const Dtype x, Dtype* y) {
+  *y = x;
+}
+
+template <typename Dtype>
+inline void storage_store(const Dtype x, bfloat16* y) {
+  *y = float_to_bfloat16(static_cast<float>(x));
+}
+
+// y[i] = bfloat16(x[i]) for n values.
+template <typename Dtype>
+inline void bfloat16_encode_cpu(const int n, const Dtype* x, bfloat16* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = float_to_bfloat16(static_cast<float>(x[i]));
+  }
+}
+
+// y[i] = x[i] for n bfloat16 values.
+template <typename Dtype>
+inline void bfloat16_decode_cpu(const int n, const bfloat16* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = static_cast<Dtype>(bfloat16_to_float(x[i]));
+  }
+}
+
+// Whether the layer reads and writes bfloat16 blobs in its CPU Forward.
+bool SupportsBfloat16Storage(const LayerParameter& layer_param);
+
+// The blobs of a TEST net (after InsertSplits) to store as bfloat16: those
+// produced and consumed only by layers that support it. The inputs and the
+// outputs of the net are kept in Dtype for the callers that read them.
+void SelectBfloat16Blobs(const NetParameter& param,
+    std::set<std::string>* blob_names);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_BFLOAT16_H_
@@ -0,0 +1,34 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_CONV3D_DEPTHWISE_HPP_
+#define _CAFFE_UTIL_CONV3D_DEPTHWISE_HPP_
+
+namespace caffe {
+
+// Depthwise 3x3x3 convolution, one filter per channel (ConvolutionParameter
+// group, channels and num_output all equal), used by Convolution3DLayer with
+// the DEPTHWISE engine. Each output row is accumulated straight from the
+// input rows, without vol2col, for any stride and padding.
+
+// data_out (channels x length_out x height_out x width_out) = every channel
+// of data_im (channels x length x height x width) convolved with its own
+// 3 x 3 x 3 filter of weight (channels x 3 x 3 x 3).
+template <typename Dtype>
+void conv3d_depthwise_forward_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int pad,
+    const int temporal_pad, const int stride, const int temporal_stride,
+    const Dtype* weight, Dtype* data_out);
+
+// Accumulates into weight_diff the gradient w.r.t. the weights, given the
+// input and the top diff, and writes the gradient w.r.t. the input to
+// data_im_diff unless it is NULL.
+template <typename Dtype>
+void conv3d_depthwise_backward_cpu(const Dtype* data_im, const Dtype* top_diff,
+    const int channels, const int length, const int height, const int width,
+    const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const Dtype* weight, Dtype* weight_diff,
+    Dtype* data_im_diff);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_CONV3D_DEPTHWISE_HPP_
@@ -0,0 +1,47 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_CONV3D_DIRECT_HPP_
+#define _CAFFE_UTIL_CONV3D_DIRECT_HPP_
+
+namespace caffe {
+
+// Direct (vol2col-free) 3x3x3 convolution with stride 1 and padding 1, used by
+// Convolution3DLayer for its most common shape. The input is first copied into
+// a zero-padded volume of conv3d_direct_padded_count() elements, which costs
+// one copy of the input instead of the 27 copies made by vol2col.
+
+// Number of elements of the padded volume, including the slack read past the
+// last row by the vectorized kernels.
+int conv3d_direct_padded_count(const int channels, const int length,
+    const int height, const int width);
+
+// Copies a channels x length x height x width volume into the interior of the
+// zero-padded volume data_pad.
+template <typename Dtype>
+void conv3d_direct_pad_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, Dtype* data_pad);
+
+// data_out (num_output x length x height x width) = weight (num_output x
+// channels x 3 x 3 x 3) convolved with the padded input.
+template <typename Dtype>
+void conv3d_direct_forward_cpu(const Dtype* data_pad, const int channels,
+    const int length, const int height, const int width, const Dtype* weight,
+    const int num_output, Dtype* data_out);
+
+// Accumulates into weight_diff the gradient w.r.t. the weights, given the
+// padded input and the num_output x length x height x width top diff.
+template <typename Dtype>
+void conv3d_direct_weight_grad_cpu(const Dtype* data_pad, const int channels,
+    const int length, const int height, const int width, const Dtype* top_diff,
+    const int num_output, Dtype* weight_diff);
+
+// Rearranges weight (num_output x channels x 3 x 3 x 3) into the spatially
+// flipped channels x num_output x 3 x 3 x 3 filters, so that the gradient
+// w.r.t. the bottom is conv3d_direct_forward_cpu of the padded top diff.
+template <typename Dtype>
+void conv3d_direct_flip_weight_cpu(const Dtype* weight, const int num_output,
+    const int channels, Dtype* weight_flipped);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_CONV3D_DIRECT_HPP_
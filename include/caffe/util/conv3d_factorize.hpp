@@ -0,0 +1,31 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_CONV3D_FACTORIZE_HPP_
+#define _CAFFE_UTIL_CONV3D_FACTORIZE_HPP_
+
+namespace caffe {
+
+// (2+1)D factorization of a trained kernel_depth x kernel_size x kernel_size
+// convolution into a 1 x kernel_size x kernel_size spatial convolution to
+// rank channels, without bias, followed by a kernel_depth x 1 x 1 temporal
+// convolution. With the filters seen as the (num_output * kernel_depth) x
+// (channels * kernel_size^2) matrix of their temporal and spatial taps, the
+// two convolutions are its truncated SVD, the singular values split evenly
+// between the two factors. Used by tools/factorize_convolution3d.
+
+// The largest useful rank, past which the factorization is exact.
+int conv3d_factorize_max_rank(const int num_output, const int channels,
+    const int kernel_depth, const int kernel_size);
+
+// Writes spatial_weight (rank x channels x 1 x kernel_size x kernel_size)
+// and temporal_weight (num_output x rank x kernel_depth x 1 x 1) for weight
+// (num_output x channels x kernel_depth x kernel_size x kernel_size), and
+// returns the relative Frobenius norm of the part of weight they drop.
+template <typename Dtype>
+Dtype conv3d_factorize_cpu(const Dtype* weight, const int num_output,
+    const int channels, const int kernel_depth, const int kernel_size,
+    const int rank, Dtype* spatial_weight, Dtype* temporal_weight);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_CONV3D_FACTORIZE_HPP_
@@ -0,0 +1,100 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_CONV3D_FFT_H_
+#define CAFFE_UTIL_CONV3D_FFT_H_
+
+#include <stdint.h>
+
+#include "caffe/blob.hpp"
+#include "caffe/util/fft.hpp"
+
+namespace caffe {
+
+// FFT-based stride 1 3D convolution shared by Convolution3DLayer and
+// Deconvolution3DLayer. Given filters w of num x channels x kernel_depth x
+// kernel_size x kernel_size, a "large" volume of channels x length x height x
+// width zero-padded by temporal_pad / pad, and a "small" volume of num x
+// (padded length - kernel_depth + 1) x ... it computes
+//   Correlate:  small[p] = sum_q large_pad[q] correlated with w[p][q]
+//   Convolve:   large[q] = sum_p small[p] fully convolved with w[p][q],
+//               cropped by the padding
+//   AccumulateWeightGradient / AddWeightGradient:
+//               w_diff[p][q] += small[p] correlated with large_pad[q]
+// With w laid out num_output x channels, Correlate is the forward pass of a
+// convolution and Convolve its gradient w.r.t. the bottom. With w laid out
+// channels x num_output, Convolve is the forward pass of a deconvolution and
+// Correlate its gradient w.r.t. the bottom.
+//
+// The filter spectra are cached and recomputed only when the weights change.
+// The padded volume is processed in tiles along length, so that the FFT size
+// along length (and with it the size of every spectrum) stays bounded.
+template <typename Dtype>
+class Conv3DFFT {
+ public:
+  Conv3DFFT();
+  // Returns false if the cached spectra and the buffers of one length tile do
+  // not fit in workspace_limit bytes, in which case the engine cannot be used.
+  bool Init(const int num, const int channels, const int length,
+      const int height, const int width, const int kernel_depth,
+      const int kernel_size, const int temporal_pad, const int pad,
+      const uint64_t workspace_limit);
+  // Estimated ratio of the multiply-adds of vol2col + GEMM to those of the
+  // FFT engine for one clip.
+  double EstimatedSavings() const;
+  // Recomputes the filter spectra if weight changed since the last call.
+  void UpdateFilters(const Blob<Dtype>& weight);
+
+  void Correlate(const Dtype* large, Dtype* small);
+  void Convolve(const Dtype* small, Dtype* large);
+  void AccumulateWeightGradient(const Dtype* small, const Dtype* large);
+  // Adds the accumulated gradient to weight_diff and clears it.
+  void AddWeightGradient(Dtype* weight_diff);
+
+  inline int fft_length() const { return fft_length_; }
+  inline int tile_length() const { return tile_length_; }
+
+ protected:
+  // Transforms one channel of a length x height x width volume into spectrum.
+  // Row j < rows of the FFT input holds row first + j of the volume, shifted
+  // by offset along height and width; everything else is zero.
+  void LoadTile(const Dtype* volume, const int length, const int height,
+      const int width, const int first, const int rows, const int offset,
+      Dtype* spectrum);
+
+  int num_;
+  int channels_;
+  int length_;
+  int height_;
+  int width_;
+  int kernel_depth_;
+  int kernel_size_;
+  int temporal_pad_;
+  int pad_;
+  // padded large volume and small volume sizes
+  int padded_length_;
+  int padded_height_;
+  int padded_width_;
+  int small_length_;
+  int small_height_;
+  int small_width_;
+  // FFT sizes, and rows of the small volume produced by one length tile
+  int fft_length_;
+  int fft_height_;
+  int fft_width_;
+  int tile_length_;
+  RealFFT3D<Dtype> fft_;
+  // num x channels filter spectra and their weight gradient accumulator
+  Blob<Dtype> filter_spectra_;
+  Blob<Dtype> gradient_spectra_;
+  // spectra of the large and small volumes of one tile
+  Blob<Dtype> large_spectra_;
+  Blob<Dtype> small_spectra_;
+  Blob<Dtype> product_;
+  Blob<Dtype> real_;
+  const SyncedMemory* filter_source_;
+  unsigned int filter_version_;
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_CONV3D_FFT_H_
@@ -0,0 +1,37 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_CONV3D_WINOGRAD_HPP_
+#define _CAFFE_UTIL_CONV3D_WINOGRAD_HPP_
+
+namespace caffe {
+
+// Winograd F(2x2x2, 3x3x3) convolution for 3x3x3 kernels with stride 1. Each
+// 2x2x2 output tile is computed from a 4x4x4 input tile, and the products of
+// all tiles are done as 64 GEMMs (one per transformed element) of size
+// num_output x channels x tiles, i.e. 64 multiplies per tile instead of 216.
+
+// Number of elements of transformed filters for num_output x channels.
+int conv3d_winograd_filter_count(const int num_output, const int channels);
+
+// Transforms weight (num_output x channels x 3 x 3 x 3) into the 64 x
+// num_output x channels filters used by conv3d_winograd_forward_cpu.
+template <typename Dtype>
+void conv3d_winograd_filter_transform_cpu(const Dtype* weight,
+    const int num_output, const int channels, Dtype* weight_winograd);
+
+// Number of elements of the workspace used by conv3d_winograd_forward_cpu.
+int conv3d_winograd_workspace_count(const int channels, const int length,
+    const int height, const int width, const int pad, const int temporal_pad,
+    const int num_output);
+
+// data_out (num_output x length_out x height_out x width_out) = convolution of
+// one clip with the transformed filters, with the given zero padding.
+template <typename Dtype>
+void conv3d_winograd_forward_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int pad,
+    const int temporal_pad, const Dtype* weight_winograd, const int num_output,
+    Dtype* workspace, Dtype* data_out);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_CONV3D_WINOGRAD_HPP_
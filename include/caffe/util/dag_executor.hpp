@@ -0,0 +1,56 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_DAG_EXECUTOR_H_
+#define CAFFE_UTIL_DAG_EXECUTOR_H_
+
+#include <pthread.h>
+
+#include <boost/function.hpp>
+
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// Runs the tasks of a dependency graph on a pool of num_threads threads, the
+// calling thread included. predecessors[i] lists the tasks that must have
+// returned before task i starts; they all come before i, so the task
+// indices are a valid serial order. Of the tasks that are ready, the one
+// with the lowest index runs first. The workers are bound to the NUMA node
+// of the thread creating the executor (see NumaBindThread).
+class DagExecutor {
+ public:
+  DagExecutor(const std::vector<std::vector<int> >& predecessors,
+      const int num_threads);
+  ~DagExecutor();
+
+  // Calls task(i) once for every task i and returns once all calls did.
+  void Run(const boost::function<void(int)>& task);
+  inline int num_tasks() const { return num_predecessors_.size(); }
+  inline int num_threads() const { return pool_.num_threads(); }
+
+ protected:
+  void Worker(const boost::function<void(int)>* task, const int thread_id);
+
+  std::vector<std::vector<int> > successors_;
+  std::vector<int> num_predecessors_;
+  ThreadPool pool_;
+  // protects the fields below
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  // of the current Run: the predecessors every task still waits for, the
+  // tasks ready to run, and the number of tasks that returned
+  std::vector<int> waiting_;
+  std::priority_queue<int, std::vector<int>, std::greater<int> > ready_;
+  int finished_;
+
+  DISABLE_COPY_AND_ASSIGN(DagExecutor);
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_DAG_EXECUTOR_H_
@@ -0,0 +1,76 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_DECONV3D_PHASE_H_
+#define CAFFE_UTIL_DECONV3D_PHASE_H_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+
+namespace caffe {
+
+// Stride-phase decomposition of a 3D deconvolution, the PHASE engine of
+// Deconvolution3DLayer. Along a dimension of stride s, pad p and kernel k,
+// output x receives input q - m through tap r + s * m only, where
+// x + p = q * s + r and 0 <= r < s. The outputs of each of the stride^3
+// phases (r_length, r_height, r_width) are therefore a dense stride 1
+// correlation of the input with the ceil((k - r) / s) taps of the phase,
+// computed as a GEMM of the phase filters with the gathered input patches
+// and written to their interleaved positions. Unlike vol2col + GEMM +
+// col2vol, no output is accumulated by a scatter, and no column entry is
+// computed for a position cropped by the padding.
+//
+// The filters (channels x num_output / filter_group x kernel_depth x
+// kernel_size x kernel_size, as in Deconvolution3DLayer) are repacked per
+// phase, and only again when they change.
+template <typename Dtype>
+class Deconv3DPhase {
+ public:
+  Deconv3DPhase();
+  // length, height and width are those of the input, the output size that
+  // of Deconvolution3DLayer.
+  void Init(const int channels, const int num_output, const int filter_group,
+      const int length, const int height, const int width,
+      const int kernel_depth, const int kernel_size, const int temporal_pad,
+      const int pad, const int temporal_stride, const int stride);
+  // Number of Dtype values of the buffer Forward needs.
+  inline size_t buffer_count() const { return buffer_count_; }
+  // Repacks the phase filters if weight changed since the last call.
+  void UpdateFilters(const Blob<Dtype>& weight);
+  // Writes every element of top (num_output x output volume), the
+  // deconvolution of one clip of bottom without the bias.
+  void Forward(const Dtype* bottom, Dtype* buffer, Dtype* top) const;
+
+ protected:
+  // One output phase: per dimension (length, height, width) its residue r,
+  // the taps, the first input index q of its outputs, their number and the
+  // first output.
+  struct Phase {
+    int residue[3];
+    int taps[3];
+    int first[3];
+    int count[3];
+    int output[3];
+    // offset of its filters in filters_, and whether the gathered patches
+    // are the input itself (a single tap at q = input index)
+    int filter_offset;
+    bool identity;
+  };
+
+  int channels_;
+  int num_output_;
+  int filter_group_;
+  int input_[3];
+  int output_[3];
+  int kernel_[3];
+  int stride_[3];
+  std::vector<Phase> phases_;
+  std::vector<Dtype> filters_;
+  size_t buffer_count_;
+  const SyncedMemory* filter_source_;
+  unsigned int filter_version_;
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_DECONV3D_PHASE_H_
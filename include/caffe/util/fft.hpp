@@ -0,0 +1,62 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_FFT_H_
+#define CAFFE_UTIL_FFT_H_
+
+#include <vector>
+
+namespace caffe {
+
+// Radix-2 FFT of power-of-two length on interleaved (real, imaginary) data.
+template <typename Dtype>
+class FFTPlan {
+ public:
+  FFTPlan() : size_(0) {}
+  void Init(const int size);
+  // In-place unnormalized transform of size_ complex values whose
+  // consecutive elements are stride complex values apart.
+  void Transform(Dtype* data, const int stride, const bool inverse) const;
+  inline int size() const { return size_; }
+
+ protected:
+  int size_;
+  std::vector<Dtype> twiddle_;
+  std::vector<int> bit_reverse_;
+};
+
+// Real-to-complex 3D FFT of a power-of-two length x height x width volume.
+// The spectrum keeps the width / 2 + 1 non-redundant columns, stored as
+// length x height x (width / 2 + 1) interleaved complex values. Two real rows
+// are transformed at once by a single complex FFT.
+template <typename Dtype>
+class RealFFT3D {
+ public:
+  RealFFT3D() : length_(0), height_(0), width_(0) {}
+  void Init(const int length, const int height, const int width);
+  // number of complex values of a spectrum
+  inline int spectrum_count() const {
+    return length_ * height_ * (width_ / 2 + 1);
+  }
+  inline int count() const { return length_ * height_ * width_; }
+  void Forward(const Dtype* data, Dtype* spectrum);
+  // Unnormalized inverse transform, the result is scaled by count().
+  // spectrum is overwritten.
+  void Inverse(Dtype* spectrum, Dtype* data);
+
+  // Smallest power of two not smaller than n.
+  static int PowerOfTwo(const int n);
+
+ protected:
+  int length_;
+  int height_;
+  int width_;
+  FFTPlan<Dtype> plan_l_;
+  FFTPlan<Dtype> plan_h_;
+  FFTPlan<Dtype> plan_w_;
+  // one complex row of width_ values
+  std::vector<Dtype> row_;
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_FFT_H_
@@ -0,0 +1,21 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_FUSE_LAYERS_H_
+#define CAFFE_UTIL_FUSE_LAYERS_H_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with every CONVOLUTION3D layer merged with the in-place
+// RELU right after it, and then with a MAX POOLING3D without padding right
+// after that if it is the only layer reading the convolution output (see
+// NetParameter.fuse_convolution3d). The fused layer keeps the name of the
+// convolution; with a fused pooling its top is the top of the pooling.
+// Pooling is not fused into channels_last nets, nor into convolutions whose
+// top is a keep_blob.
+void FuseConvolution3D(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_FUSE_LAYERS_H_
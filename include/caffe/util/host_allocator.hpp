@@ -0,0 +1,88 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_H_
+#define CAFFE_UTIL_HOST_ALLOCATOR_H_
+
+#include <pthread.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+struct HostAllocatorStats {
+  // bytes of the blocks handed out and not freed yet, and their maximum
+  size_t bytes_in_use;
+  size_t peak_bytes_in_use;
+  // bytes of the freed blocks kept for reuse
+  size_t bytes_cached;
+  // calls to Allocate, and those served from the cache
+  size_t allocations;
+  size_t cache_hits;
+};
+
+// The host memory of SyncedMemory (see CaffeMallocHost). Blocks are 64-byte
+// aligned and rounded up to a size class, four per power of two. Freed
+// blocks are cached per size class, up to cache_limit bytes, and handed out
+// again, so the blobs and prefetch buffers that data layers reshape again
+// and again neither fault in fresh pages nor fragment the heap. With
+// huge_pages (Linux only), blocks of 2 MB and more are 2 MB aligned and
+// backed by transparent huge pages. On a thread bound to a NUMA node (see
+// NumaBindThread), new blocks are placed on that node and freed blocks are
+// only handed out again to threads of the same node.
+//
+// With use_malloc, blocks come from plain malloc and go back to free, e.g.
+// to debug memory errors with valgrind. use_malloc and huge_pages default
+// to the environment variables CAFFE_HOST_MALLOC and CAFFE_HOST_HUGE_PAGES
+// being set to a nonzero number. The allocator is thread safe.
+class HostAllocator {
+ public:
+  static HostAllocator& Get();
+
+  void* Allocate(const size_t size);
+  void Free(void* ptr);
+  // Returns the cached blocks to the system.
+  void ReleaseCache();
+  HostAllocatorStats stats();
+
+  inline bool use_malloc() const { return use_malloc_; }
+  inline void set_use_malloc(const bool use_malloc) {
+    use_malloc_ = use_malloc;
+  }
+  inline bool huge_pages() const { return huge_pages_; }
+  inline void set_huge_pages(const bool huge_pages) {
+    huge_pages_ = huge_pages;
+  }
+  inline size_t cache_limit() const { return cache_limit_; }
+  // Also releases the cached blocks beyond the new limit.
+  void set_cache_limit(const size_t cache_limit);
+
+ protected:
+  HostAllocator();
+  // The size of the block holding size bytes.
+  size_t BlockSize(const size_t size) const;
+  // Frees cached blocks until at most limit bytes are cached. Requires
+  // mutex_.
+  void TrimCache(const size_t limit);
+
+  bool use_malloc_;
+  bool huge_pages_;
+  size_t cache_limit_;
+  // protects the fields below
+  pthread_mutex_t mutex_;
+  // the size and NUMA node (-1 for unbound threads) of every block in use,
+  // and the cached blocks of each size and node
+  typedef std::pair<size_t, int> BlockKey;
+  std::map<void*, BlockKey> blocks_;
+  std::map<BlockKey, std::vector<void*> > cache_;
+  HostAllocatorStats stats_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_HOST_ALLOCATOR_H_
@@ -0,0 +1,30 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_LAYOUT_H_
+#define CAFFE_UTIL_LAYOUT_H_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Converts num clips of channels x spatial values (spatial = length x height
+// x width) from layout from to the other layout, i.e. transposes every clip
+// between channels x spatial (NCLHW) and spatial x channels (NLHWC).
+template <typename Dtype>
+void convert_layout_cpu(const Dtype* data, const int num, const int channels,
+    const int spatial, const Layout from, Dtype* out);
+
+// Copy NetParameters with LayoutLayers added so that the layers that support
+// channels-last blobs get NLHWC bottoms and all other layers NCLHW ones. A
+// blob is converted at most once per layout; the converted copy of blob
+// "name" is called "name_nlhwc" or "name_nclhw".
+void InsertLayoutConversions(const NetParameter& param,
+    NetParameter* param_converted);
+
+// Whether layers of the given type accept NLHWC bottoms (and then produce
+// NLHWC tops).
+bool LayerSupportsChannelsLast(const LayerParameter& layer_param);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_LAYOUT_H_
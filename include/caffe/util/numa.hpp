@@ -0,0 +1,37 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_NUMA_H_
+#define CAFFE_UTIL_NUMA_H_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// NUMA placement for running one CPU Net replica per socket. A thread bound
+// to a node with NumaBindThread only runs on the CPUs of that node, and the
+// memory it touches first comes from that node. The HostAllocator keeps the
+// blocks of every node apart, and Caffe::thread_pool() hands a bound thread
+// a pool whose workers are bound to the same node. So a Net that is
+// constructed and run on a bound thread keeps its weights, activations and
+// worker threads on one node.
+//
+// Supported on Linux (without libnuma) and on Windows (CPU affinity only,
+// processor group 0); elsewhere the machine counts as a single node and
+// binding has no effect.
+
+// The number of NUMA nodes of the machine, at least 1.
+int NumaNodeCount();
+// The CPUs of node.
+void NumaNodeCpus(const int node, std::vector<int>* cpus);
+// Binds the calling thread to node, or unbinds it for node -1.
+void NumaBindThread(const int node);
+// The node the calling thread is bound to, -1 if none.
+int NumaThreadNode();
+// Moves the whole pages within [ptr, ptr + size) to node (Linux only).
+void NumaMoveMemory(void* ptr, const size_t size, const int node);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_NUMA_H_
@@ -0,0 +1,84 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_POOL3D_H_
+#define CAFFE_UTIL_POOL3D_H_
+
+#include <algorithm>
+
+#include "caffe/util/bfloat16.hpp"
+
+namespace caffe {
+
+// Pooling of channels x length x height x width values (NCLHW clips, one
+// plane per channel of every clip) into channels x pooled_length x
+// pooled_height x pooled_width: the CPU code of Pooling3DLayer, the max
+// pooling also shared with the pooling fused into Convolution3DLayer. The
+// input and output may be stored as Dtype or as bfloat16 (see
+// NetParameter.bfloat16_storage); the values are computed in Dtype, given as
+// the first template argument. Large problems are split by planes over the
+// threads of Caffe::thread_pool(); the Backward functions overwrite
+// bottom_diff.
+
+// The window [*start, *end) along a dimension of size of the max pooling
+// output p: kernel values from p * stride - pad, clipped to the input. A
+// window past the end of the input (the pooled sizes are rounded up) is the
+// last input value; with padding, Pooling3DLayer drops the windows that
+// would lie in the trailing padding only.
+inline void pool3d_max_window(const int p, const int kernel, const int stride,
+    const int pad, const int size, int* start, int* end) {
+  const int first = p * stride - pad;
+  *start = std::min(std::max(first, 0), size - 1);
+  *end = std::max(std::min(first + kernel, size), *start + 1);
+}
+
+// Max pooling with spatial padding pad, which is never the maximum. Unless
+// mask is NULL, the index (l * height + h) * width + w in its channel of the
+// first maximum of every window is written to mask, which has the shape of
+// pooled. The 2 x 2 x 2 and 1 x 2 x 2 windows of stride 2 without padding
+// take a kernel that reduces an output row at once, across the width.
+template <typename Dtype, typename Itype, typename Otype>
+void pool3d_max_cpu(const Itype* data, const int channels, const int length,
+    const int height, const int width, const int kernel_depth,
+    const int kernel_size, const int temporal_stride, const int stride,
+    const int pad, const int pooled_length, const int pooled_height,
+    const int pooled_width, Otype* pooled, int* mask = NULL);
+
+// The gradient of pool3d_max_cpu given its mask: every top_diff value goes to
+// the bottom_diff value it was pooled from.
+template <typename Dtype>
+void pool3d_max_backward_cpu(const Dtype* top_diff, const int* mask,
+    const int channels, const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int temporal_stride,
+    const int stride, const int pad, const int pooled_length,
+    const int pooled_height, const int pooled_width, Dtype* bottom_diff);
+
+// The gradient of pool3d_max_cpu without a mask: every top_diff value goes to
+// all the values of its window equal to the pooled top_data value.
+template <typename Dtype>
+void pool3d_max_rescan_backward_cpu(const Dtype* bottom_data,
+    const Dtype* top_data, const Dtype* top_diff, const int channels,
+    const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int temporal_stride,
+    const int stride, const int pad, const int pooled_length,
+    const int pooled_height, const int pooled_width, Dtype* bottom_diff);
+
+// Average pooling with spatial padding pad. A window is divided by its size
+// clipped to the padded input.
+template <typename Dtype, typename Itype, typename Otype>
+void pool3d_ave_cpu(const Itype* data, const int channels, const int length,
+    const int height, const int width, const int kernel_depth,
+    const int kernel_size, const int temporal_stride, const int stride,
+    const int pad, const int pooled_length, const int pooled_height,
+    const int pooled_width, Otype* pooled);
+
+// The gradient of pool3d_ave_cpu.
+template <typename Dtype>
+void pool3d_ave_backward_cpu(const Dtype* top_diff, const int channels,
+    const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int temporal_stride,
+    const int stride, const int pad, const int pooled_length,
+    const int pooled_height, const int pooled_width, Dtype* bottom_diff);
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_POOL3D_H_
@@ -0,0 +1,68 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_QUANTIZE_H_
+#define CAFFE_UTIL_QUANTIZE_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/util/mkl_alternate.hpp"
+
+namespace caffe {
+
+// Symmetric int8 quantization for the INT8 inference path of
+// Convolution3DLayer and InnerProductLayer (see QuantizationParameter).
+// A value x is stored as x / scale rounded to the nearest integer and
+// clamped to [-127, 127], so that zero (and with it the padding of the
+// columns) stays exactly zero.
+
+// Quantizes n values with the given scale.
+template <typename Dtype>
+void quantize_cpu(const int n, const Dtype* x, const Dtype scale,
+    int8_t* quantized);
+
+// Quantizes every row of a rows x cols matrix with its own scale,
+// max |row| / 127 (1 for an all-zero row).
+template <typename Dtype>
+void quantize_rows_cpu(const int rows, const int cols, const Dtype* x,
+    int8_t* quantized, Dtype* scale);
+
+// C = A * B with int32 accumulation, where A is M x K and B is K x N
+// (TransB == CblasNoTrans) or N x K (CblasTrans). Large products are split
+// over Caffe::thread_pool() by columns of C; called from inside a job of the
+// pool it runs serially. Sums of K products of int8 values in [-127, 127]
+// cannot overflow for K < 2^17.
+void int8_gemm_cpu(const CBLAS_TRANSPOSE TransB, const int M, const int N,
+    const int K, const int8_t* A, const int8_t* B, int32_t* C);
+
+// y[i][j] = C[i][j] * row_scale[i] * scale + bias[i] for the M x N int32
+// matrix C, without the bias if bias is NULL.
+template <typename Dtype>
+void dequantize_rows_cpu(const int M, const int N, const int32_t* C,
+    const Dtype* row_scale, const Dtype scale, const Dtype* bias, Dtype* y);
+
+// The weights of a layer quantized per output channel (row), recomputed
+// only when the weights change.
+template <typename Dtype>
+class QuantizedWeights {
+ public:
+  QuantizedWeights() : source_(NULL), version_(0) {}
+  // Requantizes the rows x (weight.count() / rows) matrix of weight if it
+  // changed since the last call.
+  void Update(const Blob<Dtype>& weight, const int rows);
+
+  inline const int8_t* data() const { return &data_[0]; }
+  inline const Dtype* scale() const { return &scale_[0]; }
+
+ protected:
+  std::vector<int8_t> data_;
+  std::vector<Dtype> scale_;
+  const SyncedMemory* source_;
+  unsigned int version_;
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_QUANTIZE_H_
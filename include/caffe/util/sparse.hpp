@@ -0,0 +1,67 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_SPARSE_H_
+#define CAFFE_UTIL_SPARSE_H_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+
+namespace caffe {
+
+// Sparse execution of pruned weights for Convolution3DLayer and
+// InnerProductLayer (see SparsityParameter). The weights are held as a
+// compressed sparse row (CSR) matrix: the nonzeros of row i are values[j]
+// at column col_index[j] for j in [row_ptr[i], row_ptr[i + 1]).
+
+// C = A * B, where A is the M x K CSR matrix given by row_ptr (M + 1
+// entries), col_index and values, and B is K x N. row_ptr may point into a
+// larger matrix, whose column indices and values it indexes.
+template <typename Dtype>
+void csr_gemm_cpu(const int M, const int N, const int* row_ptr,
+    const int* col_index, const Dtype* values, const Dtype* B, Dtype* C);
+
+// C = B * A^T, where B is M x K and A is the N x K CSR matrix given by
+// row_ptr (N + 1 entries), col_index and values. Large products are split
+// over Caffe::thread_pool() by rows of A; called from inside a job of the
+// pool it runs serially.
+template <typename Dtype>
+void csr_gemm_trans_cpu(const int M, const int N, const int K,
+    const Dtype* B, const int* row_ptr, const int* col_index,
+    const Dtype* values, Dtype* C);
+
+// The CSR matrix of the weights of a layer, rebuilt only when the weights
+// change.
+template <typename Dtype>
+class SparseWeights {
+ public:
+  SparseWeights() : source_(NULL), version_(0), rows_(0), density_(1) {}
+  // If weight changed since the last call, sets its values of magnitude at
+  // most threshold to zero (keeping pruned weights pruned while training)
+  // and rebuilds the CSR matrix of its rows x (weight->count() / rows)
+  // matrix.
+  void Update(Blob<Dtype>* weight, const int rows, const Dtype threshold);
+
+  inline const int* row_ptr() const { return &row_ptr_[0]; }
+  inline const int* col_index() const {
+    return col_index_.empty() ? NULL : &col_index_[0];
+  }
+  inline const Dtype* values() const {
+    return values_.empty() ? NULL : &values_[0];
+  }
+  // The fraction of nonzero weights.
+  inline float density() const { return density_; }
+
+ protected:
+  std::vector<int> row_ptr_;
+  std::vector<int> col_index_;
+  std::vector<Dtype> values_;
+  const SyncedMemory* source_;
+  unsigned int version_;
+  int rows_;
+  float density_;
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_SPARSE_H_
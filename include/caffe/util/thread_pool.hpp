@@ -0,0 +1,58 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_THREAD_POOL_H_
+#define CAFFE_UTIL_THREAD_POOL_H_
+
+#include <pthread.h>
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// A fixed set of worker threads for the CPU code of the layers. Run(job)
+// calls job(thread_id) for every thread_id in [0, num_threads()) and returns
+// once all calls finished; thread_id 0 runs on the calling thread. A Run
+// issued while another one is in progress (e.g. from inside a job) does not
+// wait for the workers but calls job serially on the calling thread, so
+// nested parallel code stays correct. With numa_node >= 0, the workers are
+// bound to that NUMA node (see NumaBindThread).
+class ThreadPool {
+ public:
+  explicit ThreadPool(const int num_threads, const int numa_node = -1);
+  ~ThreadPool();
+
+  void Run(const boost::function<void(int)>& job);
+  inline int num_threads() const { return num_threads_; }
+  inline int numa_node() const { return numa_node_; }
+
+ protected:
+  static void* WorkerEntry(void* pool);
+  void Worker();
+
+  int num_threads_;
+  int numa_node_;
+  std::vector<pthread_t> workers_;
+  // held for the duration of a parallel Run
+  pthread_mutex_t run_mutex_;
+  // protects the fields below
+  pthread_mutex_t mutex_;
+  pthread_cond_t start_cond_;
+  pthread_cond_t done_cond_;
+  const boost::function<void(int)>* job_;
+  // incremented for every parallel Run, workers wait for it to change
+  unsigned int generation_;
+  // workers that picked their thread_id, and workers still running the job
+  int started_;
+  int pending_;
+  bool stop_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_THREAD_POOL_H_
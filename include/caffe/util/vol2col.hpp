@@ -18,9 +18,15 @@
 #ifndef VOL2COL_HPP_
 #define VOL2COL_HPP_
 
+#include "caffe/util/bfloat16.hpp"
 
 namespace caffe {
 
+// Large column matrices are split over Caffe::thread_pool(): vol2col_cpu by
+// column rows, col2vol_cpu by input channels and, when there are fewer
+// channels than threads, by frames of the input, so that no two threads
+// write the same element. Called from inside a job of the pool they run
+// serially.
 template <typename Dtype>
 void vol2col_cpu(const Dtype* data_im, const int channels, const int length,
     const int height, const int width, const int ksize, const int kdepth, const int pad,
@@ -31,6 +37,47 @@ void col2vol_cpu(const Dtype* data_col, const int channels, const int length,
     const int height, const int width, const int ksize, const int kdepth, const int pad,
     const int temporal_pad, const int stride, const int temporal_stride, Dtype* data_im);
 
+// Variants of vol2col_cpu/col2vol_cpu whose column matrix rows have a leading
+// dimension of col_stride instead of length_col * height_col * width_col, so
+// that several clips can be unrolled side by side into one K x (clips * N)
+// matrix (see ConvolutionParameter.clips_per_gemm). vol2col_cpu is also
+// instantiated for int8_t, the quantized bottom of INT8 layers.
+template <typename Dtype>
+void vol2col_cpu(const Dtype* data_im, const int channels, const int length,
+    const int height, const int width, const int ksize, const int kdepth, const int pad,
+    const int temporal_pad, const int stride, const int temporal_stride,
+    const int col_stride, Dtype* data_col);
+
+template <typename Dtype>
+void col2vol_cpu(const Dtype* data_col, const int channels, const int length,
+    const int height, const int width, const int ksize, const int kdepth, const int pad,
+    const int temporal_pad, const int stride, const int temporal_stride,
+    const int col_stride, Dtype* data_im);
+
+// vol2col_cpu of a bfloat16 volume (see NetParameter.bfloat16_storage) into
+// Dtype columns, decoding the values as they are copied.
+template <typename Dtype>
+void vol2col_cpu(const bfloat16* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int col_stride, Dtype* data_col);
+
+// Channels-last (NLHWC) variants. data_im is length x height x width x
+// channels and data_col has one row per output position holding its
+// kdepth x ksize x ksize x channels patch, so that whole channel vectors are
+// copied. col2vol_nlhwc_cpu overwrites data_im.
+template <typename Dtype>
+void vol2col_nlhwc_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, Dtype* data_col);
+
+template <typename Dtype>
+void col2vol_nlhwc_cpu(const Dtype* data_col, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, Dtype* data_im);
+
 template <typename Dtype>
 void vol2col_gpu(const Dtype* data_im, const int channels, const int length,
 	    const int height, const int width, const int ksize, const int kdepth, const int pad,
@@ -0,0 +1,36 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_WORKSPACE_H_
+#define CAFFE_UTIL_WORKSPACE_H_
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+// Scratch memory that layers only use within a single Forward or Backward
+// call, such as the column buffers of the convolutions. The layers of a Net
+// run one at a time, so they all share the Workspace of the Net and it only
+// has to be as large as the largest request. The memory is grown on demand;
+// growing it (or handing it to another layer) loses its contents.
+class Workspace {
+ public:
+  Workspace() : size_(0) {}
+
+  // Makes sure that the workspace holds at least size bytes. The memory is
+  // only allocated when it is first accessed.
+  void Reserve(const size_t size);
+  void* mutable_cpu_data(const size_t size);
+  void* mutable_gpu_data(const size_t size);
+  inline size_t size() const { return size_; }
+
+ protected:
+  size_t size_;
+  shared_ptr<SyncedMemory> memory_;
+
+  DISABLE_COPY_AND_ASSIGN(Workspace);
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_WORKSPACE_H_
@@ -28,6 +28,11 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/data_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/bfloat16.hpp"
+#include "caffe/util/conv3d_fft.hpp"
+#include "caffe/util/deconv3d_phase.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/sparse.hpp"
 
 namespace caffe {
 
@@ -38,6 +43,13 @@ namespace caffe {
 			: Layer<Dtype>(param) {}
 		virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
 			vector<Blob<Dtype>*>* top);
+		// the buffers of Caffe::cpu_threads() threads on the CPU, the column
+		// buffer of one clip on the GPU
+		virtual size_t workspace_size();
+		// the columns of the batch, GEMM engine only
+		virtual size_t column_cache_size();
+		virtual void set_cache_columns(const bool cache_columns);
+		virtual bool cache_columns() { return cache_columns_; }
 
 	protected:
 		virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -48,6 +60,53 @@ namespace caffe {
 			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
 		virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
 			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+		// recomputes the Winograd filters if the weights changed since the
+		// last call
+		void UpdateWinogradWeights();
+		// same for the filters reordered for channels-last columns
+		void UpdateChannelsLastWeights();
+		// CPU work of one of num_threads threads (see Caffe::cpu_threads):
+		// thread_id handles the clips (or GEMM tiles of clips) thread_id,
+		// thread_id + num_threads, ...
+		void ForwardThread(const Dtype* bottom_data, Dtype* top_data,
+			const int thread_id, const int num_threads);
+		void BackwardThread(const Dtype* top_diff, const Dtype* bottom_data,
+			Dtype* bottom_diff, const int thread_id, const int num_threads);
+		// fused layers: adds the bias to the num_output_ x N_ output of NCLHW
+		// clip n, applies the ReLU and the pooling, and writes the result to
+		// top (which is output itself without fused pooling or bfloat16)
+		void FusedEpilogue(Dtype* output, Dtype* top_data, const int n);
+		// buffers of one CPU thread
+		struct ThreadBuffers {
+			Dtype* bottom;
+			Dtype* col;
+			Dtype* gemm;
+			Dtype* pad;
+			Dtype* winograd;
+			Dtype* fused;
+			int32_t* int8_gemm;
+			int8_t* int8_bottom;
+			int8_t* int8_col;
+			Dtype* weight_diff;
+		};
+		ThreadBuffers thread_buffers(const int thread_id);
+		// the bottom of NCLHW clip n, decoded into buffers.bottom if it is
+		// stored as bfloat16
+		const Dtype* ClipBottom(const Dtype* bottom_data, const int n,
+			const ThreadBuffers& buffers);
+		// where the num_output_ x N_ output of NCLHW clip n is computed: top
+		// itself, or buffers.fused if it is pooled or stored as bfloat16
+		Dtype* ClipOutput(Dtype* top_data, const int n,
+			const ThreadBuffers& buffers);
+		// adds the bias to the output of clip n (unless add_bias is false) or
+		// runs the fused epilogue, and stores it to a bfloat16 top
+		void FinishClip(Dtype* output, Dtype* top_data, const int n,
+			const bool add_bias);
+		// number of Dtypes in the buffers of one thread, without the weight
+		// gradient accumulator
+		int thread_buffer_count();
+		// takes the buffers of all threads from the workspace
+		void ReserveThreadBuffers();
 
 		int kernel_size_;
 		int kernel_depth_;
@@ -62,12 +121,97 @@ namespace caffe {
 		int width_;
 		int num_output_;
 		int filter_group_;
-		Blob<Dtype> col_buffer_;
+		// number of Dtypes in the column buffer
+		int col_count_;
 		shared_ptr<SyncedMemory> bias_multiplier_;
 		bool bias_term_;
+		// The K_ x N_ columns of a clip give the M_ outputs of each of the
+		// group_ x filter_group_ GEMMs. The filters of channel group g (see
+		// ConvolutionParameter.group) only read its kernel_dim_ = K_ / group_
+		// rows of the columns.
 		int M_;
 		int K_;
 		int N_;
+		int group_;
+		int kernel_dim_;
+		// number of clips unrolled into the column buffer for a single GEMM,
+		// and the size of the staging buffer that holds the num_output_ x
+		// (clips * N_) GEMM result
+		int clips_per_gemm_;
+		int gemm_count_;
+		// CPU algorithm (ConvolutionParameter_Engine) resolved in SetUp, and
+		// the buffers of the direct 3x3x3 engine: the size of the zero-padded
+		// input (or top diff) of one clip and the flipped, transposed filters
+		int engine_;
+		int pad_count_;
+		Blob<Dtype> flipped_weight_;
+		// Winograd engine: transformed filters for the forward pass and for
+		// the gradient w.r.t. the bottom, the weights version they were
+		// computed from, and the size of the workspace of one clip
+		Blob<Dtype> winograd_weight_;
+		Blob<Dtype> winograd_flipped_weight_;
+		const SyncedMemory* winograd_weight_source_;
+		unsigned int winograd_weight_version_;
+		int winograd_count_;
+		// FFT engine, correlating the padded bottom with the filters
+		Conv3DFFT<Dtype> fft_;
+		// Channels-last (NLHWC) bottom and top: filters reordered to
+		// num_output_ x kernel_depth_ x kernel_size_ x kernel_size_ x
+		// channels_ (their diff accumulating the gradient in that order), and
+		// the weights version they were computed from
+		bool channels_last_;
+		Blob<Dtype> channels_last_weight_;
+		const SyncedMemory* channels_last_weight_source_;
+		unsigned int channels_last_weight_version_;
+		// The buffers above live in the layer workspace, set by
+		// ReserveThreadBuffers before the threads run. Thread 0 uses the first
+		// copy and accumulates straight into the weight diff; every thread
+		// i > 0 has its own copy followed by a weight gradient accumulator,
+		// which are summed up at the end of Backward.
+		Dtype* workspace_data_;
+		// Columns of the whole batch kept by Forward in the TRAIN phase (see
+		// ConvolutionParameter.cache_columns), clip n at n * K_ * N_, and the
+		// bottom data version they were computed from. column_cache_data_ is
+		// set while the threads run when the cache is written or valid.
+		bool cache_columns_;
+		shared_ptr<SyncedMemory> column_cache_;
+		Dtype* column_cache_data_;
+		const SyncedMemory* column_cache_source_;
+		unsigned int column_cache_version_;
+		// Fused ReLU and max pooling (see ConvolutionParameter.fused_relu),
+		// the pooled output size, and the size of the per-thread buffer that
+		// holds the output of one clip before it is pooled
+		bool fused_relu_;
+		bool fused_pooling_;
+		int pooled_length_;
+		int pooled_height_;
+		int pooled_width_;
+		int fused_count_;
+		// INT8 inference (see QuantizationParameter): filters quantized per
+		// output channel, the scale of the bottom, and the size in Dtypes of
+		// the per-thread buffers holding the int32 GEMM result of one filter
+		// group and the int8 bottom and columns of one clip
+		bool int8_;
+		QuantizedWeights<Dtype> quantized_weight_;
+		Dtype bottom_scale_;
+		int int8_count_;
+		// sparse execution of pruned filters (see SparsityParameter), GEMM
+		// engine only; sparse_forward_ tells the threads of a Forward whether
+		// the current filters are sparse enough
+		bool sparse_;
+		SparseWeights<Dtype> sparse_weight_;
+		bool sparse_forward_;
+		// bfloat16 bottom and top data (see NetParameter.bfloat16_storage,
+		// NCLHW CPU Forward only), the blobs of the running Forward, and the
+		// size of the per-thread buffer that holds the decoded bottom of one
+		// clip for the paths that cannot read bfloat16 (all but GEMM vol2col).
+		// The output of a clip with a bfloat16 top goes through the fused
+		// buffer.
+		bool bfloat16_bottom_;
+		bool bfloat16_top_;
+		const bfloat16* bottom_bfloat16_;
+		bfloat16* top_bfloat16_;
+		int bottom_count_;
 	};
 
 	template <typename Dtype>
@@ -77,6 +221,9 @@ namespace caffe {
 			: Layer<Dtype>(param) {}
 		virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
 			vector<Blob<Dtype>*>* top);
+		// the column buffer (PHASE: the phase buffer) of one clip per thread
+		// of the CPU Forward, none for the FFT engine
+		virtual size_t workspace_size();
 
 	protected:
 		virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -87,6 +234,12 @@ namespace caffe {
 			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
 		virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
 			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+		// GEMM or PHASE Forward of clips thread_id, thread_id + num_threads,
+		// ..., with buffer thread_id of col_data
+		void ForwardThread(const Dtype* bottom_data, Dtype* top_data,
+			Dtype* col_data, const int thread_id, const int num_threads);
+		// Dtype values of the buffer of one thread of Forward_cpu
+		size_t forward_buffer_count();
 
 		int kernel_size_;
 		int kernel_depth_;
@@ -101,7 +254,6 @@ namespace caffe {
 		int width_;
 		int num_output_;
 		int filter_group_;
-		Blob<Dtype> col_buffer_;
 		shared_ptr<SyncedMemory> bias_multiplier_;
 		int height_out_;
 		int width_out_;
@@ -112,6 +264,12 @@ namespace caffe {
 		int col_offset_;
 		int output_offset_;
 		int conv_out_spatial_dim_;
+		// CPU algorithm (ConvolutionParameter_Engine) resolved in SetUp, the
+		// FFT engine, convolving the bottom with the filters, and the PHASE
+		// engine (Forward only, Backward runs on GEMM)
+		int engine_;
+		Conv3DFFT<Dtype> fft_;
+		Deconv3DPhase<Dtype> phase_;
 	};
 
 	template <typename Dtype>
@@ -131,6 +289,18 @@ namespace caffe {
 			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
 		virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
 			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+		// CPU code for channels-last (NLHWC) blobs, with the channels of a
+		// position in the innermost loop
+		void ForwardChannelsLast(const vector<Blob<Dtype>*>& bottom,
+			vector<Blob<Dtype>*>* top);
+		void BackwardChannelsLast(const vector<Blob<Dtype>*>& top,
+			vector<Blob<Dtype>*>* bottom);
+		// NCLHW CPU Forward of num clips, each of the bottom and top stored
+		// as Dtype or as bfloat16, recording the MAX argmax mask unless it is
+		// NULL
+		template <typename Itype, typename Otype>
+		void ForwardClips(const int num, const Itype* bottom_data,
+			Otype* top_data, int* mask);
 
 		int kernel_size_;
 		int kernel_depth_;
@@ -145,6 +315,11 @@ namespace caffe {
 		int pooled_height_;
 		int pooled_width_;
 		Blob<Dtype> rand_idx_;
+		// NCLHW MAX pooling: the index in its channel of the bottom value of
+		// every top value, recorded by Forward_cpu in the TRAIN phase only,
+		// so that Backward_cpu is a scatter instead of a rescan of the windows
+		Blob<int> max_idx_;
+		bool use_max_idx_;
 	};
 
 	template <typename Dtype>
@@ -193,6 +368,24 @@ namespace caffe {
 		int width_;
 		int count_;
 	};
+
+	// Copies its bottom into a top of the layout given by layout_param. The
+	// Net inserts these where a blob crosses between layers that run on
+	// channels-last blobs and the others (see NetParameter.channels_last).
+	template <typename Dtype>
+	class LayoutLayer : public Layer<Dtype> {
+	public:
+		explicit LayoutLayer(const LayerParameter& param)
+			: Layer<Dtype>(param) {}
+		virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
+			vector<Blob<Dtype>*>* top);
+
+	protected:
+		virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+			vector<Blob<Dtype>*>* top);
+		virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+	};
 }
 
 #endif /* VIDEO_3D_LAYERS_HPP_ */
@@ -14,6 +14,8 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/data_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/sparse.hpp"
 
 namespace caffe {
 	/**
@@ -93,6 +95,8 @@ class ConvolutionLayer : public Layer<Dtype> {
       : Layer<Dtype>(param) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  // the im2col buffer of one image, and its diff in Backward
+  virtual size_t workspace_size();
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -113,7 +117,6 @@ class ConvolutionLayer : public Layer<Dtype> {
   int width_;
   int num_output_;
   int group_;
-  Blob<Dtype> col_buffer_;
   shared_ptr<SyncedMemory> bias_multiplier_;
   bool bias_term_;
   int M_;
@@ -161,6 +164,11 @@ class EltwiseLayer : public Layer<Dtype> {
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+  // CPU Forward when any blob is stored as bfloat16 (see
+  // NetParameter.bfloat16_storage): the bottoms are decoded and combined,
+  // and the result stored, a block of elements at a time
+  void ForwardBfloat16(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
   EltwiseParameter_EltwiseOp op_;
   vector<Dtype> coeffs_;
   Blob<int> max_idx_;
@@ -225,6 +233,8 @@ class InnerProductLayer : public Layer<Dtype> {
       : Layer<Dtype>(param) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  // the int32 products and the quantized bottom of an INT8 layer
+  virtual size_t workspace_size();
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -241,6 +251,14 @@ class InnerProductLayer : public Layer<Dtype> {
   int N_;
   bool bias_term_;
   shared_ptr<SyncedMemory> bias_multiplier_;
+  // INT8 inference (see QuantizationParameter): weights quantized per
+  // output, and the scale of the bottom
+  bool int8_;
+  QuantizedWeights<Dtype> quantized_weight_;
+  Dtype bottom_scale_;
+  // sparse execution of pruned weights (see SparsityParameter)
+  bool sparse_;
+  SparseWeights<Dtype> sparse_weight_;
 };
 
 // Forward declare PoolingLayer and SplitLayer for use in LRNLayer.
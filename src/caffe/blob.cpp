@@ -25,7 +25,8 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int length, c
   width_ = width;
   count_ = num_ * channels_ * length_ * height_ * width_;
   if (count_) {
-    data_.reset(new SyncedMemory(count_ * sizeof(Dtype)));
+    data_.reset(new SyncedMemory(count_ * (bfloat16_storage_ ?
+        sizeof(bfloat16) : sizeof(Dtype))));
     diff_.reset(new SyncedMemory(count_ * sizeof(Dtype)));
   } else {
     data_.reset(reinterpret_cast<SyncedMemory*>(NULL));
@@ -45,39 +46,71 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
 template <typename Dtype>
 void Blob<Dtype>::ReshapeLike(const Blob<Dtype>& other) {
   Reshape(other.num(), other.channels(), other.length(), other.height(), other.width());
+  layout_ = other.layout();
 }
 
 template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int length, const int height,
-    const int width) {
+    const int width)
+    : layout_(NCLHW), bfloat16_storage_(false) {
   Reshape(num, channels, length, height, width);
 }
 
 // for backward compatibility
 template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
-    const int width) {
+    const int width)
+    : layout_(NCLHW), bfloat16_storage_(false) {
 	if (num ==0 && channels == 0 && height ==0 && width == 0)
 		Reshape(num, channels, 0, height, width);
 	else
 		Reshape(num, channels, 1, height, width);
 }
 
+template <typename Dtype>
+void Blob<Dtype>::set_bfloat16_storage(const bool bfloat16_storage) {
+  if (bfloat16_storage == bfloat16_storage_) {
+    return;
+  }
+  bfloat16_storage_ = bfloat16_storage;
+  if (count_) {
+    data_.reset(new SyncedMemory(count_ * (bfloat16_storage_ ?
+        sizeof(bfloat16) : sizeof(Dtype))));
+  }
+}
+
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_data() const {
   CHECK(data_);
+  CHECK(!bfloat16_storage_) << "The data is stored as bfloat16.";
   return (const Dtype*)data_->cpu_data();
 }
 
 template <typename Dtype>
 void Blob<Dtype>::set_cpu_data(Dtype* data) {
   CHECK(data);
+  CHECK(!bfloat16_storage_) << "The data is stored as bfloat16.";
   data_->set_cpu_data(data);
 }
 
+template <typename Dtype>
+const bfloat16* Blob<Dtype>::cpu_bfloat16_data() const {
+  CHECK(data_);
+  CHECK(bfloat16_storage_) << "The data is not stored as bfloat16.";
+  return static_cast<const bfloat16*>(data_->cpu_data());
+}
+
+template <typename Dtype>
+bfloat16* Blob<Dtype>::mutable_cpu_bfloat16_data() {
+  CHECK(data_);
+  CHECK(bfloat16_storage_) << "The data is not stored as bfloat16.";
+  return static_cast<bfloat16*>(data_->mutable_cpu_data());
+}
+
 template <typename Dtype>
 const Dtype* Blob<Dtype>::gpu_data() const {
   CHECK(data_);
+  CHECK(!bfloat16_storage_) << "bfloat16 data is only stored on the CPU.";
   return (const Dtype*)data_->gpu_data();
 }
 
@@ -96,12 +129,14 @@ const Dtype* Blob<Dtype>::gpu_diff() const {
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_cpu_data() {
   CHECK(data_);
+  CHECK(!bfloat16_storage_) << "The data is stored as bfloat16.";
   return reinterpret_cast<Dtype*>(data_->mutable_cpu_data());
 }
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_data() {
   CHECK(data_);
+  CHECK(!bfloat16_storage_) << "bfloat16 data is only stored on the CPU.";
   return reinterpret_cast<Dtype*>(data_->mutable_gpu_data());
 }
 
@@ -121,6 +156,7 @@ template <typename Dtype>
 void Blob<Dtype>::ShareData(const Blob& other) {
   CHECK_EQ(count_, other.count());
   data_ = other.data();
+  bfloat16_storage_ = other.bfloat16_storage();
 }
 
 template <typename Dtype>
@@ -134,6 +170,7 @@ template <> void Blob<int>::Update() { NOT_IMPLEMENTED; }
 
 template <typename Dtype>
 void Blob<Dtype>::Update() {
+  CHECK(!bfloat16_storage_) << "bfloat16 blobs cannot be updated.";
   // We will perform update based on where the data is located.
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
@@ -164,6 +201,24 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
       LOG(FATAL) << "Trying to copy blobs of different sizes.";
     }
   }
+  if (reshape) {
+    layout_ = source.layout();
+  }
+  CHECK_EQ(layout_, source.layout()) << "Trying to copy blobs of different "
+      << "layouts.";
+  if (!copy_diff && (bfloat16_storage_ || source.bfloat16_storage())) {
+    if (bfloat16_storage_ && source.bfloat16_storage()) {
+      memcpy(mutable_cpu_bfloat16_data(), source.cpu_bfloat16_data(),
+          sizeof(bfloat16) * count_);
+    } else if (bfloat16_storage_) {
+      bfloat16_encode_cpu(count_, source.cpu_data(),
+          mutable_cpu_bfloat16_data());
+    } else {
+      bfloat16_decode_cpu(count_, source.cpu_bfloat16_data(),
+          mutable_cpu_data());
+    }
+    return;
+  }
   switch (Caffe::mode()) {
   case Caffe::GPU:
     if (copy_diff) {
@@ -196,8 +251,20 @@ void Blob<Dtype>::FromProto(const BlobProto& proto) {
 	  Reshape(proto.num(), proto.channels(), 1, proto.height(), proto.width());
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    data_vec[i] = proto.data(i);
+  if (proto.sparse() || proto.sparse_gap_size() > 0) {
+    // the nonzero values of a sparse blob at their positions
+    CHECK_EQ(proto.sparse_gap_size(), proto.data_size());
+    memset(data_vec, 0, sizeof(Dtype) * count_);
+    int index = 0;
+    for (int i = 0; i < proto.data_size(); ++i) {
+      index += proto.sparse_gap(i);
+      CHECK_LT(index, count_) << "Sparse blob index out of range";
+      data_vec[index] = proto.data(i);
+    }
+  } else {
+    for (int i = 0; i < count_; ++i) {
+      data_vec[i] = proto.data(i);
+    }
   }
   if (proto.diff_size() > 0) {
     Dtype* diff_vec = mutable_cpu_diff();
@@ -208,7 +275,8 @@ void Blob<Dtype>::FromProto(const BlobProto& proto) {
 }
 
 template <typename Dtype>
-void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
+void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff,
+    bool sparse) const {
   proto->set_num(num_);
   proto->set_channels(channels_);
   proto->set_length(length_);
@@ -216,9 +284,29 @@ void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
   proto->set_width(width_);
   proto->clear_data();
   proto->clear_diff();
-  const Dtype* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_data(data_vec[i]);
+  proto->clear_sparse_gap();
+  proto->clear_sparse();
+  if (sparse) {
+    proto->set_sparse(true);
+    const Dtype* data_vec = cpu_data();
+    int previous = 0;
+    for (int i = 0; i < count_; ++i) {
+      if (data_vec[i] != 0) {
+        proto->add_sparse_gap(i - previous);
+        proto->add_data(data_vec[i]);
+        previous = i;
+      }
+    }
+  } else if (bfloat16_storage_) {
+    const bfloat16* data_vec = cpu_bfloat16_data();
+    for (int i = 0; i < count_; ++i) {
+      proto->add_data(bfloat16_to_float(data_vec[i]));
+    }
+  } else {
+    const Dtype* data_vec = cpu_data();
+    for (int i = 0; i < count_; ++i) {
+      proto->add_data(data_vec[i]);
+    }
   }
   if (write_diff) {
     const Dtype* diff_vec = cpu_diff();
@@ -5,7 +5,9 @@
 
 #include <process.h>
 #include "caffe/common.hpp"
+#include "caffe/util/numa.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -23,9 +25,10 @@ int64_t cluster_seedgen(void) {
 
 
 Caffe::Caffe()
-    : mode_(Caffe::CPU), phase_(Caffe::TRAIN), cublas_handle_(NULL),
-      curand_generator_(NULL),
-      random_generator_() {
+    : mode_(Caffe::CPU), phase_(Caffe::TRAIN), cpu_threads_(1),
+      cublas_handle_(NULL), curand_generator_(NULL),
+      random_generator_(), thread_pools_(NumaNodeCount() + 1) {
+  CHECK_EQ(pthread_mutex_init(&thread_pools_mutex_, NULL), 0);
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
@@ -45,6 +48,7 @@ Caffe::~Caffe() {
   if (curand_generator_) {
     CURAND_CHECK(curandDestroyGenerator(curand_generator_));
   }
+  pthread_mutex_destroy(&thread_pools_mutex_);
 }
 
 void Caffe::set_random_seed(const unsigned int seed) {
@@ -64,6 +68,33 @@ void Caffe::set_random_seed(const unsigned int seed) {
   Get().random_generator_.reset(new RNG(seed));
 }
 
+void Caffe::set_cpu_threads(const int cpu_threads) {
+  CHECK_GE(cpu_threads, 1);
+  if (cpu_threads == Get().cpu_threads_) {
+    return;
+  }
+  Get().cpu_threads_ = cpu_threads;
+  pthread_mutex_lock(&Get().thread_pools_mutex_);
+  for (int i = 0; i < Get().thread_pools_.size(); ++i) {
+    Get().thread_pools_[i].reset();
+  }
+  pthread_mutex_unlock(&Get().thread_pools_mutex_);
+}
+
+ThreadPool& Caffe::thread_pool() {
+  const int node = NumaThreadNode();
+  // threads of the same node, such as the workers of a DagExecutor, may
+  // ask for the pool of their node at the same time
+  pthread_mutex_lock(&Get().thread_pools_mutex_);
+  shared_ptr<ThreadPool>& pool = Get().thread_pools_[node + 1];
+  if (!pool) {
+    pool.reset(new ThreadPool(Get().cpu_threads_, node));
+  }
+  ThreadPool* result = pool.get();
+  pthread_mutex_unlock(&Get().thread_pools_mutex_);
+  return *result;
+}
+
 void Caffe::SetDevice(const int device_id) {
   int current_device;
   CUDA_CHECK(cudaGetDevice(&current_device));
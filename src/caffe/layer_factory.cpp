@@ -102,6 +102,8 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return new EltwiseProductLayer<Dtype>(param);
   case LayerParameter_LayerType_STRETCH:
 	  return new Stretch3DLayer<Dtype>(param);
+  case LayerParameter_LayerType_LAYOUT:
+	  return new LayoutLayer<Dtype>(param);
   case LayerParameter_LayerType_NONE:
     LOG(FATAL) << "Layer " << name << " has unspecified type.";
     break;
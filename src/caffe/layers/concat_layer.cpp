@@ -30,6 +30,8 @@ void ConcatLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
   for (int i = 1; i < bottom.size(); ++i) {
+    CHECK_EQ(bottom[i]->layout(), bottom[0]->layout())
+        << "All bottom blobs of ConcatLayer must have the same layout.";
     count_ += bottom[i]->count();
 	if (concat_dim_ == 0) {
 		num_ += bottom[i]->num();
@@ -45,6 +47,7 @@ void ConcatLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }
   (*top)[0]->Reshape(num_, channels_, length_, height_, width_);
+  (*top)[0]->set_layout(bottom[0]->layout());
   CHECK_EQ(count_, (*top)[0]->count());
 }
 
@@ -60,6 +63,19 @@ Dtype ConcatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       caffe_copy(num_elem, bottom_data, top_data+(*top)[0]->offset(offset_num));
       offset_num += bottom[i]->num();
     }
+  } else if (concat_dim_ == 1 && (*top)[0]->layout() == NLHWC) {
+    // the channels of every position are concatenated
+    const int spatial = num_ * length_ * height_ * width_;
+    int offset_channel = 0;
+    for (int i = 0; i < bottom.size(); ++i) {
+      const Dtype* bottom_data = bottom[i]->cpu_data();
+      const int channels = bottom[i]->channels();
+      for (int p = 0; p < spatial; ++p) {
+        caffe_copy(channels, bottom_data + p * channels,
+          top_data + p * channels_ + offset_channel);
+      }
+      offset_channel += channels;
+    }
   } else if (concat_dim_ == 1) {
     int offset_channel = 0;
     for (int i = 0; i < bottom.size(); ++i) {
@@ -90,6 +106,19 @@ void ConcatLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         top_diff+top[0]->offset(offset_num), bottom_diff);
       offset_num += blob->num();
     }
+  } else if (concat_dim_ == 1 && top[0]->layout() == NLHWC) {
+    const int spatial = num_ * length_ * height_ * width_;
+    int offset_channel = 0;
+    for (int i = 0; i < bottom->size(); ++i) {
+      Blob<Dtype>* blob = (*bottom)[i];
+      Dtype* bottom_diff = blob->mutable_cpu_diff();
+      const int channels = blob->channels();
+      for (int p = 0; p < spatial; ++p) {
+        caffe_copy(channels, top_diff + p * channels_ + offset_channel,
+          bottom_diff + p * channels);
+      }
+      offset_channel += channels;
+    }
   } else if (concat_dim_ == 1) {
     int offset_channel = 0;
     for (int i = 0; i < bottom->size(); ++i) {
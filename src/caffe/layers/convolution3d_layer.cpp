@@ -15,13 +15,24 @@
  */
 
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/video_3d_layers.hpp"
 #include "caffe/util/vol2col.hpp"
+#include "caffe/util/conv3d_depthwise.hpp"
+#include "caffe/util/conv3d_direct.hpp"
+#include "caffe/util/conv3d_winograd.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/pool3d.hpp"
+#include "caffe/util/quantize.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -44,32 +55,251 @@ void Convolution3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   width_ = bottom[0]->width();
   num_output_ = this->layer_param_.convolution_param().num_output();
   filter_group_ = this->layer_param_.convolution_param().filter_group();
+  group_ = this->layer_param_.convolution_param().group();
   CHECK_GT(num_output_, 0);
 
-  // number of output filters must be divided by filter_group
-  CHECK_EQ(num_output_ % filter_group_, 0);
+  // number of output filters must be divided by filter_group within every
+  // channel group
+  CHECK_EQ(channels_ % group_, 0)
+      << "Number of channels should be multiples of group.";
+  CHECK_EQ(num_output_ % (group_ * filter_group_), 0);
 
-  // The vol2col result buffer would only hold one image at a time to avoid
-  // overly large memory usage.
+  // The vol2col result buffer holds clips_per_gemm_ images at a time (one by
+  // default) to avoid overly large memory usage.
 
   int height_out = (height_ + 2 * pad_ - kernel_size_) / stride_ + 1;
   int width_out = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
   int length_out = (length_ + 2 * temporal_pad_ - kernel_depth_) / temporal_stride_ + 1;
 
-  // buffer for one image
-  col_buffer_.Reshape(
-      1, channels_ * kernel_depth_ * kernel_size_ * kernel_size_, length_out, height_out, width_out);
-
-
   bias_term_ = this->layer_param_.convolution_param().bias_term();
 
   // Figure out the dimensions for individual gemms.
-  M_ = num_output_ / filter_group_; // doing convolution filter_group_ times per volume
+  M_ = num_output_ / (group_ * filter_group_);
   K_ = channels_ * kernel_depth_ * kernel_size_ * kernel_size_;
   N_ = length_out * height_out * width_out;
+  kernel_dim_ = K_ / group_;
+
+  // On CPU several clips can be unrolled side by side so that one large GEMM
+  // replaces clips_per_gemm_ small ones. The column buffer and the staging
+  // buffer for the GEMM result have to fit in gemm_workspace_limit.
+  clips_per_gemm_ = std::min<int>(
+      this->layer_param_.convolution_param().clips_per_gemm(), num_);
+  clips_per_gemm_ = std::max(clips_per_gemm_, 1);
+  const uint64_t clip_workspace =
+      static_cast<uint64_t>(K_ + num_output_) * N_ * sizeof(Dtype);
+  const uint64_t workspace_limit =
+      this->layer_param_.convolution_param().gemm_workspace_limit();
+  while (clips_per_gemm_ > 1 &&
+      clips_per_gemm_ * clip_workspace > workspace_limit) {
+    --clips_per_gemm_;
+  }
+  if (clips_per_gemm_ <
+      this->layer_param_.convolution_param().clips_per_gemm() &&
+      clips_per_gemm_ < num_) {
+    LOG(INFO) << "Reducing clips_per_gemm to " << clips_per_gemm_
+        << " to fit the GEMM workspace limit of " << workspace_limit
+        << " bytes";
+  }
+
+  // A channels-last bottom (see NetParameter.channels_last) gives a
+  // channels-last top. Its columns have one row of K_ values per output
+  // position, so the GEMM result of consecutive clips is already in top.
+  channels_last_ = bottom[0]->layout() == NLHWC;
+  CHECK(!channels_last_ || group_ == 1)
+      << "Grouped Convolution3D requires NCLHW blobs.";
+
+  // INT8 inference quantizes the bottom of one clip, unrolls it and runs an
+  // int8 GEMM per filter group in place of the engines below
+  int8_ = this->layer_param_.quantization_param().precision() ==
+      QuantizationParameter_Precision_INT8;
+  if (int8_ && channels_last_) {
+    LOG(INFO) << "INT8 Convolution3D requires NCLHW blobs, running "
+        << this->layer_param_.name() << " in FP32.";
+    int8_ = false;
+  }
+  int8_count_ = 0;
+  if (int8_) {
+    const float bottom_range =
+        this->layer_param_.quantization_param().bottom_range();
+    CHECK_GT(bottom_range, 0) << "INT8 layer " << this->layer_param_.name()
+        << " has no bottom_range, calibrate it with tools/calibrate_int8.";
+    bottom_scale_ = bottom_range / 127;
+    clips_per_gemm_ = 1;
+    // the int32 result first, so that it is aligned
+    const size_t int8_bytes = sizeof(int32_t) * M_ * N_ +
+        channels_ * length_ * height_ * width_ + K_ * N_;
+    int8_count_ = (int8_bytes + sizeof(Dtype) - 1) / sizeof(Dtype);
+  }
+
+  // bfloat16 blobs are set up by the Net before SetUp (see
+  // NetParameter.bfloat16_storage)
+  bfloat16_bottom_ = bottom[0]->bfloat16_storage();
+  bfloat16_top_ = (*top)[0]->bfloat16_storage();
+  CHECK(!channels_last_ || !(bfloat16_bottom_ || bfloat16_top_))
+      << "bfloat16 Convolution3D requires NCLHW blobs.";
+  bottom_bfloat16_ = NULL;
+  top_bfloat16_ = NULL;
+
+  // buffer for clips_per_gemm_ images
+  col_count_ = int8_ ? 0 : K_ * clips_per_gemm_ * N_;
+  gemm_count_ = (clips_per_gemm_ > 1 && !channels_last_) ?
+      num_output_ * clips_per_gemm_ * N_ : 0;
+  pad_count_ = 0;
+  winograd_count_ = 0;
+
+  // Resolve the CPU engine. The direct engine handles 3x3x3 kernels with
+  // stride 1 and padding 1 only, for which the output has the input size.
+  const bool direct_shape = kernel_size_ == 3 && kernel_depth_ == 3 &&
+      stride_ == 1 && temporal_stride_ == 1 && pad_ == 1 && temporal_pad_ == 1;
+  const bool fft_shape = stride_ == 1 && temporal_stride_ == 1;
+  engine_ = this->layer_param_.convolution_param().engine();
+  if (int8_) {
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  // pruned filters are multiplied with the columns of the GEMM engine
+  sparse_ = this->layer_param_.has_sparsity_param() && !int8_ &&
+      !channels_last_;
+  if (sparse_) {
+    if (engine_ != ConvolutionParameter_Engine_DEFAULT &&
+        engine_ != ConvolutionParameter_Engine_GEMM) {
+      LOG(INFO) << "Sparse Convolution3D runs on the GEMM engine only, "
+          << "falling back to GEMM.";
+    }
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  if (channels_last_) {
+    if (engine_ != ConvolutionParameter_Engine_DEFAULT &&
+        engine_ != ConvolutionParameter_Engine_GEMM) {
+      LOG(INFO) << "Channels-last blobs are handled by the GEMM engine only, "
+          << "falling back to GEMM.";
+    }
+    engine_ = ConvolutionParameter_Engine_GEMM;
+    channels_last_weight_.Reshape(num_output_, kernel_depth_, kernel_size_,
+        kernel_size_, channels_);
+    channels_last_weight_source_ = NULL;
+    channels_last_weight_version_ = 0;
+  }
+  // Grouped convolutions run one GEMM per group, or on the depthwise engine
+  // for one 3x3x3 filter per channel.
+  const bool depthwise_shape = group_ == channels_ &&
+      num_output_ == channels_ && kernel_size_ == 3 && kernel_depth_ == 3;
+  if (engine_ == ConvolutionParameter_Engine_DEPTHWISE && !depthwise_shape) {
+    LOG(INFO) << "The DEPTHWISE engine requires group, channels and "
+        << "num_output to be equal and a 3x3x3 kernel, falling back to GEMM.";
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  if (group_ > 1 && engine_ != ConvolutionParameter_Engine_GEMM &&
+      engine_ != ConvolutionParameter_Engine_DEPTHWISE) {
+    if (engine_ != ConvolutionParameter_Engine_DEFAULT) {
+      LOG(INFO) << "Only the GEMM and DEPTHWISE engines support group, "
+          << "falling back to " << (depthwise_shape ? "DEPTHWISE." : "GEMM.");
+    }
+    engine_ = depthwise_shape ? ConvolutionParameter_Engine_DEPTHWISE :
+        ConvolutionParameter_Engine_GEMM;
+  }
+  if (engine_ == ConvolutionParameter_Engine_DEFAULT && direct_shape) {
+    engine_ = ConvolutionParameter_Engine_DIRECT;
+  }
+  if ((engine_ == ConvolutionParameter_Engine_DEFAULT ||
+      engine_ == ConvolutionParameter_Engine_FFT) && fft_shape) {
+    const bool fft_fits = fft_.Init(num_output_, channels_, length_, height_,
+        width_, kernel_depth_, kernel_size_, temporal_pad_, pad_,
+        this->layer_param_.convolution_param().fft_workspace_limit());
+    if (!fft_fits) {
+      if (engine_ == ConvolutionParameter_Engine_FFT) {
+        LOG(INFO) << "The FFT engine does not fit in fft_workspace_limit, "
+            << "falling back to GEMM.";
+      }
+      engine_ = ConvolutionParameter_Engine_GEMM;
+    } else if (engine_ == ConvolutionParameter_Engine_DEFAULT) {
+      const double savings = fft_.EstimatedSavings();
+      if (savings >=
+          this->layer_param_.convolution_param().fft_savings_threshold()) {
+        LOG(INFO) << "Using the FFT engine, estimated to need " << savings
+            << " times fewer flops than GEMM";
+        engine_ = ConvolutionParameter_Engine_FFT;
+      }
+    }
+  } else if (engine_ == ConvolutionParameter_Engine_FFT) {
+    LOG(INFO) << "The FFT engine requires stride 1, falling back to GEMM.";
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  if (engine_ == ConvolutionParameter_Engine_DEFAULT) {
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  const bool winograd_shape = kernel_size_ == 3 && kernel_depth_ == 3 &&
+      stride_ == 1 && temporal_stride_ == 1 && pad_ <= 2 && temporal_pad_ <= 2;
+  if (engine_ == ConvolutionParameter_Engine_WINOGRAD && !winograd_shape) {
+    LOG(INFO) << "The WINOGRAD engine requires a 3x3x3 kernel with stride 1 "
+        << "and pad at most 2, falling back to GEMM.";
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  if (engine_ == ConvolutionParameter_Engine_WINOGRAD) {
+    // the gradient w.r.t. the bottom is a Winograd convolution of the top
+    // diff, padded by 2 - pad, with the flipped, transposed filters
+    winograd_weight_.Reshape(1, 1, 1, 1,
+        conv3d_winograd_filter_count(num_output_, channels_));
+    winograd_flipped_weight_.Reshape(1, 1, 1, 1,
+        conv3d_winograd_filter_count(channels_, num_output_));
+    flipped_weight_.Reshape(channels_, num_output_, 3, 3, 3);
+    winograd_count_ = std::max(
+        conv3d_winograd_workspace_count(channels_, length_, height_, width_,
+            pad_, temporal_pad_, num_output_),
+        conv3d_winograd_workspace_count(num_output_, length_out, height_out,
+            width_out, 2 - pad_, 2 - temporal_pad_, channels_));
+    winograd_weight_source_ = NULL;
+    winograd_weight_version_ = 0;
+  }
+  if (engine_ == ConvolutionParameter_Engine_DIRECT) {
+    CHECK(direct_shape) << "The DIRECT engine requires kernel_size 3, "
+        << "kernel_depth 3, stride 1 and pad 1.";
+    pad_count_ = conv3d_direct_padded_count(
+        std::max(channels_, num_output_), length_, height_, width_);
+    flipped_weight_.Reshape(channels_, num_output_, 3, 3, 3);
+  }
+
+  // Fused ReLU and max pooling (TEST nets, see
+  // NetParameter.fuse_convolution3d). Each output clip is pooled from a
+  // per-thread buffer into top.
+  fused_relu_ = this->layer_param_.convolution_param().fused_relu();
+  fused_pooling_ = this->layer_param_.convolution_param().fused_pooling();
+  fused_count_ = 0;
+  if (fused_pooling_) {
+    const PoolingParameter& pool_param = this->layer_param_.pooling_param();
+    CHECK_EQ(pool_param.pool(), PoolingParameter_PoolMethod_MAX)
+        << "Only max pooling can be fused into Convolution3D.";
+    CHECK_EQ(pool_param.pad(), 0)
+        << "Pooling with padding cannot be fused into Convolution3D.";
+    CHECK(!channels_last_)
+        << "Pooling fused into Convolution3D requires NCLHW blobs.";
+    pooled_height_ = static_cast<int>(ceil(static_cast<float>(
+        height_out - pool_param.kernel_size()) / pool_param.stride())) + 1;
+    pooled_width_ = static_cast<int>(ceil(static_cast<float>(
+        width_out - pool_param.kernel_size()) / pool_param.stride())) + 1;
+    pooled_length_ = static_cast<int>(ceil(static_cast<float>(
+        length_out - pool_param.kernel_depth()) /
+        pool_param.temporal_stride())) + 1;
+  }
+  if (fused_pooling_ || bfloat16_top_) {
+    fused_count_ = num_output_ * N_;
+  }
+  // only the GEMM vol2col reads the bfloat16 bottom directly
+  bottom_count_ = (bfloat16_bottom_ &&
+      (engine_ != ConvolutionParameter_Engine_GEMM || int8_)) ?
+      channels_ * length_ * height_ * width_ : 0;
+
+  // the per-thread buffers are taken from the workspace with the sizes above
+  workspace_data_ = NULL;
+  set_cache_columns(this->layer_param_.convolution_param().cache_columns());
 
   // output size
-  (*top)[0]->Reshape(bottom[0]->num(), num_output_, length_out, height_out, width_out);
+  if (fused_pooling_) {
+    (*top)[0]->Reshape(bottom[0]->num(), num_output_, pooled_length_,
+        pooled_height_, pooled_width_);
+  } else {
+    (*top)[0]->Reshape(bottom[0]->num(), num_output_, length_out, height_out, width_out);
+  }
+  (*top)[0]->set_layout(bottom[0]->layout());
 
   // Check if we need to set up the weights
   if (this->blobs_.size() > 0) {
@@ -81,8 +311,8 @@ void Convolution3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
       this->blobs_.resize(1);
     }
     // Initialize the weights
-    this->blobs_[0].reset(new Blob<Dtype>(
-        num_output_, channels_, kernel_depth_, kernel_size_, kernel_size_));
+    this->blobs_[0].reset(new Blob<Dtype>(num_output_, channels_ / group_,
+        kernel_depth_, kernel_size_, kernel_size_));
     // fill the weights
     shared_ptr<Filler<Dtype> > weight_filler(GetFiller<Dtype>(
         this->layer_param_.convolution_param().weight_filler()));
@@ -100,59 +330,501 @@ void Convolution3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 
   // Set up the bias filler
   if (bias_term_) {
-    bias_multiplier_.reset(new SyncedMemory(N_ * sizeof(Dtype)));
+    bias_multiplier_.reset(
+        new SyncedMemory(clips_per_gemm_ * N_ * sizeof(Dtype)));
     Dtype* bias_multiplier_data =
         reinterpret_cast<Dtype*>(bias_multiplier_->mutable_cpu_data());
-    for (int i = 0; i < N_; ++i) {
+    for (int i = 0; i < clips_per_gemm_ * N_; ++i) {
         bias_multiplier_data[i] = 1.;
     }
   }
 }
 
 
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::UpdateWinogradWeights() {
+  const SyncedMemory* weight_source = this->blobs_[0]->data().get();
+  if (weight_source == winograd_weight_source_ &&
+      weight_source->version() == winograd_weight_version_) {
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  conv3d_winograd_filter_transform_cpu(weight, num_output_, channels_,
+      winograd_weight_.mutable_cpu_data());
+  conv3d_direct_flip_weight_cpu(weight, num_output_, channels_,
+      flipped_weight_.mutable_cpu_data());
+  conv3d_winograd_filter_transform_cpu(flipped_weight_.cpu_data(), channels_,
+      num_output_, winograd_flipped_weight_.mutable_cpu_data());
+  winograd_weight_source_ = weight_source;
+  winograd_weight_version_ = weight_source->version();
+}
+
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::UpdateChannelsLastWeights() {
+  const SyncedMemory* weight_source = this->blobs_[0]->data().get();
+  if (weight_source == channels_last_weight_source_ &&
+      weight_source->version() == channels_last_weight_version_) {
+    return;
+  }
+  // num_output_ x channels_ x kernel volume -> num_output_ x kernel volume x
+  // channels_, the order of the channels-last columns
+  convert_layout_cpu(this->blobs_[0]->cpu_data(), num_output_, channels_,
+      kernel_depth_ * kernel_size_ * kernel_size_, NCLHW,
+      channels_last_weight_.mutable_cpu_data());
+  channels_last_weight_source_ = weight_source;
+  channels_last_weight_version_ = weight_source->version();
+}
+
+template <typename Dtype>
+int Convolution3DLayer<Dtype>::thread_buffer_count() {
+  const bool gemm_path = engine_ == ConvolutionParameter_Engine_GEMM ||
+      engine_ == ConvolutionParameter_Engine_WINOGRAD;
+  return bottom_count_ + (gemm_path ? col_count_ + gemm_count_ : 0) +
+      pad_count_ + winograd_count_ + fused_count_ + int8_count_;
+}
+
+template <typename Dtype>
+size_t Convolution3DLayer<Dtype>::workspace_size() {
+  if (Caffe::mode() == Caffe::GPU) {
+    return sizeof(Dtype) * K_ * N_;
+  }
+  if (engine_ == ConvolutionParameter_Engine_FFT) {
+    // the FFT engine keeps its spectra in fft_ and runs on a single thread
+    return sizeof(Dtype) * thread_buffer_count();
+  }
+  // threads past the last clip return before touching their buffers
+  const int num_threads = std::min(Caffe::cpu_threads(), num_);
+  return sizeof(Dtype) * (thread_buffer_count() + (num_threads - 1) *
+      (thread_buffer_count() + this->blobs_[0]->count()));
+}
+
+template <typename Dtype>
+size_t Convolution3DLayer<Dtype>::column_cache_size() {
+  if (engine_ != ConvolutionParameter_Engine_GEMM || int8_) {
+    return 0;
+  }
+  return sizeof(Dtype) * num_ * K_ * N_;
+}
+
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::set_cache_columns(const bool cache_columns) {
+  cache_columns_ = cache_columns && column_cache_size() > 0;
+  if (cache_columns_) {
+    // allocated by the first Forward in the TRAIN phase
+    column_cache_.reset(new SyncedMemory(column_cache_size()));
+  } else {
+    column_cache_.reset();
+  }
+  column_cache_data_ = NULL;
+  column_cache_source_ = NULL;
+  column_cache_version_ = 0;
+}
+
+template <typename Dtype>
+typename Convolution3DLayer<Dtype>::ThreadBuffers
+Convolution3DLayer<Dtype>::thread_buffers(const int thread_id) {
+  ThreadBuffers buffers;
+  buffers.bottom = NULL;
+  buffers.col = buffers.gemm = buffers.pad = buffers.winograd = NULL;
+  buffers.fused = NULL;
+  buffers.int8_gemm = NULL;
+  buffers.int8_bottom = buffers.int8_col = NULL;
+  buffers.weight_diff = NULL;
+  const bool gemm_path = engine_ == ConvolutionParameter_Engine_GEMM ||
+      engine_ == ConvolutionParameter_Engine_WINOGRAD;
+  Dtype* workspace = workspace_data_;
+  if (thread_id > 0) {
+    workspace += thread_buffer_count() + (thread_id - 1) *
+        (thread_buffer_count() + this->blobs_[0]->count());
+  }
+  if (bottom_count_) {
+    buffers.bottom = workspace;
+  }
+  workspace += bottom_count_;
+  if (gemm_path) {
+    buffers.col = workspace;
+    workspace += col_count_;
+    if (gemm_count_) {
+      buffers.gemm = workspace;
+    }
+    workspace += gemm_count_;
+  }
+  if (pad_count_) {
+    buffers.pad = workspace;
+  }
+  workspace += pad_count_;
+  if (winograd_count_) {
+    buffers.winograd = workspace;
+  }
+  workspace += winograd_count_;
+  if (fused_count_) {
+    buffers.fused = workspace;
+  }
+  workspace += fused_count_;
+  if (int8_count_) {
+    buffers.int8_gemm = reinterpret_cast<int32_t*>(workspace);
+    buffers.int8_bottom = reinterpret_cast<int8_t*>(buffers.int8_gemm +
+        M_ * N_);
+    buffers.int8_col = buffers.int8_bottom +
+        channels_ * length_ * height_ * width_;
+  }
+  workspace += int8_count_;
+  if (thread_id > 0) {
+    buffers.weight_diff = workspace;
+  }
+  return buffers;
+}
+
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::ReserveThreadBuffers() {
+  workspace_data_ = static_cast<Dtype*>(
+      this->workspace()->mutable_cpu_data(workspace_size()));
+}
+
+template <typename Dtype>
+const Dtype* Convolution3DLayer<Dtype>::ClipBottom(const Dtype* bottom_data,
+    const int n, const ThreadBuffers& buffers) {
+  const int bottom_dim = channels_ * length_ * height_ * width_;
+  if (!bfloat16_bottom_) {
+    return bottom_data + n * bottom_dim;
+  }
+  bfloat16_decode_cpu(bottom_dim, bottom_bfloat16_ + n * bottom_dim,
+      buffers.bottom);
+  return buffers.bottom;
+}
+
+template <typename Dtype>
+Dtype* Convolution3DLayer<Dtype>::ClipOutput(Dtype* top_data, const int n,
+    const ThreadBuffers& buffers) {
+  if (fused_pooling_ || bfloat16_top_) {
+    return buffers.fused;
+  }
+  return top_data + n * num_output_ * N_;
+}
+
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::FinishClip(Dtype* output, Dtype* top_data,
+    const int n, const bool add_bias) {
+  if (fused_relu_ || fused_pooling_) {
+    FusedEpilogue(output, top_data, n);
+    return;
+  }
+  if (bias_term_ && add_bias) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_, N_, 1,
+        (Dtype)1., this->blobs_[1]->cpu_data(),
+        reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+        (Dtype)1., output);
+  }
+  if (bfloat16_top_) {
+    bfloat16_encode_cpu(num_output_ * N_, output,
+        top_bfloat16_ + n * num_output_ * N_);
+  }
+}
+
 template <typename Dtype>
 Dtype Convolution3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
+  // the threads reach bfloat16 blobs through bottom_bfloat16_ and
+  // top_bfloat16_
+  const Dtype* bottom_data = bfloat16_bottom_ ? NULL : bottom[0]->cpu_data();
+  Dtype* top_data = bfloat16_top_ ? NULL : (*top)[0]->mutable_cpu_data();
+  bottom_bfloat16_ = bfloat16_bottom_ ? bottom[0]->cpu_bfloat16_data() : NULL;
+  top_bfloat16_ = bfloat16_top_ ? (*top)[0]->mutable_cpu_bfloat16_data() :
+      NULL;
+  ReserveThreadBuffers();
+
+  if (engine_ == ConvolutionParameter_Engine_FFT) {
+    // the FFT engine keeps its spectra in fft_ and runs on a single thread
+    fft_.UpdateFilters(*this->blobs_[0]);
+    const ThreadBuffers buffers = thread_buffers(0);
+    for (int n = 0; n < num_; ++n) {
+      Dtype* output = ClipOutput(top_data, n, buffers);
+      fft_.Correlate(ClipBottom(bottom_data, n, buffers), output);
+      FinishClip(output, top_data, n, true);
+    }
+    return Dtype(0.);
+  }
+
+  if (engine_ == ConvolutionParameter_Engine_WINOGRAD) {
+    UpdateWinogradWeights();
+  }
+  if (channels_last_) {
+    UpdateChannelsLastWeights();
+  }
+  if (int8_) {
+    quantized_weight_.Update(*this->blobs_[0], num_output_);
+  }
+  if (sparse_) {
+    sparse_weight_.Update(this->blobs_[0].get(), num_output_,
+        this->layer_param_.sparsity_param().threshold());
+  }
+  sparse_forward_ = sparse_ && sparse_weight_.density() <=
+      this->layer_param_.sparsity_param().max_density();
+  // bring the parameters to the CPU before the threads read them
+  this->blobs_[0]->cpu_data();
+  if (bias_term_) {
+    this->blobs_[1]->cpu_data();
+  }
+  // only a Backward can reuse the columns
+  column_cache_data_ = (cache_columns_ && Caffe::phase() == Caffe::TRAIN) ?
+      static_cast<Dtype*>(column_cache_->mutable_cpu_data()) : NULL;
+  const int num_threads = Caffe::cpu_threads();
+  if (num_threads == 1) {
+    ForwardThread(bottom_data, top_data, 0, 1);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(
+        &Convolution3DLayer<Dtype>::ForwardThread, this, bottom_data,
+        top_data, _1, num_threads));
+  }
+  if (column_cache_data_) {
+    column_cache_source_ = bottom[0]->data().get();
+    column_cache_version_ = column_cache_source_->version();
+  } else {
+    column_cache_source_ = NULL;
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::ForwardThread(const Dtype* bottom_data,
+      Dtype* top_data, const int thread_id, const int num_threads) {
+  const int bottom_dim = channels_ * length_ * height_ * width_;
+  const int top_dim = fused_pooling_ ?
+      num_output_ * pooled_length_ * pooled_height_ * pooled_width_ :
+      num_output_ * N_;
+  const bool fused = fused_relu_ || fused_pooling_;
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const Dtype* bias_multiplier = bias_term_ ?
+      reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()) : NULL;
+  if (engine_ != ConvolutionParameter_Engine_GEMM && thread_id >= num_) {
+    return;
+  }
+  if (engine_ == ConvolutionParameter_Engine_GEMM &&
+      thread_id * clips_per_gemm_ >= num_) {
+    return;
+  }
+  ThreadBuffers buffers = thread_buffers(thread_id);
 
-  int weight_offset = M_ * K_;
-  int top_offset = M_ * N_;
+  if (int8_) {
+    const int8_t* quantized_weight = quantized_weight_.data();
+    const Dtype* weight_scale = quantized_weight_.scale();
+    for (int n = thread_id; n < num_; n += num_threads) {
+      Dtype* output = ClipOutput(top_data, n, buffers);
+      // quantizing before unrolling gives the same columns, as zero padding
+      // stays zero, with 1 / (kernel volume) of the roundings
+      quantize_cpu(bottom_dim, ClipBottom(bottom_data, n, buffers),
+          bottom_scale_, buffers.int8_bottom);
+      vol2col_cpu(buffers.int8_bottom, channels_, length_, height_, width_,
+          kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_,
+          temporal_stride_, N_, buffers.int8_col);
+      for (int g = 0; g < group_ * filter_group_; ++g) {
+        int8_gemm_cpu(CblasNoTrans, M_, N_, kernel_dim_,
+            quantized_weight + g * M_ * kernel_dim_,
+            buffers.int8_col + g / filter_group_ * kernel_dim_ * N_,
+            buffers.int8_gemm);
+        dequantize_rows_cpu(M_, N_, buffers.int8_gemm, weight_scale + g * M_,
+            bottom_scale_, (bias_term_ && !fused) ? bias + g * M_ : NULL,
+            output + g * M_ * N_);
+      }
+      FinishClip(output, top_data, n, false);
+    }
+    return;
+  }
 
-  for (int n = 0; n < num_; ++n) {
-	// First, im2col
-    vol2col_cpu(bottom_data + bottom[0]->offset(n), channels_, length_, height_,
-	    		  width_, kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_, temporal_stride_, col_data);
+  if (engine_ == ConvolutionParameter_Engine_DIRECT) {
+    for (int n = thread_id; n < num_; n += num_threads) {
+      Dtype* output = ClipOutput(top_data, n, buffers);
+      conv3d_direct_pad_cpu(ClipBottom(bottom_data, n, buffers), channels_,
+          length_, height_, width_, buffers.pad);
+      conv3d_direct_forward_cpu(buffers.pad, channels_, length_, height_,
+          width_, weight, num_output_, output);
+      FinishClip(output, top_data, n, true);
+    }
+    return;
+  }
 
-    // Second, inner-product without filter groups
-	for (int g=0 ; g < filter_group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-	    (Dtype)1., weight + g * weight_offset, col_data,
-	    (Dtype)0., top_data + (*top)[0]->offset(n) + g * top_offset);
-	}
-      // third, add bias
-	if (bias_term_) {
-	  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-	   N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-	   reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
-	   (Dtype)1., top_data + (*top)[0]->offset(n));
+  if (engine_ == ConvolutionParameter_Engine_DEPTHWISE) {
+    for (int n = thread_id; n < num_; n += num_threads) {
+      Dtype* output = ClipOutput(top_data, n, buffers);
+      conv3d_depthwise_forward_cpu(ClipBottom(bottom_data, n, buffers),
+          channels_, length_, height_, width_, pad_, temporal_pad_, stride_,
+          temporal_stride_, weight, output);
+      FinishClip(output, top_data, n, true);
     }
+    return;
+  }
 
+  if (engine_ == ConvolutionParameter_Engine_WINOGRAD) {
+    for (int n = thread_id; n < num_; n += num_threads) {
+      Dtype* output = ClipOutput(top_data, n, buffers);
+      conv3d_winograd_forward_cpu(ClipBottom(bottom_data, n, buffers),
+          channels_, length_, height_, width_, pad_, temporal_pad_,
+          winograd_weight_.cpu_data(), num_output_, buffers.winograd,
+          output);
+      FinishClip(output, top_data, n, true);
+    }
+    return;
+  }
+
+  if (channels_last_) {
+    // (clips * N_) x K_ columns times the K_ x num_output_ filters give the
+    // channels-last top of the clips
+    for (int n = thread_id * clips_per_gemm_; n < num_;
+        n += num_threads * clips_per_gemm_) {
+      const int clips = std::min(clips_per_gemm_, num_ - n);
+      Dtype* col_data = column_cache_data_ ?
+          column_cache_data_ + static_cast<size_t>(n) * K_ * N_ : buffers.col;
+      for (int i = 0; i < clips; ++i) {
+        vol2col_nlhwc_cpu(bottom_data + (n + i) * bottom_dim, channels_,
+            length_, height_, width_, kernel_size_, kernel_depth_, pad_,
+            temporal_pad_, stride_, temporal_stride_, col_data + i * N_ * K_);
+      }
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, clips * N_,
+          num_output_, K_, (Dtype)1., col_data,
+          channels_last_weight_.cpu_data(), (Dtype)0.,
+          top_data + n * top_dim);
+      if (fused_relu_) {
+        // bias and ReLU in one pass over the num_output_ values of every
+        // position
+        for (int p = 0; p < clips * N_; ++p) {
+          Dtype* output = top_data + n * top_dim + p * num_output_;
+          for (int o = 0; o < num_output_; ++o) {
+            output[o] = std::max(bias_term_ ? output[o] + bias[o] : output[o],
+                Dtype(0));
+          }
+        }
+      } else if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, clips * N_,
+            num_output_, 1, (Dtype)1., bias_multiplier, bias, (Dtype)1.,
+            top_data + n * top_dim);
+      }
+    }
+    return;
+  }
+  for (int n = thread_id * clips_per_gemm_; n < num_;
+      n += num_threads * clips_per_gemm_) {
+    const int clips = std::min(clips_per_gemm_, num_ - n);
+    // the columns of all clips in this tile sit side by side in col_data
+    const int col_stride = clips * N_;
+    Dtype* col_data = column_cache_data_ ?
+        column_cache_data_ + static_cast<size_t>(n) * K_ * N_ : buffers.col;
+    // a single clip is written straight into its output (see ClipOutput),
+    // several clips go through the staging buffer and are scattered
+    // afterwards
+    Dtype* output = buffers.gemm;
+    if (clips == 1) {
+      output = ClipOutput(top_data, n, buffers);
+    }
+
+    // First, vol2col, which decodes a bfloat16 bottom as it goes
+    for (int i = 0; i < clips; ++i) {
+      if (bfloat16_bottom_) {
+        vol2col_cpu<Dtype>(bottom_bfloat16_ + (n + i) * bottom_dim, channels_,
+            length_, height_, width_, kernel_size_, kernel_depth_, pad_,
+            temporal_pad_, stride_, temporal_stride_, col_stride,
+            col_data + i * N_);
+      } else {
+        vol2col_cpu(bottom_data + (n + i) * bottom_dim, channels_, length_,
+            height_, width_, kernel_size_, kernel_depth_, pad_, temporal_pad_,
+            stride_, temporal_stride_, col_stride, col_data + i * N_);
+      }
+    }
+
+    // Second, inner-product with channel and filter groups
+    for (int g = 0; g < group_ * filter_group_; ++g) {
+      if (sparse_forward_) {
+        csr_gemm_cpu(M_, col_stride, sparse_weight_.row_ptr() + g * M_,
+            sparse_weight_.col_index(), sparse_weight_.values(),
+            col_data + g / filter_group_ * kernel_dim_ * col_stride,
+            output + g * M_ * col_stride);
+      } else {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, col_stride,
+            kernel_dim_, (Dtype)1., weight + g * M_ * kernel_dim_,
+            col_data + g / filter_group_ * kernel_dim_ * col_stride,
+            (Dtype)0., output + g * M_ * col_stride);
+      }
+    }
+
+    // finally, scatter the num_output_ x (clips * N_) result and add the
+    // bias per clip
+    if (clips > 1) {
+      for (int i = 0; i < clips; ++i) {
+        Dtype* clip_output = ClipOutput(top_data, n + i, buffers);
+        for (int o = 0; o < num_output_; ++o) {
+          caffe_copy(N_, output + o * col_stride + i * N_,
+              clip_output + o * N_);
+        }
+        FinishClip(clip_output, top_data, n + i, true);
+      }
+    } else {
+      FinishClip(output, top_data, n, true);
+    }
+  }
+}
+
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::FusedEpilogue(Dtype* output, Dtype* top_data,
+    const int n) {
+  // The bias and the ReLU in a single pass over the output. The sums are the
+  // ones of the bias GEMM against the vector of ones, so the result matches
+  // a separate ReLU layer bit for bit.
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int o = 0; o < num_output_; ++o) {
+    Dtype* row = output + o * N_;
+    if (bias_term_ && fused_relu_) {
+      for (int i = 0; i < N_; ++i) {
+        row[i] = std::max(row[i] + bias[o], Dtype(0));
+      }
+    } else if (bias_term_) {
+      for (int i = 0; i < N_; ++i) {
+        row[i] += bias[o];
+      }
+    } else if (fused_relu_) {
+      for (int i = 0; i < N_; ++i) {
+        row[i] = std::max(row[i], Dtype(0));
+      }
+    }
+  }
+  if (fused_pooling_) {
+    const PoolingParameter& pool_param = this->layer_param_.pooling_param();
+    const int length_out = (length_ + 2 * temporal_pad_ - kernel_depth_)
+        / temporal_stride_ + 1;
+    const int height_out = (height_ + 2 * pad_ - kernel_size_) / stride_ + 1;
+    const int width_out = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
+    const int top_dim =
+        num_output_ * pooled_length_ * pooled_height_ * pooled_width_;
+    if (bfloat16_top_) {
+      pool3d_max_cpu<Dtype>(output, num_output_, length_out, height_out,
+          width_out, pool_param.kernel_depth(), pool_param.kernel_size(),
+          pool_param.temporal_stride(), pool_param.stride(), 0,
+          pooled_length_, pooled_height_, pooled_width_,
+          top_bfloat16_ + n * top_dim);
+    } else {
+      pool3d_max_cpu<Dtype>(output, num_output_, length_out, height_out,
+          width_out, pool_param.kernel_depth(), pool_param.kernel_size(),
+          pool_param.temporal_stride(), pool_param.stride(), 0,
+          pooled_length_, pooled_height_, pooled_width_,
+          top_data + n * top_dim);
+    }
+  } else if (bfloat16_top_) {
+    bfloat16_encode_cpu(num_output_ * N_, output,
+        top_bfloat16_ + n * num_output_ * N_);
   }
-  return Dtype(0.);
 }
 
 template <typename Dtype>
 void Convolution3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  CHECK(!fused_relu_ && !fused_pooling_)
+      << "Fused Convolution3D layers do not support Backward.";
+  CHECK(!int8_) << "INT8 Convolution3D layers do not support Backward.";
+  CHECK(!bfloat16_bottom_ && !bfloat16_top_)
+      << "Convolution3D layers with bfloat16 blobs do not support Backward.";
   const Dtype* top_diff = top[0]->cpu_diff();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
-  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
+  Dtype* bottom_diff = propagate_down ? (*bottom)[0]->mutable_cpu_diff() : NULL;
   // bias gradient if necessary
   Dtype* bias_diff = NULL;
 
@@ -160,6 +832,13 @@ void Convolution3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     bias_diff = this->blobs_[1]->mutable_cpu_diff();
     memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
     for (int n = 0; n < num_; ++n) {
+      if (channels_last_) {
+        caffe_cpu_gemv<Dtype>(CblasTrans, N_, num_output_,
+            1., top_diff + top[0]->offset(n),
+            reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), 1.,
+            bias_diff);
+        continue;
+      }
 	  caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
 		  1., top_diff + top[0]->offset(n),
 		  reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), 1.,
@@ -167,46 +846,231 @@ void Convolution3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     }
   }
 
-  int weight_offset = M_ * K_;
-  int top_offset = M_ * N_;
-
   memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
-  for (int n = 0; n < num_; ++n) {
-	// since we saved memory in the forward pass by not storing all col data,
-	// we will need to recompute them.
-	vol2col_cpu(bottom_data + (*bottom)[0]->offset(n), channels_, length_, height_,
-					  width_, kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_,
-					  temporal_stride_, col_data);
-
-	// gradient w.r.t. weight. Note that we will accumulate diffs.
-	for (int g=0; g<filter_group_; ++g){
-		caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-				(Dtype)1., top_diff + top[0]->offset(n) + g * top_offset,
-				col_data, (Dtype)1.,
-				weight_diff + g * weight_offset);
-	}
-
-	// gradient w.r.t. bottom data, if necessary
-	if (propagate_down) {
-	  // compute first filter group -> col_diff
-	  caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-	    (Dtype)1., weight,
-		top_diff + top[0]->offset(n),
-		(Dtype)0., col_data);
-
-	  // accumulate the other filter groups -> col_diff
-	  for (int g=1; g<filter_group_; ++g){
-	    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-	      (Dtype)1., weight + g * weight_offset,
-		  top_diff + top[0]->offset(n) + g * top_offset,
-		  (Dtype)1., col_data);
-	  }
-
-	  // vol2im back to the data
-	  col2vol_cpu(col_data, channels_, length_, height_, width_, kernel_size_, kernel_depth_, pad_,
-		  temporal_pad_, stride_, temporal_stride_, bottom_diff + (*bottom)[0]->offset(n));
-	}
 
+  if (engine_ == ConvolutionParameter_Engine_FFT) {
+    for (int n = 0; n < num_; ++n) {
+      fft_.AccumulateWeightGradient(top_diff + top[0]->offset(n),
+          bottom_data + (*bottom)[0]->offset(n));
+    }
+    fft_.AddWeightGradient(weight_diff);
+    if (propagate_down) {
+      fft_.UpdateFilters(*this->blobs_[0]);
+      for (int n = 0; n < num_; ++n) {
+        fft_.Convolve(top_diff + top[0]->offset(n),
+            bottom_diff + (*bottom)[0]->offset(n));
+      }
+    }
+    return;
+  }
+
+  if (propagate_down && engine_ == ConvolutionParameter_Engine_DIRECT) {
+    // the gradient w.r.t. the bottom is the direct convolution of the padded
+    // top diff with the flipped, transposed filters
+    conv3d_direct_flip_weight_cpu(this->blobs_[0]->cpu_data(), num_output_,
+        channels_, flipped_weight_.mutable_cpu_data());
+  }
+  if (propagate_down && engine_ == ConvolutionParameter_Engine_WINOGRAD) {
+    UpdateWinogradWeights();
+  }
+  // thread 0 accumulates the channels-last weight gradient in the diff of
+  // channels_last_weight_
+  Dtype* thread_weight_diff = weight_diff;
+  if (channels_last_) {
+    UpdateChannelsLastWeights();
+    thread_weight_diff = channels_last_weight_.mutable_cpu_diff();
+    caffe_set(channels_last_weight_.count(), Dtype(0), thread_weight_diff);
+  }
+  this->blobs_[0]->cpu_data();
+
+  ReserveThreadBuffers();
+  // reuse the columns of the last Forward if the bottom has not changed since
+  column_cache_data_ = (column_cache_source_ &&
+      column_cache_source_ == (*bottom)[0]->data().get() &&
+      column_cache_version_ == column_cache_source_->version()) ?
+      static_cast<Dtype*>(column_cache_->mutable_cpu_data()) : NULL;
+  const int num_threads = Caffe::cpu_threads();
+  if (num_threads == 1) {
+    BackwardThread(top_diff, bottom_data, bottom_diff, 0, 1);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(
+        &Convolution3DLayer<Dtype>::BackwardThread, this, top_diff,
+        bottom_data, bottom_diff, _1, num_threads));
+    // reduce the weight gradients of the threads that had work
+    const int weight_tasks = (engine_ == ConvolutionParameter_Engine_DIRECT ||
+        engine_ == ConvolutionParameter_Engine_DEPTHWISE) ?
+        num_ : (num_ + clips_per_gemm_ - 1) / clips_per_gemm_;
+    for (int i = 1; i < std::min(num_threads, weight_tasks); ++i) {
+      caffe_axpy<Dtype>(this->blobs_[0]->count(), (Dtype)1.,
+          thread_buffers(i).weight_diff, thread_weight_diff);
+    }
+  }
+  if (channels_last_) {
+    convert_layout_cpu(thread_weight_diff, num_output_, channels_,
+        kernel_depth_ * kernel_size_ * kernel_size_, NLHWC, weight_diff);
+  }
+}
+
+template <typename Dtype>
+void Convolution3DLayer<Dtype>::BackwardThread(const Dtype* top_diff,
+      const Dtype* bottom_data, Dtype* bottom_diff, const int thread_id,
+      const int num_threads) {
+  const int bottom_dim = channels_ * length_ * height_ * width_;
+  const int top_dim = num_output_ * N_;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  if (thread_id >= num_) {
+    return;
+  }
+  ThreadBuffers buffers = thread_buffers(thread_id);
+  // thread 0 accumulates into the weight diff cleared by Backward_cpu
+  Dtype* weight_diff = buffers.weight_diff;
+  const int weight_tasks = (engine_ == ConvolutionParameter_Engine_DIRECT ||
+      engine_ == ConvolutionParameter_Engine_DEPTHWISE) ?
+      num_ : (num_ + clips_per_gemm_ - 1) / clips_per_gemm_;
+  if (thread_id == 0) {
+    weight_diff = channels_last_ ? channels_last_weight_.mutable_cpu_diff()
+        : this->blobs_[0]->mutable_cpu_diff();
+  } else if (thread_id < weight_tasks) {
+    caffe_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
+  }
+
+  if (engine_ == ConvolutionParameter_Engine_DIRECT) {
+    for (int n = thread_id; n < num_; n += num_threads) {
+      conv3d_direct_pad_cpu(bottom_data + n * bottom_dim, channels_,
+          length_, height_, width_, buffers.pad);
+      conv3d_direct_weight_grad_cpu(buffers.pad, channels_, length_, height_,
+          width_, top_diff + n * top_dim, num_output_, weight_diff);
+      if (bottom_diff) {
+        conv3d_direct_pad_cpu(top_diff + n * top_dim, num_output_,
+            length_, height_, width_, buffers.pad);
+        conv3d_direct_forward_cpu(buffers.pad, num_output_, length_, height_,
+            width_, flipped_weight_.cpu_data(), channels_,
+            bottom_diff + n * bottom_dim);
+      }
+    }
+    return;
+  }
+
+  if (engine_ == ConvolutionParameter_Engine_DEPTHWISE) {
+    for (int n = thread_id; n < num_; n += num_threads) {
+      conv3d_depthwise_backward_cpu(bottom_data + n * bottom_dim,
+          top_diff + n * top_dim, channels_, length_, height_, width_, pad_,
+          temporal_pad_, stride_, temporal_stride_, weight, weight_diff,
+          bottom_diff ? bottom_diff + n * bottom_dim : NULL);
+    }
+    return;
+  }
+
+  // the columns are recomputed into col_data unless Forward kept them, the
+  // column diff always goes to col_data
+  Dtype* col_data = buffers.col;
+  if (channels_last_) {
+    for (int n = thread_id * clips_per_gemm_; n < num_;
+        n += num_threads * clips_per_gemm_) {
+      const int clips = std::min(clips_per_gemm_, num_ - n);
+      const Dtype* columns = col_data;
+      if (column_cache_data_) {
+        columns = column_cache_data_ + static_cast<size_t>(n) * K_ * N_;
+      } else {
+        for (int i = 0; i < clips; ++i) {
+          vol2col_nlhwc_cpu(bottom_data + (n + i) * bottom_dim, channels_,
+              length_, height_, width_, kernel_size_, kernel_depth_, pad_,
+              temporal_pad_, stride_, temporal_stride_,
+              col_data + i * N_ * K_);
+        }
+      }
+      // num_output_ x K_ gradient of the channels-last filters
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num_output_, K_,
+          clips * N_, (Dtype)1., top_diff + n * top_dim, columns,
+          (Dtype)1., weight_diff);
+      if (bottom_diff) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, clips * N_, K_,
+            num_output_, (Dtype)1., top_diff + n * top_dim,
+            channels_last_weight_.cpu_data(), (Dtype)0., col_data);
+        for (int i = 0; i < clips; ++i) {
+          col2vol_nlhwc_cpu(col_data + i * N_ * K_, channels_, length_,
+              height_, width_, kernel_size_, kernel_depth_, pad_,
+              temporal_pad_, stride_, temporal_stride_,
+              bottom_diff + (n + i) * bottom_dim);
+        }
+      }
+    }
+    return;
+  }
+  for (int n = thread_id * clips_per_gemm_; n < num_;
+      n += num_threads * clips_per_gemm_) {
+    const int clips = std::min(clips_per_gemm_, num_ - n);
+    const int col_stride = clips * N_;
+
+    // unless the forward pass kept the col data (cache_columns), we will
+    // need to recompute them.
+    const Dtype* columns = col_data;
+    if (column_cache_data_) {
+      columns = column_cache_data_ + static_cast<size_t>(n) * K_ * N_;
+    } else {
+      for (int i = 0; i < clips; ++i) {
+        vol2col_cpu(bottom_data + (n + i) * bottom_dim, channels_,
+            length_, height_, width_, kernel_size_, kernel_depth_, pad_,
+            temporal_pad_, stride_, temporal_stride_, col_stride,
+            col_data + i * N_);
+      }
+    }
+
+    // gather the top diff of the tile into the same num_output_ x
+    // (clips * N_) layout as the columns
+    const Dtype* tile_diff = top_diff + n * top_dim;
+    if (clips > 1) {
+      for (int i = 0; i < clips; ++i) {
+        for (int o = 0; o < num_output_; ++o) {
+          caffe_copy(N_, top_diff + (n + i) * top_dim + o * N_,
+              buffers.gemm + o * col_stride + i * N_);
+        }
+      }
+      tile_diff = buffers.gemm;
+    }
+
+    // gradient w.r.t. weight. Note that we will accumulate diffs.
+    for (int g = 0; g < group_ * filter_group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, kernel_dim_,
+          col_stride, (Dtype)1., tile_diff + g * M_ * col_stride,
+          columns + g / filter_group_ * kernel_dim_ * col_stride, (Dtype)1.,
+          weight_diff + g * M_ * kernel_dim_);
+    }
+
+    // gradient w.r.t. bottom data, if necessary (the Winograd engine only
+    // uses the GEMM path for the weight gradient)
+    if (bottom_diff && engine_ == ConvolutionParameter_Engine_GEMM) {
+      // the first filter group of every channel group writes its rows of
+      // col_diff, the other filter groups accumulate
+      for (int g = 0; g < group_ * filter_group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
+            col_stride, M_, (Dtype)1., weight + g * M_ * kernel_dim_,
+            tile_diff + g * M_ * col_stride,
+            (Dtype)(g % filter_group_ == 0 ? 0. : 1.),
+            col_data + g / filter_group_ * kernel_dim_ * col_stride);
+      }
+
+      // col2vol back to the data
+      for (int i = 0; i < clips; ++i) {
+        col2vol_cpu(col_data + i * N_, channels_, length_, height_, width_,
+            kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_,
+            temporal_stride_, col_stride,
+            bottom_diff + (n + i) * bottom_dim);
+      }
+    }
+  }
+
+  if (bottom_diff && engine_ == ConvolutionParameter_Engine_WINOGRAD) {
+    const int length_out = (length_ + 2 * temporal_pad_ - kernel_depth_)
+        / temporal_stride_ + 1;
+    const int height_out = (height_ + 2 * pad_ - kernel_size_) / stride_ + 1;
+    const int width_out = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
+    for (int n = thread_id; n < num_; n += num_threads) {
+      conv3d_winograd_forward_cpu(top_diff + n * top_dim, num_output_,
+          length_out, height_out, width_out, 2 - pad_, 2 - temporal_pad_,
+          winograd_flipped_weight_.cpu_data(), channels_, buffers.winograd,
+          bottom_diff + n * bottom_dim);
+    }
   }
 }
 
@@ -27,22 +27,28 @@ namespace caffe {
 template <typename Dtype>
 Dtype Convolution3DLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  CHECK(!fused_relu_ && !fused_pooling_)
+      << "Fused Convolution3D layers only run on the CPU.";
+  CHECK(!int8_) << "INT8 Convolution3D layers only run on the CPU.";
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = (*top)[0]->mutable_gpu_data();
-  Dtype* col_data = col_buffer_.mutable_gpu_data();
+  Dtype* col_data = static_cast<Dtype*>(
+      this->workspace()->mutable_gpu_data(sizeof(Dtype) * K_ * N_));
   const Dtype* weight = this->blobs_[0]->gpu_data();
 
-  int weight_offset = M_ * K_;
+  int weight_offset = M_ * kernel_dim_;
+  int col_offset = kernel_dim_ * N_;
   int top_offset = M_ * N_;
   
   for (int n = 0; n < num_; ++n) {
     // First, im2col
     vol2col_gpu(bottom_data + bottom[0]->offset(n), channels_, length_, height_,
                       width_, kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_, temporal_stride_, col_data);
-    // Second, innerproduct with groups
-    for (int g=0; g<filter_group_; ++g){
-      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-        (Dtype)1., weight + g * weight_offset, col_data,
+    // Second, innerproduct with channel and filter groups
+    for (int g=0; g<group_ * filter_group_; ++g){
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, kernel_dim_,
+        (Dtype)1., weight + g * weight_offset,
+        col_data + g / filter_group_ * col_offset,
         (Dtype)0., top_data + (*top)[0]->offset(n) + g * top_offset);
     }
     // third, add bias
@@ -59,12 +65,16 @@ Dtype Convolution3DLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void Convolution3DLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  CHECK(!fused_relu_ && !fused_pooling_)
+      << "Fused Convolution3D layers do not support Backward.";
+  CHECK(!int8_) << "INT8 Convolution3D layers do not support Backward.";
   const Dtype* top_diff = top[0]->gpu_diff();
   const Dtype* weight = this->blobs_[0]->gpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->gpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_gpu_diff();
-  Dtype* col_data = col_buffer_.mutable_gpu_data();
+  Dtype* col_data = static_cast<Dtype*>(
+      this->workspace()->mutable_gpu_data(sizeof(Dtype) * K_ * N_));
   // bias gradient if necessary
   Dtype* bias_diff = NULL;
 
@@ -80,7 +90,8 @@ void Convolution3DLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     }
   }
 
-  int weight_offset = M_ * K_;
+  int weight_offset = M_ * kernel_dim_;
+  int col_offset = kernel_dim_ * N_;
   int top_offset = M_ * N_;
   
   CUDA_CHECK(cudaMemset(weight_diff, 0,
@@ -91,24 +102,22 @@ void Convolution3DLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     vol2col_gpu(bottom_data + (*bottom)[0]->offset(n), channels_, length_, height_,
                       width_, kernel_size_, kernel_depth_, pad_, temporal_pad_, stride_, temporal_stride_, col_data);
     // gradient w.r.t. weight. Note that we will accumulate diffs.
-    for (int g=0; g<filter_group_; ++g) {
-      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+    for (int g=0; g<group_ * filter_group_; ++g) {
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, kernel_dim_, N_,
         (Dtype)1., top_diff + top[0]->offset(n) + g * top_offset,
-        col_data, (Dtype)1.,
+        col_data + g / filter_group_ * col_offset, (Dtype)1.,
         weight_diff + g * weight_offset);
 	}
     // gradient w.r.t. bottom data, if necessary
     if (propagate_down) {
-      caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-        (Dtype)1., weight,
-        top_diff + top[0]->offset(n),
-        (Dtype)0., col_data);
-    
-      for (int g=1; g<filter_group_; ++g) {
-        caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+      // the first filter group of every channel group writes its rows,
+      // the other filter groups accumulate
+      for (int g=0; g<group_ * filter_group_; ++g) {
+        caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_, N_, M_,
           (Dtype)1., weight + g * weight_offset,
           top_diff + top[0]->offset(n) + g * top_offset,
-          (Dtype)1., col_data);
+          (Dtype)(g % filter_group_ == 0 ? 0. : 1.),
+          col_data + g / filter_group_ * col_offset);
 	  }
       // col2vol back to the data
       col2vol_gpu(col_data, channels_, length_, height_, width_, kernel_size_, kernel_depth_, pad_,
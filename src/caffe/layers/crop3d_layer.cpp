@@ -48,6 +48,8 @@ void Crop3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 
    (*top)[0]->Reshape(bottom[0]->num(), bottom[0]->channels(), bottom[1]->length(), bottom[1]->height(),
 	          bottom[1]->width());
+   // the second bottom only provides the shape, the layout is the first one's
+   (*top)[0]->set_layout(bottom[0]->layout());
 }
 
 template <typename Dtype>
@@ -55,6 +57,19 @@ Dtype Crop3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
    const Dtype* bottom_data = bottom[0]->cpu_data(); 
    Dtype* top_data = (*top)[0]->mutable_cpu_data(); 
+   if (bottom[0]->layout() == NLHWC) {
+     // a cropped row holds width x channels contiguous values
+     for (int n = 0; n < (*top)[0]->num(); ++n) {
+       for (int l = 0; l < (*top)[0]->length(); ++l) {
+         for (int h = 0; h < (*top)[0]->height(); ++h) {
+           caffe_copy((*top)[0]->width() * (*top)[0]->channels(),
+               bottom_data + bottom[0]->offset(n, 0, crop_l_ + l, crop_h_ + h, crop_w_),
+               top_data + (*top)[0]->offset(n, 0, l, h, 0));
+         }
+       }
+     }
+     return Dtype(0.);
+   }
    for (int n = 0; n < (*top)[0]->num(); ++n) {
 	   for (int c = 0; c < (*top)[0]->channels(); ++c) {
 		   for (int l = 0; l < (*top)[0]->length(); ++l)
@@ -62,7 +77,7 @@ Dtype Crop3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 			   for (int h = 0; h < (*top)[0]->height(); ++h) {
 				   caffe_copy((*top)[0]->width(),
 					   bottom_data + bottom[0]->offset(n, c, crop_l_ + l, crop_h_ + h, crop_w_),
-					   top_data + (*top)[0]->offset(n, c, l, h));
+					   top_data + (*top)[0]->offset(n, c, l, h, 0));
 			   }
 		   }
      } 
@@ -81,13 +96,25 @@ void Crop3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
    if (propagate_down) { 
 	   caffe_set((*bottom)[0]->count(), static_cast<Dtype>(0), bottom_diff);
 	   caffe_set((*bottom)[1]->count(), static_cast<Dtype>(0), (*bottom)[1]->mutable_cpu_diff());
+     if (top[0]->layout() == NLHWC) {
+       for (int n = 0; n < top[0]->num(); ++n) {
+         for (int l = 0; l < top[0]->length(); ++l) {
+           for (int h = 0; h < top[0]->height(); ++h) {
+             caffe_copy(top[0]->width() * top[0]->channels(),
+                 top_diff + top[0]->offset(n, 0, l, h, 0),
+                 bottom_diff + (*bottom)[0]->offset(n, 0, crop_l_ + l, crop_h_ + h, crop_w_));
+           }
+         }
+       }
+       return;
+     }
      for (int n = 0; n < top[0]->num(); ++n) { 
        for (int c = 0; c < top[0]->channels(); ++c) { 
 		   for (int l = 0; l < top[0]->length(); ++l)
 		   {
 			   for (int h = 0; h < top[0]->height(); ++h) {
 				   caffe_copy(top[0]->width(),
-					   top_diff + top[0]->offset(n, c, l, h),
+					   top_diff + top[0]->offset(n, c, l, h, 0),
 					   bottom_diff + (*bottom)[0]->offset(n, c, crop_l_ + l, crop_h_ + h, crop_w_));
 			   }
          } 
@@ -15,6 +15,9 @@
  */
 
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -22,6 +25,7 @@
 #include "caffe/util/vol2col.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -57,10 +61,8 @@ void Deconvolution3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   length_out_ = temporal_stride_ * (length_ - 1) + kernel_depth_ - 2 * temporal_pad_;
   conv_out_spatial_dim_ = height_  * width_ * length_;
 
-  // buffer for one image
-  col_buffer_.Reshape(
-      1, channels_ * kernel_depth_ * kernel_size_ * kernel_size_, length_, height_, width_);
-
+  // the kernel_dim_ x conv_out_spatial_dim_ column buffer of one image is
+  // taken from the workspace
 
   bias_term_ = this->layer_param_.convolution_param().bias_term();
 
@@ -70,6 +72,59 @@ void Deconvolution3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   col_offset_ = kernel_dim_ * conv_out_spatial_dim_ / filter_group_;
   output_offset_ = channels_ * conv_out_spatial_dim_ / filter_group_;
 
+  // Resolve the CPU engine. The FFT engine handles stride 1 without filter
+  // groups; it treats the top as the padded volume the bottom is correlated
+  // with, so the filters are laid out channels_ x num_output_. The PHASE
+  // engine handles any shape and is the DEFAULT for strided layers.
+  const bool fft_shape = stride_ == 1 && temporal_stride_ == 1 &&
+      filter_group_ == 1;
+  engine_ = this->layer_param_.convolution_param().engine();
+  if (engine_ != ConvolutionParameter_Engine_DEFAULT &&
+      engine_ != ConvolutionParameter_Engine_GEMM &&
+      engine_ != ConvolutionParameter_Engine_FFT &&
+      engine_ != ConvolutionParameter_Engine_PHASE) {
+    LOG(INFO) << "Deconvolution3DLayer only supports the GEMM, FFT and "
+        << "PHASE engines, falling back to GEMM.";
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  if ((engine_ == ConvolutionParameter_Engine_DEFAULT ||
+      engine_ == ConvolutionParameter_Engine_FFT) && fft_shape) {
+    const bool fft_fits = fft_.Init(channels_, num_output_, length_out_,
+        height_out_, width_out_, kernel_depth_, kernel_size_, temporal_pad_,
+        pad_, this->layer_param_.convolution_param().fft_workspace_limit());
+    if (!fft_fits) {
+      if (engine_ == ConvolutionParameter_Engine_FFT) {
+        LOG(INFO) << "The FFT engine does not fit in fft_workspace_limit, "
+            << "falling back to GEMM.";
+      }
+      engine_ = ConvolutionParameter_Engine_GEMM;
+    } else if (engine_ == ConvolutionParameter_Engine_DEFAULT) {
+      const double savings = fft_.EstimatedSavings();
+      if (savings >=
+          this->layer_param_.convolution_param().fft_savings_threshold()) {
+        LOG(INFO) << "Using the FFT engine, estimated to need " << savings
+            << " times fewer flops than GEMM";
+        engine_ = ConvolutionParameter_Engine_FFT;
+      }
+    }
+  } else if (engine_ == ConvolutionParameter_Engine_FFT) {
+    LOG(INFO) << "The FFT engine requires stride 1 and filter_group 1, "
+        << "falling back to GEMM.";
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  if (engine_ == ConvolutionParameter_Engine_DEFAULT &&
+      (stride_ > 1 || temporal_stride_ > 1)) {
+    engine_ = ConvolutionParameter_Engine_PHASE;
+  }
+  if (engine_ == ConvolutionParameter_Engine_DEFAULT) {
+    engine_ = ConvolutionParameter_Engine_GEMM;
+  }
+  if (engine_ == ConvolutionParameter_Engine_PHASE) {
+    phase_.Init(channels_, num_output_, filter_group_, length_, height_,
+        width_, kernel_depth_, kernel_size_, temporal_pad_, pad_,
+        temporal_stride_, stride_);
+  }
+
   // output size
   (*top)[0]->Reshape(bottom[0]->num(), num_output_, length_out_, height_out_, width_out_);
 
@@ -109,36 +164,116 @@ void Deconvolution3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+size_t Deconvolution3DLayer<Dtype>::workspace_size() {
+  if (Caffe::mode() == Caffe::CPU &&
+      engine_ == ConvolutionParameter_Engine_FFT) {
+    return 0;
+  }
+  const int num_threads = Caffe::mode() == Caffe::CPU ?
+      std::min(Caffe::cpu_threads(), num_) : 1;
+  // Backward runs on the columns of one clip
+  return sizeof(Dtype) * std::max(forward_buffer_count() * num_threads,
+      static_cast<size_t>(kernel_dim_) * conv_out_spatial_dim_);
+}
+
+template <typename Dtype>
+size_t Deconvolution3DLayer<Dtype>::forward_buffer_count() {
+  if (Caffe::mode() == Caffe::CPU &&
+      engine_ == ConvolutionParameter_Engine_PHASE) {
+    return phase_.buffer_count();
+  }
+  return static_cast<size_t>(kernel_dim_) * conv_out_spatial_dim_;
+}
+
 template <typename Dtype>
 Dtype Deconvolution3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
 
-  for (int n = 0; n < num_; ++n) {
+  if (engine_ == ConvolutionParameter_Engine_FFT) {
+    fft_.UpdateFilters(*this->blobs_[0]);
+    for (int n = 0; n < num_; ++n) {
+      fft_.Convolve(bottom_data + bottom[0]->offset(n),
+          top_data + (*top)[0]->offset(n));
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+            length_out_ * height_out_ * width_out_, 1, (Dtype)1.,
+            this->blobs_[1]->cpu_data(),
+            reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+            (Dtype)1., top_data + (*top)[0]->offset(n));
+      }
+    }
+    return Dtype(0.);
+  }
+
+  // Clips are processed concurrently, each thread with its own columns. A
+  // single clip is instead split inside col2vol_cpu.
+  Dtype* col_data = static_cast<Dtype*>(
+      this->workspace()->mutable_cpu_data(workspace_size()));
+  if (engine_ == ConvolutionParameter_Engine_PHASE) {
+    phase_.UpdateFilters(*this->blobs_[0]);
+  }
+  this->blobs_[0]->cpu_data();
+  if (bias_term_) {
+    this->blobs_[1]->cpu_data();
+  }
+  const int num_threads = std::min(Caffe::cpu_threads(), num_);
+  if (num_threads == 1) {
+    ForwardThread(bottom_data, top_data, col_data, 0, 1);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(
+        &Deconvolution3DLayer<Dtype>::ForwardThread, this, bottom_data,
+        top_data, col_data, _1, num_threads));
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void Deconvolution3DLayer<Dtype>::ForwardThread(const Dtype* bottom_data,
+      Dtype* top_data, Dtype* col_data, const int thread_id,
+      const int num_threads) {
+  if (thread_id >= num_threads) {
+    return;
+  }
+  const int bottom_dim = channels_ * conv_out_spatial_dim_;
+  const int top_dim = num_output_ * length_out_ * height_out_ * width_out_;
+  col_data += thread_id * forward_buffer_count();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  for (int n = thread_id; n < num_; n += num_threads) {
+    if (engine_ == ConvolutionParameter_Engine_PHASE) {
+      phase_.Forward(bottom_data + n * bottom_dim, col_data,
+          top_data + n * top_dim);
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+            length_out_ * height_out_ * width_out_, 1, (Dtype)1.,
+            this->blobs_[1]->cpu_data(),
+            reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+            (Dtype)1., top_data + n * top_dim);
+      }
+      continue;
+    }
 	  // First, inner-product
 	  for (int g = 0; g < filter_group_; ++g) {
 		  caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / filter_group_, 
 			  conv_out_spatial_dim_, channels_ / filter_group_,
-			  (Dtype)1., weight + weight_offset_ * g, bottom_data + bottom[0]->offset(n) + output_offset_ * g,
+			  (Dtype)1., weight + weight_offset_ * g, bottom_data + n * bottom_dim + output_offset_ * g,
 			  (Dtype)0., col_data + col_offset_ * g);
 
 	  }
 	  //Second, col2vol
 	  col2vol_cpu(col_data, num_output_, length_out_, height_out_, width_out_, kernel_size_, kernel_depth_, pad_,
-		  temporal_pad_, stride_, temporal_stride_, top_data + (*top)[0]->offset(n));
+		  temporal_pad_, stride_, temporal_stride_, top_data + n * top_dim);
 
 	  //Third, add bias
 	  if (bias_term_) {
 		  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
 			  length_out_ * height_out_ * width_out_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
 			  reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
-			  (Dtype)1., top_data + (*top)[0]->offset(n));
+			  (Dtype)1., top_data + n * top_dim);
 	  }
   }
-  return Dtype(0.);
 }
 
 template <typename Dtype>
@@ -149,7 +284,8 @@ void Deconvolution3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
+  Dtype* col_data = static_cast<Dtype*>(
+      this->workspace()->mutable_cpu_data(workspace_size()));
   // bias gradient if necessary
   Dtype* bias_diff = NULL;
 
@@ -165,6 +301,23 @@ void Deconvolution3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 
   memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
+
+  if (engine_ == ConvolutionParameter_Engine_FFT) {
+    for (int n = 0; n < num_; ++n) {
+      fft_.AccumulateWeightGradient(bottom_data + (*bottom)[0]->offset(n),
+          top_diff + top[0]->offset(n));
+    }
+    fft_.AddWeightGradient(weight_diff);
+    if (propagate_down) {
+      fft_.UpdateFilters(*this->blobs_[0]);
+      for (int n = 0; n < num_; ++n) {
+        fft_.Correlate(top_diff + top[0]->offset(n),
+            bottom_diff + (*bottom)[0]->offset(n));
+      }
+    }
+    return;
+  }
+
   for (int n = 0; n < num_; ++n) {
 	// since we saved memory in the forward pass by not storing all col data,
 	// we will need to recompute them.
@@ -29,7 +29,8 @@ Dtype Deconvolution3DLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& botto
       vector<Blob<Dtype>*>* top) {
 	const Dtype* bottom_data = bottom[0]->gpu_data();
 	Dtype* top_data = (*top)[0]->mutable_gpu_data();
-	Dtype* col_data = col_buffer_.mutable_gpu_data();
+	Dtype* col_data = static_cast<Dtype*>(
+		this->workspace()->mutable_gpu_data(workspace_size()));
 	const Dtype* weight = this->blobs_[0]->gpu_data();
 
 	for (int n = 0; n < num_; ++n) {
@@ -64,7 +65,8 @@ void Deconvolution3DLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
 	Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
 	const Dtype* bottom_data = (*bottom)[0]->gpu_data();
 	Dtype* bottom_diff = (*bottom)[0]->mutable_gpu_diff();
-	Dtype* col_data = col_buffer_.mutable_gpu_data();
+	Dtype* col_data = static_cast<Dtype*>(
+		this->workspace()->mutable_gpu_data(workspace_size()));
 	// bias gradient if necessary
 	Dtype* bias_diff = NULL;
 
@@ -1,5 +1,6 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <algorithm>
 #include <cfloat>
 #include <vector>
 
@@ -9,6 +10,9 @@
 
 namespace caffe {
 
+	// Elements combined at a time when blobs are stored as bfloat16.
+	static const int kEltwiseBfloat16Block = 4096;
+
 	template <typename Dtype>
 	void EltwiseLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 		vector<Blob<Dtype>*>* top) {
@@ -47,6 +51,14 @@ namespace caffe {
 	template <typename Dtype>
 	Dtype EltwiseLayer<Dtype>::Forward_cpu(
 		const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+		bool bfloat16 = (*top)[0]->bfloat16_storage();
+		for (int i = 0; i < bottom.size(); ++i) {
+			bfloat16 |= bottom[i]->bfloat16_storage();
+		}
+		if (bfloat16) {
+			ForwardBfloat16(bottom, top);
+			return Dtype(0.);
+		}
 		int* mask = NULL;
 		const Dtype* bottom_data_a = NULL;
 		const Dtype* bottom_data_b = NULL;
@@ -102,9 +114,70 @@ namespace caffe {
 		return Dtype(0.);
 	}
 
+	template <typename Dtype>
+	void EltwiseLayer<Dtype>::ForwardBfloat16(
+		const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+		const int count = (*top)[0]->count();
+		const bool bfloat16_top = (*top)[0]->bfloat16_storage();
+		Dtype* top_data = bfloat16_top ? NULL : (*top)[0]->mutable_cpu_data();
+		bfloat16* top_bfloat16 = bfloat16_top ?
+			(*top)[0]->mutable_cpu_bfloat16_data() : NULL;
+		int* mask = op_ == EltwiseParameter_EltwiseOp_MAX ?
+			max_idx_.mutable_cpu_data() : NULL;
+		vector<Dtype> decoded(kEltwiseBfloat16Block);
+		vector<Dtype> result(bfloat16_top ? kEltwiseBfloat16Block : 0);
+		for (int begin = 0; begin < count; begin += kEltwiseBfloat16Block) {
+			const int n = std::min(kEltwiseBfloat16Block, count - begin);
+			Dtype* y = bfloat16_top ? &result[0] : top_data + begin;
+			for (int i = 0; i < bottom.size(); ++i) {
+				const Dtype* x = NULL;
+				if (bottom[i]->bfloat16_storage()) {
+					bfloat16_decode_cpu(n, bottom[i]->cpu_bfloat16_data() + begin,
+						&decoded[0]);
+					x = &decoded[0];
+				} else {
+					x = bottom[i]->cpu_data() + begin;
+				}
+				// the same operations, in the same order, as Forward_cpu
+				switch (op_) {
+				case EltwiseParameter_EltwiseOp_PROD:
+					if (i == 0) {
+						caffe_copy(n, x, y);
+					} else {
+						caffe_mul(n, y, x, y);
+					}
+					break;
+				case EltwiseParameter_EltwiseOp_SUM:
+					if (i == 0) {
+						caffe_set(n, Dtype(0), y);
+					}
+					caffe_axpy(n, coeffs_[i], x, y);
+					break;
+				case EltwiseParameter_EltwiseOp_MAX:
+					// bottom 1 wins ties with bottom 0, later bottoms have to be
+					// strictly larger
+					for (int j = 0; j < n; ++j) {
+						if (i == 0 || (i == 1 ? !(y[j] > x[j]) : x[j] > y[j])) {
+							y[j] = x[j];
+							mask[begin + j] = i;
+						}
+					}
+					break;
+				default:
+					LOG(FATAL) << "Unknown elementwise operation.";
+				}
+			}
+			if (bfloat16_top) {
+				bfloat16_encode_cpu(n, y, top_bfloat16 + begin);
+			}
+		}
+	}
+
 	template <typename Dtype>
 	void EltwiseLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 		const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+		CHECK(!top[0]->bfloat16_storage())
+			<< "Eltwise layers with bfloat16 blobs do not support Backward.";
 		const int* mask = NULL;
 		const int count = top[0]->count();
 		const Dtype* top_data = top[0]->cpu_data();
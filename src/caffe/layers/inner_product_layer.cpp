@@ -8,6 +8,8 @@
 #include "caffe/layer.hpp"
 #include "caffe/vision_layers.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/sparse.hpp"
 
 namespace caffe {
 
@@ -23,6 +25,16 @@ void InnerProductLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   K_ = bottom[0]->count() / bottom[0]->num();
   N_ = num_output;
   (*top)[0]->Reshape(bottom[0]->num(), num_output, 1, 1, 1);
+  int8_ = this->layer_param_.quantization_param().precision() ==
+      QuantizationParameter_Precision_INT8;
+  if (int8_) {
+    const float bottom_range =
+        this->layer_param_.quantization_param().bottom_range();
+    CHECK_GT(bottom_range, 0) << "INT8 layer " << this->layer_param_.name()
+        << " has no bottom_range, calibrate it with tools/calibrate_int8.";
+    bottom_scale_ = bottom_range / 127;
+  }
+  sparse_ = this->layer_param_.has_sparsity_param() && !int8_;
   // Check if we need to set up the weights
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -57,14 +69,47 @@ void InnerProductLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+size_t InnerProductLayer<Dtype>::workspace_size() {
+  return int8_ ? sizeof(int32_t) * M_ * N_ + M_ * K_ : 0;
+}
+
 template <typename Dtype>
 Dtype InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
+  if (int8_) {
+    // the int32 products first, so that they are aligned
+    int32_t* product = static_cast<int32_t*>(
+        this->workspace()->mutable_cpu_data(workspace_size()));
+    int8_t* quantized_bottom = reinterpret_cast<int8_t*>(product + M_ * N_);
+    quantized_weight_.Update(*this->blobs_[0], N_);
+    quantize_cpu(M_ * K_, bottom_data, bottom_scale_, quantized_bottom);
+    int8_gemm_cpu(CblasTrans, M_, N_, K_, quantized_bottom,
+        quantized_weight_.data(), product);
+    const Dtype* weight_scale = quantized_weight_.scale();
+    const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    for (int m = 0; m < M_; ++m) {
+      for (int n = 0; n < N_; ++n) {
+        top_data[m * N_ + n] = product[m * N_ + n] * weight_scale[n] *
+            bottom_scale_ + (bias ? bias[n] : Dtype(0));
+      }
+    }
+    return Dtype(0);
+  }
+  if (sparse_) {
+    sparse_weight_.Update(this->blobs_[0].get(), N_,
+        this->layer_param_.sparsity_param().threshold());
+  }
+  if (sparse_ && sparse_weight_.density() <=
+      this->layer_param_.sparsity_param().max_density()) {
+    csr_gemm_trans_cpu(M_, N_, K_, bottom_data, sparse_weight_.row_ptr(),
+        sparse_weight_.col_index(), sparse_weight_.values(), top_data);
+  } else {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
+        bottom_data, this->blobs_[0]->cpu_data(), (Dtype)0., top_data);
+  }
   if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
@@ -77,6 +122,7 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const bool propagate_down,
     vector<Blob<Dtype>*>* bottom) {
+  CHECK(!int8_) << "INT8 InnerProduct layers do not support Backward.";
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   // Gradient with respect to weight
@@ -0,0 +1,57 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/video_3d_layers.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  CHECK_EQ(bottom.size(), 1) << "Layout Layer takes a single blob as input.";
+  CHECK_EQ(top->size(), 1) << "Layout Layer takes a single blob as output.";
+  CHECK_NE((*top)[0], bottom[0]) << "Layout Layer cannot be in-place.";
+  (*top)[0]->Reshape(bottom[0]->num(), bottom[0]->channels(),
+      bottom[0]->length(), bottom[0]->height(), bottom[0]->width());
+  (*top)[0]->set_layout(this->layer_param_.layout_param().layout());
+}
+
+template <typename Dtype>
+Dtype LayoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const Blob<Dtype>* blob = bottom[0];
+  if (blob->layout() == (*top)[0]->layout()) {
+    caffe_copy(blob->count(), blob->cpu_data(),
+        (*top)[0]->mutable_cpu_data());
+  } else {
+    convert_layout_cpu(blob->cpu_data(), blob->num(), blob->channels(),
+        blob->length() * blob->height() * blob->width(), blob->layout(),
+        (*top)[0]->mutable_cpu_data());
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  if (!propagate_down) {
+    return;
+  }
+  const Blob<Dtype>* blob = top[0];
+  if (blob->layout() == (*bottom)[0]->layout()) {
+    caffe_copy(blob->count(), blob->cpu_diff(),
+        (*bottom)[0]->mutable_cpu_diff());
+  } else {
+    convert_layout_cpu(blob->cpu_diff(), blob->num(), blob->channels(),
+        blob->length() * blob->height() * blob->width(), blob->layout(),
+        (*bottom)[0]->mutable_cpu_diff());
+  }
+}
+
+INSTANTIATE_CLASS(LayoutLayer);
+
+}  // namespace caffe
@@ -15,8 +15,7 @@ void NeuronLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   // NeuronLayer allows in-place computations. If the computation is not
   // in-place, we will need to initialize the top blob.
   if ((*top)[0] != bottom[0]) {
-    (*top)[0]->Reshape(bottom[0]->num(), bottom[0]->channels(), bottom[0]->length(),
-        bottom[0]->height(), bottom[0]->width());
+    (*top)[0]->ReshapeLike(*bottom[0]);
   }
 }
 
@@ -24,6 +24,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/video_3d_layers.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/pool3d.hpp"
 
 using std::max;
 using std::min;
@@ -41,9 +42,10 @@ void Pooling3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   temporal_stride_ = this->layer_param_.pooling_param().temporal_stride();
   pad_ = this->layer_param_.pooling_param().pad();
   if (pad_ != 0) {
-    CHECK_EQ(this->layer_param_.pooling_param().pool(),
-             PoolingParameter_PoolMethod_AVE)
-        << "Padding implemented only for average pooling.";
+    CHECK_NE(this->layer_param_.pooling_param().pool(),
+             PoolingParameter_PoolMethod_STOCHASTIC)
+        << "Padding implemented only for average and max pooling.";
+    CHECK_LT(pad_, kernel_size_) << "A window cannot lie in the padding.";
   }
   channels_ = bottom[0]->channels();
   length_ = bottom[0]->length();
@@ -55,8 +57,30 @@ void Pooling3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
       width_ + 2 * pad_ - kernel_size_) / stride_)) + 1;
   pooled_length_ = static_cast<int>(ceil(static_cast<float>(
 	      length_ - kernel_depth_) / temporal_stride_)) + 1;
+  if (pad_) {
+    // the last window must start inside the input or its leading padding;
+    // with pad close to kernel_size, rounding up can add one that lies in
+    // the trailing padding only
+    if ((pooled_height_ - 1) * stride_ >= height_ + pad_) {
+      --pooled_height_;
+    }
+    if ((pooled_width_ - 1) * stride_ >= width_ + pad_) {
+      --pooled_width_;
+    }
+    CHECK_LT((pooled_height_ - 1) * stride_, height_ + pad_);
+    CHECK_LT((pooled_width_ - 1) * stride_, width_ + pad_);
+  }
   (*top)[0]->Reshape(bottom[0]->num(), channels_, pooled_length_, pooled_height_,
       pooled_width_);
+  (*top)[0]->set_layout(bottom[0]->layout());
+  CHECK(bottom[0]->layout() == NCLHW || !(bottom[0]->bfloat16_storage() ||
+      (*top)[0]->bfloat16_storage()))
+      << "bfloat16 Pooling3D requires NCLHW blobs.";
+  if (bottom[0]->layout() == NLHWC) {
+    CHECK_NE(this->layer_param_.pooling_param().pool(),
+             PoolingParameter_PoolMethod_STOCHASTIC)
+        << "Stochastic pooling does not support channels-last blobs.";
+  }
 
   // If stochastic pooling, we will initialize the random index part.
   if (this->layer_param_.pooling_param().pool() ==
@@ -64,197 +88,107 @@ void Pooling3DLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
     rand_idx_.Reshape(bottom[0]->num(), channels_, pooled_length_, pooled_height_,
       pooled_width_);
   }
+  // the MAX mask is allocated by the first Forward that needs it
+  max_idx_.Reshape(0, 0, 0, 0, 0);
+  use_max_idx_ = false;
 }
 
 template <typename Dtype>
 Dtype Pooling3DLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-	  const Dtype* bottom_data = bottom[0]->cpu_data();
-	  Dtype* top_data = (*top)[0]->mutable_cpu_data();
-	  // Different pooling methods. We explicitly do the switch outside the for
-	  // loop to save time, although this results in more codes.
-	  int top_count = (*top)[0]->count();
-	  switch (this->layer_param_.pooling_param().pool()) {
-	  case PoolingParameter_PoolMethod_MAX:
-	    // Initialize
-	    for (int i = 0; i < top_count; ++i) {
-	      top_data[i] = -FLT_MAX;
-	    }
-	    // The main loop
-	    for (int n = 0; n < bottom[0]->num(); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_;
-	              int wstart = pw * stride_;
-	              int lstart = pl * temporal_stride_;
-
-				  hstart = max(hstart, 0);
-	              wstart = max(wstart, 0);
-				  hstart = min(hstart, height_ - 1);
-				  wstart = min(wstart, width_ - 1);
-
-	              int hend = min(hstart + kernel_size_, height_);
-	              int wend = min(wstart + kernel_size_, width_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw] =
-	                      max(top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw],
-	                          bottom_data[(l * height_ + h) * width_ + w]);
-	                  }
-	                }
-	              }
-	            }
-	          }
-	    	}
-	        // compute offset
-	        bottom_data += bottom[0]->offset(0, 1);
-	        top_data += (*top)[0]->offset(0, 1);
-	      }
-	    }
-	    break;
-	  case PoolingParameter_PoolMethod_AVE:
-	    for (int i = 0; i < top_count; ++i) {
-	      top_data[i] = 0;
-	    }
-	    // The main loop
-	    for (int n = 0; n < bottom[0]->num(); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_ - pad_;
-	              int wstart = pw * stride_ - pad_;
-	              int lstart = pl * temporal_stride_;
-			      hstart = max(hstart, 0);
-	              wstart = max(wstart, 0);
-				  hstart = min(hstart, height_ - 1);
-				  wstart = min(wstart, width_ - 1);
-
-
-	              int hend = min(hstart + kernel_size_, height_ + pad_);
-	              int wend = min(wstart + kernel_size_, width_ + pad_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              int pool_size = (hend - hstart) * (wend - wstart) * (lend - lstart);
-	              	              hend = min(hend, height_);
-	              wend = min(wend, width_);
-	              lend = min(lend, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw] +=
-	                        bottom_data[(l * height_ + h) * width_ + w];
-	                  }
-	                }
-	              }
-	              top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw] /= pool_size;
-	            }
-	          }
-	    	}
-	        // compute offset
-	        bottom_data += bottom[0]->offset(0, 1);
-	        top_data += (*top)[0]->offset(0, 1);
-	      }
+	  use_max_idx_ = false;
+	  if (bottom[0]->layout() == NLHWC) {
+	    ForwardChannelsLast(bottom, top);
+	    return Dtype(0.);
+	  }
+	  // either blob may be stored as bfloat16 (see
+	  // NetParameter.bfloat16_storage)
+	  const bool bfloat16_bottom = bottom[0]->bfloat16_storage();
+	  const bool bfloat16_top = (*top)[0]->bfloat16_storage();
+	  if (bfloat16_bottom && bfloat16_top) {
+	    ForwardClips(bottom[0]->num(), bottom[0]->cpu_bfloat16_data(),
+	        (*top)[0]->mutable_cpu_bfloat16_data(), NULL);
+	  } else if (bfloat16_bottom) {
+	    ForwardClips(bottom[0]->num(), bottom[0]->cpu_bfloat16_data(),
+	        (*top)[0]->mutable_cpu_data(), NULL);
+	  } else if (bfloat16_top) {
+	    ForwardClips(bottom[0]->num(), bottom[0]->cpu_data(),
+	        (*top)[0]->mutable_cpu_bfloat16_data(), NULL);
+	  } else {
+	    // only a Backward reads the mask, so it is not kept at TEST
+	    use_max_idx_ = Caffe::phase() == Caffe::TRAIN &&
+	        this->layer_param_.pooling_param().pool() ==
+	        PoolingParameter_PoolMethod_MAX;
+	    if (use_max_idx_ && max_idx_.count() != (*top)[0]->count()) {
+	      max_idx_.Reshape((*top)[0]->num(), channels_, pooled_length_,
+	          pooled_height_, pooled_width_);
 	    }
-	    break;
-	  case PoolingParameter_PoolMethod_STOCHASTIC:
-	    NOT_IMPLEMENTED;
-	    break;
-	  default:
-	    LOG(FATAL) << "Unknown pooling method.";
+	    ForwardClips(bottom[0]->num(), bottom[0]->cpu_data(),
+	        (*top)[0]->mutable_cpu_data(),
+	        use_max_idx_ ? max_idx_.mutable_cpu_data() : NULL);
 	  }
 	  return Dtype(0.);
 
 }
 
+template <typename Dtype>
+template <typename Itype, typename Otype>
+void Pooling3DLayer<Dtype>::ForwardClips(const int num,
+      const Itype* bottom_data, Otype* top_data, int* mask) {
+  // the planes of all clips are pooled at once, split over the threads
+  switch (this->layer_param_.pooling_param().pool()) {
+  case PoolingParameter_PoolMethod_MAX:
+    pool3d_max_cpu<Dtype>(bottom_data, num * channels_, length_, height_,
+        width_, kernel_depth_, kernel_size_, temporal_stride_, stride_, pad_,
+        pooled_length_, pooled_height_, pooled_width_, top_data, mask);
+    break;
+  case PoolingParameter_PoolMethod_AVE:
+    pool3d_ave_cpu<Dtype>(bottom_data, num * channels_, length_, height_,
+        width_, kernel_depth_, kernel_size_, temporal_stride_, stride_, pad_,
+        pooled_length_, pooled_height_, pooled_width_, top_data);
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC:
+    NOT_IMPLEMENTED;
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
+}
+
 template <typename Dtype>
 void Pooling3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
 	  if (!propagate_down) {
 	    return;
 	  }
+	  CHECK(!top[0]->bfloat16_storage() && !(*bottom)[0]->bfloat16_storage())
+	      << "Pooling3D layers with bfloat16 blobs do not support Backward.";
+	  if (top[0]->layout() == NLHWC) {
+	    BackwardChannelsLast(top, bottom);
+	    return;
+	  }
 	  const Dtype* top_diff = top[0]->cpu_diff();
-	  const Dtype* top_data = top[0]->cpu_data();
-	  const Dtype* bottom_data = (*bottom)[0]->cpu_data();
 	  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-	  // Different pooling methods. We explicitly do the switch outside the for
-	  // loop to save time, although this results in more codes.
-	  memset(bottom_diff, 0, (*bottom)[0]->count() * sizeof(Dtype));
+	  const int planes = top[0]->num() * channels_;
 	  switch (this->layer_param_.pooling_param().pool()) {
 	  case PoolingParameter_PoolMethod_MAX:
-	    // The main loop
-	    for (int n = 0; n < top[0]->num(); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_;
-	              int wstart = pw * stride_;
-	              int lstart = pl * temporal_stride_;
-	              int hend = min(hstart + kernel_size_, height_);
-	              int wend = min(wstart + kernel_size_, width_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    bottom_diff[(l * height_ + h) * width_ + w] +=
-	                        top_diff[(pl * pooled_height_ + ph) * pooled_width_ + pw] *
-	                        (bottom_data[(l * height_ + h) * width_ + w] ==
-	                            top_data[(pl * pooled_height_ + ph) * pooled_width_ + pw]);
-	                  }
-	                }
-	              }
-	            }
-	          }
-	    	}
-	        // offset
-	        bottom_data += (*bottom)[0]->offset(0, 1);
-	        top_data += top[0]->offset(0, 1);
-	        bottom_diff += (*bottom)[0]->offset(0, 1);
-	        top_diff += top[0]->offset(0, 1);
-	      }
+	    if (use_max_idx_) {
+	      pool3d_max_backward_cpu(top_diff, max_idx_.cpu_data(), planes,
+	          length_, height_, width_, kernel_depth_, kernel_size_,
+	          temporal_stride_, stride_, pad_, pooled_length_, pooled_height_,
+	          pooled_width_, bottom_diff);
+	    } else {
+	      // without a mask (Forward at TEST), the windows are scanned again
+	      pool3d_max_rescan_backward_cpu((*bottom)[0]->cpu_data(),
+	          top[0]->cpu_data(), top_diff, planes, length_, height_, width_,
+	          kernel_depth_, kernel_size_, temporal_stride_, stride_, pad_,
+	          pooled_length_, pooled_height_, pooled_width_, bottom_diff);
 	    }
 	    break;
 	  case PoolingParameter_PoolMethod_AVE:
-	    // The main loop
-	    for (int n = 0; n < top[0]->num(); ++n) {
-	      for (int c = 0; c < channels_; ++c) {
-	    	for (int pl = 0; pl < pooled_length_; ++pl) {
-	          for (int ph = 0; ph < pooled_height_; ++ph) {
-	            for (int pw = 0; pw < pooled_width_; ++pw) {
-	              int hstart = ph * stride_ - pad_;
-	              int wstart = pw * stride_ - pad_;
-	              int lstart = pl * temporal_stride_;
-	              int hend = min(hstart + kernel_size_, height_ + pad_);
-	              int wend = min(wstart + kernel_size_, width_ + pad_);
-	              int lend = min(lstart + kernel_depth_, length_);
-	              int pool_size = (hend - hstart) * (wend - wstart) * (lend - lstart);
-	              hstart = max(hstart, 0);
-	              wstart = max(wstart, 0);
-	              hend = min(hend, height_);
-	              wend = min(wend, width_);
-	              lend = min(lend, length_);
-	              for (int l = lstart; l < lend; ++l) {
-	                for (int h = hstart; h < hend; ++h) {
-	                  for (int w = wstart; w < wend; ++w) {
-	                    bottom_diff[(l * height_ + h) * width_ + w] +=
-	                      top_diff[(pl * pooled_height_ + ph) * pooled_width_ + pw] / pool_size;
-	                  }
-	                }
-	              }
-	            }
-	          }
-	    	}
-	        // offset
-	        bottom_data += (*bottom)[0]->offset(0, 1);
-	        top_data += top[0]->offset(0, 1);
-	        bottom_diff += (*bottom)[0]->offset(0, 1);
-	        top_diff += top[0]->offset(0, 1);
-	      }
-	    }
+	    pool3d_ave_backward_cpu(top_diff, planes, length_, height_, width_,
+	        kernel_depth_, kernel_size_, temporal_stride_, stride_, pad_,
+	        pooled_length_, pooled_height_, pooled_width_, bottom_diff);
 	    break;
 	  case PoolingParameter_PoolMethod_STOCHASTIC:
 	    NOT_IMPLEMENTED;
@@ -266,6 +200,128 @@ void Pooling3DLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 }
 
 
+// The channels-last code visits the same windows as the NCLHW code of
+// pool3d.hpp, in the same order, so both layouts give identical results.
+template <typename Dtype>
+void Pooling3DLayer<Dtype>::ForwardChannelsLast(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  const bool max_pool = this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX;
+  for (int n = 0; n < bottom[0]->num(); ++n) {
+    for (int pl = 0; pl < pooled_length_; ++pl) {
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = min(max(ph * stride_ - pad_, 0), height_ - 1);
+          int wstart = min(max(pw * stride_ - pad_, 0), width_ - 1);
+          const int lstart = pl * temporal_stride_;
+          int hend = min(hstart + kernel_size_, height_ + pad_);
+          int wend = min(wstart + kernel_size_, width_ + pad_);
+          const int lend = min(lstart + kernel_depth_, length_);
+          const int pool_size =
+              (hend - hstart) * (wend - wstart) * (lend - lstart);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          if (max_pool) {
+            pool3d_max_window(ph, kernel_size_, stride_, pad_, height_,
+                &hstart, &hend);
+            pool3d_max_window(pw, kernel_size_, stride_, pad_, width_,
+                &wstart, &wend);
+          }
+          Dtype* out = top_data
+              + (*top)[0]->offset(n, 0, pl, ph, pw);
+          for (int c = 0; c < channels_; ++c) {
+            out[c] = max_pool ? -FLT_MAX : 0;
+          }
+          for (int l = lstart; l < lend; ++l) {
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                const Dtype* in = bottom_data
+                    + bottom[0]->offset(n, 0, l, h, w);
+                if (max_pool) {
+                  for (int c = 0; c < channels_; ++c) {
+                    out[c] = max(out[c], in[c]);
+                  }
+                } else {
+                  for (int c = 0; c < channels_; ++c) {
+                    out[c] += in[c];
+                  }
+                }
+              }
+            }
+          }
+          if (!max_pool) {
+            for (int c = 0; c < channels_; ++c) {
+              out[c] /= pool_size;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Pooling3DLayer<Dtype>::BackwardChannelsLast(
+      const vector<Blob<Dtype>*>& top, vector<Blob<Dtype>*>* bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* top_data = top[0]->cpu_data();
+  const Dtype* bottom_data = (*bottom)[0]->cpu_data();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  memset(bottom_diff, 0, (*bottom)[0]->count() * sizeof(Dtype));
+  const bool max_pool = this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX;
+  for (int n = 0; n < top[0]->num(); ++n) {
+    for (int pl = 0; pl < pooled_length_; ++pl) {
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_ - pad_;
+          int wstart = pw * stride_ - pad_;
+          const int lstart = pl * temporal_stride_;
+          int hend = min(hstart + kernel_size_, height_ + pad_);
+          int wend = min(wstart + kernel_size_, width_ + pad_);
+          const int lend = min(lstart + kernel_depth_, length_);
+          const int pool_size =
+              (hend - hstart) * (wend - wstart) * (lend - lstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          if (max_pool) {
+            pool3d_max_window(ph, kernel_size_, stride_, pad_, height_,
+                &hstart, &hend);
+            pool3d_max_window(pw, kernel_size_, stride_, pad_, width_,
+                &wstart, &wend);
+          }
+          const int top_offset = top[0]->offset(n, 0, pl, ph, pw);
+          for (int l = lstart; l < lend; ++l) {
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                const int bottom_offset = (*bottom)[0]->offset(n, 0, l, h, w);
+                Dtype* in_diff = bottom_diff + bottom_offset;
+                const Dtype* out_diff = top_diff + top_offset;
+                if (max_pool) {
+                  const Dtype* in = bottom_data + bottom_offset;
+                  const Dtype* out = top_data + top_offset;
+                  for (int c = 0; c < channels_; ++c) {
+                    in_diff[c] += out_diff[c] * (in[c] == out[c]);
+                  }
+                } else {
+                  for (int c = 0; c < channels_; ++c) {
+                    in_diff[c] += out_diff[c] / pool_size;
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+
 INSTANTIATE_CLASS(Pooling3DLayer);
 
 
@@ -10,14 +10,35 @@ using std::max;
 
 namespace caffe {
 
+// top = max(bottom, 0) for blobs stored as Dtype or as bfloat16 (see
+// NetParameter.bfloat16_storage)
+template <typename Dtype, typename Itype, typename Otype>
+static void relu_forward_cpu(const int count, const Itype* bottom_data,
+    Otype* top_data) {
+  for (int i = 0; i < count; ++i) {
+    storage_store(max(static_cast<Dtype>(storage_value(bottom_data[i])),
+        Dtype(0)), &top_data[i]);
+  }
+}
+
 template <typename Dtype>
 Dtype ReLULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = (*top)[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = max(bottom_data[i], Dtype(0));
+  const bool bfloat16_bottom = bottom[0]->bfloat16_storage();
+  const bool bfloat16_top = (*top)[0]->bfloat16_storage();
+  if (bfloat16_bottom && bfloat16_top) {
+    relu_forward_cpu<Dtype>(count, bottom[0]->cpu_bfloat16_data(),
+        (*top)[0]->mutable_cpu_bfloat16_data());
+  } else if (bfloat16_bottom) {
+    relu_forward_cpu<Dtype>(count, bottom[0]->cpu_bfloat16_data(),
+        (*top)[0]->mutable_cpu_data());
+  } else if (bfloat16_top) {
+    relu_forward_cpu<Dtype>(count, bottom[0]->cpu_data(),
+        (*top)[0]->mutable_cpu_bfloat16_data());
+  } else {
+    relu_forward_cpu<Dtype>(count, bottom[0]->cpu_data(),
+        (*top)[0]->mutable_cpu_data());
   }
   return Dtype(0);
 }
@@ -26,6 +47,8 @@ template <typename Dtype>
 void ReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const bool propagate_down,
     vector<Blob<Dtype>*>* bottom) {
+  CHECK(!top[0]->bfloat16_storage() && !(*bottom)[0]->bfloat16_storage())
+      << "ReLU layers with bfloat16 blobs do not support Backward.";
   if (propagate_down) {
     const Dtype* bottom_data = (*bottom)[0]->cpu_data();
     const Dtype* top_diff = top[0]->cpu_diff();
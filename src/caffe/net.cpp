@@ -1,5 +1,9 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
 #include <map>
 #include <set>
 #include <string>
@@ -9,8 +13,12 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/autotune.hpp"
+#include "caffe/util/bfloat16.hpp"
+#include "caffe/util/fuse_layers.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/insert_splits.hpp"
+#include "caffe/util/layout.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 using std::pair;
@@ -33,9 +41,49 @@ Net<Dtype>::Net(const string& param_file) {
 
 template <typename Dtype>
 void Net<Dtype>::Init(const NetParameter& in_param) {
-  // Create a copy of in_param with splits added where necessary.
+  // Create a copy of in_param with the fusions, layout conversions and
+  // splits added where necessary. Fused layers and channels-last blobs are
+  // only supported by the CPU code, and fused layers have no Backward.
+  NetParameter fused_param;
+  if (in_param.fuse_convolution3d() && Caffe::mode() == Caffe::CPU &&
+      Caffe::phase() == Caffe::TEST) {
+    FuseConvolution3D(in_param, &fused_param);
+  } else {
+    if (in_param.fuse_convolution3d()) {
+      LOG(INFO) << "fuse_convolution3d is ignored in GPU mode and in the "
+          << "TRAIN phase.";
+    }
+    fused_param.CopyFrom(in_param);
+  }
+  NetParameter layout_param;
+  if (in_param.channels_last() && Caffe::mode() == Caffe::CPU) {
+    InsertLayoutConversions(fused_param, &layout_param);
+  } else {
+    if (in_param.channels_last()) {
+      LOG(INFO) << "channels_last is ignored in GPU mode.";
+    }
+    layout_param.CopyFrom(fused_param);
+  }
   NetParameter param;
-  InsertSplits(in_param, &param);
+  InsertSplits(layout_param, &param);
+  // Blobs to store as bfloat16, which only the CPU Forward of some layers
+  // reads and writes.
+  set<string> bfloat16_blobs;
+  if (in_param.bfloat16_storage() && Caffe::mode() == Caffe::CPU &&
+      Caffe::phase() == Caffe::TEST && !in_param.channels_last()) {
+    SelectBfloat16Blobs(param, &bfloat16_blobs);
+  } else if (in_param.bfloat16_storage()) {
+    LOG(INFO) << "bfloat16_storage is ignored in GPU mode, in the TRAIN "
+        << "phase and with channels_last.";
+  }
+  size_t bfloat16_bytes_saved = 0;
+  // Times the CPU algorithms of the convolutions as they are set up.
+  shared_ptr<ConvolutionTuner<Dtype> > tuner;
+  if (in_param.autotune_convolution() && Caffe::mode() == Caffe::CPU) {
+    tuner.reset(new ConvolutionTuner<Dtype>(in_param.autotune_cache()));
+  } else if (in_param.autotune_convolution()) {
+    LOG(INFO) << "autotune_convolution is ignored in GPU mode.";
+  }
   // Basically, build all the layers and set up its connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
@@ -48,11 +96,11 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (int i = 0; i < param.input_size(); ++i) {
     const string& blob_name = param.input(i);
     shared_ptr<Blob<Dtype> > blob_pointer(
-        new Blob<Dtype>(param.input_dim(i * 4),
-                        param.input_dim(i * 4 + 1),
-                        param.input_dim(i * 4 + 2),
-                        param.input_dim(i * 4 + 3),
-                        param.input_dim(i * 4 + 4)));
+        new Blob<Dtype>(param.input_dim(i * 5),
+                        param.input_dim(i * 5 + 1),
+                        param.input_dim(i * 5 + 2),
+                        param.input_dim(i * 5 + 3),
+                        param.input_dim(i * 5 + 4)));
     blobs_.push_back(blob_pointer);
     blob_names_.push_back(blob_name);
     blob_need_backward_.push_back(param.force_backward());
@@ -111,6 +159,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
         // Normal output.
         LOG(INFO) << layer_param.name() << " -> " << blob_name;
         shared_ptr<Blob<Dtype> > blob_pointer(new Blob<Dtype>());
+        blob_pointer->set_bfloat16_storage(bfloat16_blobs.count(blob_name));
         blobs_.push_back(blob_pointer);
         blob_names_.push_back(blob_name);
         blob_need_backward_.push_back(param.force_backward());
@@ -120,7 +169,13 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
         top_id_vecs_[i].push_back(blob_names_.size() - 1);
       }
     }
-    // After this layer is connected, set it up.
+    // After this layer is connected, set it up, with the fastest algorithm
+    // for the shape of its bottom if it is tuned.
+    LayerParameter tuned_param;
+    if (tuner && tuner->Tune(layer_param, bottom_vecs_[i], top_vecs_[i],
+        &tuned_param)) {
+      layers_[i].reset(GetLayer<Dtype>(tuned_param));
+    }
     // LOG(INFO) << "Setting up " << layer_names_[i];
     layers_[i]->SetUp(bottom_vecs_[i], &top_vecs_[i]);
     for (int topid = 0; topid < top_vecs_[i].size(); ++topid) {
@@ -129,9 +184,15 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
           << top_vecs_[i][topid]->length() << " "
           << top_vecs_[i][topid]->height() << " "
           << top_vecs_[i][topid]->width() << " ("
-          << top_vecs_[i][topid]->count() << ")";
+          << top_vecs_[i][topid]->count() << ")"
+          << (top_vecs_[i][topid]->layout() == NLHWC ? " NLHWC" : "")
+          << (top_vecs_[i][topid]->bfloat16_storage() ? " bfloat16" : "");
       if (!in_place)
         memory_used += top_vecs_[i][topid]->count();
+      if (!in_place && top_vecs_[i][topid]->bfloat16_storage()) {
+        bfloat16_bytes_saved += top_vecs_[i][topid]->count() *
+            (sizeof(Dtype) - sizeof(bfloat16));
+      }
     }
     DLOG(INFO) << "Memory  required for Data " << memory_used*sizeof(Dtype);
     int blobs_lr_size = layers_[i]->layer_param().blobs_lr_size();
@@ -172,12 +233,739 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (size_t i = 0; i < layer_names_.size(); ++i) {
     layer_names_index_[layer_names_[i]] = i;
   }
+  if (tuner) {
+    tuner->Save();
+  }
   GetLearningRateAndWeightDecay();
+  CacheColumns(param.column_cache_limit());
+  ShareWorkspace();
+  if (in_param.plan_memory() && Caffe::mode() == Caffe::CPU &&
+      Caffe::phase() == Caffe::TEST) {
+    PlanMemory(set<string>(in_param.keep_blob().begin(),
+        in_param.keep_blob().end()));
+  } else if (in_param.plan_memory()) {
+    LOG(INFO) << "plan_memory is ignored in GPU mode and in the TRAIN phase.";
+  }
+  if (in_param.gradient_checkpointing() && Caffe::mode() == Caffe::CPU &&
+      Caffe::phase() == Caffe::TRAIN) {
+    SetUpCheckpoints(in_param);
+  } else if (in_param.gradient_checkpointing()) {
+    LOG(INFO) << "gradient_checkpointing is ignored in GPU mode and in the "
+        << "TEST phase.";
+  }
+  if (in_param.parallel_branches() && Caffe::mode() == Caffe::CPU &&
+      checkpoint_begin_.empty()) {
+    SetUpBranches(in_param);
+  } else if (in_param.parallel_branches()) {
+    LOG(INFO) << "parallel_branches is ignored in GPU mode and with "
+        << "gradient_checkpointing.";
+  }
+  if (!bfloat16_blobs.empty()) {
+    LOG(INFO) << "Storing " << bfloat16_blobs.size() << " blobs as bfloat16, "
+        << "saving " << bfloat16_bytes_saved << " bytes";
+  }
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for Data " << memory_used*sizeof(Dtype);
 }
 
 
+template <typename Dtype>
+void Net<Dtype>::CacheColumns(const size_t limit) {
+  // Layers with cache_columns set in their own parameters always cache, the
+  // others in order of the net while their columns fit in the limit.
+  size_t cached_size = 0;
+  int cached_layers = 0;
+  for (int i = 0; i < layers_.size(); ++i) {
+    const size_t size = layers_[i]->column_cache_size();
+    if (size == 0) {
+      continue;
+    }
+    if (!layer_need_backward_[i]) {
+      layers_[i]->set_cache_columns(false);
+      continue;
+    }
+    if (!layers_[i]->cache_columns() && cached_size + size <= limit) {
+      layers_[i]->set_cache_columns(true);
+    }
+    if (layers_[i]->cache_columns()) {
+      LOG(INFO) << layer_names_[i] << " caches its forward columns ("
+          << size << " bytes)";
+      cached_size += size;
+      ++cached_layers;
+    }
+  }
+  if (cached_layers > 0) {
+    LOG(INFO) << "Column cache: " << cached_layers << " layers, "
+        << cached_size << " bytes (column_cache_limit " << limit << ")";
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareWorkspace() {
+  // The layers run one at a time, so a single workspace as large as the
+  // largest request replaces the scratch buffers of the individual layers.
+  workspace_.reset(new Workspace());
+  size_t total_size = 0;
+  size_t max_size = 0;
+  for (int i = 0; i < layers_.size(); ++i) {
+    layers_[i]->set_workspace(workspace_);
+    const size_t size = layers_[i]->workspace_size();
+    total_size += size;
+    max_size = std::max(max_size, size);
+  }
+  workspace_->Reserve(max_size);
+  if (total_size > 0) {
+    LOG(INFO) << "Layer workspaces share " << max_size << " bytes instead of "
+        << total_size << " (saving " << total_size - max_size << " bytes)";
+  }
+}
+
+// Root of the group of blob i, see Net::GroupSharedBlobs.
+static int FindBlobGroup(vector<int>* parent, int i) {
+  while ((*parent)[i] != i) {
+    (*parent)[i] = (*parent)[(*parent)[i]];
+    i = (*parent)[i];
+  }
+  return i;
+}
+
+template <typename Dtype>
+void Net<Dtype>::GroupSharedBlobs(vector<int>* blob_group) {
+  // Blobs sharing their data are in one group, including the tops and the
+  // bottom of a SPLIT or a FLATTEN, which share their data in Forward.
+  const int num_blobs = blobs_.size();
+  vector<int> parent(num_blobs);
+  map<const SyncedMemory*, int> memory_blob;
+  for (int i = 0; i < num_blobs; ++i) {
+    parent[i] = i;
+    if (blobs_[i]->count() == 0) {
+      continue;
+    }
+    const SyncedMemory* memory = blobs_[i]->data().get();
+    if (memory_blob.count(memory)) {
+      parent[FindBlobGroup(&parent, i)] =
+          FindBlobGroup(&parent, memory_blob[memory]);
+    } else {
+      memory_blob[memory] = i;
+    }
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    const LayerParameter_LayerType type = layers_[i]->layer_param().type();
+    if (type != LayerParameter_LayerType_SPLIT &&
+        type != LayerParameter_LayerType_FLATTEN) {
+      continue;
+    }
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      parent[FindBlobGroup(&parent, top_id_vecs_[i][j])] =
+          FindBlobGroup(&parent, bottom_id_vecs_[i][0]);
+    }
+  }
+  blob_group->resize(num_blobs);
+  for (int i = 0; i < num_blobs; ++i) {
+    (*blob_group)[i] = FindBlobGroup(&parent, i);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemory(const set<string>& keep_blobs) {
+  // Blobs sharing their data are planned as one group.
+  const int num_blobs = blobs_.size();
+  vector<int> blob_group;
+  GroupSharedBlobs(&blob_group);
+  // The lifetime of a group runs from the first layer writing one of its
+  // blobs to the last layer reading or writing one. The inputs, the outputs,
+  // keep_blobs and the tops of MEMORY_DATA, which point to memory of the
+  // layer, are not planned.
+  vector<int> first(num_blobs, layers_.size());
+  vector<int> last(num_blobs, -1);
+  vector<bool> fixed(num_blobs, false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    fixed[blob_group[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    fixed[blob_group[net_output_blob_indices_[i]]] = true;
+  }
+  for (set<string>::const_iterator it = keep_blobs.begin();
+      it != keep_blobs.end(); ++it) {
+    CHECK(has_blob(*it)) << "Unknown keep_blob " << *it;
+    fixed[blob_group[blob_names_index_[*it]]] = true;
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    const bool memory_data = layers_[i]->layer_param().type() ==
+        LayerParameter_LayerType_MEMORY_DATA;
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      const int group = blob_group[top_id_vecs_[i][j]];
+      first[group] = std::min(first[group], i);
+      last[group] = std::max(last[group], i);
+      fixed[group] = fixed[group] || memory_data;
+    }
+    for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+      const int group = blob_group[bottom_id_vecs_[i][j]];
+      last[group] = std::max(last[group], i);
+    }
+  }
+  // Memories and size in bytes of each group.
+  map<int, vector<SyncedMemory*> > group_memories;
+  vector<size_t> group_size(num_blobs, 0);
+  for (int i = 0; i < num_blobs; ++i) {
+    if (blobs_[i]->count() == 0) {
+      continue;
+    }
+    SyncedMemory* memory = blobs_[i]->data().get();
+    vector<SyncedMemory*>& memories = group_memories[blob_group[i]];
+    if (std::find(memories.begin(), memories.end(), memory) ==
+        memories.end()) {
+      memories.push_back(memory);
+    }
+    group_size[blob_group[i]] = std::max(group_size[blob_group[i]],
+        memory->size());
+  }
+  // In the order the groups are written, give each the smallest free buffer
+  // large enough for it, else grow the largest free buffer, else add one. A
+  // buffer is free once the last layer using its current group has run.
+  vector<pair<int, int> > order;
+  size_t naive_size = 0;
+  size_t fixed_size = 0;
+  for (map<int, vector<SyncedMemory*> >::iterator it = group_memories.begin();
+      it != group_memories.end(); ++it) {
+    if (fixed[it->first]) {
+      fixed_size += group_size[it->first];
+    } else {
+      order.push_back(std::make_pair(first[it->first], it->first));
+      naive_size += group_size[it->first];
+    }
+  }
+  std::sort(order.begin(), order.end());
+  vector<size_t> buffer_size;
+  vector<int> buffer_busy_until;
+  vector<int> group_buffer(num_blobs, -1);
+  for (int i = 0; i < order.size(); ++i) {
+    const int group = order[i].second;
+    const size_t size = group_size[group];
+    int best = -1;
+    int largest = -1;
+    for (int b = 0; b < buffer_size.size(); ++b) {
+      if (buffer_busy_until[b] >= first[group]) {
+        continue;
+      }
+      if (buffer_size[b] >= size &&
+          (best < 0 || buffer_size[b] < buffer_size[best])) {
+        best = b;
+      }
+      if (largest < 0 || buffer_size[b] > buffer_size[largest]) {
+        largest = b;
+      }
+    }
+    if (best < 0 && largest >= 0) {
+      best = largest;
+      buffer_size[best] = size;
+    }
+    if (best < 0) {
+      best = buffer_size.size();
+      buffer_size.push_back(size);
+      buffer_busy_until.push_back(-1);
+    }
+    buffer_busy_until[best] = last[group];
+    group_buffer[group] = best;
+  }
+  activation_buffers_.clear();
+  size_t planned_size = 0;
+  for (int b = 0; b < buffer_size.size(); ++b) {
+    activation_buffers_.push_back(shared_ptr<SyncedMemory>(
+        new SyncedMemory(buffer_size[b])));
+    planned_size += buffer_size[b];
+  }
+  for (int i = 0; i < order.size(); ++i) {
+    const int group = order[i].second;
+    void* buffer = activation_buffers_[group_buffer[group]]->mutable_cpu_data();
+    const vector<SyncedMemory*>& memories = group_memories[group];
+    for (int j = 0; j < memories.size(); ++j) {
+      memories[j]->set_cpu_data(buffer);
+    }
+  }
+  LOG(INFO) << "Memory plan: " << order.size() << " blob groups share "
+      << buffer_size.size() << " buffers of " << planned_size
+      << " bytes instead of " << naive_size << " (saving "
+      << naive_size - planned_size << " bytes); " << fixed_size
+      << " bytes of inputs, outputs and kept blobs are not planned";
+}
+
+// Rough number of floating point operations of the Forward of a layer: a
+// multiply and an add per weight and output position (input position for
+// DECONVOLUTION3D) for the layers with weights, one per top element for the
+// others.
+template <typename Dtype>
+static double EstimateForwardFlops(Layer<Dtype>* layer,
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  double flops = 0;
+  if (layer->blobs().size() > 0 && !top.empty()) {
+    const Blob<Dtype>* positions = (layer->layer_param().type() ==
+        LayerParameter_LayerType_DECONVOLUTION3D) ? bottom[0] : top[0];
+    flops = 2. * layer->blobs()[0]->count() * positions->count() /
+        positions->channels();
+  } else {
+    for (int i = 0; i < top.size(); ++i) {
+      flops += top[i]->count();
+    }
+  }
+  return flops;
+}
+
+template <typename Dtype>
+void Net<Dtype>::SetUpCheckpoints(const NetParameter& param) {
+  const int num_layers = layers_.size();
+  const int num_blobs = blobs_.size();
+  vector<int> blob_group;
+  GroupSharedBlobs(&blob_group);
+  // A segment may only end after layer i if no group written up to layer i
+  // is written again later, so that the inputs of a segment still hold the
+  // same data when it is recomputed.
+  vector<int> last_writer(num_blobs, -1);
+  for (int i = 0; i < num_layers; ++i) {
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      last_writer[blob_group[top_id_vecs_[i][j]]] = i;
+    }
+  }
+  vector<bool> can_end(num_layers);
+  int written_until = -1;
+  for (int i = 0; i < num_layers; ++i) {
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      written_until = std::max(written_until,
+          last_writer[blob_group[top_id_vecs_[i][j]]]);
+    }
+    can_end[i] = written_until <= i;
+  }
+  checkpoint_begin_.assign(1, 0);
+  if (param.checkpoint_blob_size() > 0) {
+    set<int> ends;
+    for (int i = 0; i < param.checkpoint_blob_size(); ++i) {
+      const string& blob_name = param.checkpoint_blob(i);
+      CHECK(has_blob(blob_name)) << "Unknown checkpoint_blob " << blob_name;
+      int end = last_writer[blob_group[blob_names_index_[blob_name]]];
+      while (end >= 0 && end < num_layers - 1 && !can_end[end]) {
+        ++end;
+      }
+      if (end >= 0 && end < num_layers - 1) {
+        ends.insert(end + 1);
+      }
+    }
+    checkpoint_begin_.insert(checkpoint_begin_.end(), ends.begin(),
+        ends.end());
+  } else {
+    const int length = std::max(1, static_cast<int>(
+        std::ceil(std::sqrt(static_cast<double>(num_layers)))));
+    for (int i = 0; i < num_layers - 1; ++i) {
+      if (can_end[i] && i + 1 - checkpoint_begin_.back() >= length) {
+        checkpoint_begin_.push_back(i + 1);
+      }
+    }
+  }
+  checkpoint_begin_.push_back(num_layers);
+  const int num_segments = checkpoint_begin_.size() - 1;
+  // A group is kept if it is used in more than one segment, if it is an
+  // input or an output of the net, or if it is written by a layer without
+  // bottoms (the data layers, which must not run again).
+  vector<int> group_segment(num_blobs, -1);
+  vector<bool> kept(num_blobs, false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    kept[blob_group[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    kept[blob_group[net_output_blob_indices_[i]]] = true;
+  }
+  for (int s = 0; s < num_segments; ++s) {
+    for (int i = checkpoint_begin_[s]; i < checkpoint_begin_[s + 1]; ++i) {
+      const vector<int>* ids[2] = {&bottom_id_vecs_[i], &top_id_vecs_[i]};
+      for (int k = 0; k < 2; ++k) {
+        for (int j = 0; j < ids[k]->size(); ++j) {
+          const int group = blob_group[(*ids[k])[j]];
+          if (group_segment[group] >= 0 && group_segment[group] != s) {
+            kept[group] = true;
+          }
+          group_segment[group] = s;
+          kept[group] = kept[group] || bottom_id_vecs_[i].empty();
+        }
+      }
+    }
+  }
+  // A segment recomputes the layers writing a group it does not keep. The
+  // kept bottoms of these layers must not be written again after them, and
+  // their kept tops not by a layer that is not recomputed; else the segment
+  // keeps all its groups. The last segment is still in memory when its
+  // Backward runs, and the segments without Backward are not recomputed.
+  checkpoint_recompute_.assign(num_segments, vector<int>());
+  layer_recomputed_.assign(num_layers, false);
+  checkpoint_rng_.resize(num_layers);
+  for (int s = 0; s < num_segments; ++s) {
+    const int begin = checkpoint_begin_[s];
+    const int end = checkpoint_begin_[s + 1];
+    for (int i = begin; i < end; ++i) {
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        if (!kept[blob_group[top_id_vecs_[i][j]]]) {
+          layer_recomputed_[i] = true;
+        }
+      }
+    }
+    bool valid = true;
+    for (int i = begin; i < end && valid; ++i) {
+      if (!layer_recomputed_[i]) {
+        continue;
+      }
+      for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+        const int group = blob_group[bottom_id_vecs_[i][j]];
+        valid = valid && !(kept[group] && last_writer[group] >= i);
+      }
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        const int group = blob_group[top_id_vecs_[i][j]];
+        for (int m = i + 1; m < end && kept[group]; ++m) {
+          for (int k = 0; k < top_id_vecs_[m].size(); ++k) {
+            valid = valid && (layer_recomputed_[m] ||
+                blob_group[top_id_vecs_[m][k]] != group);
+          }
+        }
+      }
+    }
+    bool need_backward = false;
+    for (int i = begin; i < end; ++i) {
+      need_backward = need_backward || layer_need_backward_[i];
+    }
+    for (int i = begin; i < end; ++i) {
+      if (!valid) {
+        for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+          kept[blob_group[bottom_id_vecs_[i][j]]] = true;
+        }
+        for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+          kept[blob_group[top_id_vecs_[i][j]]] = true;
+        }
+      }
+      if (!valid || s == num_segments - 1 || !need_backward) {
+        layer_recomputed_[i] = false;
+      }
+      if (layer_recomputed_[i]) {
+        checkpoint_recompute_[s].push_back(i);
+      }
+    }
+    if (!valid) {
+      LOG(INFO) << "Segment " << layer_names_[begin] << " to "
+          << layer_names_[end - 1] << " keeps all its blobs: a layer writes "
+          << "a blob in place after a layer to recompute used it";
+    }
+  }
+  // The groups that are not kept are placed in one buffer, from its start
+  // for every segment: the data of each group, and every distinct diff.
+  vector<size_t> group_data_size(num_blobs, 0);
+  for (int i = 0; i < num_blobs; ++i) {
+    if (blobs_[i]->count() > 0) {
+      group_data_size[blob_group[i]] = std::max(group_data_size[blob_group[i]],
+          blobs_[i]->data()->size());
+    }
+  }
+  vector<pair<SyncedMemory*, size_t> > placements;
+  size_t buffer_size = 0;
+  size_t naive_size = 0;
+  for (int s = 0; s < num_segments; ++s) {
+    map<int, size_t> group_offset;
+    set<SyncedMemory*> placed;
+    size_t offset = 0;
+    for (int i = checkpoint_begin_[s]; i < checkpoint_begin_[s + 1]; ++i) {
+      const vector<int>* ids[2] = {&bottom_id_vecs_[i], &top_id_vecs_[i]};
+      for (int k = 0; k < 2; ++k) {
+        for (int j = 0; j < ids[k]->size(); ++j) {
+          const Blob<Dtype>* blob = blobs_[(*ids[k])[j]].get();
+          const int group = blob_group[(*ids[k])[j]];
+          if (kept[group] || blob->count() == 0) {
+            continue;
+          }
+          if (!group_offset.count(group)) {
+            group_offset[group] = offset;
+            offset += (group_data_size[group] + 63) / 64 * 64;
+            naive_size += group_data_size[group];
+          }
+          if (placed.insert(blob->data().get()).second) {
+            placements.push_back(std::make_pair(blob->data().get(),
+                group_offset[group]));
+          }
+          if (placed.insert(blob->diff().get()).second) {
+            placements.push_back(std::make_pair(blob->diff().get(), offset));
+            offset += (blob->diff()->size() + 63) / 64 * 64;
+            naive_size += blob->diff()->size();
+          }
+        }
+      }
+    }
+    buffer_size = std::max(buffer_size, offset);
+  }
+  if (buffer_size > 0) {
+    checkpoint_buffer_.reset(new SyncedMemory(buffer_size));
+    char* buffer = static_cast<char*>(checkpoint_buffer_->mutable_cpu_data());
+    for (int i = 0; i < placements.size(); ++i) {
+      placements[i].first->set_cpu_data(buffer + placements[i].second);
+    }
+  }
+  // Report the memory saved against the extra Forward computation.
+  double forward_flops = 0;
+  double recompute_flops = 0;
+  int recomputed_layers = 0;
+  for (int s = 0; s < num_segments; ++s) {
+    double segment_flops = 0;
+    for (int i = checkpoint_begin_[s]; i < checkpoint_begin_[s + 1]; ++i) {
+      const double flops = EstimateForwardFlops(layers_[i].get(),
+          bottom_vecs_[i], top_vecs_[i]);
+      forward_flops += flops;
+      if (layer_recomputed_[i]) {
+        segment_flops += flops;
+      }
+    }
+    LOG(INFO) << "Checkpoint segment " << s << ": "
+        << layer_names_[checkpoint_begin_[s]] << " to "
+        << layer_names_[checkpoint_begin_[s + 1] - 1] << ", recomputes "
+        << checkpoint_recompute_[s].size() << " layers ("
+        << segment_flops / 1e6 << " MFLOP)";
+    recompute_flops += segment_flops;
+    recomputed_layers += checkpoint_recompute_[s].size();
+  }
+  LOG(INFO) << "Gradient checkpointing: the blobs not kept by the "
+      << num_segments << " segments share " << buffer_size
+      << " bytes instead of " << naive_size << " (saving "
+      << static_cast<int64_t>(naive_size) - static_cast<int64_t>(buffer_size)
+      << " bytes); recomputing " << recomputed_layers << " layers costs about "
+      << recompute_flops / 1e6 << " MFLOP per iteration, "
+      << 100 * recompute_flops / std::max(3 * forward_flops, 1.)
+      << "% of the about " << 3 * forward_flops / 1e6
+      << " MFLOP of Forward and Backward";
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeSegment(const int segment) {
+  const vector<int>& layers = checkpoint_recompute_[segment];
+  if (layers.empty()) {
+    return;
+  }
+  // the layers draw the same random numbers, e.g. DROPOUT masks, as in
+  // Forward
+  const rng_t rng = *caffe_rng();
+  for (int i = 0; i < layers.size(); ++i) {
+    *caffe_rng() = checkpoint_rng_[layers[i]];
+    layers_[layers[i]]->Forward(bottom_vecs_[layers[i]],
+        &top_vecs_[layers[i]]);
+  }
+  *caffe_rng() = rng;
+}
+
+// Adds to predecessors the earlier tasks that task has to wait for: the last
+// writer of every resource it reads or writes, and the readers since then of
+// every resource it writes.
+static void AddHazards(const int task, const vector<int>& reads,
+    const vector<int>& writes, vector<int>* last_writer,
+    vector<vector<int> >* readers, vector<int>* predecessors) {
+  for (int i = 0; i < reads.size(); ++i) {
+    if ((*last_writer)[reads[i]] >= 0) {
+      predecessors->push_back((*last_writer)[reads[i]]);
+    }
+    (*readers)[reads[i]].push_back(task);
+  }
+  for (int i = 0; i < writes.size(); ++i) {
+    vector<int>& resource_readers = (*readers)[writes[i]];
+    if ((*last_writer)[writes[i]] >= 0) {
+      predecessors->push_back((*last_writer)[writes[i]]);
+    }
+    predecessors->insert(predecessors->end(), resource_readers.begin(),
+        resource_readers.end());
+    resource_readers.clear();
+    (*last_writer)[writes[i]] = task;
+  }
+  std::sort(predecessors->begin(), predecessors->end());
+  predecessors->erase(std::unique(predecessors->begin(), predecessors->end()),
+      predecessors->end());
+  predecessors->erase(std::remove(predecessors->begin(), predecessors->end(),
+      task), predecessors->end());
+}
+
+// Sets ancestors[i][j] if task j has to finish before task i starts.
+static void FindAncestors(const vector<vector<int> >& predecessors,
+    vector<vector<bool> >* ancestors) {
+  ancestors->assign(predecessors.size(),
+      vector<bool>(predecessors.size(), false));
+  for (int i = 0; i < predecessors.size(); ++i) {
+    for (int j = 0; j < predecessors[i].size(); ++j) {
+      const int p = predecessors[i][j];
+      (*ancestors)[i][p] = true;
+      for (int k = 0; k < p; ++k) {
+        if ((*ancestors)[p][k]) {
+          (*ancestors)[i][k] = true;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::SetUpBranches(const NetParameter& param) {
+  // The resources the layers read and write: the data of the blobs sharing
+  // their memory (GroupSharedBlobs, and the buffers of PlanMemory), the diff
+  // of a blob, shared by the bottom and the first top of a SPLIT or a
+  // FLATTEN in Backward, and the random number generator.
+  const int num_layers = layers_.size();
+  const int num_blobs = blobs_.size();
+  vector<int> data_resource;
+  GroupSharedBlobs(&data_resource);
+  map<const void*, int> buffer_blob;
+  for (int i = 0; i < num_blobs; ++i) {
+    if (blobs_[i]->count() == 0 ||
+        blobs_[i]->data()->head() != SyncedMemory::HEAD_AT_CPU) {
+      continue;
+    }
+    const void* buffer = blobs_[i]->data()->cpu_data();
+    if (buffer_blob.count(buffer)) {
+      data_resource[FindBlobGroup(&data_resource, i)] =
+          FindBlobGroup(&data_resource, buffer_blob[buffer]);
+    } else {
+      buffer_blob[buffer] = i;
+    }
+  }
+  vector<int> diff_resource(num_blobs);
+  for (int i = 0; i < num_blobs; ++i) {
+    diff_resource[i] = i;
+  }
+  for (int i = 0; i < num_layers; ++i) {
+    const LayerParameter_LayerType type = layers_[i]->layer_param().type();
+    if (type == LayerParameter_LayerType_SPLIT ||
+        type == LayerParameter_LayerType_FLATTEN) {
+      diff_resource[FindBlobGroup(&diff_resource, top_id_vecs_[i][0])] =
+          FindBlobGroup(&diff_resource, bottom_id_vecs_[i][0]);
+    }
+  }
+  for (int i = 0; i < num_blobs; ++i) {
+    data_resource[i] = FindBlobGroup(&data_resource, i);
+    diff_resource[i] = num_blobs + FindBlobGroup(&diff_resource, i);
+  }
+  const int rng_resource = 2 * num_blobs;
+  // In Forward, a layer reads the data of its bottoms and writes the data of
+  // its tops; DROPOUT and the data layers draw random numbers.
+  vector<vector<int> > forward_predecessors(num_layers);
+  vector<int> last_writer(2 * num_blobs + 1, -1);
+  vector<vector<int> > readers(2 * num_blobs + 1);
+  for (int i = 0; i < num_layers; ++i) {
+    vector<int> reads, writes;
+    for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+      reads.push_back(data_resource[bottom_id_vecs_[i][j]]);
+    }
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      writes.push_back(data_resource[top_id_vecs_[i][j]]);
+    }
+    if (bottom_id_vecs_[i].empty() || layers_[i]->layer_param().type() ==
+        LayerParameter_LayerType_DROPOUT) {
+      writes.push_back(rng_resource);
+    }
+    AddHazards(i, reads, writes, &last_writer, &readers,
+        &forward_predecessors[i]);
+  }
+  // In Backward, which runs the layers from the last, a layer reads the diff
+  // of its tops and writes the diff of its bottoms; the data is only read.
+  vector<vector<int> > backward_predecessors(num_layers);
+  last_writer.assign(2 * num_blobs + 1, -1);
+  readers.assign(2 * num_blobs + 1, vector<int>());
+  for (int p = 0; p < num_layers; ++p) {
+    const int i = num_layers - 1 - p;
+    if (!layer_need_backward_[i]) {
+      continue;
+    }
+    vector<int> reads, writes;
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      reads.push_back(diff_resource[top_id_vecs_[i][j]]);
+    }
+    for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+      writes.push_back(diff_resource[bottom_id_vecs_[i][j]]);
+    }
+    AddHazards(p, reads, writes, &last_writer, &readers,
+        &backward_predecessors[p]);
+  }
+  // The width of the net is the largest number of layers at the same depth
+  // of the Forward graph.
+  vector<int> depth(num_layers, 0);
+  vector<int> depth_layers(num_layers, 0);
+  int width = 0;
+  for (int i = 0; i < num_layers; ++i) {
+    for (int j = 0; j < forward_predecessors[i].size(); ++j) {
+      depth[i] = std::max(depth[i], depth[forward_predecessors[i][j]] + 1);
+    }
+    width = std::max(width, ++depth_layers[depth[i]]);
+  }
+  const int threads = param.branch_threads() > 0 ? param.branch_threads() :
+      width;
+  if (width < 2 || threads < 2) {
+    LOG(INFO) << "Parallel branches: " << (width < 2 ?
+        "the net has no layers that can run concurrently" :
+        "branch_threads is 1") << ", running the layers in order.";
+    return;
+  }
+  // Layers that may run at the same time, in Forward or in Backward, get
+  // different workspaces; workspace_ is the first one.
+  vector<vector<bool> > forward_ancestors, backward_ancestors;
+  FindAncestors(forward_predecessors, &forward_ancestors);
+  FindAncestors(backward_predecessors, &backward_ancestors);
+  vector<int> layer_workspace(num_layers, -1);
+  vector<size_t> workspace_size;
+  for (int i = 0; i < num_layers; ++i) {
+    const size_t size = layers_[i]->workspace_size();
+    if (size == 0) {
+      continue;
+    }
+    vector<bool> taken(workspace_size.size(), false);
+    for (int j = 0; j < i; ++j) {
+      if (layer_workspace[j] < 0) {
+        continue;
+      }
+      const bool forward = !forward_ancestors[i][j];
+      const bool backward = layer_need_backward_[i] &&
+          layer_need_backward_[j] && !backward_ancestors[num_layers - 1 - j][
+          num_layers - 1 - i];
+      if (forward || backward) {
+        taken[layer_workspace[j]] = true;
+      }
+    }
+    layer_workspace[i] = std::find(taken.begin(), taken.end(), false) -
+        taken.begin();
+    if (layer_workspace[i] == workspace_size.size()) {
+      workspace_size.push_back(0);
+    }
+    workspace_size[layer_workspace[i]] =
+        std::max(workspace_size[layer_workspace[i]], size);
+  }
+  branch_workspaces_.clear();
+  size_t branch_workspace_size = 0;
+  for (int w = 1; w < workspace_size.size(); ++w) {
+    branch_workspaces_.push_back(shared_ptr<Workspace>(new Workspace()));
+    branch_workspaces_.back()->Reserve(workspace_size[w]);
+    branch_workspace_size += workspace_size[w];
+  }
+  for (int i = 0; i < num_layers; ++i) {
+    if (layer_workspace[i] > 0) {
+      layers_[i]->set_workspace(branch_workspaces_[layer_workspace[i] - 1]);
+    }
+  }
+  forward_executor_.reset(new DagExecutor(forward_predecessors, threads));
+  backward_executor_.reset(new DagExecutor(backward_predecessors, threads));
+  layer_loss_.resize(num_layers);
+  LOG(INFO) << "Parallel branches: up to " << width << " layers can run "
+      << "concurrently, on " << threads << " threads; "
+      << branch_workspaces_.size() << " extra workspaces of "
+      << branch_workspace_size << " bytes in total";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ForwardLayer(const int i) {
+  layer_loss_[i] = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardLayer(const int i) {
+  const int layer = layers_.size() - 1 - i;
+  if (layer_need_backward_[layer]) {
+    layers_[layer]->Backward(top_vecs_[layer], true, &bottom_vecs_[layer]);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::GetLearningRateAndWeightDecay() {
   LOG(INFO) << "Collecting Learning Rate and Weight Decay.";
@@ -221,8 +1009,22 @@ const vector<Blob<Dtype>*>& Net<Dtype>::ForwardPrefilled(Dtype* loss) {
   if (loss != NULL) {
     *loss = Dtype(0.);
   }
+  if (forward_executor_) {
+    // the layers running on the workers of the executor take the thread
+    // pool of their node, which has to exist already
+    Caffe::thread_pool();
+    forward_executor_->Run(boost::bind(&Net<Dtype>::ForwardLayer, this, _1));
+    // in order, for the same rounding as a serial Forward
+    for (int i = 0; i < layers_.size() && loss != NULL; ++i) {
+      *loss += layer_loss_[i];
+    }
+    return net_output_blobs_;
+  }
   for (int i = 0; i < layers_.size(); ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
+    if (!layer_recomputed_.empty() && layer_recomputed_[i]) {
+      checkpoint_rng_[i] = *caffe_rng();
+    }
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
     if (loss != NULL) {
       *loss += layer_loss;
@@ -266,7 +1068,19 @@ string Net<Dtype>::Forward(const string& input_blob_protos, Dtype* loss) {
 
 template <typename Dtype>
 void Net<Dtype>::Backward() {
+  if (backward_executor_) {
+    Caffe::thread_pool();
+    backward_executor_->Run(boost::bind(&Net<Dtype>::BackwardLayer, this,
+        _1));
+    return;
+  }
+  // With gradient checkpointing, the blobs a segment does not keep are
+  // recomputed before its Backward.
+  int segment = static_cast<int>(checkpoint_recompute_.size()) - 1;
   for (int i = layers_.size() - 1; i >= 0; --i) {
+    if (segment >= 0 && i == checkpoint_begin_[segment + 1] - 1) {
+      RecomputeSegment(segment--);
+    }
     if (layer_need_backward_[i]) {
       layers_[i]->Backward(top_vecs_[i], true, &bottom_vecs_[i]);
     }
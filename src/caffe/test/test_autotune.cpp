@@ -0,0 +1,233 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <google/protobuf/text_format.h>
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/autotune.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ConvolutionTunerTest : public ::testing::Test {
+ protected:
+  ConvolutionTunerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 6, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    layer_param_.set_name("conv");
+    layer_param_.set_type(LayerParameter_LayerType_CONVOLUTION3D);
+    ConvolutionParameter* conv_param =
+        layer_param_.mutable_convolution_param();
+    conv_param->set_num_output(4);
+    conv_param->set_kernel_size(3);
+    conv_param->set_kernel_depth(3);
+    conv_param->set_pad(1);
+    conv_param->set_temporal_pad(1);
+  }
+  virtual ~ConvolutionTunerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+
+  // The engines and clips_per_gemm of the candidates of layer_param_.
+  vector<string> Candidates() {
+    vector<LayerParameter> candidates;
+    ConvolutionTuner<Dtype>::Candidates(layer_param_, *blob_bottom_,
+        &candidates);
+    vector<string> names;
+    for (int i = 0; i < candidates.size(); ++i) {
+      const ConvolutionParameter& conv_param =
+          candidates[i].convolution_param();
+      string name = ConvolutionParameter_Engine_Name(conv_param.engine());
+      if (conv_param.has_clips_per_gemm()) {
+        std::ostringstream clips;
+        clips << "x" << conv_param.clips_per_gemm();
+        name += clips.str();
+      }
+      names.push_back(name);
+    }
+    return names;
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  LayerParameter layer_param_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(ConvolutionTunerTest, Dtypes);
+
+TYPED_TEST(ConvolutionTunerTest, TestCandidates) {
+  const char* all[] = {"GEMM", "GEMMx2", "DIRECT", "WINOGRAD", "FFT"};
+  EXPECT_EQ(this->Candidates(), vector<string>(all, all + 5));
+  // pad 2: no DIRECT engine
+  this->layer_param_.mutable_convolution_param()->set_pad(2);
+  const char* pad2[] = {"GEMM", "GEMMx2", "WINOGRAD", "FFT"};
+  EXPECT_EQ(this->Candidates(), vector<string>(pad2, pad2 + 4));
+  // stride 2: GEMM only, with clips_per_gemm as given
+  this->layer_param_.mutable_convolution_param()->set_stride(2);
+  this->layer_param_.mutable_convolution_param()->set_clips_per_gemm(1);
+  EXPECT_EQ(this->Candidates(), vector<string>(1, "GEMMx1"));
+  // channels-last blobs: GEMM only
+  this->layer_param_.mutable_convolution_param()->set_stride(1);
+  this->layer_param_.mutable_convolution_param()->clear_clips_per_gemm();
+  this->blob_bottom_->set_layout(NLHWC);
+  const char* channels_last[] = {"GEMM", "GEMMx2"};
+  EXPECT_EQ(this->Candidates(), vector<string>(channels_last,
+      channels_last + 2));
+  this->blob_bottom_->set_layout(NCLHW);
+  // sparse weights: GEMM only
+  this->layer_param_.mutable_sparsity_param();
+  EXPECT_EQ(this->Candidates(), vector<string>(channels_last,
+      channels_last + 2));
+  this->layer_param_.clear_sparsity_param();
+  // depthwise: GEMM per group or the DEPTHWISE engine
+  this->layer_param_.mutable_convolution_param()->set_group(3);
+  this->layer_param_.mutable_convolution_param()->set_num_output(3);
+  const char* depthwise[] = {"GEMM", "GEMMx2", "DEPTHWISE"};
+  EXPECT_EQ(this->Candidates(), vector<string>(depthwise, depthwise + 3));
+  this->layer_param_.mutable_convolution_param()->clear_group();
+  this->layer_param_.mutable_convolution_param()->set_num_output(4);
+  this->layer_param_.set_type(LayerParameter_LayerType_DECONVOLUTION3D);
+  const char* deconvolution[] = {"GEMM", "FFT"};
+  EXPECT_EQ(this->Candidates(), vector<string>(deconvolution,
+      deconvolution + 2));
+  this->layer_param_.mutable_convolution_param()->set_stride(2);
+  const char* strided_deconvolution[] = {"GEMM", "PHASE"};
+  EXPECT_EQ(this->Candidates(), vector<string>(strided_deconvolution,
+      strided_deconvolution + 2));
+  this->layer_param_.mutable_convolution_param()->set_stride(1);
+  this->layer_param_.set_type(LayerParameter_LayerType_CONVOLUTION);
+  EXPECT_EQ(this->Candidates(), vector<string>(1, "GEMM"));
+  this->layer_param_.set_type(LayerParameter_LayerType_RELU);
+  EXPECT_TRUE(this->Candidates().empty());
+}
+
+TYPED_TEST(ConvolutionTunerTest, TestCPUTuneAndCache) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  const string cache_file = tmpnam(NULL);
+  LayerParameter tuned_param;
+  {
+    ConvolutionTuner<TypeParam> tuner(cache_file);
+    ASSERT_TRUE(tuner.Tune(this->layer_param_, this->blob_bottom_vec_,
+        this->blob_top_vec_, &tuned_param));
+    EXPECT_NE(tuned_param.convolution_param().engine(),
+        ConvolutionParameter_Engine_DEFAULT);
+    tuner.Save();
+  }
+  ConvolutionTuningCache cache;
+  ASSERT_TRUE(ReadProtoFromTextFile(cache_file, &cache));
+  ASSERT_EQ(cache.entry_size(), 1);
+  EXPECT_EQ(cache.entry(0).key(), ConvolutionTuner<TypeParam>::Key(
+      this->layer_param_, *this->blob_bottom_, *this->blob_top_));
+  EXPECT_EQ(cache.entry(0).engine(),
+      tuned_param.convolution_param().engine());
+  // a later tuner takes the winner from the cache, here rigged to DIRECT
+  cache.mutable_entry(0)->set_engine(ConvolutionParameter_Engine_DIRECT);
+  cache.mutable_entry(0)->set_clips_per_gemm(0);
+  WriteProtoToTextFile(cache, cache_file);
+  {
+    ConvolutionTuner<TypeParam> tuner(cache_file);
+    ASSERT_TRUE(tuner.Tune(this->layer_param_, this->blob_bottom_vec_,
+        this->blob_top_vec_, &tuned_param));
+    EXPECT_EQ(tuned_param.convolution_param().engine(),
+        ConvolutionParameter_Engine_DIRECT);
+    EXPECT_FALSE(tuned_param.convolution_param().has_clips_per_gemm());
+  }
+  // another shape has another key
+  const string key = ConvolutionTuner<TypeParam>::Key(this->layer_param_,
+      *this->blob_bottom_, *this->blob_top_);
+  this->blob_bottom_->Reshape(2, 3, 4, 6, 6);
+  EXPECT_NE(ConvolutionTuner<TypeParam>::Key(this->layer_param_,
+      *this->blob_bottom_, *this->blob_top_), key);
+  // layers with an engine set are not tuned
+  this->layer_param_.mutable_convolution_param()->set_engine(
+      ConvolutionParameter_Engine_GEMM);
+  ConvolutionTuner<TypeParam> tuner("");
+  EXPECT_FALSE(tuner.Tune(this->layer_param_, this->blob_bottom_vec_,
+      this->blob_top_vec_, &tuned_param));
+  remove(cache_file.c_str());
+}
+
+TYPED_TEST(ConvolutionTunerTest, TestCPUTuneTrain) {
+  // TRAIN candidates are timed with Backward
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  this->layer_param_.set_type(LayerParameter_LayerType_DECONVOLUTION3D);
+  ConvolutionTuner<TypeParam> tuner("");
+  LayerParameter tuned_param;
+  ASSERT_TRUE(tuner.Tune(this->layer_param_, this->blob_bottom_vec_,
+      this->blob_top_vec_, &tuned_param));
+  const ConvolutionParameter_Engine engine =
+      tuned_param.convolution_param().engine();
+  EXPECT_TRUE(engine == ConvolutionParameter_Engine_GEMM ||
+      engine == ConvolutionParameter_Engine_FFT);
+  // the net blobs are left alone
+  EXPECT_EQ(this->blob_top_->count(), 0);
+  Caffe::set_phase(Caffe::TEST);
+}
+
+TYPED_TEST(ConvolutionTunerTest, TestCPUTuningKeepsWeights) {
+  // a seeded net has the same initial weights whether its convolutions are
+  // timed (cold cache) or taken from the cache (warm)
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  const string proto =
+      "name: 'TestTuningWeights' "
+      "input: 'data' "
+      "input_dim: 2 input_dim: 3 input_dim: 4 input_dim: 6 input_dim: 5 "
+      "autotune_convolution: true "
+      "layers: { name: 'conv1' type: CONVOLUTION3D "
+      "  convolution_param { num_output: 4 kernel_size: 3 kernel_depth: 3 "
+      "    pad: 1 temporal_pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "    bias_filler { type: 'gaussian' std: 0.1 } } "
+      "  bottom: 'data' top: 'conv1' } "
+      "layers: { name: 'conv2' type: CONVOLUTION3D "
+      "  convolution_param { num_output: 4 kernel_size: 3 kernel_depth: 3 "
+      "    pad: 1 temporal_pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "    bias_filler { type: 'gaussian' std: 0.1 } } "
+      "  bottom: 'conv1' top: 'conv2' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  const string cache_file = tmpnam(NULL);
+  param.set_autotune_cache(cache_file);
+  vector<vector<TypeParam> > weights(2);
+  for (int run = 0; run < 2; ++run) {
+    Caffe::set_random_seed(1701);
+    Net<TypeParam> net(param);
+    for (int i = 0; i < net.params().size(); ++i) {
+      const Blob<TypeParam>& blob = *net.params()[i];
+      weights[run].insert(weights[run].end(), blob.cpu_data(),
+          blob.cpu_data() + blob.count());
+    }
+  }
+  ConvolutionTuningCache cache;
+  ASSERT_TRUE(ReadProtoFromTextFile(cache_file, &cache));
+  EXPECT_EQ(cache.entry_size(), 2);
+  ASSERT_EQ(weights[0].size(), weights[1].size());
+  for (int i = 0; i < weights[0].size(); ++i) {
+    EXPECT_EQ(weights[0][i], weights[1][i]) << i;
+  }
+  remove(cache_file.c_str());
+  Caffe::set_phase(Caffe::TEST);
+}
+
+}  // namespace caffe
@@ -0,0 +1,278 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <cfloat>
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/neuron_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/bfloat16.hpp"
+#include "caffe/util/insert_splits.hpp"
+#include "caffe/video_3d_layers.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::set;
+using std::string;
+
+namespace caffe {
+
+TEST(Bfloat16Test, TestRounding) {
+  // bfloat16 has 8 bits of precision, values 2^-7 apart just above 1
+  EXPECT_EQ(float_to_bfloat16(1.f).bits, 0x3f80);
+  EXPECT_EQ(float_to_bfloat16(-2.5f).bits, 0xc020);
+  // ties go to the even neighbour, other values to the nearest one
+  EXPECT_EQ(float_to_bfloat16(1.f + ldexpf(1.f, -8)).bits, 0x3f80);
+  EXPECT_EQ(float_to_bfloat16(1.f + 3 * ldexpf(1.f, -8)).bits, 0x3f82);
+  EXPECT_EQ(float_to_bfloat16(1.f + ldexpf(1.f, -8) + ldexpf(1.f, -20)).bits,
+      0x3f81);
+  EXPECT_EQ(float_to_bfloat16(1.f + ldexpf(1.f, -8) - ldexpf(1.f, -20)).bits,
+      0x3f80);
+  // values past the largest bfloat16 round to infinity, NaN stays NaN
+  EXPECT_EQ(float_to_bfloat16(FLT_MAX).bits, 0x7f80);
+  EXPECT_EQ(float_to_bfloat16(-HUGE_VALF).bits, 0xff80);
+  EXPECT_TRUE(std::isnan(bfloat16_to_float(float_to_bfloat16(NAN))));
+  // every bfloat16 value decodes and encodes back to itself
+  for (int bits = 0; bits < 0x10000; ++bits) {
+    bfloat16 x;
+    x.bits = static_cast<uint16_t>(bits);
+    const float value = bfloat16_to_float(x);
+    if (!std::isnan(value)) {
+      EXPECT_EQ(float_to_bfloat16(value).bits, bits);
+    }
+  }
+}
+
+template <typename Dtype>
+class Bfloat16BlobTest : public ::testing::Test {};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(Bfloat16BlobTest, Dtypes);
+
+TYPED_TEST(Bfloat16BlobTest, TestStorage) {
+  Blob<TypeParam> source(2, 3, 4, 5, 6);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&source);
+  Blob<TypeParam> blob(2, 3, 4, 5, 6);
+  blob.set_bfloat16_storage(true);
+  EXPECT_TRUE(blob.bfloat16_storage());
+  EXPECT_EQ(blob.data()->size(), source.count() * sizeof(bfloat16));
+  EXPECT_EQ(blob.diff()->size(), source.count() * sizeof(TypeParam));
+  // reshaping keeps the storage
+  blob.Reshape(2, 3, 4, 5, 7);
+  EXPECT_EQ(blob.data()->size(), blob.count() * sizeof(bfloat16));
+  blob.Reshape(2, 3, 4, 5, 6);
+  // copies round to bfloat16 and decode back
+  blob.CopyFrom(source);
+  for (int i = 0; i < source.count(); ++i) {
+    EXPECT_EQ(blob.cpu_bfloat16_data()[i].bits,
+        float_to_bfloat16(source.cpu_data()[i]).bits);
+  }
+  Blob<TypeParam> decoded;
+  decoded.CopyFrom(blob, false, true);
+  EXPECT_FALSE(decoded.bfloat16_storage());
+  for (int i = 0; i < source.count(); ++i) {
+    EXPECT_EQ(decoded.cpu_data()[i],
+        bfloat16_to_float(blob.cpu_bfloat16_data()[i]));
+    EXPECT_NEAR(decoded.cpu_data()[i], source.cpu_data()[i],
+        std::fabs(source.cpu_data()[i]) / 256);
+  }
+  Blob<TypeParam> shared(2, 3, 4, 5, 6);
+  shared.ShareData(blob);
+  EXPECT_TRUE(shared.bfloat16_storage());
+  EXPECT_EQ(shared.cpu_bfloat16_data(), blob.cpu_bfloat16_data());
+  blob.set_bfloat16_storage(false);
+  EXPECT_EQ(blob.data()->size(), source.count() * sizeof(TypeParam));
+}
+
+template <typename Dtype>
+class Bfloat16LayerTest : public ::testing::Test {
+ protected:
+  // Runs the layer on Dtype bottoms holding bfloat16 values, then on every
+  // mix of Dtype and bfloat16 bottoms and top (and in place on a bfloat16
+  // blob if in_place), and checks that the outputs are the Dtype ones,
+  // rounded to bfloat16 where the top is stored as bfloat16.
+  template <typename LayerType>
+  void Check(const LayerParameter& layer_param, const int num_bottoms,
+      const bool in_place) {
+    Caffe::set_mode(Caffe::CPU);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    vector<shared_ptr<Blob<Dtype> > > bottoms, bfloat16_bottoms;
+    vector<Blob<Dtype>*> bottom_vec;
+    for (int i = 0; i < num_bottoms; ++i) {
+      Blob<Dtype> values(2, 3, 4, 6, 5);
+      filler.Fill(&values);
+      bfloat16_bottoms.push_back(shared_ptr<Blob<Dtype> >(
+          new Blob<Dtype>(2, 3, 4, 6, 5)));
+      bfloat16_bottoms[i]->set_bfloat16_storage(true);
+      bfloat16_bottoms[i]->CopyFrom(values);
+      bottoms.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      bottoms[i]->CopyFrom(*bfloat16_bottoms[i], false, true);
+      bottom_vec.push_back(bottoms[i].get());
+    }
+    Blob<Dtype> reference;
+    vector<Blob<Dtype>*> reference_vec(1, &reference);
+    LayerType layer(layer_param);
+    layer.SetUp(bottom_vec, &reference_vec);
+    layer.Forward(bottom_vec, &reference_vec);
+    // bit i of storage for bottom i, bit num_bottoms for the top
+    for (int storage = 1; storage < (2 << num_bottoms); ++storage) {
+      vector<Blob<Dtype>*> mixed_vec;
+      for (int i = 0; i < num_bottoms; ++i) {
+        mixed_vec.push_back(((storage >> i) & 1) ? bfloat16_bottoms[i].get() :
+            bottoms[i].get());
+      }
+      Blob<Dtype> top;
+      top.set_bfloat16_storage((storage >> num_bottoms) & 1);
+      vector<Blob<Dtype>*> top_vec(1, &top);
+      LayerType mixed_layer(layer_param);
+      mixed_layer.SetUp(mixed_vec, &top_vec);
+      mixed_layer.Forward(mixed_vec, &top_vec);
+      CheckTop(reference, top);
+    }
+    if (in_place) {
+      Blob<Dtype> blob;
+      blob.set_bfloat16_storage(true);
+      blob.CopyFrom(*bfloat16_bottoms[0], false, true);
+      vector<Blob<Dtype>*> blob_vec(1, &blob);
+      LayerType in_place_layer(layer_param);
+      in_place_layer.SetUp(blob_vec, &blob_vec);
+      in_place_layer.Forward(blob_vec, &blob_vec);
+      CheckTop(reference, blob);
+    }
+  }
+
+  void CheckTop(const Blob<Dtype>& reference, const Blob<Dtype>& top) {
+    ASSERT_EQ(top.count(), reference.count());
+    for (int i = 0; i < top.count(); ++i) {
+      if (top.bfloat16_storage()) {
+        EXPECT_EQ(top.cpu_bfloat16_data()[i].bits,
+            float_to_bfloat16(reference.cpu_data()[i]).bits);
+      } else {
+        EXPECT_EQ(top.cpu_data()[i], reference.cpu_data()[i]);
+      }
+    }
+  }
+};
+
+TYPED_TEST_CASE(Bfloat16LayerTest, Dtypes);
+
+TYPED_TEST(Bfloat16LayerTest, TestCPUPooling3D) {
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_temporal_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  this->template Check<Pooling3DLayer<TypeParam> >(layer_param, 1, false);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_AVE);
+  pooling_param->set_pad(1);
+  this->template Check<Pooling3DLayer<TypeParam> >(layer_param, 1, false);
+}
+
+TYPED_TEST(Bfloat16LayerTest, TestCPUReLU) {
+  LayerParameter layer_param;
+  this->template Check<ReLULayer<TypeParam> >(layer_param, 1, true);
+}
+
+TYPED_TEST(Bfloat16LayerTest, TestCPUEltwise) {
+  LayerParameter layer_param;
+  EltwiseParameter* eltwise_param = layer_param.mutable_eltwise_param();
+  eltwise_param->set_operation(EltwiseParameter_EltwiseOp_PROD);
+  this->template Check<EltwiseLayer<TypeParam> >(layer_param, 2, false);
+  eltwise_param->set_operation(EltwiseParameter_EltwiseOp_MAX);
+  this->template Check<EltwiseLayer<TypeParam> >(layer_param, 3, false);
+  eltwise_param->set_operation(EltwiseParameter_EltwiseOp_SUM);
+  eltwise_param->add_coeff(1);
+  eltwise_param->add_coeff(-0.5);
+  this->template Check<EltwiseLayer<TypeParam> >(layer_param, 2, false);
+}
+
+TEST(SelectBfloat16BlobsTest, TestSelection) {
+  // Blobs touched by a layer without bfloat16 support (the split of pool1,
+  // the dropout), the input and the output stay in Dtype.
+  const string& proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "} "
+      "layers: { "
+      "  name: 'conv2a' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'pool1' "
+      "  top: 'conv2a' "
+      "} "
+      "layers: { "
+      "  name: 'conv2b' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'pool1' "
+      "  top: 'conv2b' "
+      "} "
+      "layers: { "
+      "  name: 'drop2b' "
+      "  type: DROPOUT "
+      "  bottom: 'conv2b' "
+      "  top: 'conv2b' "
+      "} "
+      "layers: { "
+      "  name: 'sum' "
+      "  type: ELTWISE "
+      "  bottom: 'conv2a' "
+      "  bottom: 'conv2b' "
+      "  top: 'sum' "
+      "} "
+      "layers: { "
+      "  name: 'pool2' "
+      "  type: POOLING3D "
+      "  bottom: 'sum' "
+      "  top: 'pool2' "
+      "  pooling_param { pool: AVE kernel_size: 2 stride: 2 } "
+      "} "
+      "layers: { "
+      "  name: 'conv3' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'pool2' "
+      "  top: 'conv3' "
+      "} ";
+  NetParameter param, split_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  InsertSplits(param, &split_param);
+  set<string> blob_names;
+  SelectBfloat16Blobs(split_param, &blob_names);
+  set<string> expected;
+  expected.insert("conv1");
+  expected.insert("conv2a");
+  expected.insert("sum");
+  expected.insert("pool2");
+  EXPECT_TRUE(blob_names == expected);
+}
+
+}  // namespace caffe
@@ -7,6 +7,7 @@
 #include "caffe/common.hpp"
 #include "caffe/blob.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/proto/caffe.pb.h"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -57,4 +58,69 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestChannelsLastOffset) {
+  this->blob_->Reshape(2, 3, 4, 5, 6);
+  EXPECT_EQ(this->blob_->layout(), NCLHW);
+  EXPECT_EQ(this->blob_->offset(1, 2, 3, 4, 5),
+      (((1 * 3 + 2) * 4 + 3) * 5 + 4) * 6 + 5);
+  this->blob_->set_layout(NLHWC);
+  EXPECT_EQ(this->blob_->offset(1, 2, 3, 4, 5),
+      (((1 * 4 + 3) * 5 + 4) * 6 + 5) * 3 + 2);
+  // reshaping keeps the layout, ReshapeLike copies it
+  this->blob_->Reshape(2, 3, 4, 5, 6);
+  EXPECT_EQ(this->blob_->layout(), NLHWC);
+  this->blob_preshaped_->ReshapeLike(*this->blob_);
+  EXPECT_EQ(this->blob_preshaped_->layout(), NLHWC);
+}
+
+TYPED_TEST(BlobSimpleTest, TestSparseProto) {
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_preshaped_);
+  TypeParam* data = this->blob_preshaped_->mutable_cpu_data();
+  int nonzero = 0;
+  for (int i = 0; i < this->blob_preshaped_->count(); ++i) {
+    // zeros at both ends and runs of zeros
+    if (i == 0 || i % 7 > 1 || i == this->blob_preshaped_->count() - 1) {
+      data[i] = 0;
+    } else {
+      ++nonzero;
+    }
+  }
+  BlobProto proto;
+  this->blob_preshaped_->ToProto(&proto, false, true);
+  EXPECT_EQ(proto.data_size(), nonzero);
+  EXPECT_EQ(proto.sparse_gap_size(), nonzero);
+  this->blob_->FromProto(proto);
+  EXPECT_EQ(this->blob_->count(), this->blob_preshaped_->count());
+  // BlobProto holds floats
+  for (int i = 0; i < this->blob_->count(); ++i) {
+    EXPECT_EQ(this->blob_->cpu_data()[i],
+        static_cast<float>(this->blob_preshaped_->cpu_data()[i]));
+  }
+  // a dense proto of the same blob reads back the same
+  this->blob_preshaped_->ToProto(&proto);
+  EXPECT_EQ(proto.sparse_gap_size(), 0);
+  EXPECT_EQ(proto.data_size(), this->blob_preshaped_->count());
+}
+
+TYPED_TEST(BlobSimpleTest, TestSparseProtoZeros) {
+  // a sparse blob of zeros has no values at all
+  caffe_set(this->blob_preshaped_->count(), TypeParam(0),
+      this->blob_preshaped_->mutable_cpu_data());
+  BlobProto proto;
+  this->blob_preshaped_->ToProto(&proto, false, true);
+  EXPECT_TRUE(proto.sparse());
+  EXPECT_EQ(proto.data_size(), 0);
+  EXPECT_EQ(proto.sparse_gap_size(), 0);
+  this->blob_->ReshapeLike(*this->blob_preshaped_);
+  caffe_set(this->blob_->count(), TypeParam(1),
+      this->blob_->mutable_cpu_data());
+  this->blob_->FromProto(proto);
+  EXPECT_EQ(this->blob_->count(), this->blob_preshaped_->count());
+  for (int i = 0; i < this->blob_->count(); ++i) {
+    EXPECT_EQ(this->blob_->cpu_data()[i], 0);
+  }
+}
+
 }  // namespace caffe
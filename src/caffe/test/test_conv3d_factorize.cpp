@@ -0,0 +1,196 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/conv3d_factorize.hpp"
+#include "caffe/video_3d_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class Conv3DFactorizeTest : public ::testing::Test {
+ protected:
+  // Factorizes weight_ to rank and returns the largest difference between
+  // weight_ and the product of the factors.
+  Dtype Reconstruct(const int rank, Dtype* error) {
+    const int num_output = weight_.num();
+    const int channels = weight_.channels();
+    const int kernel_depth = weight_.length();
+    const int kernel_area = weight_.height() * weight_.width();
+    std::vector<Dtype> spatial(rank * channels * kernel_area);
+    std::vector<Dtype> temporal(num_output * rank * kernel_depth);
+    *error = conv3d_factorize_cpu(weight_.cpu_data(), num_output, channels,
+        kernel_depth, weight_.height(), rank, &spatial[0], &temporal[0]);
+    Dtype max_difference = 0;
+    for (int o = 0; o < num_output; ++o) {
+      for (int c = 0; c < channels; ++c) {
+        for (int t = 0; t < kernel_depth; ++t) {
+          for (int k = 0; k < kernel_area; ++k) {
+            Dtype sum = 0;
+            for (int r = 0; r < rank; ++r) {
+              sum += temporal[(o * rank + r) * kernel_depth + t] *
+                  spatial[(r * channels + c) * kernel_area + k];
+            }
+            max_difference = std::max(max_difference, static_cast<Dtype>(
+                std::fabs(sum - weight_.data_at(o, c, t, k / weight_.width(),
+                k % weight_.width()))));
+          }
+        }
+      }
+    }
+    return max_difference;
+  }
+
+  Blob<Dtype> weight_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(Conv3DFactorizeTest, Dtypes);
+
+TYPED_TEST(Conv3DFactorizeTest, TestCPUFullRankIsExact) {
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  TypeParam error;
+  // more spatial than temporal rows, then the other way around
+  this->weight_.Reshape(4, 3, 3, 3, 3);
+  filler.Fill(&this->weight_);
+  EXPECT_EQ(conv3d_factorize_max_rank(4, 3, 3, 3), 12);
+  EXPECT_LT(this->Reconstruct(12, &error), 1e-4);
+  EXPECT_LT(error, 1e-3);
+  this->weight_.Reshape(8, 1, 3, 3, 3);
+  filler.Fill(&this->weight_);
+  EXPECT_EQ(conv3d_factorize_max_rank(8, 1, 3, 3), 9);
+  EXPECT_LT(this->Reconstruct(9, &error), 1e-4);
+  EXPECT_LT(error, 1e-3);
+}
+
+TYPED_TEST(Conv3DFactorizeTest, TestCPUSeparable) {
+  // filters that are a temporal profile times a spatial one are rank 1
+  this->weight_.Reshape(4, 3, 3, 3, 3);
+  TypeParam* weight = this->weight_.mutable_cpu_data();
+  for (int o = 0; o < 4; ++o) {
+    for (int c = 0; c < 3; ++c) {
+      for (int t = 0; t < 3; ++t) {
+        for (int k = 0; k < 9; ++k) {
+          weight[((o * 3 + c) * 3 + t) * 9 + k] =
+              (o + 1 - t) * std::cos(static_cast<TypeParam>(c * 9 + k));
+        }
+      }
+    }
+  }
+  TypeParam error;
+  EXPECT_LT(this->Reconstruct(1, &error), 1e-4);
+  EXPECT_LT(error, 1e-3);
+}
+
+TYPED_TEST(Conv3DFactorizeTest, TestCPUTruncatedError) {
+  // the reported error shrinks with the rank and matches the dropped part
+  this->weight_.Reshape(4, 3, 3, 3, 3);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&this->weight_);
+  TypeParam norm = 0;
+  for (int i = 0; i < this->weight_.count(); ++i) {
+    norm += this->weight_.cpu_data()[i] * this->weight_.cpu_data()[i];
+  }
+  TypeParam previous_error = 1;
+  for (int rank = 1; rank < 12; ++rank) {
+    TypeParam error;
+    this->Reconstruct(rank, &error);
+    EXPECT_GT(error, 0);
+    EXPECT_LT(error, previous_error);
+    previous_error = error;
+  }
+  // at rank 6 the dropped norm is that of weight minus the factors
+  const int rank = 6;
+  std::vector<TypeParam> spatial(rank * 27), temporal(4 * rank * 3);
+  const TypeParam error = conv3d_factorize_cpu(this->weight_.cpu_data(), 4, 3,
+      3, 3, rank, &spatial[0], &temporal[0]);
+  TypeParam dropped = 0;
+  for (int o = 0; o < 4; ++o) {
+    for (int c = 0; c < 3; ++c) {
+      for (int t = 0; t < 3; ++t) {
+        for (int k = 0; k < 9; ++k) {
+          TypeParam sum = 0;
+          for (int r = 0; r < rank; ++r) {
+            sum += temporal[(o * rank + r) * 3 + t] *
+                spatial[(r * 3 + c) * 9 + k];
+          }
+          const TypeParam difference =
+              this->weight_.cpu_data()[((o * 3 + c) * 3 + t) * 9 + k] - sum;
+          dropped += difference * difference;
+        }
+      }
+    }
+  }
+  EXPECT_NEAR(error, std::sqrt(dropped / norm), 1e-4);
+}
+
+TYPED_TEST(Conv3DFactorizeTest, TestCPUFactorizedLayersMatch) {
+  // a spatial then a temporal Convolution3D with the factors give the output
+  // of the original layer, here with padding and spatial and temporal strides
+  Caffe::set_mode(Caffe::CPU);
+  Blob<TypeParam> bottom(2, 3, 5, 6, 7), middle, top, factorized_top;
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<TypeParam>*> bottom_vec(1, &bottom), middle_vec(1, &middle);
+  vector<Blob<TypeParam>*> top_vec(1, &top);
+  vector<Blob<TypeParam>*> factorized_top_vec(1, &factorized_top);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_stride(2);
+  convolution_param->set_temporal_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(bottom_vec, &top_vec);
+  layer.Forward(bottom_vec, &top_vec);
+
+  const int rank = 12;
+  LayerParameter spatial_param(layer_param);
+  ConvolutionParameter* spatial_conv =
+      spatial_param.mutable_convolution_param();
+  spatial_conv->set_num_output(rank);
+  spatial_conv->set_kernel_depth(1);
+  spatial_conv->set_temporal_pad(0);
+  spatial_conv->set_temporal_stride(1);
+  spatial_conv->set_bias_term(false);
+  LayerParameter temporal_param(layer_param);
+  ConvolutionParameter* temporal_conv =
+      temporal_param.mutable_convolution_param();
+  temporal_conv->set_kernel_size(1);
+  temporal_conv->set_pad(0);
+  temporal_conv->set_stride(1);
+  Convolution3DLayer<TypeParam> spatial_layer(spatial_param);
+  spatial_layer.SetUp(bottom_vec, &middle_vec);
+  Convolution3DLayer<TypeParam> temporal_layer(temporal_param);
+  temporal_layer.SetUp(middle_vec, &factorized_top_vec);
+  conv3d_factorize_cpu(layer.blobs()[0]->cpu_data(), 4, 3, 3, 3, rank,
+      spatial_layer.blobs()[0]->mutable_cpu_data(),
+      temporal_layer.blobs()[0]->mutable_cpu_data());
+  temporal_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  spatial_layer.Forward(bottom_vec, &middle_vec);
+  temporal_layer.Forward(middle_vec, &factorized_top_vec);
+  ASSERT_EQ(factorized_top.count(), top.count());
+  EXPECT_EQ(factorized_top.length(), top.length());
+  EXPECT_EQ(factorized_top.height(), top.height());
+  for (int i = 0; i < top.count(); ++i) {
+    EXPECT_NEAR(factorized_top.cpu_data()[i], top.cpu_data()[i], 1e-3);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,1142 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "cuda_runtime.h"
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/video_3d_layers.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+extern cudaDeviceProp CAFFE_TEST_CUDA_PROP;
+
+template <typename Dtype>
+class Convolution3DLayerTest : public ::testing::Test {
+ protected:
+  Convolution3DLayerTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_bottom_->Reshape(2, 3, 4, 6, 5);
+    // fill the values
+    FillerParameter filler_param;
+    filler_param.set_value(1.);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~Convolution3DLayerTest() { delete blob_bottom_; delete blob_top_; }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(Convolution3DLayerTest, Dtypes);
+
+TYPED_TEST(Convolution3DLayerTest, TestSetup) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(4);
+  shared_ptr<Layer<TypeParam> > layer(
+      new Convolution3DLayer<TypeParam>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 4);
+  EXPECT_EQ(this->blob_top_->length(), 2);
+  EXPECT_EQ(this->blob_top_->height(), 2);
+  EXPECT_EQ(this->blob_top_->width(), 2);
+  // batching clips should not change the shape
+  convolution_param->set_clips_per_gemm(2);
+  layer.reset(new Convolution3DLayer<TypeParam>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 4);
+  EXPECT_EQ(this->blob_top_->length(), 2);
+  EXPECT_EQ(this->blob_top_->height(), 2);
+  EXPECT_EQ(this->blob_top_->width(), 2);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUSimpleConvolution) {
+  // We will simply see if the convolution layer carries out averaging well.
+  FillerParameter filler_param;
+  filler_param.set_value(1.);
+  ConstantFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("constant");
+  convolution_param->mutable_weight_filler()->set_value(1);
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<TypeParam> > layer(
+      new Convolution3DLayer<TypeParam>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Caffe::set_mode(Caffe::CPU);
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // After the convolution, the output should all have output values 81.1
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], 81.1, 1e-4);
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUBatchedMatchesPerClip) {
+  // Unrolling several clips into one GEMM must give the same result as
+  // processing them one by one, including a partial last tile.
+  this->blob_bottom_->Reshape(5, 3, 4, 6, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_filter_group(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+
+  convolution_param->set_clips_per_gemm(3);
+  Convolution3DLayer<TypeParam> batched_layer(layer_param);
+  batched_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  batched_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  batched_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  batched_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradient) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientBatched) {
+  this->blob_bottom_->Reshape(3, 2, 3, 4, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_clips_per_gemm(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUDirectMatchesGEMM) {
+  // The direct 3x3x3 engine must agree with vol2col + GEMM in both passes.
+  // The width covers full vector tiles as well as a ragged tail, and the
+  // number of outputs a partial block of output channels.
+  this->blob_bottom_->Reshape(2, 3, 3, 4, 37);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference, bottom_reference, weight_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  // use a random top diff
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  top_reference.CopyFrom(*this->blob_top_, true);
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+  weight_reference.CopyFrom(*layer.blobs()[0], true, true);
+
+  convolution_param->set_engine(ConvolutionParameter_Engine_DEFAULT);
+  Convolution3DLayer<TypeParam> direct_layer(layer_param);
+  direct_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  direct_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  direct_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  direct_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+  }
+  this->blob_top_->CopyFrom(top_reference, true);
+  direct_layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  const TypeParam* bottom_diff = this->blob_bottom_->cpu_diff();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(bottom_diff[i], bottom_reference.cpu_diff()[i], 1e-4);
+  }
+  const TypeParam* weight_diff = direct_layer.blobs()[0]->cpu_diff();
+  for (int i = 0; i < weight_reference.count(); ++i) {
+    EXPECT_NEAR(weight_diff[i], weight_reference.cpu_diff()[i], 1e-3);
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientDirect) {
+  this->blob_bottom_->Reshape(2, 2, 3, 4, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUWinogradMatchesGEMM) {
+  // The Winograd engine must agree with vol2col + GEMM in both passes, for
+  // odd output sizes (partial tiles) and different spatial/temporal padding.
+  this->blob_bottom_->Reshape(2, 3, 4, 5, 7);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(2);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference, bottom_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  // use a random top diff
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  top_reference.CopyFrom(*this->blob_top_, true);
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  Convolution3DLayer<TypeParam> winograd_layer(layer_param);
+  winograd_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  winograd_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  winograd_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  winograd_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+  }
+  this->blob_top_->CopyFrom(top_reference, true);
+  winograd_layer.Backward(this->blob_top_vec_, true,
+      &(this->blob_bottom_vec_));
+  const TypeParam* bottom_diff = this->blob_bottom_->cpu_diff();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(bottom_diff[i], bottom_reference.cpu_diff()[i], 1e-4);
+  }
+
+  // the transformed filters must follow a weight update
+  filler.Fill(layer.blobs()[0].get());
+  winograd_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  top_reference.CopyFrom(*this->blob_top_);
+  winograd_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientWinograd) {
+  this->blob_bottom_->Reshape(2, 2, 3, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUFFTMatchesGEMM) {
+  // The FFT engine must agree with vol2col + GEMM in both passes. The
+  // workspace limit is chosen so that the length is split into three tiles.
+  this->blob_bottom_->Reshape(2, 2, 12, 5, 6);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(5);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->set_fft_workspace_limit(12288 * sizeof(TypeParam));
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference, bottom_reference, weight_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  // use a random top diff
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  top_reference.CopyFrom(*this->blob_top_, true);
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+  weight_reference.CopyFrom(*layer.blobs()[0], true, true);
+
+  convolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  Convolution3DLayer<TypeParam> fft_layer(layer_param);
+  fft_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  fft_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  fft_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  fft_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+  }
+  this->blob_top_->CopyFrom(top_reference, true);
+  fft_layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  const TypeParam* bottom_diff = this->blob_bottom_->cpu_diff();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(bottom_diff[i], bottom_reference.cpu_diff()[i], 1e-4);
+  }
+  const TypeParam* weight_diff = fft_layer.blobs()[0]->cpu_diff();
+  for (int i = 0; i < weight_reference.count(); ++i) {
+    EXPECT_NEAR(weight_diff[i], weight_reference.cpu_diff()[i], 1e-3);
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientFFT) {
+  this->blob_bottom_->Reshape(2, 2, 5, 3, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(5);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUThreadedMatchesSingleThread) {
+  // Splitting the clips over several threads, each with its own buffers and
+  // weight gradient accumulator, must not change the result of any engine
+  // that runs on the thread pool.
+  this->blob_bottom_->Reshape(5, 3, 3, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const ConvolutionParameter_Engine engines[] = {
+    ConvolutionParameter_Engine_GEMM, ConvolutionParameter_Engine_DIRECT,
+    ConvolutionParameter_Engine_WINOGRAD
+  };
+  Caffe::set_mode(Caffe::CPU);
+  for (int e = 0; e < 3; ++e) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_kernel_depth(3);
+    convolution_param->set_pad(1);
+    convolution_param->set_temporal_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->set_clips_per_gemm(2);
+    convolution_param->set_engine(engines[e]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    Convolution3DLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    Caffe::set_cpu_threads(1);
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    Blob<TypeParam> top_reference, bottom_reference, weight_reference;
+    top_reference.CopyFrom(*this->blob_top_, false, true);
+    // use a random top diff
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    top_reference.CopyFrom(*this->blob_top_, true);
+    layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+    bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+    weight_reference.CopyFrom(*layer.blobs()[0], true, true);
+
+    Caffe::set_cpu_threads(3);
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const TypeParam* top_data = this->blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+    }
+    this->blob_top_->CopyFrom(top_reference, true);
+    layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+    const TypeParam* bottom_diff = this->blob_bottom_->cpu_diff();
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(bottom_diff[i], bottom_reference.cpu_diff()[i], 1e-4);
+    }
+    const TypeParam* weight_diff = layer.blobs()[0]->cpu_diff();
+    for (int i = 0; i < weight_reference.count(); ++i) {
+      EXPECT_NEAR(weight_diff[i], weight_reference.cpu_diff()[i], 1e-3);
+    }
+  }
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientThreaded) {
+  this->blob_bottom_->Reshape(3, 2, 3, 4, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(2);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUInt8MatchesFP32) {
+  // Rounding a bottom value and a weight moves their product by at most
+  // |w| * bottom_scale / 2 + |x| * weight_scale / 2 + the product of the
+  // half scales, which bounds the error of every output of the INT8 layer.
+  this->blob_bottom_->Reshape(3, 4, 4, 6, 7);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_filter_group(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+
+  TypeParam range = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    range = std::max(range, std::fabs(this->blob_bottom_->cpu_data()[i]));
+  }
+  layer_param.mutable_quantization_param()->set_precision(
+      QuantizationParameter_Precision_INT8);
+  layer_param.mutable_quantization_param()->set_bottom_range(range);
+  Convolution3DLayer<TypeParam> int8_layer(layer_param);
+  int8_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  int8_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  int8_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  int8_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const int num_output = 6;
+  const int kernel_count = layer.blobs()[0]->count() / num_output;
+  const int spatial = this->blob_top_->count() / this->blob_top_->num() /
+      num_output;
+  const TypeParam bottom_scale = range / 127;
+  double error = 0, magnitude = 0;
+  for (int o = 0; o < num_output; ++o) {
+    TypeParam weight_range = 0;
+    for (int k = 0; k < kernel_count; ++k) {
+      weight_range = std::max(weight_range,
+          std::fabs(layer.blobs()[0]->cpu_data()[o * kernel_count + k]));
+    }
+    const TypeParam weight_scale = weight_range / 127;
+    const TypeParam bound = kernel_count * (weight_range * bottom_scale / 2 +
+        range * weight_scale / 2 + bottom_scale * weight_scale / 4) + 1e-4;
+    for (int n = 0; n < this->blob_top_->num(); ++n) {
+      for (int i = 0; i < spatial; ++i) {
+        const int index = (n * num_output + o) * spatial + i;
+        const TypeParam expected = top_reference.cpu_data()[index];
+        const TypeParam actual = this->blob_top_->cpu_data()[index];
+        EXPECT_NEAR(actual, expected, bound);
+        error += std::fabs(actual - expected);
+        magnitude += std::fabs(expected);
+      }
+    }
+  }
+  // the rounding errors mostly cancel out
+  EXPECT_LT(error, 0.03 * magnitude);
+
+  // integer sums do not depend on the split over threads
+  Blob<TypeParam> int8_reference;
+  int8_reference.CopyFrom(*this->blob_top_, false, true);
+  Caffe::set_cpu_threads(2);
+  int8_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], int8_reference.cpu_data()[i]);
+  }
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUBfloat16MatchesFP32) {
+  // With a bfloat16 bottom or top the layer still computes in Dtype: its
+  // output is the Dtype output for the decoded bottom, rounded to bfloat16.
+  this->blob_bottom_->Reshape(3, 3, 4, 6, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Blob<TypeParam> bottom_bfloat16(3, 3, 4, 6, 5);
+  bottom_bfloat16.set_bfloat16_storage(true);
+  bottom_bfloat16.CopyFrom(*this->blob_bottom_);
+  this->blob_bottom_->CopyFrom(bottom_bfloat16);
+  Caffe::set_mode(Caffe::CPU);
+  // GEMM one and two clips at a time, DIRECT, WINOGRAD, FFT, and GEMM with
+  // the fused ReLU and pooling
+  const ConvolutionParameter_Engine engines[] = {
+      ConvolutionParameter_Engine_GEMM, ConvolutionParameter_Engine_GEMM,
+      ConvolutionParameter_Engine_DIRECT, ConvolutionParameter_Engine_WINOGRAD,
+      ConvolutionParameter_Engine_FFT, ConvolutionParameter_Engine_GEMM};
+  for (int e = 0; e < 6; ++e) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_kernel_depth(3);
+    convolution_param->set_pad(1);
+    convolution_param->set_temporal_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->set_engine(engines[e]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    if (e == 1) {
+      convolution_param->set_clips_per_gemm(2);
+    }
+    if (e == 5) {
+      convolution_param->set_fused_relu(true);
+      convolution_param->set_fused_pooling(true);
+      PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+      pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+      pooling_param->set_kernel_size(2);
+      pooling_param->set_stride(2);
+      pooling_param->set_kernel_depth(2);
+      pooling_param->set_temporal_stride(2);
+    }
+    Convolution3DLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    // bfloat16 bottom, top, or both
+    for (int storage = 1; storage < 4; ++storage) {
+      const bool bfloat16_bottom = storage & 1;
+      const bool bfloat16_top = storage & 2;
+      Blob<TypeParam> top;
+      top.set_bfloat16_storage(bfloat16_top);
+      vector<Blob<TypeParam>*> bottom_vec(1, bfloat16_bottom ?
+          &bottom_bfloat16 : this->blob_bottom_);
+      vector<Blob<TypeParam>*> top_vec(1, &top);
+      Convolution3DLayer<TypeParam> bfloat16_layer(layer_param);
+      bfloat16_layer.SetUp(bottom_vec, &top_vec);
+      for (int i = 0; i < layer.blobs().size(); ++i) {
+        bfloat16_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+      }
+      bfloat16_layer.Forward(bottom_vec, &top_vec);
+      ASSERT_EQ(top.count(), this->blob_top_->count());
+      for (int i = 0; i < top.count(); ++i) {
+        if (bfloat16_top) {
+          EXPECT_EQ(top.cpu_bfloat16_data()[i].bits,
+              float_to_bfloat16(this->blob_top_->cpu_data()[i]).bits);
+        } else {
+          EXPECT_EQ(top.cpu_data()[i], this->blob_top_->cpu_data()[i]);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUSharedWorkspace) {
+  // Layers sharing a workspace overwrite each other's buffers, which must
+  // not change their results.
+  this->blob_bottom_->Reshape(3, 3, 3, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  const ConvolutionParameter_Engine engines[] = {
+    ConvolutionParameter_Engine_GEMM, ConvolutionParameter_Engine_DIRECT
+  };
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(2);
+  shared_ptr<Workspace> workspace(new Workspace());
+  vector<shared_ptr<Convolution3DLayer<TypeParam> > > layers;
+  vector<shared_ptr<Blob<TypeParam> > > tops, top_references;
+  vector<vector<Blob<TypeParam>*> > top_vecs(2);
+  for (int e = 0; e < 2; ++e) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_kernel_depth(3);
+    convolution_param->set_pad(1);
+    convolution_param->set_temporal_pad(1);
+    convolution_param->set_num_output(4 + e);
+    convolution_param->set_clips_per_gemm(2);
+    convolution_param->set_engine(engines[e]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    layers.push_back(shared_ptr<Convolution3DLayer<TypeParam> >(
+        new Convolution3DLayer<TypeParam>(layer_param)));
+    tops.push_back(shared_ptr<Blob<TypeParam> >(new Blob<TypeParam>()));
+    top_vecs[e].push_back(tops[e].get());
+    layers[e]->SetUp(this->blob_bottom_vec_, &top_vecs[e]);
+    EXPECT_GT(layers[e]->workspace_size(), 0);
+    // the reference result, computed with the private workspace
+    layers[e]->Forward(this->blob_bottom_vec_, &top_vecs[e]);
+    top_references.push_back(
+        shared_ptr<Blob<TypeParam> >(new Blob<TypeParam>()));
+    top_references[e]->CopyFrom(*tops[e], false, true);
+    layers[e]->set_workspace(workspace);
+  }
+  for (int iter = 0; iter < 2; ++iter) {
+    for (int e = 0; e < 2; ++e) {
+      layers[e]->Forward(this->blob_bottom_vec_, &top_vecs[e]);
+      const TypeParam* top_data = tops[e]->cpu_data();
+      for (int i = 0; i < tops[e]->count(); ++i) {
+        EXPECT_EQ(top_data[i], top_references[e]->cpu_data()[i]);
+      }
+    }
+  }
+  EXPECT_EQ(workspace->size(), std::max(layers[0]->workspace_size(),
+      layers[1]->workspace_size()));
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUCachedColumnsMatchRecompute) {
+  // Backward from the columns kept by Forward gives exactly the gradients of
+  // the recomputed ones, and the cache is not used once the bottom changed.
+  this->blob_bottom_->Reshape(5, 3, 3, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Caffe::set_mode(Caffe::CPU);
+  for (int threads = 1; threads <= 2; ++threads) {
+    Caffe::set_cpu_threads(threads);
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_kernel_depth(3);
+    convolution_param->set_stride(2);
+    convolution_param->set_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->set_clips_per_gemm(2);
+    convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    Convolution3DLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    EXPECT_FALSE(layer.cache_columns());
+    // K_ = 3 * 27 rows of N_ = top count / (5 clips * 4 outputs) columns
+    EXPECT_EQ(layer.column_cache_size(),
+        sizeof(TypeParam) * 3 * 27 * this->blob_top_->count() / 4);
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+    Blob<TypeParam> bottom_reference, weight_reference;
+    bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+    weight_reference.CopyFrom(*layer.blobs()[0], true, true);
+
+    layer.set_cache_columns(true);
+    EXPECT_TRUE(layer.cache_columns());
+    for (int changed = 0; changed < 2; ++changed) {
+      Blob<TypeParam> top_diff;
+      top_diff.CopyFrom(*this->blob_top_, true, true);
+      layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      this->blob_top_->CopyFrom(top_diff, true);
+      if (changed) {
+        // writing the bottom between Forward and Backward
+        this->blob_bottom_->mutable_cpu_data();
+      }
+      layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+      const TypeParam* bottom_diff = this->blob_bottom_->cpu_diff();
+      for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+        EXPECT_EQ(bottom_diff[i], bottom_reference.cpu_diff()[i]);
+      }
+      const TypeParam* weight_diff = layer.blobs()[0]->cpu_diff();
+      for (int i = 0; i < weight_reference.count(); ++i) {
+        EXPECT_EQ(weight_diff[i], weight_reference.cpu_diff()[i]);
+      }
+    }
+  }
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientCachedColumns) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->set_cache_columns(true);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUChannelsLastMatchesNCLHW) {
+  // A channels-last bottom must give the transposed top, bottom diff and the
+  // same weight gradient as the NCLHW layer.
+  this->blob_bottom_->Reshape(3, 5, 4, 6, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_clips_per_gemm(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // use a random top diff
+  Blob<TypeParam> top_diff;
+  top_diff.ReshapeLike(*this->blob_top_);
+  filler.Fill(&top_diff);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+
+  const int spatial = this->blob_bottom_->length() *
+      this->blob_bottom_->height() * this->blob_bottom_->width();
+  Blob<TypeParam> bottom(3, 5, 4, 6, 5), top;
+  bottom.set_layout(NLHWC);
+  convert_layout_cpu(this->blob_bottom_->cpu_data(), 3, 5, spatial, NCLHW,
+      bottom.mutable_cpu_data());
+  vector<Blob<TypeParam>*> bottom_vec(1, &bottom), top_vec(1, &top);
+  Convolution3DLayer<TypeParam> cl_layer(layer_param);
+  cl_layer.SetUp(bottom_vec, &top_vec);
+  EXPECT_EQ(top.layout(), NLHWC);
+  cl_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  cl_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  cl_layer.Forward(bottom_vec, &top_vec);
+  const int top_spatial = top.length() * top.height() * top.width();
+  Blob<TypeParam> converted;
+  converted.ReshapeLike(*this->blob_top_);
+  convert_layout_cpu(top.cpu_data(), top.num(), top.channels(), top_spatial,
+      NLHWC, converted.mutable_cpu_data());
+  for (int i = 0; i < converted.count(); ++i) {
+    EXPECT_NEAR(converted.cpu_data()[i], this->blob_top_->cpu_data()[i],
+        1e-4);
+  }
+  convert_layout_cpu(this->blob_top_->cpu_diff(), top.num(), top.channels(),
+      top_spatial, NCLHW, top.mutable_cpu_diff());
+  cl_layer.Backward(top_vec, true, &bottom_vec);
+  converted.ReshapeLike(*this->blob_bottom_);
+  convert_layout_cpu(bottom.cpu_diff(), 3, 5, spatial, NLHWC,
+      converted.mutable_cpu_data());
+  for (int i = 0; i < converted.count(); ++i) {
+    EXPECT_NEAR(converted.cpu_data()[i], this->blob_bottom_->cpu_diff()[i],
+        1e-4);
+  }
+  for (int i = 0; i < 2; ++i) {
+    const Blob<TypeParam>& param = *layer.blobs()[i];
+    for (int j = 0; j < param.count(); ++j) {
+      EXPECT_NEAR(cl_layer.blobs()[i]->cpu_diff()[j], param.cpu_diff()[j],
+          1e-3);
+    }
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientChannelsLast) {
+  this->blob_bottom_->Reshape(3, 2, 3, 4, 4);
+  this->blob_bottom_->set_layout(NLHWC);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(2);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGroupMatchesSeparate) {
+  // A layer with 2 channel groups (and 2 filter groups within each) must
+  // match two layers run on its halves of the channels and filters.
+  this->blob_bottom_->Reshape(2, 4, 3, 5, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(8);
+  convolution_param->set_filter_group(2);
+  convolution_param->set_clips_per_gemm(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  LayerParameter group_param(layer_param);
+  group_param.mutable_convolution_param()->set_group(2);
+  Convolution3DLayer<TypeParam> layer(group_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(layer.blobs()[0]->channels(), 2);
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+
+  convolution_param->set_num_output(4);
+  for (int g = 0; g < 2; ++g) {
+    Blob<TypeParam> bottom(2, 2, 3, 5, 4), top;
+    vector<Blob<TypeParam>*> bottom_vec(1, &bottom), top_vec(1, &top);
+    for (int n = 0; n < 2; ++n) {
+      caffe_copy(bottom.count() / 2,
+          this->blob_bottom_->cpu_data() + this->blob_bottom_->offset(n, 2 * g),
+          bottom.mutable_cpu_data() + bottom.offset(n));
+    }
+    Convolution3DLayer<TypeParam> group_layer(layer_param);
+    group_layer.SetUp(bottom_vec, &top_vec);
+    const int weight_count = group_layer.blobs()[0]->count();
+    caffe_copy(weight_count, layer.blobs()[0]->cpu_data() + g * weight_count,
+        group_layer.blobs()[0]->mutable_cpu_data());
+    caffe_copy(4, layer.blobs()[1]->cpu_data() + g * 4,
+        group_layer.blobs()[1]->mutable_cpu_data());
+    group_layer.Forward(bottom_vec, &top_vec);
+    for (int n = 0; n < 2; ++n) {
+      caffe_copy(top.count() / 2,
+          this->blob_top_->cpu_diff() + this->blob_top_->offset(n, 4 * g),
+          top.mutable_cpu_diff() + top.offset(n));
+    }
+    group_layer.Backward(top_vec, true, &bottom_vec);
+    for (int n = 0; n < 2; ++n) {
+      for (int i = 0; i < top.count() / 2; ++i) {
+        EXPECT_NEAR(top.cpu_data()[top.offset(n) + i],
+            this->blob_top_->cpu_data()[this->blob_top_->offset(n, 4 * g) + i],
+            1e-4);
+      }
+      for (int i = 0; i < bottom.count() / 2; ++i) {
+        EXPECT_NEAR(bottom.cpu_diff()[bottom.offset(n) + i],
+            this->blob_bottom_->cpu_diff()[
+            this->blob_bottom_->offset(n, 2 * g) + i], 1e-4);
+      }
+    }
+    for (int i = 0; i < weight_count; ++i) {
+      EXPECT_NEAR(group_layer.blobs()[0]->cpu_diff()[i],
+          layer.blobs()[0]->cpu_diff()[g * weight_count + i], 1e-3);
+    }
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUSparseMatchesDense) {
+  // Pruned filters give the same output on the sparse path, with channel
+  // and filter groups and several clips per GEMM, and on several threads.
+  this->blob_bottom_->Reshape(3, 4, 3, 5, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(8);
+  convolution_param->set_group(2);
+  convolution_param->set_filter_group(2);
+  convolution_param->set_clips_per_gemm(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  TypeParam* weight = layer.blobs()[0]->mutable_cpu_data();
+  for (int i = 0; i < layer.blobs()[0]->count(); ++i) {
+    if (i % 5 != 0) {
+      weight[i] = 0;
+    }
+  }
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+
+  // DIRECT is overridden by the sparse GEMM path
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  layer_param.mutable_sparsity_param();
+  for (int threads = 1; threads <= 2; ++threads) {
+    Caffe::set_cpu_threads(threads);
+    Convolution3DLayer<TypeParam> sparse_layer(layer_param);
+    sparse_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    sparse_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+    sparse_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+    sparse_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+          top_reference.cpu_data()[i], 1e-4);
+    }
+  }
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientGroup) {
+  this->blob_bottom_->Reshape(2, 4, 3, 4, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUDepthwiseMatchesGEMM) {
+  // The depthwise engine must agree with the grouped GEMM in both passes,
+  // for strides and paddings that clip the rows on either side.
+  this->blob_bottom_->Reshape(2, 3, 5, 6, 9);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  for (int stride = 1; stride <= 2; ++stride) {
+    for (int pad = 0; pad <= 2; ++pad) {
+      convolution_param->set_stride(stride);
+      convolution_param->set_temporal_stride(stride);
+      convolution_param->set_pad(pad);
+      convolution_param->set_temporal_pad(2 - pad);
+      convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+      Convolution3DLayer<TypeParam> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      Blob<TypeParam> top_reference, bottom_reference, weight_reference;
+      top_reference.CopyFrom(*this->blob_top_, false, true);
+      // use a random top diff
+      filler.Fill(this->blob_top_);
+      caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+          this->blob_top_->mutable_cpu_diff());
+      top_reference.CopyFrom(*this->blob_top_, true);
+      layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+      bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+      weight_reference.CopyFrom(*layer.blobs()[0], true, true);
+
+      // DEFAULT picks the depthwise engine for this shape
+      convolution_param->set_engine(ConvolutionParameter_Engine_DEFAULT);
+      Convolution3DLayer<TypeParam> depthwise_layer(layer_param);
+      depthwise_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      depthwise_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+      depthwise_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+      depthwise_layer.Forward(this->blob_bottom_vec_,
+          &(this->blob_top_vec_));
+      const TypeParam* top_data = this->blob_top_->cpu_data();
+      for (int i = 0; i < this->blob_top_->count(); ++i) {
+        EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+      }
+      this->blob_top_->CopyFrom(top_reference, true);
+      depthwise_layer.Backward(this->blob_top_vec_, true,
+          &(this->blob_bottom_vec_));
+      const TypeParam* bottom_diff = this->blob_bottom_->cpu_diff();
+      for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+        EXPECT_NEAR(bottom_diff[i], bottom_reference.cpu_diff()[i], 1e-4);
+      }
+      const TypeParam* weight_diff = depthwise_layer.blobs()[0]->cpu_diff();
+      for (int i = 0; i < weight_reference.count(); ++i) {
+        EXPECT_NEAR(weight_diff[i], weight_reference.cpu_diff()[i], 1e-3);
+      }
+    }
+  }
+}
+
+TYPED_TEST(Convolution3DLayerTest, TestCPUGradientDepthwise) {
+  this->blob_bottom_->Reshape(2, 2, 3, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_group(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DEPTHWISE);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(2);
+  Convolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+  Caffe::set_cpu_threads(1);
+}
+
+}  // namespace caffe
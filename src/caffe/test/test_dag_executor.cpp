@@ -0,0 +1,74 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <pthread.h>
+
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/util/dag_executor.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Records when every task starts and finishes, on one clock of events.
+struct DagRecord {
+  pthread_mutex_t mutex;
+  int clock;
+  std::vector<int> start, finish;
+};
+
+static void RecordTask(DagRecord* record, const int task) {
+  pthread_mutex_lock(&record->mutex);
+  record->start[task] = record->clock++;
+  pthread_mutex_unlock(&record->mutex);
+  // some work, so that independent tasks overlap
+  volatile double sum = 0;
+  for (int i = 0; i < 10000; ++i) {
+    sum += i;
+  }
+  pthread_mutex_lock(&record->mutex);
+  record->finish[task] = record->clock++;
+  pthread_mutex_unlock(&record->mutex);
+}
+
+class DagExecutorTest : public ::testing::Test {};
+
+TEST_F(DagExecutorTest, TestDependencies) {
+  // two towers of three tasks between a fork and a join, run five times
+  std::vector<std::vector<int> > predecessors(8);
+  predecessors[1].push_back(0);
+  predecessors[2].push_back(0);
+  predecessors[3].push_back(1);
+  predecessors[4].push_back(2);
+  predecessors[5].push_back(3);
+  predecessors[6].push_back(4);
+  predecessors[7].push_back(5);
+  predecessors[7].push_back(6);
+  for (int num_threads = 1; num_threads <= 3; ++num_threads) {
+    DagExecutor executor(predecessors, num_threads);
+    EXPECT_EQ(executor.num_tasks(), 8);
+    EXPECT_EQ(executor.num_threads(), num_threads);
+    for (int run = 0; run < 5; ++run) {
+      DagRecord record;
+      pthread_mutex_init(&record.mutex, NULL);
+      record.clock = 0;
+      record.start.assign(8, -1);
+      record.finish.assign(8, -1);
+      executor.Run(boost::bind(&RecordTask, &record, _1));
+      pthread_mutex_destroy(&record.mutex);
+      for (int i = 0; i < 8; ++i) {
+        EXPECT_GE(record.start[i], 0) << i;
+        for (int j = 0; j < predecessors[i].size(); ++j) {
+          EXPECT_GT(record.start[i], record.finish[predecessors[i][j]])
+              << i << " " << predecessors[i][j];
+        }
+      }
+    }
+  }
+}
+
+}  // namespace caffe
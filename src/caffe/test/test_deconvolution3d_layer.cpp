@@ -10,6 +10,8 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/vision_layers.hpp"
+#include "caffe/video_3d_layers.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -82,4 +84,274 @@ TYPED_TEST(SoftmaxLayerTest, TestGradientCPU) {
       &(this->blob_top_vec_));
 }
 
+template <typename Dtype>
+class Deconvolution3DLayerTest : public ::testing::Test {
+ protected:
+  Deconvolution3DLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 2, 3, 3, 4)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~Deconvolution3DLayerTest() { delete blob_bottom_; delete blob_top_; }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(Deconvolution3DLayerTest, Dtypes);
+
+TYPED_TEST(Deconvolution3DLayerTest, TestSetup) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  Deconvolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 2);
+  EXPECT_EQ(this->blob_top_->length(), 5);
+  EXPECT_EQ(this->blob_top_->height(), 6);
+  EXPECT_EQ(this->blob_top_->width(), 8);
+}
+
+TYPED_TEST(Deconvolution3DLayerTest, TestCPUGradient) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Deconvolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Deconvolution3DLayerTest, TestCPUThreadedForward) {
+  // Concurrent clips, and a single clip whose col2vol is split into slabs of
+  // frames, give the single-threaded output, with both engines.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_temporal_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  for (int i = 0; i < 4; ++i) {
+    const int num = (i % 2) ? 3 : 1;
+    convolution_param->set_engine(i < 2 ? ConvolutionParameter_Engine_GEMM :
+        ConvolutionParameter_Engine_PHASE);
+    this->blob_bottom_->Reshape(num, 4, 4, 16, 16);
+    FillerParameter filler_param;
+    GaussianFiller<TypeParam> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    Deconvolution3DLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    Blob<TypeParam> top_reference;
+    top_reference.CopyFrom(*this->blob_top_, false, true);
+    Caffe::set_cpu_threads(3);
+    caffe_set(this->blob_top_->count(), TypeParam(7),
+        this->blob_top_->mutable_cpu_data());
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    Caffe::set_cpu_threads(1);
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+          top_reference.cpu_data()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(Deconvolution3DLayerTest, TestCPUPhaseMatchesGEMM) {
+  // The PHASE engine must agree with GEMM + col2vol: kernels larger than,
+  // equal to (every phase a single tap on the input) and smaller than the
+  // stride (phases no tap reaches), padding, mixed strides, filter groups.
+  const int shapes[][6] = {
+    // kernel_size, kernel_depth, stride, temporal_stride, pad, temporal_pad
+    {3, 3, 2, 2, 1, 1},
+    {4, 3, 2, 1, 1, 1},
+    {2, 2, 2, 2, 0, 0},
+    {1, 3, 2, 2, 0, 2},
+    {5, 4, 3, 2, 2, 1}
+  };
+  for (int s = 0; s < sizeof(shapes) / sizeof(shapes[0]); ++s) {
+    for (int filter_group = 1; filter_group <= 2; ++filter_group) {
+      LayerParameter layer_param;
+      ConvolutionParameter* convolution_param =
+          layer_param.mutable_convolution_param();
+      convolution_param->set_kernel_size(shapes[s][0]);
+      convolution_param->set_kernel_depth(shapes[s][1]);
+      convolution_param->set_stride(shapes[s][2]);
+      convolution_param->set_temporal_stride(shapes[s][3]);
+      convolution_param->set_pad(shapes[s][4]);
+      convolution_param->set_temporal_pad(shapes[s][5]);
+      convolution_param->set_num_output(4);
+      convolution_param->set_filter_group(filter_group);
+      convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+      convolution_param->mutable_weight_filler()->set_type("gaussian");
+      convolution_param->mutable_bias_filler()->set_type("gaussian");
+      Caffe::set_mode(Caffe::CPU);
+      Deconvolution3DLayer<TypeParam> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      Blob<TypeParam> top_reference, bottom_reference;
+      top_reference.CopyFrom(*this->blob_top_, false, true);
+      FillerParameter filler_param;
+      GaussianFiller<TypeParam> filler(filler_param);
+      filler.Fill(this->blob_top_);
+      caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+          this->blob_top_->mutable_cpu_diff());
+      top_reference.CopyFrom(*this->blob_top_, true);
+      layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+      bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+
+      convolution_param->set_engine(ConvolutionParameter_Engine_PHASE);
+      Deconvolution3DLayer<TypeParam> phase_layer(layer_param);
+      phase_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      phase_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+      phase_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+      caffe_set(this->blob_top_->count(), TypeParam(7),
+          this->blob_top_->mutable_cpu_data());
+      phase_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      for (int i = 0; i < this->blob_top_->count(); ++i) {
+        EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+            top_reference.cpu_data()[i], 1e-4);
+      }
+      this->blob_top_->CopyFrom(top_reference, true);
+      phase_layer.Backward(this->blob_top_vec_, true,
+          &(this->blob_bottom_vec_));
+      for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+        EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+            bottom_reference.cpu_diff()[i], 1e-4);
+      }
+      // the filters are repacked when the weights change
+      caffe_scal(phase_layer.blobs()[0]->count(), TypeParam(2),
+          phase_layer.blobs()[0]->mutable_cpu_data());
+      caffe_set(phase_layer.blobs()[1]->count(), TypeParam(0),
+          phase_layer.blobs()[1]->mutable_cpu_data());
+      caffe_set(layer.blobs()[1]->count(), TypeParam(0),
+          layer.blobs()[1]->mutable_cpu_data());
+      layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      top_reference.CopyFrom(*this->blob_top_);
+      phase_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+      for (int i = 0; i < this->blob_top_->count(); ++i) {
+        EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+            2 * top_reference.cpu_data()[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(Deconvolution3DLayerTest, TestCPUGradientPhase) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_kernel_depth(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_temporal_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_PHASE);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Deconvolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Deconvolution3DLayerTest, TestCPUFFTMatchesGEMM) {
+  // The FFT engine must agree with vol2col + GEMM in both passes.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(5);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Deconvolution3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference, bottom_reference, weight_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  // use a random top diff
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  top_reference.CopyFrom(*this->blob_top_, true);
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  bottom_reference.CopyFrom(*this->blob_bottom_, true, true);
+  weight_reference.CopyFrom(*layer.blobs()[0], true, true);
+
+  convolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  Deconvolution3DLayer<TypeParam> fft_layer(layer_param);
+  fft_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  fft_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  fft_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  fft_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], top_reference.cpu_data()[i], 1e-4);
+  }
+  this->blob_top_->CopyFrom(top_reference, true);
+  fft_layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  const TypeParam* bottom_diff = this->blob_bottom_->cpu_diff();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(bottom_diff[i], bottom_reference.cpu_diff()[i], 1e-4);
+  }
+  const TypeParam* weight_diff = fft_layer.blobs()[0]->cpu_diff();
+  for (int i = 0; i < weight_reference.count(); ++i) {
+    EXPECT_NEAR(weight_diff[i], weight_reference.cpu_diff()[i], 1e-3);
+  }
+}
+
+TYPED_TEST(Deconvolution3DLayerTest, TestCPUGradientFFT) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_kernel_depth(5);
+  convolution_param->set_pad(1);
+  convolution_param->set_temporal_pad(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  Deconvolution3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
 }  // namespace caffe
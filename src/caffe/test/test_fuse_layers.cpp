@@ -0,0 +1,357 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <string>
+#include <vector>
+
+#include "cuda_runtime.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/neuron_layers.hpp"
+#include "caffe/video_3d_layers.hpp"
+#include "caffe/util/fuse_layers.hpp"
+#include "caffe/util/layout.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::string;
+
+namespace caffe {
+
+extern cudaDeviceProp CAFFE_TEST_CUDA_PROP;
+
+template <typename Dtype>
+class Convolution3DFusionTest : public ::testing::Test {
+ protected:
+  Convolution3DFusionTest()
+      : blob_bottom_(new Blob<Dtype>(3, 3, 4, 6, 6)),
+        blob_conv_(new Blob<Dtype>()),
+        blob_pool_(new Blob<Dtype>()),
+        blob_fused_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+  }
+  virtual ~Convolution3DFusionTest() {
+    delete blob_bottom_;
+    delete blob_conv_;
+    delete blob_pool_;
+    delete blob_fused_;
+  }
+
+  // Runs CONVOLUTION3D + in-place RELU (+ POOLING3D) as separate layers and
+  // as one fused layer, and checks that the outputs are identical.
+  void CheckFusion(const ConvolutionParameter& convolution_param,
+      const bool pooling) {
+    LayerParameter layer_param;
+    layer_param.mutable_convolution_param()->CopyFrom(convolution_param);
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+    pooling_param->set_kernel_size(3);
+    pooling_param->set_stride(2);
+    pooling_param->set_kernel_depth(2);
+    pooling_param->set_temporal_stride(2);
+    vector<Blob<Dtype>*> conv_vec(1, blob_conv_);
+    vector<Blob<Dtype>*> pool_vec(1, blob_pool_);
+    vector<Blob<Dtype>*> fused_vec(1, blob_fused_);
+    Convolution3DLayer<Dtype> conv_layer(layer_param);
+    conv_layer.SetUp(blob_bottom_vec_, &conv_vec);
+    ReLULayer<Dtype> relu_layer(layer_param);
+    relu_layer.SetUp(conv_vec, &conv_vec);
+    Pooling3DLayer<Dtype> pool_layer(layer_param);
+    if (pooling) {
+      pool_layer.SetUp(conv_vec, &pool_vec);
+    }
+    layer_param.mutable_convolution_param()->set_fused_relu(true);
+    layer_param.mutable_convolution_param()->set_fused_pooling(pooling);
+    Convolution3DLayer<Dtype> fused_layer(layer_param);
+    fused_layer.SetUp(blob_bottom_vec_, &fused_vec);
+    for (int i = 0; i < conv_layer.blobs().size(); ++i) {
+      fused_layer.blobs()[i]->CopyFrom(*conv_layer.blobs()[i]);
+    }
+    Blob<Dtype>* reference = pooling ? blob_pool_ : blob_conv_;
+    EXPECT_EQ(blob_fused_->num(), reference->num());
+    EXPECT_EQ(blob_fused_->channels(), reference->channels());
+    EXPECT_EQ(blob_fused_->length(), reference->length());
+    EXPECT_EQ(blob_fused_->height(), reference->height());
+    EXPECT_EQ(blob_fused_->width(), reference->width());
+    EXPECT_EQ(blob_fused_->layout(), reference->layout());
+    for (int threads = 1; threads <= 2; ++threads) {
+      Caffe::set_cpu_threads(threads);
+      conv_layer.Forward(blob_bottom_vec_, &conv_vec);
+      relu_layer.Forward(conv_vec, &conv_vec);
+      if (pooling) {
+        pool_layer.Forward(conv_vec, &pool_vec);
+      }
+      fused_layer.Forward(blob_bottom_vec_, &fused_vec);
+      for (int i = 0; i < reference->count(); ++i) {
+        EXPECT_EQ(blob_fused_->cpu_data()[i], reference->cpu_data()[i]);
+      }
+    }
+    Caffe::set_cpu_threads(1);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_conv_;
+  Blob<Dtype>* const blob_pool_;
+  Blob<Dtype>* const blob_fused_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(Convolution3DFusionTest, Dtypes);
+
+TYPED_TEST(Convolution3DFusionTest, TestCPUFusedMatchesUnfused) {
+  Caffe::set_mode(Caffe::CPU);
+  const ConvolutionParameter_Engine engines[] = {
+    ConvolutionParameter_Engine_GEMM, ConvolutionParameter_Engine_GEMM,
+    ConvolutionParameter_Engine_DIRECT, ConvolutionParameter_Engine_WINOGRAD,
+    ConvolutionParameter_Engine_FFT
+  };
+  for (int e = 0; e < 5; ++e) {
+    ConvolutionParameter convolution_param;
+    convolution_param.set_kernel_size(3);
+    convolution_param.set_kernel_depth(3);
+    convolution_param.set_pad(1);
+    convolution_param.set_temporal_pad(1);
+    convolution_param.set_num_output(4);
+    convolution_param.set_clips_per_gemm(e == 1 ? 2 : 1);
+    convolution_param.set_engine(engines[e]);
+    convolution_param.mutable_weight_filler()->set_type("gaussian");
+    convolution_param.mutable_bias_filler()->set_type("gaussian");
+    this->CheckFusion(convolution_param, false);
+    this->CheckFusion(convolution_param, true);
+    convolution_param.set_bias_term(false);
+    this->CheckFusion(convolution_param, true);
+  }
+}
+
+TYPED_TEST(Convolution3DFusionTest, TestCPUFusedReLUChannelsLast) {
+  Caffe::set_mode(Caffe::CPU);
+  Blob<TypeParam> bottom(3, 3, 4, 6, 6);
+  bottom.set_layout(NLHWC);
+  convert_layout_cpu(this->blob_bottom_->cpu_data(), 3, 3, 4 * 6 * 6, NCLHW,
+      bottom.mutable_cpu_data());
+  this->blob_bottom_->CopyFrom(bottom, false, true);
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(3);
+  convolution_param.set_kernel_depth(3);
+  convolution_param.set_stride(2);
+  convolution_param.set_num_output(5);
+  convolution_param.set_clips_per_gemm(2);
+  convolution_param.mutable_weight_filler()->set_type("gaussian");
+  convolution_param.mutable_bias_filler()->set_type("gaussian");
+  this->CheckFusion(convolution_param, false);
+}
+
+class FuseConvolution3DTest : public ::testing::Test {
+ protected:
+  void RunFusionTest(
+      const string& input_param_string, const string& output_param_string) {
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    FuseConvolution3D(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    // Also test idempotence.
+    NetParameter double_fuse_param;
+    FuseConvolution3D(actual_output_param, &double_fuse_param);
+    EXPECT_EQ(actual_output_param.DebugString(),
+        double_fuse_param.DebugString());
+  }
+};
+
+TEST_F(FuseConvolution3DTest, TestFusion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "fuse_convolution3d: true "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "} "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'conv2' "
+      "  top: 'conv2' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "fuse_convolution3d: true "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'pool1' "
+      "  convolution_param { fused_relu: true fused_pooling: true } "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "} "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "  convolution_param { fused_relu: true } "
+      "} ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FuseConvolution3DTest, TestNoPoolingFusion) {
+  // The pooling is not fused when the convolution output has another
+  // reader, uses padding or averages.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "} "
+      "layers: { "
+      "  name: 'fc1' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'conv1' "
+      "  top: 'fc1' "
+      "} "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'pool2' "
+      "  type: POOLING3D "
+      "  bottom: 'conv2' "
+      "  top: 'pool2' "
+      "  pooling_param { pool: AVE kernel_size: 2 stride: 2 } "
+      "} ";
+  this->RunFusionTest(input_proto, input_proto);
+}
+
+TEST_F(FuseConvolution3DTest, TestKeepBlob) {
+  // a kept convolution output stays in the net: the ReLU is fused, the
+  // pooling is not
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "keep_blob: 'conv1' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "keep_blob: 'conv1' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { fused_relu: true } "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "} ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FuseConvolution3DTest, TestNoReLUFusion) {
+  // only an in-place ReLU right after the convolution is fused
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'relu1' "
+      "} "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'relu1' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'drop2' "
+      "  type: DROPOUT "
+      "  bottom: 'conv2' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'conv2' "
+      "  top: 'conv2' "
+      "} ";
+  this->RunFusionTest(input_proto, input_proto);
+}
+
+}  // namespace caffe
@@ -0,0 +1,111 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdint.h>
+
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HostAllocatorTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    HostAllocator& allocator = HostAllocator::Get();
+    use_malloc_ = allocator.use_malloc();
+    cache_limit_ = allocator.cache_limit();
+    allocator.set_use_malloc(false);
+    allocator.ReleaseCache();
+  }
+
+  virtual void TearDown() {
+    HostAllocator& allocator = HostAllocator::Get();
+    allocator.set_use_malloc(use_malloc_);
+    allocator.set_cache_limit(cache_limit_);
+  }
+
+  bool use_malloc_;
+  size_t cache_limit_;
+};
+
+TEST_F(HostAllocatorTest, TestAlignment) {
+  HostAllocator& allocator = HostAllocator::Get();
+  const size_t sizes[] = {1, 3, 64, 100, 4097, 1 << 20, 3 << 20};
+  for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    void* ptr = allocator.Allocate(sizes[i]);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % 64, 0) << sizes[i];
+    memset(ptr, 1, sizes[i]);
+    allocator.Free(ptr);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestCache) {
+  HostAllocator& allocator = HostAllocator::Get();
+  const HostAllocatorStats before = allocator.stats();
+  // 1000 and 1010 bytes share a size class, 5000 bytes do not
+  void* ptr = allocator.Allocate(1000);
+  HostAllocatorStats stats = allocator.stats();
+  EXPECT_EQ(stats.allocations, before.allocations + 1);
+  EXPECT_EQ(stats.cache_hits, before.cache_hits);
+  EXPECT_GE(stats.bytes_in_use, before.bytes_in_use + 1000);
+  EXPECT_GE(stats.peak_bytes_in_use, stats.bytes_in_use);
+  allocator.Free(ptr);
+  stats = allocator.stats();
+  EXPECT_EQ(stats.bytes_in_use, before.bytes_in_use);
+  EXPECT_GT(stats.bytes_cached, 0);
+  void* other = allocator.Allocate(5000);
+  EXPECT_EQ(allocator.stats().cache_hits, before.cache_hits);
+  void* reused = allocator.Allocate(1010);
+  EXPECT_EQ(reused, ptr);
+  EXPECT_EQ(allocator.stats().cache_hits, before.cache_hits + 1);
+  allocator.Free(other);
+  allocator.Free(reused);
+  allocator.ReleaseCache();
+  EXPECT_EQ(allocator.stats().bytes_cached, 0);
+}
+
+TEST_F(HostAllocatorTest, TestCacheLimit) {
+  HostAllocator& allocator = HostAllocator::Get();
+  allocator.set_cache_limit(0);
+  void* ptr = allocator.Allocate(1000);
+  allocator.Free(ptr);
+  EXPECT_EQ(allocator.stats().bytes_cached, 0);
+}
+
+TEST_F(HostAllocatorTest, TestMalloc) {
+  HostAllocator& allocator = HostAllocator::Get();
+  void* pooled = allocator.Allocate(1000);
+  allocator.set_use_malloc(true);
+  const HostAllocatorStats before = allocator.stats();
+  void* ptr = allocator.Allocate(1000);
+  memset(ptr, 1, 1000);
+  EXPECT_EQ(allocator.stats().allocations, before.allocations);
+  allocator.Free(ptr);
+  // a block allocated before the switch is still freed by the allocator
+  allocator.Free(pooled);
+  EXPECT_EQ(allocator.stats().bytes_in_use + 1024, before.bytes_in_use);
+  EXPECT_EQ(allocator.stats().bytes_cached, 0);
+}
+
+TEST_F(HostAllocatorTest, TestSyncedMemory) {
+  HostAllocator& allocator = HostAllocator::Get();
+  const HostAllocatorStats before = allocator.stats();
+  {
+    SyncedMemory mem(1000);
+    const char* data = static_cast<const char*>(mem.cpu_data());
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(data) % 64, 0);
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(data[i], 0);
+    }
+    EXPECT_GT(allocator.stats().bytes_in_use, before.bytes_in_use);
+  }
+  EXPECT_EQ(allocator.stats().bytes_in_use, before.bytes_in_use);
+}
+
+}  // namespace caffe
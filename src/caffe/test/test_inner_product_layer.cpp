@@ -1,5 +1,7 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <vector>
 
@@ -75,6 +77,112 @@ TYPED_TEST(InnerProductLayerTest, TestCPU) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestCPUInt8MatchesFP32) {
+  // Rounding a bottom value and a weight moves their product by at most
+  // |w| * bottom_scale / 2 + |x| * weight_scale / 2 + the product of the
+  // half scales.
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  Caffe::set_mode(Caffe::CPU);
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+
+  const TypeParam* bottom_data = this->blob_bottom_->cpu_data();
+  TypeParam range = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    range = std::max(range, std::fabs(bottom_data[i]));
+  }
+  layer_param.mutable_quantization_param()->set_precision(
+      QuantizationParameter_Precision_INT8);
+  layer_param.mutable_quantization_param()->set_bottom_range(range);
+  InnerProductLayer<TypeParam> int8_layer(layer_param);
+  int8_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  int8_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  int8_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  int8_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const int num = this->blob_bottom_->num();
+  const int dim = this->blob_bottom_->count() / num;
+  const TypeParam* weight = layer.blobs()[0]->cpu_data();
+  const TypeParam bottom_scale = range / 127;
+  for (int o = 0; o < 10; ++o) {
+    TypeParam weight_range = 0;
+    for (int k = 0; k < dim; ++k) {
+      weight_range = std::max(weight_range, std::fabs(weight[o * dim + k]));
+    }
+    const TypeParam weight_scale = weight_range / 127;
+    for (int n = 0; n < num; ++n) {
+      TypeParam bound = 1e-4;
+      for (int k = 0; k < dim; ++k) {
+        bound += std::fabs(weight[o * dim + k]) * bottom_scale / 2 +
+            std::fabs(bottom_data[n * dim + k]) * weight_scale / 2 +
+            bottom_scale * weight_scale / 4;
+      }
+      EXPECT_NEAR(this->blob_top_->cpu_data()[n * 10 + o],
+          top_reference.cpu_data()[n * 10 + o], bound);
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestCPUSparseMatchesDense) {
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  Caffe::set_mode(Caffe::CPU);
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // prune all but the largest weights
+  const TypeParam threshold = 1.2;
+  TypeParam* weight = layer.blobs()[0]->mutable_cpu_data();
+  for (int i = 0; i < layer.blobs()[0]->count(); ++i) {
+    if (std::fabs(weight[i]) <= threshold) {
+      weight[i] = 0;
+    }
+  }
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+
+  // the sparse layer is given the unpruned weights and prunes them itself
+  layer_param.mutable_sparsity_param()->set_threshold(threshold);
+  InnerProductLayer<TypeParam> sparse_layer(layer_param);
+  sparse_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  sparse_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  sparse_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < layer.blobs()[0]->count(); ++i) {
+    const TypeParam value = sparse_layer.blobs()[0]->cpu_data()[i];
+    EXPECT_TRUE(value == 0 || std::fabs(value) > threshold);
+  }
+  sparse_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  sparse_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i],
+        1e-4);
+  }
+  // snapshots hold the nonzero weights only
+  LayerParameter snapshot;
+  sparse_layer.ToProto(&snapshot);
+  EXPECT_GT(snapshot.blobs(0).sparse_gap_size(), 0);
+  EXPECT_LT(snapshot.blobs(0).data_size(), layer.blobs()[0]->count() / 2);
+  EXPECT_EQ(snapshot.blobs(1).sparse_gap_size(), 0);
+  InnerProductLayer<TypeParam> restored_layer(layer_param);
+  restored_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  restored_layer.blobs()[0]->FromProto(snapshot.blobs(0));
+  for (int i = 0; i < layer.blobs()[0]->count(); ++i) {
+    EXPECT_EQ(restored_layer.blobs()[0]->cpu_data()[i],
+        static_cast<float>(layer.blobs()[0]->cpu_data()[i]));
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGPU) {
   if (sizeof(TypeParam) == 4 || CAFFE_TEST_CUDA_PROP.major >= 2) {
     LayerParameter layer_param;
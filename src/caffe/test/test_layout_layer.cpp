@@ -0,0 +1,402 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <string>
+#include <vector>
+
+#include "cuda_runtime.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/video_3d_layers.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::string;
+
+namespace caffe {
+
+extern cudaDeviceProp CAFFE_TEST_CUDA_PROP;
+
+template <typename Dtype>
+class LayoutLayerTest : public ::testing::Test {
+ protected:
+  LayoutLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5, 6)),
+        blob_bottom_2_(new Blob<Dtype>(2, 2, 4, 5, 6)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    filler.Fill(this->blob_bottom_2_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~LayoutLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_2_;
+    delete blob_top_;
+  }
+
+  // Runs the layer on the NCLHW bottoms and on NLHWC copies of them, and
+  // checks that the NLHWC top and bottom diffs are the transposed NCLHW ones.
+  void CheckChannelsLast(const LayerParameter& layer_param,
+      const vector<Blob<Dtype>*>& bottom) {
+    Caffe::set_mode(Caffe::CPU);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    vector<Blob<Dtype>*> bottom_vec(bottom);
+    shared_ptr<Layer<Dtype> > layer(GetLayer<Dtype>(layer_param));
+    layer->SetUp(bottom_vec, &blob_top_vec_);
+    layer->Forward(bottom_vec, &blob_top_vec_);
+    Blob<Dtype> top_diff;
+    top_diff.ReshapeLike(*blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        blob_top_->mutable_cpu_diff());
+    layer->Backward(blob_top_vec_, true, &bottom_vec);
+
+    vector<shared_ptr<Blob<Dtype> > > cl_bottom(bottom.size());
+    vector<Blob<Dtype>*> cl_bottom_vec(bottom.size());
+    for (int i = 0; i < bottom.size(); ++i) {
+      cl_bottom[i].reset(new Blob<Dtype>());
+      cl_bottom[i]->ReshapeLike(*bottom[i]);
+      cl_bottom[i]->set_layout(NLHWC);
+      convert_layout_cpu(bottom[i]->cpu_data(), bottom[i]->num(),
+          bottom[i]->channels(), Spatial(*bottom[i]), NCLHW,
+          cl_bottom[i]->mutable_cpu_data());
+      cl_bottom_vec[i] = cl_bottom[i].get();
+    }
+    Blob<Dtype> cl_top;
+    vector<Blob<Dtype>*> cl_top_vec(1, &cl_top);
+    shared_ptr<Layer<Dtype> > cl_layer(GetLayer<Dtype>(layer_param));
+    cl_layer->SetUp(cl_bottom_vec, &cl_top_vec);
+    EXPECT_EQ(cl_top.layout(), NLHWC);
+    cl_layer->Forward(cl_bottom_vec, &cl_top_vec);
+    Blob<Dtype> converted;
+    converted.ReshapeLike(*blob_top_);
+    convert_layout_cpu(cl_top.cpu_data(), cl_top.num(), cl_top.channels(),
+        Spatial(cl_top), NLHWC, converted.mutable_cpu_data());
+    for (int i = 0; i < converted.count(); ++i) {
+      EXPECT_NEAR(converted.cpu_data()[i], blob_top_->cpu_data()[i], 1e-5);
+    }
+    convert_layout_cpu(blob_top_->cpu_diff(), cl_top.num(),
+        cl_top.channels(), Spatial(cl_top), NCLHW, cl_top.mutable_cpu_diff());
+    cl_layer->Backward(cl_top_vec, true, &cl_bottom_vec);
+    // the second bottom of Crop3D gets no gradient
+    const int num_diffs = (layer_param.type() ==
+        LayerParameter_LayerType_CROP3D) ? 1 : bottom.size();
+    for (int i = 0; i < num_diffs; ++i) {
+      converted.ReshapeLike(*bottom[i]);
+      convert_layout_cpu(cl_bottom[i]->cpu_diff(), bottom[i]->num(),
+          bottom[i]->channels(), Spatial(*bottom[i]), NLHWC,
+          converted.mutable_cpu_data());
+      for (int j = 0; j < converted.count(); ++j) {
+        EXPECT_NEAR(converted.cpu_data()[j], bottom[i]->cpu_diff()[j], 1e-5);
+      }
+    }
+  }
+
+  static int Spatial(const Blob<Dtype>& blob) {
+    return blob.length() * blob.height() * blob.width();
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_2_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(LayoutLayerTest, Dtypes);
+
+TYPED_TEST(LayoutLayerTest, TestSetup) {
+  LayerParameter layer_param;
+  layer_param.mutable_layout_param()->set_layout(NLHWC);
+  LayoutLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 3);
+  EXPECT_EQ(this->blob_top_->length(), 4);
+  EXPECT_EQ(this->blob_top_->height(), 5);
+  EXPECT_EQ(this->blob_top_->width(), 6);
+  EXPECT_EQ(this->blob_top_->layout(), NLHWC);
+}
+
+TYPED_TEST(LayoutLayerTest, TestCPURoundTrip) {
+  LayerParameter layer_param;
+  layer_param.mutable_layout_param()->set_layout(NLHWC);
+  Caffe::set_mode(Caffe::CPU);
+  LayoutLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int l = 0; l < 4; ++l) {
+        for (int h = 0; h < 5; ++h) {
+          for (int w = 0; w < 6; ++w) {
+            EXPECT_EQ(this->blob_top_->data_at(n, c, l, h, w),
+                this->blob_bottom_->data_at(n, c, l, h, w));
+          }
+        }
+      }
+    }
+  }
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_->cpu_diff()[i],
+        this->blob_bottom_->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(LayoutLayerTest, TestCPUPooling3DChannelsLast) {
+  LayerParameter layer_param;
+  layer_param.set_type(LayerParameter_LayerType_POOLING3D);
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_stride(2);
+  pooling_param->set_temporal_stride(2);
+  this->CheckChannelsLast(layer_param, this->blob_bottom_vec_);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_AVE);
+  pooling_param->set_pad(1);
+  this->CheckChannelsLast(layer_param, this->blob_bottom_vec_);
+}
+
+TYPED_TEST(LayoutLayerTest, TestCPUCrop3DChannelsLast) {
+  LayerParameter layer_param;
+  layer_param.set_type(LayerParameter_LayerType_CROP3D);
+  Blob<TypeParam> shape(2, 1, 2, 3, 3);
+  vector<Blob<TypeParam>*> bottom(this->blob_bottom_vec_);
+  bottom.push_back(&shape);
+  this->CheckChannelsLast(layer_param, bottom);
+}
+
+TYPED_TEST(LayoutLayerTest, TestCPUConcatChannelsLast) {
+  LayerParameter layer_param;
+  layer_param.set_type(LayerParameter_LayerType_CONCAT);
+  vector<Blob<TypeParam>*> bottom(this->blob_bottom_vec_);
+  bottom.push_back(this->blob_bottom_2_);
+  this->CheckChannelsLast(layer_param, bottom);
+}
+
+class LayoutInsertionTest : public ::testing::Test {
+ protected:
+  void RunInsertionTest(
+      const string& input_param_string, const string& output_param_string) {
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    InsertLayoutConversions(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    // Also test idempotence.
+    NetParameter double_insert_param;
+    InsertLayoutConversions(actual_output_param, &double_insert_param);
+    EXPECT_EQ(actual_output_param.DebugString(),
+        double_insert_param.DebugString());
+  }
+};
+
+TEST_F(LayoutInsertionTest, TestNoInsertion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} ";
+  this->RunInsertionTest(input_proto, input_proto);
+}
+
+TEST_F(LayoutInsertionTest, TestInsertion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "input: 'label' "
+      "channels_last: true "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} "
+      "layers: { "
+      "  name: 'fc6' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'pool1' "
+      "  top: 'fc6' "
+      "} "
+      "layers: { "
+      "  name: 'relu6' "
+      "  type: RELU "
+      "  bottom: 'fc6' "
+      "  top: 'fc6' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: SOFTMAX_LOSS "
+      "  bottom: 'fc6' "
+      "  bottom: 'label' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "input: 'label' "
+      "channels_last: true "
+      "layers: { "
+      "  name: 'data_nlhwc' "
+      "  type: LAYOUT "
+      "  bottom: 'data' "
+      "  top: 'data_nlhwc' "
+      "  layout_param { layout: NLHWC } "
+      "} "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data_nlhwc' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1_nclhw' "
+      "  type: LAYOUT "
+      "  bottom: 'pool1' "
+      "  top: 'pool1_nclhw' "
+      "  layout_param { layout: NCLHW } "
+      "} "
+      "layers: { "
+      "  name: 'fc6' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'pool1_nclhw' "
+      "  top: 'fc6' "
+      "} "
+      "layers: { "
+      "  name: 'relu6' "
+      "  type: RELU "
+      "  bottom: 'fc6' "
+      "  top: 'fc6' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: SOFTMAX_LOSS "
+      "  bottom: 'fc6' "
+      "  bottom: 'label' "
+      "} ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(LayoutInsertionTest, TestInsertionInPlace) {
+  // An in-place layer without NLHWC support works on the converted copy,
+  // which is then converted back for the next Pooling3D.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "channels_last: true "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'drop1' "
+      "  type: DROPOUT "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "channels_last: true "
+      "layers: { "
+      "  name: 'data_nlhwc' "
+      "  type: LAYOUT "
+      "  bottom: 'data' "
+      "  top: 'data_nlhwc' "
+      "  layout_param { layout: NLHWC } "
+      "} "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION3D "
+      "  bottom: 'data_nlhwc' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'conv1_nclhw' "
+      "  type: LAYOUT "
+      "  bottom: 'conv1' "
+      "  top: 'conv1_nclhw' "
+      "  layout_param { layout: NCLHW } "
+      "} "
+      "layers: { "
+      "  name: 'drop1' "
+      "  type: DROPOUT "
+      "  bottom: 'conv1_nclhw' "
+      "  top: 'conv1_nclhw' "
+      "} "
+      "layers: { "
+      "  name: 'conv1_nclhw_nlhwc' "
+      "  type: LAYOUT "
+      "  bottom: 'conv1_nclhw' "
+      "  top: 'conv1_nclhw_nlhwc' "
+      "  layout_param { layout: NLHWC } "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING3D "
+      "  bottom: 'conv1_nclhw_nlhwc' "
+      "  top: 'pool1' "
+      "} ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+}  // namespace caffe
@@ -2,11 +2,14 @@
 
 #include <google/protobuf/text_format.h>
 #include <leveldb/db.h>
+#include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "caffe/common.hpp"
+#include "caffe/filler.hpp"
 #include "caffe/net.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 
@@ -133,4 +136,384 @@ TYPED_TEST(NetTest, TestGetLayerByName) {
   EXPECT_FALSE(net.layer_by_name("label"));
 }
 
+template <typename Dtype>
+class NetMemoryPlanTest : public ::testing::Test {
+ protected:
+  NetMemoryPlanTest() {
+    // conv1 and conv3 feed two consumers each (through splits), flat shares
+    // the data of conv3 in Forward
+    proto_ =
+        "name: 'TestMemoryPlan' "
+        "input: 'data' "
+        "input_dim: 2 input_dim: 3 input_dim: 4 input_dim: 6 input_dim: 6 "
+        "layers: { name: 'conv1' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 4 kernel_size: 3 kernel_depth: 3 "
+        "    pad: 1 temporal_pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'data' top: 'conv1' } "
+        "layers: { name: 'relu1' type: RELU bottom: 'conv1' top: 'conv1' } "
+        "layers: { name: 'conv2a' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 3 kernel_size: 1 kernel_depth: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'conv1' top: 'conv2a' } "
+        "layers: { name: 'conv2b' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 5 kernel_size: 3 kernel_depth: 1 "
+        "    pad: 1 weight_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'conv1' top: 'conv2b' } "
+        "layers: { name: 'concat' type: CONCAT "
+        "  bottom: 'conv2a' bottom: 'conv2b' top: 'concat' } "
+        "layers: { name: 'pool' type: POOLING3D "
+        "  pooling_param { pool: MAX kernel_size: 2 kernel_depth: 2 "
+        "    stride: 2 temporal_stride: 2 } "
+        "  bottom: 'concat' top: 'pool' } "
+        "layers: { name: 'conv3' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 6 kernel_size: 3 kernel_depth: 2 "
+        "    pad: 1 weight_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'pool' top: 'conv3' } "
+        "layers: { name: 'relu3' type: RELU bottom: 'conv3' top: 'relu3' } "
+        "layers: { name: 'flat' type: FLATTEN bottom: 'conv3' top: 'flat' } "
+        "layers: { name: 'ip' type: INNER_PRODUCT "
+        "  inner_product_param { num_output: 7 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'flat' top: 'ip' } "
+        "layers: { name: 'eltwise' type: ELTWISE "
+        "  bottom: 'relu3' bottom: 'conv3' top: 'sum' } ";
+  }
+
+  // Runs the net twice on the same random input, with weights from the same
+  // seed, and returns the blobs named in names.
+  void Run(const bool plan_memory, const vector<string>& names,
+      vector<vector<Dtype> >* values, size_t* distinct_memories) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto_, &param));
+    param.set_plan_memory(plan_memory);
+    param.add_keep_blob("conv2a");
+    Caffe::set_random_seed(1701);
+    Net<Dtype> net(param);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(net.input_blobs()[0]);
+    net.ForwardPrefilled();
+    net.ForwardPrefilled();
+    values->clear();
+    for (int i = 0; i < names.size(); ++i) {
+      const Blob<Dtype>& blob = *net.blob_by_name(names[i]);
+      values->push_back(vector<Dtype>(blob.cpu_data(),
+          blob.cpu_data() + blob.count()));
+    }
+    set<const void*> memories;
+    for (int i = 0; i < net.blobs().size(); ++i) {
+      memories.insert(net.blobs()[i]->cpu_data());
+    }
+    *distinct_memories = memories.size();
+  }
+
+  string proto_;
+};
+
+TYPED_TEST_CASE(NetMemoryPlanTest, Dtypes);
+
+TYPED_TEST(NetMemoryPlanTest, TestCPUPlannedMatchesUnplanned) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  // the outputs of the net and the kept blob conv2a
+  vector<string> names;
+  names.push_back("ip");
+  names.push_back("sum");
+  names.push_back("conv2a");
+  vector<vector<TypeParam> > expected, actual;
+  size_t unplanned_memories, planned_memories;
+  this->Run(false, names, &expected, &unplanned_memories);
+  this->Run(true, names, &actual, &planned_memories);
+  EXPECT_LT(planned_memories, unplanned_memories);
+  for (int i = 0; i < names.size(); ++i) {
+    ASSERT_EQ(expected[i].size(), actual[i].size());
+    for (int j = 0; j < expected[i].size(); ++j) {
+      EXPECT_EQ(expected[i][j], actual[i][j]) << names[i] << " " << j;
+    }
+  }
+}
+
+TYPED_TEST(NetMemoryPlanTest, TestCPUKeptBlobsNotShared) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(this->proto_, &param));
+  param.set_plan_memory(true);
+  param.add_keep_blob("conv2a");
+  Net<TypeParam> net(param);
+  const char* kept[] = {"data", "conv2a", "ip", "sum"};
+  for (int k = 0; k < 4; ++k) {
+    const void* memory = net.blob_by_name(kept[k])->cpu_data();
+    for (int i = 0; i < net.blobs().size(); ++i) {
+      if (net.blob_names()[i] != kept[k]) {
+        EXPECT_NE(memory, net.blobs()[i]->cpu_data())
+            << kept[k] << " " << net.blob_names()[i];
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetMemoryPlanTest, TestCPUFusedKeepsKeptBlob) {
+  // a feature extractor reading conv1 lists it in keep_blob, so neither
+  // fusing pool1 into conv1 nor planning the memory hides its values
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  const string proto =
+      "name: 'TestFusedKeepBlob' "
+      "input: 'data' "
+      "input_dim: 2 input_dim: 3 input_dim: 4 input_dim: 6 input_dim: 6 "
+      "layers: { name: 'conv1' type: CONVOLUTION3D "
+      "  convolution_param { num_output: 4 kernel_size: 3 kernel_depth: 3 "
+      "    pad: 1 temporal_pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "    bias_filler { type: 'gaussian' std: 0.1 } } "
+      "  bottom: 'data' top: 'conv1' } "
+      "layers: { name: 'relu1' type: RELU bottom: 'conv1' top: 'conv1' } "
+      "layers: { name: 'pool1' type: POOLING3D "
+      "  pooling_param { pool: MAX kernel_size: 2 kernel_depth: 2 "
+      "    stride: 2 temporal_stride: 2 } "
+      "  bottom: 'conv1' top: 'pool1' } "
+      "layers: { name: 'ip' type: INNER_PRODUCT "
+      "  inner_product_param { num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } } "
+      "  bottom: 'pool1' top: 'ip' } ";
+  vector<vector<TypeParam> > values(2);
+  for (int optimized = 0; optimized < 2; ++optimized) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    if (optimized) {
+      param.set_fuse_convolution3d(true);
+      param.set_plan_memory(true);
+      param.add_keep_blob("conv1");
+    }
+    Caffe::set_random_seed(1701);
+    Net<TypeParam> net(param);
+    ASSERT_TRUE(net.has_blob("conv1"));
+    FillerParameter filler_param;
+    GaussianFiller<TypeParam> filler(filler_param);
+    filler.Fill(net.input_blobs()[0]);
+    net.ForwardPrefilled();
+    const Blob<TypeParam>& conv1 = *net.blob_by_name("conv1");
+    values[optimized].assign(conv1.cpu_data(),
+        conv1.cpu_data() + conv1.count());
+  }
+  ASSERT_EQ(values[0].size(), values[1].size());
+  for (int i = 0; i < values[0].size(); ++i) {
+    EXPECT_NEAR(values[0][i], values[1][i], 1e-5) << i;
+  }
+}
+
+template <typename Dtype>
+class NetCheckpointTest : public ::testing::Test {
+ protected:
+  NetCheckpointTest() {
+    // the dropout mask of the first segment is drawn again when it is
+    // recomputed
+    proto_ =
+        "name: 'TestCheckpoint' "
+        "input: 'data' "
+        "input_dim: 2 input_dim: 3 input_dim: 4 input_dim: 6 input_dim: 6 "
+        "input: 'target' "
+        "input_dim: 2 input_dim: 5 input_dim: 1 input_dim: 1 input_dim: 1 "
+        "force_backward: true "
+        "layers: { name: 'conv1' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 4 kernel_size: 3 kernel_depth: 3 "
+        "    pad: 1 temporal_pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'data' top: 'conv1' } "
+        "layers: { name: 'relu1' type: RELU bottom: 'conv1' top: 'conv1' } "
+        "layers: { name: 'drop1' type: DROPOUT bottom: 'conv1' top: 'conv1' } "
+        "layers: { name: 'pool1' type: POOLING3D "
+        "  pooling_param { pool: MAX kernel_size: 2 kernel_depth: 2 "
+        "    stride: 2 temporal_stride: 2 } "
+        "  bottom: 'conv1' top: 'pool1' } "
+        "layers: { name: 'conv2' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 6 kernel_size: 3 kernel_depth: 2 "
+        "    pad: 1 weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'pool1' top: 'conv2' } "
+        "layers: { name: 'relu2' type: RELU bottom: 'conv2' top: 'conv2' } "
+        "layers: { name: 'ip' type: INNER_PRODUCT "
+        "  inner_product_param { num_output: 5 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'conv2' top: 'ip' } "
+        "layers: { name: 'loss' type: EUCLIDEAN_LOSS "
+        "  bottom: 'ip' bottom: 'target' } ";
+  }
+
+  // Runs Forward and Backward twice with weights and inputs from the same
+  // seed, and returns the loss followed by the parameter and input diffs.
+  void Run(const bool checkpointing, const string& checkpoint_blob,
+      vector<Dtype>* values) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto_, &param));
+    param.set_gradient_checkpointing(checkpointing);
+    if (!checkpoint_blob.empty()) {
+      param.add_checkpoint_blob(checkpoint_blob);
+    }
+    Caffe::set_random_seed(1701);
+    Net<Dtype> net(param);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(net.input_blobs()[0]);
+    filler.Fill(net.input_blobs()[1]);
+    values->clear();
+    for (int iter = 0; iter < 2; ++iter) {
+      Dtype loss;
+      net.ForwardPrefilled(&loss);
+      net.Backward();
+      values->push_back(loss);
+    }
+    for (int i = 0; i < net.params().size(); ++i) {
+      const Blob<Dtype>& blob = *net.params()[i];
+      values->insert(values->end(), blob.cpu_diff(),
+          blob.cpu_diff() + blob.count());
+    }
+    const Blob<Dtype>& data = *net.input_blobs()[0];
+    values->insert(values->end(), data.cpu_diff(),
+        data.cpu_diff() + data.count());
+    if (checkpointing && !checkpoint_blob.empty()) {
+      // conv1 and conv2 are only used in their segment
+      EXPECT_EQ(net.blob_by_name("conv1")->cpu_data(),
+          net.blob_by_name("conv2")->cpu_data());
+      EXPECT_NE(net.blob_by_name(checkpoint_blob)->cpu_data(),
+          net.blob_by_name("conv2")->cpu_data());
+    }
+  }
+
+  string proto_;
+};
+
+TYPED_TEST_CASE(NetCheckpointTest, Dtypes);
+
+TYPED_TEST(NetCheckpointTest, TestCPUCheckpointedMatchesStored) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  vector<TypeParam> expected, actual;
+  this->Run(false, "", &expected);
+  const char* checkpoint_blobs[] = {"pool1", ""};
+  for (int c = 0; c < 2; ++c) {
+    this->Run(true, checkpoint_blobs[c], &actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i], actual[i]) << checkpoint_blobs[c] << " " << i;
+    }
+  }
+}
+
+template <typename Dtype>
+class NetBranchTest : public ::testing::Test {
+ protected:
+  NetBranchTest() {
+    // two towers with a dropout each, between the SPLIT of data and an
+    // ELTWISE
+    proto_ =
+        "name: 'TestBranches' "
+        "input: 'data' "
+        "input_dim: 2 input_dim: 3 input_dim: 4 input_dim: 6 input_dim: 6 "
+        "input: 'target' "
+        "input_dim: 2 input_dim: 5 input_dim: 1 input_dim: 1 input_dim: 1 "
+        "force_backward: true "
+        "layers: { name: 'conv_a' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 4 kernel_size: 3 kernel_depth: 3 "
+        "    pad: 1 temporal_pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'data' top: 'conv_a' } "
+        "layers: { name: 'relu_a' type: RELU bottom: 'conv_a' top: 'conv_a' } "
+        "layers: { name: 'drop_a' type: DROPOUT "
+        "  bottom: 'conv_a' top: 'conv_a' } "
+        "layers: { name: 'conv_b' type: CONVOLUTION3D "
+        "  convolution_param { num_output: 4 kernel_size: 1 kernel_depth: 3 "
+        "    temporal_pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'data' top: 'conv_b' } "
+        "layers: { name: 'relu_b' type: RELU bottom: 'conv_b' top: 'conv_b' } "
+        "layers: { name: 'drop_b' type: DROPOUT "
+        "  bottom: 'conv_b' top: 'conv_b' } "
+        "layers: { name: 'sum' type: ELTWISE "
+        "  eltwise_param { operation: SUM } "
+        "  bottom: 'conv_a' bottom: 'conv_b' top: 'sum' } "
+        "layers: { name: 'ip' type: INNER_PRODUCT "
+        "  inner_product_param { num_output: 5 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } } "
+        "  bottom: 'sum' top: 'ip' } "
+        "layers: { name: 'loss' type: EUCLIDEAN_LOSS "
+        "  bottom: 'ip' bottom: 'target' } ";
+  }
+
+  virtual void TearDown() {
+    Caffe::set_cpu_threads(1);
+  }
+
+  // Runs Forward, and in the TRAIN phase Backward, twice with weights and
+  // inputs from the same seed, and returns the loss and the data of ip
+  // followed by the parameter and input diffs.
+  void Run(const bool parallel, const int branch_threads,
+      vector<Dtype>* values) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto_, &param));
+    param.set_parallel_branches(parallel);
+    param.set_branch_threads(branch_threads);
+    param.set_plan_memory(true);
+    param.add_keep_blob("ip");
+    Caffe::set_random_seed(1701);
+    Net<Dtype> net(param);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(net.input_blobs()[0]);
+    filler.Fill(net.input_blobs()[1]);
+    values->clear();
+    for (int iter = 0; iter < 2; ++iter) {
+      Dtype loss;
+      net.ForwardPrefilled(&loss);
+      values->push_back(loss);
+      const Blob<Dtype>& ip = *net.blob_by_name("ip");
+      values->insert(values->end(), ip.cpu_data(),
+          ip.cpu_data() + ip.count());
+      if (Caffe::phase() == Caffe::TRAIN) {
+        net.Backward();
+      }
+    }
+    if (Caffe::phase() == Caffe::TEST) {
+      return;
+    }
+    for (int i = 0; i < net.params().size(); ++i) {
+      const Blob<Dtype>& blob = *net.params()[i];
+      values->insert(values->end(), blob.cpu_diff(),
+          blob.cpu_diff() + blob.count());
+    }
+    const Blob<Dtype>& data = *net.input_blobs()[0];
+    values->insert(values->end(), data.cpu_diff(),
+        data.cpu_diff() + data.count());
+  }
+
+  string proto_;
+};
+
+TYPED_TEST_CASE(NetBranchTest, Dtypes);
+
+TYPED_TEST(NetBranchTest, TestCPUParallelMatchesSerial) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(2);
+  const Caffe::Phase phases[] = {Caffe::TRAIN, Caffe::TEST};
+  for (int p = 0; p < 2; ++p) {
+    Caffe::set_phase(phases[p]);
+    vector<TypeParam> expected, actual;
+    this->Run(false, 0, &expected);
+    for (int branch_threads = 0; branch_threads <= 3; ++branch_threads) {
+      this->Run(true, branch_threads, &actual);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (int i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(expected[i], actual[i]) << p << " " << branch_threads
+            << " " << i;
+      }
+    }
+  }
+}
+
 }  // namespace caffe
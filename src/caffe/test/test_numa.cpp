@@ -0,0 +1,121 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <pthread.h>
+
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+#include "caffe/util/numa.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+static void RecordNode(std::vector<int>* nodes, const int thread_id) {
+  (*nodes)[thread_id] = NumaThreadNode();
+}
+
+// What a thread bound to node 0 sees.
+struct NumaThreadResult {
+  int thread_node;
+  int caffe_pool_node;
+  std::vector<int> worker_nodes;
+  // a block of 1000 bytes, freed again
+  void* block;
+};
+
+static void* BoundThread(void* arg) {
+  NumaThreadResult* result = reinterpret_cast<NumaThreadResult*>(arg);
+  NumaBindThread(0);
+  result->thread_node = NumaThreadNode();
+  result->caffe_pool_node = Caffe::thread_pool().numa_node();
+  ThreadPool pool(3, 0);
+  result->worker_nodes.resize(3, -1);
+  pool.Run(boost::bind(&RecordNode, &result->worker_nodes, _1));
+  result->block = HostAllocator::Get().Allocate(1000);
+  HostAllocator::Get().Free(result->block);
+  return NULL;
+}
+
+static void* BoundPoolThread(void* arg) {
+  NumaBindThread(0);
+  *reinterpret_cast<ThreadPool**>(arg) = &Caffe::thread_pool();
+  return NULL;
+}
+
+static NumaThreadResult RunBoundThread() {
+  NumaThreadResult result;
+  pthread_t thread;
+  CHECK(!pthread_create(&thread, NULL, BoundThread, &result));
+  CHECK(!pthread_join(thread, NULL));
+  return result;
+}
+
+class NumaTest : public ::testing::Test {};
+
+TEST_F(NumaTest, TestNodes) {
+  EXPECT_GE(NumaNodeCount(), 1);
+  std::vector<int> cpus;
+  NumaNodeCpus(0, &cpus);
+  EXPECT_GE(cpus.size(), 1);
+  EXPECT_EQ(NumaThreadNode(), -1);
+  EXPECT_EQ(Caffe::thread_pool().numa_node(), -1);
+}
+
+TEST_F(NumaTest, TestBindThread) {
+  NumaThreadResult result = RunBoundThread();
+  EXPECT_EQ(result.thread_node, 0);
+  EXPECT_EQ(result.caffe_pool_node, 0);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(result.worker_nodes[i], 0) << i;
+  }
+  // binding does not leak to other threads
+  EXPECT_EQ(NumaThreadNode(), -1);
+}
+
+TEST_F(NumaTest, TestConcurrentPools) {
+  // threads of one node that ask for their pool at once share one pool
+  const int cpu_threads = Caffe::cpu_threads();
+  Caffe::set_cpu_threads(cpu_threads + 1);
+  std::vector<pthread_t> threads(4);
+  std::vector<ThreadPool*> pools(threads.size(), NULL);
+  for (int i = 0; i < threads.size(); ++i) {
+    CHECK(!pthread_create(&threads[i], NULL, BoundPoolThread, &pools[i]));
+  }
+  for (int i = 0; i < threads.size(); ++i) {
+    CHECK(!pthread_join(threads[i], NULL));
+  }
+  for (int i = 0; i < threads.size(); ++i) {
+    ASSERT_TRUE(pools[i] != NULL) << i;
+    EXPECT_EQ(pools[i], pools[0]) << i;
+  }
+  EXPECT_EQ(pools[0]->numa_node(), 0);
+  EXPECT_EQ(pools[0]->num_threads(), cpu_threads + 1);
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
+TEST_F(NumaTest, TestHostAllocatorNodes) {
+  HostAllocator& allocator = HostAllocator::Get();
+  if (allocator.use_malloc()) {
+    return;
+  }
+  allocator.ReleaseCache();
+  // the block cached by node 0 is not handed to an unbound thread, but to
+  // the next thread of node 0
+  void* block = RunBoundThread().block;
+  const size_t cache_hits = allocator.stats().cache_hits;
+  void* unbound = allocator.Allocate(1000);
+  EXPECT_NE(unbound, block);
+  EXPECT_EQ(allocator.stats().cache_hits, cache_hits);
+  EXPECT_EQ(RunBoundThread().block, block);
+  EXPECT_EQ(allocator.stats().cache_hits, cache_hits + 1);
+  allocator.Free(unbound);
+  allocator.ReleaseCache();
+}
+
+}  // namespace caffe
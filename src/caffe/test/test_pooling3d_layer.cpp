@@ -0,0 +1,327 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/video_3d_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class Pooling3DLayerTest : public ::testing::Test {
+ protected:
+  Pooling3DLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 5, 6, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~Pooling3DLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  // Runs Forward and Backward in phase with a Gaussian top diff, leaving the
+  // bottom diff in bottom_diff.
+  void ForwardBackward(Pooling3DLayer<Dtype>* layer, Caffe::Phase phase,
+      Blob<Dtype>* bottom_diff) {
+    Caffe::set_phase(phase);
+    layer->Forward(blob_bottom_vec_, &blob_top_vec_);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    Caffe::set_random_seed(1701);
+    Blob<Dtype> top_diff;
+    top_diff.ReshapeLike(*blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        blob_top_->mutable_cpu_diff());
+    layer->Backward(blob_top_vec_, true, &blob_bottom_vec_);
+    bottom_diff->CopyFrom(*blob_bottom_, true, true);
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+
+  // The max pooling of blob_bottom_ into top, shaped as blob_top_, over the
+  // windows clipped to the input; a window past its end is the last value.
+  void ReferenceMax(const int kernel_depth, const int kernel_size,
+      const int temporal_stride, const int stride, const int pad,
+      Blob<Dtype>* top) {
+    top->ReshapeLike(*blob_top_);
+    const int kernel[3] = {kernel_depth, kernel_size, kernel_size};
+    const int strides[3] = {temporal_stride, stride, stride};
+    const int pads[3] = {0, pad, pad};
+    const int size[3] = {blob_bottom_->length(), blob_bottom_->height(),
+        blob_bottom_->width()};
+    for (int n = 0; n < top->num(); ++n) {
+      for (int c = 0; c < top->channels(); ++c) {
+        for (int pl = 0; pl < top->length(); ++pl) {
+          for (int ph = 0; ph < top->height(); ++ph) {
+            for (int pw = 0; pw < top->width(); ++pw) {
+              const int p[3] = {pl, ph, pw};
+              int start[3], end[3];
+              for (int d = 0; d < 3; ++d) {
+                start[d] = std::max(p[d] * strides[d] - pads[d], 0);
+                end[d] = std::min(p[d] * strides[d] - pads[d] + kernel[d],
+                    size[d]);
+                if (start[d] >= size[d]) {
+                  start[d] = size[d] - 1;
+                  end[d] = size[d];
+                }
+              }
+              Dtype value = -FLT_MAX;
+              for (int l = start[0]; l < end[0]; ++l) {
+                for (int h = start[1]; h < end[1]; ++h) {
+                  for (int w = start[2]; w < end[2]; ++w) {
+                    value = std::max(value,
+                        blob_bottom_->data_at(n, c, l, h, w));
+                  }
+                }
+              }
+              top->mutable_cpu_data()[top->offset(n, c, pl, ph, pw)] = value;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(Pooling3DLayerTest, Dtypes);
+
+TYPED_TEST(Pooling3DLayerTest, TestSetup) {
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_temporal_stride(2);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 3);
+  EXPECT_EQ(this->blob_top_->length(), 3);
+  EXPECT_EQ(this->blob_top_->height(), 3);
+  EXPECT_EQ(this->blob_top_->width(), 2);
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUMaxMaskMatchesRescan) {
+  // Without ties, the scatter of the TRAIN mask gives the gradient of the
+  // rescan of the windows done after a TEST Forward.
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_temporal_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  Caffe::set_mode(Caffe::CPU);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> mask_diff, rescan_diff;
+  this->ForwardBackward(&layer, Caffe::TRAIN, &mask_diff);
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  this->ForwardBackward(&layer, Caffe::TEST, &rescan_diff);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i]);
+  }
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_EQ(mask_diff.cpu_diff()[i], rescan_diff.cpu_diff()[i]);
+  }
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUMaxMaskTies) {
+  // With a constant bottom, the mask routes every top diff to a single
+  // bottom value, where the rescan gives it to the whole window.
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(2);
+  pooling_param->set_stride(2);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_temporal_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  Caffe::set_mode(Caffe::CPU);
+  caffe_set(this->blob_bottom_->count(), TypeParam(1),
+      this->blob_bottom_->mutable_cpu_data());
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> mask_diff, rescan_diff;
+  this->ForwardBackward(&layer, Caffe::TRAIN, &mask_diff);
+  this->ForwardBackward(&layer, Caffe::TEST, &rescan_diff);
+  TypeParam top_sum = 0;
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    top_sum += this->blob_top_->cpu_diff()[i];
+  }
+  TypeParam mask_sum = 0;
+  int mask_nonzero = 0, rescan_nonzero = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    mask_sum += mask_diff.cpu_diff()[i];
+    mask_nonzero += mask_diff.cpu_diff()[i] != 0;
+    rescan_nonzero += rescan_diff.cpu_diff()[i] != 0;
+  }
+  EXPECT_NEAR(mask_sum, top_sum, 1e-4);
+  EXPECT_EQ(mask_nonzero, this->blob_top_->count());
+  EXPECT_EQ(rescan_nonzero, this->blob_bottom_->count());
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUGradientMax) {
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_temporal_stride(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  Caffe::set_mode(Caffe::CPU);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUForwardMaxPad) {
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pad(1);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_temporal_stride(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  Caffe::set_mode(Caffe::CPU);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->length(), 4);
+  EXPECT_EQ(this->blob_top_->height(), 4);
+  EXPECT_EQ(this->blob_top_->width(), 3);
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  this->ReferenceMax(2, 3, 1, 2, 1, &top_reference);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUForwardMaxPadClipped) {
+  // with a height and width of 3, a 3 x 3 window of stride 3 and padding 2
+  // would start a third window in the trailing padding; it is dropped
+  this->blob_bottom_->Reshape(2, 3, 5, 3, 3);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(3);
+  pooling_param->set_pad(2);
+  pooling_param->set_kernel_depth(1);
+  pooling_param->set_temporal_stride(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  Caffe::set_mode(Caffe::CPU);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->length(), 5);
+  EXPECT_EQ(this->blob_top_->height(), 2);
+  EXPECT_EQ(this->blob_top_->width(), 2);
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  this->ReferenceMax(1, 3, 1, 3, 2, &top_reference);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUGradientMaxPad) {
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pad(1);
+  pooling_param->set_kernel_depth(2);
+  pooling_param->set_temporal_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  Caffe::set_mode(Caffe::CPU);
+  Pooling3DLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUMax2x2Kernels) {
+  // The 1 x 2 x 2 and 2 x 2 x 2 kernels, on a bottom of odd length and
+  // width, give the reference maxima, and their mask the rescan gradient.
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(2);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  Caffe::set_mode(Caffe::CPU);
+  for (int kernel_depth = 1; kernel_depth <= 2; ++kernel_depth) {
+    pooling_param->set_kernel_depth(kernel_depth);
+    pooling_param->set_temporal_stride(kernel_depth);
+    Pooling3DLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    Blob<TypeParam> mask_diff, rescan_diff, top_reference;
+    this->ForwardBackward(&layer, Caffe::TRAIN, &mask_diff);
+    this->ReferenceMax(kernel_depth, 2, kernel_depth, 2, 0, &top_reference);
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_EQ(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i]);
+    }
+    this->ForwardBackward(&layer, Caffe::TEST, &rescan_diff);
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_EQ(mask_diff.cpu_diff()[i], rescan_diff.cpu_diff()[i]);
+    }
+  }
+}
+
+TYPED_TEST(Pooling3DLayerTest, TestCPUThreaded) {
+  // Splitting the planes over threads gives the single-threaded Forward and
+  // Backward, for the 2 x 2 x 2 kernel, padded max and average pooling.
+  this->blob_bottom_->Reshape(2, 4, 8, 32, 33);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Caffe::set_mode(Caffe::CPU);
+  for (int i = 0; i < 3; ++i) {
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_kernel_size(i == 0 ? 2 : 3);
+    pooling_param->set_stride(2);
+    pooling_param->set_pad(i == 0 ? 0 : 1);
+    pooling_param->set_kernel_depth(2);
+    pooling_param->set_temporal_stride(2);
+    pooling_param->set_pool(i < 2 ? PoolingParameter_PoolMethod_MAX :
+        PoolingParameter_PoolMethod_AVE);
+    Pooling3DLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    Blob<TypeParam> bottom_diff, threaded_diff, top_reference;
+    this->ForwardBackward(&layer, Caffe::TRAIN, &bottom_diff);
+    top_reference.CopyFrom(*this->blob_top_, false, true);
+    Caffe::set_cpu_threads(3);
+    this->ForwardBackward(&layer, Caffe::TRAIN, &threaded_diff);
+    Caffe::set_cpu_threads(1);
+    for (int j = 0; j < this->blob_top_->count(); ++j) {
+      EXPECT_EQ(this->blob_top_->cpu_data()[j], top_reference.cpu_data()[j]);
+    }
+    for (int j = 0; j < this->blob_bottom_->count(); ++j) {
+      EXPECT_EQ(threaded_diff.cpu_diff()[j], bottom_diff.cpu_diff()[j]);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,117 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdint.h>
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/quantize.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class Int8GemmTest : public ::testing::Test {
+ protected:
+  // Checks int8_gemm_cpu against the products computed in int32 one by one,
+  // with values covering the whole int8 range.
+  void Check(const CBLAS_TRANSPOSE TransB, const int M, const int N,
+      const int K) {
+    std::vector<int8_t> A(M * K), B(K * N);
+    for (int i = 0; i < A.size(); ++i) {
+      A[i] = static_cast<int8_t>((i * 37 + 11) % 255 - 127);
+    }
+    for (int i = 0; i < B.size(); ++i) {
+      B[i] = static_cast<int8_t>((i * 53 + 5) % 255 - 127);
+    }
+    std::vector<int32_t> C(M * N, 7);
+    int8_gemm_cpu(TransB, M, N, K, &A[0], &B[0], &C[0]);
+    for (int m = 0; m < M; ++m) {
+      for (int n = 0; n < N; ++n) {
+        int32_t sum = 0;
+        for (int k = 0; k < K; ++k) {
+          sum += A[m * K + k] *
+              (TransB == CblasNoTrans ? B[k * N + n] : B[n * K + k]);
+        }
+        EXPECT_EQ(C[m * N + n], sum);
+      }
+    }
+  }
+};
+
+TEST_F(Int8GemmTest, TestCPUNoTrans) {
+  // rows in and out of groups of four, a ragged column block
+  this->Check(CblasNoTrans, 7, 300, 19);
+  this->Check(CblasNoTrans, 1, 5, 3);
+}
+
+TEST_F(Int8GemmTest, TestCPUTrans) {
+  this->Check(CblasTrans, 7, 300, 19);
+  this->Check(CblasTrans, 1, 5, 3);
+}
+
+TEST_F(Int8GemmTest, TestCPUThreaded) {
+  // large enough to be split over the thread pool
+  Caffe::set_cpu_threads(3);
+  this->Check(CblasNoTrans, 5, 1000, 300);
+  this->Check(CblasTrans, 5, 1000, 300);
+  Caffe::set_cpu_threads(1);
+}
+
+template <typename Dtype>
+class QuantizeTest : public ::testing::Test {};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(QuantizeTest, Dtypes);
+
+TYPED_TEST(QuantizeTest, TestCPUQuantize) {
+  const TypeParam x[] = {0., 0.06, -0.04, 1.24, 1.26, -1.26, 12.6, 13., -20.};
+  const int8_t expected[] = {0, 1, 0, 12, 13, -13, 126, 127, -127};
+  int8_t quantized[9];
+  // values past the range saturate
+  quantize_cpu(9, x, TypeParam(0.1), quantized);
+  for (int i = 0; i < 9; ++i) {
+    EXPECT_EQ(quantized[i], expected[i]);
+  }
+}
+
+TYPED_TEST(QuantizeTest, TestCPUQuantizeRows) {
+  Blob<TypeParam> weight(1, 1, 1, 4, 50);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&weight);
+  // an all-zero row
+  TypeParam* data = weight.mutable_cpu_data();
+  for (int j = 0; j < 50; ++j) {
+    data[2 * 50 + j] = 0;
+  }
+  QuantizedWeights<TypeParam> quantized;
+  quantized.Update(weight, 4);
+  for (int i = 0; i < 4; ++i) {
+    TypeParam range = 0;
+    for (int j = 0; j < 50; ++j) {
+      range = std::max(range, std::fabs(weight.cpu_data()[i * 50 + j]));
+    }
+    const TypeParam scale = quantized.scale()[i];
+    EXPECT_EQ(scale, i == 2 ? TypeParam(1) : range / TypeParam(127));
+    for (int j = 0; j < 50; ++j) {
+      const TypeParam w = weight.cpu_data()[i * 50 + j];
+      const int q = quantized.data()[i * 50 + j];
+      EXPECT_NEAR(q * scale, w, scale / 2 + 1e-6);
+      if (std::fabs(w) == range && range > 0) {
+        EXPECT_EQ(std::abs(q), 127);
+      }
+    }
+  }
+  // changed weights are requantized
+  weight.mutable_cpu_data()[0] = 1000;
+  quantized.Update(weight, 4);
+  EXPECT_EQ(quantized.data()[0], 127);
+  EXPECT_EQ(quantized.scale()[0], TypeParam(1000) / TypeParam(127));
+}
+
+}  // namespace caffe
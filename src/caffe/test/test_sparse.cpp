@@ -0,0 +1,115 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/sparse.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class SparseTest : public ::testing::Test {
+ protected:
+  // Fills weight_ (rows x cols) with Gaussian values of which about 1 in 4
+  // are kept, with a whole row of zeros.
+  void FillWeights(const int rows, const int cols) {
+    weight_.Reshape(1, 1, 1, rows, cols);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&weight_);
+    Dtype* data = weight_.mutable_cpu_data();
+    for (int i = 0; i < weight_.count(); ++i) {
+      if (i % 4 != 1 || i / cols == 1) {
+        data[i] = 0;
+      }
+    }
+  }
+
+  Blob<Dtype> weight_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(SparseTest, Dtypes);
+
+TYPED_TEST(SparseTest, TestCPUGemm) {
+  const int M = 7, K = 19, N = 33;
+  this->FillWeights(M, K);
+  SparseWeights<TypeParam> sparse_weight;
+  sparse_weight.Update(&this->weight_, M, 0);
+  EXPECT_LT(sparse_weight.density(), 0.3);
+  Blob<TypeParam> B(1, 1, 1, K, N), C(1, 1, 1, M, N), reference(1, 1, 1, M, N);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&B);
+  filler.Fill(&C);
+  caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasNoTrans, M, N, K, 1.,
+      this->weight_.cpu_data(), B.cpu_data(), 0., reference.mutable_cpu_data());
+  csr_gemm_cpu(M, N, sparse_weight.row_ptr(), sparse_weight.col_index(),
+      sparse_weight.values(), B.cpu_data(), C.mutable_cpu_data());
+  for (int i = 0; i < M * N; ++i) {
+    EXPECT_NEAR(C.cpu_data()[i], reference.cpu_data()[i], 1e-4);
+  }
+  // rows 2 to 5 alone
+  csr_gemm_cpu(3, N, sparse_weight.row_ptr() + 2, sparse_weight.col_index(),
+      sparse_weight.values(), B.cpu_data(), C.mutable_cpu_data());
+  for (int i = 0; i < 3 * N; ++i) {
+    EXPECT_NEAR(C.cpu_data()[i], reference.cpu_data()[2 * N + i], 1e-4);
+  }
+}
+
+TYPED_TEST(SparseTest, TestCPUGemmTrans) {
+  // large enough to be split over the thread pool with 3 threads
+  const int M = 5, K = 1000, N = 900;
+  this->FillWeights(N, K);
+  SparseWeights<TypeParam> sparse_weight;
+  sparse_weight.Update(&this->weight_, N, 0);
+  Blob<TypeParam> B(1, 1, 1, M, K), C(1, 1, 1, M, N), reference(1, 1, 1, M, N);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&B);
+  caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasTrans, M, N, K, 1.,
+      B.cpu_data(), this->weight_.cpu_data(), 0., reference.mutable_cpu_data());
+  for (int threads = 1; threads <= 3; threads += 2) {
+    Caffe::set_cpu_threads(threads);
+    caffe_set(C.count(), TypeParam(7), C.mutable_cpu_data());
+    csr_gemm_trans_cpu(M, N, K, B.cpu_data(), sparse_weight.row_ptr(),
+        sparse_weight.col_index(), sparse_weight.values(),
+        C.mutable_cpu_data());
+    for (int i = 0; i < M * N; ++i) {
+      EXPECT_NEAR(C.cpu_data()[i], reference.cpu_data()[i], 1e-3);
+    }
+  }
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(SparseTest, TestUpdate) {
+  this->weight_.Reshape(1, 1, 1, 2, 4);
+  const TypeParam values[] = {0.5, -0.05, 0, 2, 0, 0, -0.1, 0.2};
+  caffe_copy(8, values, this->weight_.mutable_cpu_data());
+  SparseWeights<TypeParam> sparse_weight;
+  // the threshold prunes the blob itself
+  sparse_weight.Update(&this->weight_, 2, 0.1);
+  const TypeParam pruned[] = {0.5, 0, 0, 2, 0, 0, 0, 0.2};
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(this->weight_.cpu_data()[i], pruned[i]);
+  }
+  EXPECT_EQ(sparse_weight.density(), 3. / 8);
+  EXPECT_EQ(sparse_weight.row_ptr()[1], 2);
+  EXPECT_EQ(sparse_weight.row_ptr()[2], 3);
+  EXPECT_EQ(sparse_weight.col_index()[1], 3);
+  EXPECT_EQ(sparse_weight.values()[2], TypeParam(0.2));
+  // rebuilt only when the weights change
+  this->weight_.mutable_cpu_data()[5] = 1;
+  sparse_weight.Update(&this->weight_, 2, 0.1);
+  EXPECT_EQ(sparse_weight.density(), 4. / 8);
+  EXPECT_EQ(sparse_weight.col_index()[2], 1);
+}
+
+}  // namespace caffe
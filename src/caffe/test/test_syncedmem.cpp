@@ -31,6 +31,20 @@ TEST_F(SyncedMemoryTest, TestAllocation) {
   EXPECT_TRUE(mem.mutable_gpu_data());
 }
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10);
+  const unsigned int version = mem.version();
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), version);
+  mem.mutable_cpu_data();
+  EXPECT_EQ(mem.version(), version + 1);
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), version + 1);
+  char data[10];
+  mem.set_cpu_data(data);
+  EXPECT_EQ(mem.version(), version + 2);
+}
+
 TEST_F(SyncedMemoryTest, TestCPUWrite) {
   SyncedMemory mem(10);
   void* cpu_data = mem.mutable_cpu_data();
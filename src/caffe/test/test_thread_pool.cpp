@@ -0,0 +1,60 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+static void CountThread(std::vector<int>* counts, const int thread_id) {
+  ++(*counts)[thread_id];
+}
+
+static void NestedRun(ThreadPool* pool, std::vector<int>* counts,
+    const int thread_id) {
+  std::vector<int> inner(pool->num_threads(), 0);
+  pool->Run(boost::bind(&CountThread, &inner, _1));
+  for (int i = 0; i < inner.size(); ++i) {
+    (*counts)[thread_id * pool->num_threads() + i] = inner[i];
+  }
+}
+
+class ThreadPoolTest : public ::testing::Test {};
+
+TEST_F(ThreadPoolTest, TestRun) {
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.num_threads(), 4);
+  std::vector<int> counts(4, 0);
+  for (int run = 0; run < 10; ++run) {
+    pool.Run(boost::bind(&CountThread, &counts, _1));
+  }
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(counts[i], 10);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestNestedRun) {
+  // a Run from inside a job runs every thread_id on the calling thread
+  ThreadPool pool(3);
+  std::vector<int> counts(9, 0);
+  pool.Run(boost::bind(&NestedRun, &pool, &counts, _1));
+  for (int i = 0; i < 9; ++i) {
+    EXPECT_EQ(counts[i], 1);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestCaffeThreads) {
+  EXPECT_EQ(Caffe::cpu_threads(), 1);
+  Caffe::set_cpu_threads(2);
+  EXPECT_EQ(Caffe::thread_pool().num_threads(), 2);
+  Caffe::set_cpu_threads(1);
+  EXPECT_EQ(Caffe::thread_pool().num_threads(), 1);
+}
+
+}  // namespace caffe
@@ -0,0 +1,133 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/vol2col.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Element by element definition of vol2col with a column row stride.
+template <typename Dtype>
+static void ReferenceVol2col(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int col_stride, Dtype* data_col) {
+  const int length_col = (length + 2 * temporal_pad - kdepth) /
+      temporal_stride + 1;
+  const int height_col = (height + 2 * pad - ksize) / stride + 1;
+  const int width_col = (width + 2 * pad - ksize) / stride + 1;
+  for (int c = 0; c < channels * kdepth * ksize * ksize; ++c) {
+    const int w_offset = c % ksize;
+    const int h_offset = (c / ksize) % ksize;
+    const int l_offset = (c / ksize / ksize) % kdepth;
+    const int c_im = c / ksize / ksize / kdepth;
+    for (int l = 0; l < length_col; ++l) {
+      for (int h = 0; h < height_col; ++h) {
+        for (int w = 0; w < width_col; ++w) {
+          const int l_pad = l * temporal_stride - temporal_pad + l_offset;
+          const int h_pad = h * stride - pad + h_offset;
+          const int w_pad = w * stride - pad + w_offset;
+          const bool inside = l_pad >= 0 && l_pad < length && h_pad >= 0 &&
+              h_pad < height && w_pad >= 0 && w_pad < width;
+          data_col[c * col_stride + (l * height_col + h) * width_col + w] =
+              inside ? data_im[((c_im * length + l_pad) * height + h_pad) *
+              width + w_pad] : 0;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+class Vol2colTest : public ::testing::Test {
+ protected:
+  Vol2colTest() : blob_im_(new Blob<Dtype>()) {}
+  virtual ~Vol2colTest() { delete blob_im_; }
+
+  // Checks vol2col_cpu against the reference, and col2vol_cpu by the
+  // identity <vol2col(x), y> = <x, col2vol(y)>.
+  void Check(const int channels, const int length, const int height,
+      const int width, const int ksize, const int kdepth, const int pad,
+      const int temporal_pad, const int stride, const int temporal_stride) {
+    blob_im_->Reshape(1, channels, length, height, width);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_im_);
+    const int length_col = (length + 2 * temporal_pad - kdepth) /
+        temporal_stride + 1;
+    const int height_col = (height + 2 * pad - ksize) / stride + 1;
+    const int width_col = (width + 2 * pad - ksize) / stride + 1;
+    const int rows = channels * kdepth * ksize * ksize;
+    // leave a gap between the rows to cover col_stride
+    const int col_stride = length_col * height_col * width_col + 3;
+    Blob<Dtype> col(1, 1, 1, rows, col_stride);
+    Blob<Dtype> reference(1, 1, 1, rows, col_stride);
+    caffe_set(col.count(), Dtype(7.), col.mutable_cpu_data());
+    caffe_set(reference.count(), Dtype(7.), reference.mutable_cpu_data());
+    vol2col_cpu(blob_im_->cpu_data(), channels, length, height, width, ksize,
+        kdepth, pad, temporal_pad, stride, temporal_stride, col_stride,
+        col.mutable_cpu_data());
+    ReferenceVol2col(blob_im_->cpu_data(), channels, length, height, width,
+        ksize, kdepth, pad, temporal_pad, stride, temporal_stride, col_stride,
+        reference.mutable_cpu_data());
+    for (int i = 0; i < col.count(); ++i) {
+      EXPECT_EQ(col.cpu_data()[i], reference.cpu_data()[i]);
+    }
+    filler.Fill(&reference);
+    caffe_set(blob_im_->count(), Dtype(7.), blob_im_->mutable_cpu_diff());
+    col2vol_cpu(reference.cpu_data(), channels, length, height, width, ksize,
+        kdepth, pad, temporal_pad, stride, temporal_stride, col_stride,
+        blob_im_->mutable_cpu_diff());
+    // accumulate in double, the order of the sums differs
+    double col_dot = 0;
+    for (int c = 0; c < rows; ++c) {
+      for (int i = 0; i < col_stride - 3; ++i) {
+        col_dot += col.cpu_data()[c * col_stride + i] *
+            reference.cpu_data()[c * col_stride + i];
+      }
+    }
+    double im_dot = 0;
+    for (int i = 0; i < blob_im_->count(); ++i) {
+      im_dot += blob_im_->cpu_data()[i] * blob_im_->cpu_diff()[i];
+    }
+    EXPECT_NEAR(col_dot, im_dot, 1e-6 * col.count());
+  }
+
+  Blob<Dtype>* const blob_im_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(Vol2colTest, Dtypes);
+
+TYPED_TEST(Vol2colTest, TestCPUStride1) {
+  this->Check(2, 4, 5, 19, 3, 3, 1, 1, 1, 1);
+  this->Check(2, 4, 5, 19, 3, 2, 0, 0, 1, 1);
+  // padding wider than the kernel offset on both sides
+  this->Check(1, 3, 4, 3, 3, 3, 2, 2, 1, 1);
+}
+
+TYPED_TEST(Vol2colTest, TestCPUStride2) {
+  this->Check(2, 5, 7, 17, 3, 3, 1, 1, 2, 2);
+  this->Check(3, 4, 6, 9, 2, 1, 0, 0, 2, 1);
+}
+
+TYPED_TEST(Vol2colTest, TestCPUThreaded) {
+  // large enough to be split over the thread pool
+  Caffe::set_cpu_threads(3);
+  this->Check(5, 6, 13, 29, 3, 3, 1, 1, 1, 1);
+  this->Check(8, 8, 15, 31, 3, 3, 1, 1, 2, 1);
+  // fewer channels than threads, split into slabs of frames
+  this->Check(2, 8, 20, 40, 3, 3, 1, 1, 1, 1);
+  this->Check(1, 9, 24, 40, 4, 3, 1, 1, 2, 2);
+  this->Check(1, 2, 40, 40, 3, 3, 2, 2, 1, 1);
+  Caffe::set_cpu_threads(1);
+}
+
+}  // namespace caffe
@@ -0,0 +1,327 @@
+// Copyright 2014 BVLC and contributors.
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/autotune.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+// The first run of every candidate warms up its buffers and caches, the
+// best of the next ones is kept.
+static const int kTuningRuns = 3;
+
+string CpuModelName() {
+  // cpuid leaves 0x80000002 to 0x80000004 hold the 48 bytes of the brand
+  unsigned int registers[12] = {0};
+  bool found = false;
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0x80000000);
+  if (static_cast<unsigned int>(info[0]) >= 0x80000004) {
+    for (int i = 0; i < 3; ++i) {
+      __cpuid(info, 0x80000002 + i);
+      memcpy(registers + 4 * i, info, sizeof(info));
+    }
+    found = true;
+  }
+#elif defined(__i386__) || defined(__x86_64__)
+  if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004) {
+    for (int i = 0; i < 3; ++i) {
+      __get_cpuid(0x80000002 + i, registers + 4 * i, registers + 4 * i + 1,
+          registers + 4 * i + 2, registers + 4 * i + 3);
+    }
+    found = true;
+  }
+#endif
+  if (!found) {
+    return "unknown CPU";
+  }
+  char brand[sizeof(registers) + 1];
+  memcpy(brand, registers, sizeof(registers));
+  brand[sizeof(registers)] = '\0';
+  string name(brand);
+  const size_t begin = name.find_first_not_of(' ');
+  const size_t end = name.find_last_not_of(' ');
+  return begin == string::npos ? "unknown CPU" :
+      name.substr(begin, end - begin + 1);
+}
+
+// The engine and clips_per_gemm of a candidate, for the log.
+static string Describe(const ConvolutionParameter& conv_param) {
+  string description = ConvolutionParameter_Engine_Name(conv_param.engine());
+  if (conv_param.engine() == ConvolutionParameter_Engine_GEMM &&
+      conv_param.has_clips_per_gemm()) {
+    std::ostringstream clips;
+    clips << " with clips_per_gemm " << conv_param.clips_per_gemm();
+    description += clips.str();
+  }
+  return description;
+}
+
+template <typename Dtype>
+ConvolutionTuner<Dtype>::ConvolutionTuner(const string& cache_file)
+    : cache_file_(cache_file), updated_(false) {
+  if (cache_file_.empty() || !std::ifstream(cache_file_.c_str()).good()) {
+    return;
+  }
+  if (!ReadProtoFromTextFile(cache_file_, &cache_)) {
+    LOG(WARNING) << "Cannot parse the tuning cache " << cache_file_
+        << ", tuning again.";
+    cache_.Clear();
+  }
+  for (int i = 0; i < cache_.entry_size(); ++i) {
+    entry_index_[cache_.entry(i).key()] = i;
+  }
+  LOG(INFO) << "Read " << cache_.entry_size() << " tuned convolutions from "
+      << cache_file_;
+}
+
+template <typename Dtype>
+string ConvolutionTuner<Dtype>::Key(const LayerParameter& param,
+    const Blob<Dtype>& bottom, const Blob<Dtype>& top) {
+  const ConvolutionParameter& conv_param = param.convolution_param();
+  std::ostringstream key;
+  key << LayerParameter_LayerType_Name(param.type())
+      << (sizeof(Dtype) == sizeof(float) ? " float" : " double")
+      << (Caffe::phase() == Caffe::TRAIN ? " TRAIN" : " TEST")
+      << " bottom " << bottom.num() << "x" << bottom.channels() << "x"
+      << bottom.length() << "x" << bottom.height() << "x" << bottom.width()
+      << (bottom.layout() == NLHWC ? " NLHWC" : "")
+      << (bottom.bfloat16_storage() ? " bfloat16" : "")
+      << (top.bfloat16_storage() ? " top bfloat16" : "")
+      << " num_output " << conv_param.num_output()
+      << " kernel " << conv_param.kernel_depth() << "x"
+      << conv_param.kernel_size() << "x" << conv_param.kernel_size()
+      << " stride " << conv_param.temporal_stride() << "x"
+      << conv_param.stride()
+      << " pad " << conv_param.temporal_pad() << "x" << conv_param.pad()
+      << " group " << conv_param.group()
+      << " filter_group " << conv_param.filter_group()
+      << (conv_param.bias_term() ? " bias" : "")
+      << (conv_param.fused_relu() ? " fused_relu" : "")
+      << (conv_param.fused_pooling() ? " fused_pooling" : "");
+  if (conv_param.has_clips_per_gemm()) {
+    key << " clips_per_gemm " << conv_param.clips_per_gemm();
+  }
+  key << " on " << CpuModelName() << " with " << Caffe::cpu_threads()
+      << " threads";
+  return key.str();
+}
+
+template <typename Dtype>
+void ConvolutionTuner<Dtype>::Candidates(const LayerParameter& param,
+    const Blob<Dtype>& bottom, vector<LayerParameter>* candidates) {
+  candidates->clear();
+  const ConvolutionParameter& conv_param = param.convolution_param();
+  const bool stride_one =
+      conv_param.stride() == 1 && conv_param.temporal_stride() == 1;
+  LayerParameter candidate(param);
+  ConvolutionParameter* candidate_param =
+      candidate.mutable_convolution_param();
+  candidate_param->set_engine(ConvolutionParameter_Engine_GEMM);
+  candidates->push_back(candidate);
+  switch (param.type()) {
+  case LayerParameter_LayerType_CONVOLUTION3D: {
+    // one clip per GEMM, or the whole batch unless it was set
+    if (!conv_param.has_clips_per_gemm() && bottom.num() > 1) {
+      candidate_param->set_clips_per_gemm(bottom.num());
+      candidates->push_back(candidate);
+      candidate_param->clear_clips_per_gemm();
+    }
+    // channels-last blobs and sparse weights are handled by the GEMM engine
+    // only
+    if (bottom.layout() == NLHWC || param.has_sparsity_param()) {
+      break;
+    }
+    if (conv_param.group() == bottom.channels() &&
+        conv_param.num_output() == bottom.channels() &&
+        conv_param.kernel_size() == 3 && conv_param.kernel_depth() == 3) {
+      candidate_param->set_engine(ConvolutionParameter_Engine_DEPTHWISE);
+      candidates->push_back(candidate);
+    }
+    // the other engines do not support channel groups
+    if (conv_param.group() > 1) {
+      break;
+    }
+    const bool kernel_3x3x3 = conv_param.kernel_size() == 3 &&
+        conv_param.kernel_depth() == 3 && stride_one;
+    if (kernel_3x3x3 && conv_param.pad() == 1 &&
+        conv_param.temporal_pad() == 1) {
+      candidate_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+      candidates->push_back(candidate);
+    }
+    if (kernel_3x3x3 && conv_param.pad() <= 2 &&
+        conv_param.temporal_pad() <= 2) {
+      candidate_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+      candidates->push_back(candidate);
+    }
+    if (stride_one) {
+      candidate_param->set_engine(ConvolutionParameter_Engine_FFT);
+      candidates->push_back(candidate);
+    }
+    break;
+  }
+  case LayerParameter_LayerType_DECONVOLUTION3D:
+    if (stride_one && conv_param.filter_group() == 1) {
+      candidate_param->set_engine(ConvolutionParameter_Engine_FFT);
+      candidates->push_back(candidate);
+    }
+    if (!stride_one) {
+      candidate_param->set_engine(ConvolutionParameter_Engine_PHASE);
+      candidates->push_back(candidate);
+    }
+    break;
+  case LayerParameter_LayerType_CONVOLUTION:
+    // im2col + GEMM is the only CPU algorithm of ConvolutionLayer
+    break;
+  default:
+    candidates->clear();
+    break;
+  }
+}
+
+template <typename Dtype>
+float ConvolutionTuner<Dtype>::Time(const LayerParameter& param,
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // blobs of the same shape, layout and storage as those of the net, which
+  // are not touched
+  vector<shared_ptr<Blob<Dtype> > > blobs;
+  vector<Blob<Dtype>*> bottom_vec, top_vec;
+  for (int i = 0; i < bottom.size(); ++i) {
+    shared_ptr<Blob<Dtype> > blob(new Blob<Dtype>());
+    blob->set_bfloat16_storage(bottom[i]->bfloat16_storage());
+    blob->Reshape(bottom[i]->num(), bottom[i]->channels(),
+        bottom[i]->length(), bottom[i]->height(), bottom[i]->width());
+    blob->set_layout(bottom[i]->layout());
+    memset(blob->data()->mutable_cpu_data(), 0, blob->data()->size());
+    blobs.push_back(blob);
+    bottom_vec.push_back(blob.get());
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    shared_ptr<Blob<Dtype> > blob(new Blob<Dtype>());
+    blob->set_bfloat16_storage(top[i]->bfloat16_storage());
+    blobs.push_back(blob);
+    top_vec.push_back(blob.get());
+  }
+  shared_ptr<Layer<Dtype> > layer(GetLayer<Dtype>(param));
+  layer->SetUp(bottom_vec, &top_vec);
+  const bool backward = Caffe::phase() == Caffe::TRAIN;
+  if (backward) {
+    for (int i = 0; i < top_vec.size(); ++i) {
+      caffe_set(top_vec[i]->count(), Dtype(0), top_vec[i]->mutable_cpu_diff());
+    }
+  }
+  Timer timer;
+  float best = FLT_MAX;
+  for (int run = 0; run <= kTuningRuns; ++run) {
+    timer.Start();
+    layer->Forward(bottom_vec, &top_vec);
+    if (backward) {
+      layer->Backward(top_vec, true, &bottom_vec);
+    }
+    timer.Stop();
+    if (run > 0) {
+      best = std::min(best, timer.MilliSeconds());
+    }
+  }
+  return best;
+}
+
+template <typename Dtype>
+bool ConvolutionTuner<Dtype>::Tune(const LayerParameter& param,
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top,
+    LayerParameter* tuned_param) {
+  if (param.convolution_param().engine() !=
+      ConvolutionParameter_Engine_DEFAULT ||
+      param.quantization_param().precision() ==
+      QuantizationParameter_Precision_INT8) {
+    return false;
+  }
+  vector<LayerParameter> candidates;
+  Candidates(param, *bottom[0], &candidates);
+  if (candidates.size() < 2) {
+    return false;
+  }
+  const string key = Key(param, *bottom[0], *top[0]);
+  std::map<string, int>::const_iterator it = entry_index_.find(key);
+  if (it != entry_index_.end()) {
+    LOG(INFO) << "Tuning cache: " << param.name() << " uses "
+        << ConvolutionParameter_Engine_Name(cache_.entry(it->second).engine());
+  } else {
+    // the fillers of the candidates draw random numbers, which the layers
+    // of the net must draw as if the layer had not been timed, so that a
+    // seeded net has the same weights whether the cache had the layer or not
+    const rng_t rng = *caffe_rng();
+    int best = 0;
+    float best_time = FLT_MAX;
+    for (int i = 0; i < candidates.size(); ++i) {
+      const float time = Time(candidates[i], bottom, top);
+      LOG(INFO) << "Tuning " << param.name() << ": "
+          << Describe(candidates[i].convolution_param()) << " " << time
+          << " ms";
+      if (time < best_time) {
+        best = i;
+        best_time = time;
+      }
+    }
+    *caffe_rng() = rng;
+    const ConvolutionParameter& best_param =
+        candidates[best].convolution_param();
+    LOG(INFO) << "Tuning " << param.name() << ": using "
+        << Describe(best_param);
+    ConvolutionTuningCache::Entry* entry = cache_.add_entry();
+    entry->set_key(key);
+    entry->set_engine(best_param.engine());
+    if (best_param.has_clips_per_gemm() &&
+        !param.convolution_param().has_clips_per_gemm()) {
+      entry->set_clips_per_gemm(best_param.clips_per_gemm());
+    }
+    entry->set_milliseconds(best_time);
+    entry_index_[key] = cache_.entry_size() - 1;
+    updated_ = true;
+    it = entry_index_.find(key);
+  }
+  const ConvolutionTuningCache::Entry& entry = cache_.entry(it->second);
+  tuned_param->CopyFrom(param);
+  tuned_param->mutable_convolution_param()->set_engine(entry.engine());
+  if (entry.clips_per_gemm() > 0) {
+    tuned_param->mutable_convolution_param()->set_clips_per_gemm(
+        entry.clips_per_gemm());
+  }
+  return true;
+}
+
+template <typename Dtype>
+void ConvolutionTuner<Dtype>::Save() {
+  if (!updated_ || cache_file_.empty()) {
+    return;
+  }
+  WriteProtoToTextFile(cache_, cache_file_);
+  LOG(INFO) << "Wrote " << cache_.entry_size() << " tuned convolutions to "
+      << cache_file_;
+  updated_ = false;
+}
+
+INSTANTIATE_CLASS(ConvolutionTuner);
+
+}  // namespace caffe
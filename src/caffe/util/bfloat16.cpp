@@ -0,0 +1,63 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <set>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/bfloat16.hpp"
+
+using std::set;
+using std::string;
+
+namespace caffe {
+
+bool SupportsBfloat16Storage(const LayerParameter& layer_param) {
+  switch (layer_param.type()) {
+  case LayerParameter_LayerType_CONVOLUTION3D:
+  case LayerParameter_LayerType_RELU:
+  case LayerParameter_LayerType_ELTWISE:
+    return true;
+  case LayerParameter_LayerType_POOLING3D:
+    return layer_param.pooling_param().pool() ==
+        PoolingParameter_PoolMethod_MAX ||
+        layer_param.pooling_param().pool() ==
+        PoolingParameter_PoolMethod_AVE;
+  default:
+    return false;
+  }
+}
+
+void SelectBfloat16Blobs(const NetParameter& param,
+    set<string>* blob_names) {
+  // blobs read or written by a layer that needs Dtype data, and the blobs
+  // left over at the end, which are the outputs of the net
+  set<string> dtype_blobs(param.input().begin(), param.input().end());
+  set<string> available_blobs(param.input().begin(), param.input().end());
+  set<string> produced_blobs;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    const bool supported = SupportsBfloat16Storage(layer_param);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      if (!supported) {
+        dtype_blobs.insert(layer_param.bottom(j));
+      }
+      available_blobs.erase(layer_param.bottom(j));
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      if (!supported) {
+        dtype_blobs.insert(layer_param.top(j));
+      }
+      available_blobs.insert(layer_param.top(j));
+      produced_blobs.insert(layer_param.top(j));
+    }
+  }
+  blob_names->clear();
+  for (set<string>::const_iterator it = produced_blobs.begin();
+      it != produced_blobs.end(); ++it) {
+    if (!dtype_blobs.count(*it) && !available_blobs.count(*it)) {
+      blob_names->insert(*it);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,154 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cstring>
+
+#include "caffe/util/conv3d_depthwise.hpp"
+
+namespace caffe {
+
+// The outputs [*begin, *end) of a row of size out whose input index
+// o * stride + offset lies within [0, size).
+static void valid_range(const int size, const int out, const int stride,
+    const int offset, int* begin, int* end) {
+  *begin = offset >= 0 ? 0 : (stride - 1 - offset) / stride;
+  *end = (size - 1 - offset) < 0 ? 0 :
+      std::min(out, (size - 1 - offset) / stride + 1);
+  *begin = std::min(*begin, *end);
+}
+
+template <typename Dtype>
+void conv3d_depthwise_forward_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int pad,
+    const int temporal_pad, const int stride, const int temporal_stride,
+    const Dtype* weight, Dtype* data_out) {
+  const int length_out = (length + 2 * temporal_pad - 3) / temporal_stride + 1;
+  const int height_out = (height + 2 * pad - 3) / stride + 1;
+  const int width_out = (width + 2 * pad - 3) / stride + 1;
+  // the output columns each of the three taps of a row reaches
+  int w_begin[3], w_end[3];
+  for (int kw = 0; kw < 3; ++kw) {
+    valid_range(width, width_out, stride, kw - pad, &w_begin[kw],
+        &w_end[kw]);
+  }
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* in = data_im + c * length * height * width;
+    const Dtype* w = weight + c * 27;
+    for (int l = 0; l < length_out; ++l) {
+      for (int h = 0; h < height_out; ++h) {
+        Dtype* out = data_out +
+            ((c * length_out + l) * height_out + h) * width_out;
+        memset(out, 0, sizeof(Dtype) * width_out);
+        for (int kl = 0; kl < 3; ++kl) {
+          const int il = l * temporal_stride - temporal_pad + kl;
+          if (il < 0 || il >= length) {
+            continue;
+          }
+          for (int kh = 0; kh < 3; ++kh) {
+            const int ih = h * stride - pad + kh;
+            if (ih < 0 || ih >= height) {
+              continue;
+            }
+            const Dtype* in_row = in + (il * height + ih) * width;
+            for (int kw = 0; kw < 3; ++kw) {
+              const Dtype wv = w[(kl * 3 + kh) * 3 + kw];
+              const Dtype* in_tap = in_row + kw - pad;
+              if (stride == 1) {
+                for (int i = w_begin[kw]; i < w_end[kw]; ++i) {
+                  out[i] += wv * in_tap[i];
+                }
+              } else {
+                for (int i = w_begin[kw]; i < w_end[kw]; ++i) {
+                  out[i] += wv * in_tap[i * stride];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void conv3d_depthwise_backward_cpu(const Dtype* data_im, const Dtype* top_diff,
+    const int channels, const int length, const int height, const int width,
+    const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const Dtype* weight, Dtype* weight_diff,
+    Dtype* data_im_diff) {
+  const int length_out = (length + 2 * temporal_pad - 3) / temporal_stride + 1;
+  const int height_out = (height + 2 * pad - 3) / stride + 1;
+  const int width_out = (width + 2 * pad - 3) / stride + 1;
+  int w_begin[3], w_end[3];
+  for (int kw = 0; kw < 3; ++kw) {
+    valid_range(width, width_out, stride, kw - pad, &w_begin[kw],
+        &w_end[kw]);
+  }
+  if (data_im_diff) {
+    memset(data_im_diff, 0,
+        sizeof(Dtype) * channels * length * height * width);
+  }
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* in = data_im + c * length * height * width;
+    Dtype* in_diff = data_im_diff ?
+        data_im_diff + c * length * height * width : NULL;
+    const Dtype* w = weight + c * 27;
+    Dtype* w_diff = weight_diff + c * 27;
+    for (int l = 0; l < length_out; ++l) {
+      for (int h = 0; h < height_out; ++h) {
+        const Dtype* out_diff = top_diff +
+            ((c * length_out + l) * height_out + h) * width_out;
+        for (int kl = 0; kl < 3; ++kl) {
+          const int il = l * temporal_stride - temporal_pad + kl;
+          if (il < 0 || il >= length) {
+            continue;
+          }
+          for (int kh = 0; kh < 3; ++kh) {
+            const int ih = h * stride - pad + kh;
+            if (ih < 0 || ih >= height) {
+              continue;
+            }
+            const int row = (il * height + ih) * width;
+            for (int kw = 0; kw < 3; ++kw) {
+              const int k = (kl * 3 + kh) * 3 + kw;
+              const Dtype* in_tap = in + row + kw - pad;
+              Dtype sum = 0;
+              for (int i = w_begin[kw]; i < w_end[kw]; ++i) {
+                sum += out_diff[i] * in_tap[i * stride];
+              }
+              w_diff[k] += sum;
+              if (in_diff) {
+                Dtype* in_diff_tap = in_diff + row + kw - pad;
+                const Dtype wv = w[k];
+                for (int i = w_begin[kw]; i < w_end[kw]; ++i) {
+                  in_diff_tap[i * stride] += wv * out_diff[i];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template void conv3d_depthwise_forward_cpu<float>(const float* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const float* weight, float* data_out);
+template void conv3d_depthwise_forward_cpu<double>(const double* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const double* weight, double* data_out);
+template void conv3d_depthwise_backward_cpu<float>(const float* data_im,
+    const float* top_diff, const int channels, const int length,
+    const int height, const int width, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const float* weight,
+    float* weight_diff, float* data_im_diff);
+template void conv3d_depthwise_backward_cpu<double>(const double* data_im,
+    const double* top_diff, const int channels, const int length,
+    const int height, const int width, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, const double* weight,
+    double* weight_diff, double* data_im_diff);
+
+}  // namespace caffe
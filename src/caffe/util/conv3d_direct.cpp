@@ -0,0 +1,372 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "caffe/util/conv3d_direct.hpp"
+
+namespace caffe {
+
+// Output channels whose accumulators are kept in registers at the same time.
+static const int kOutBlock = 4;
+// Elements read past the end of the last padded row by a width tile.
+static const int kPadSlack = 64;
+
+// Portable kernels. The inner loops have constant trip counts so that the
+// compiler can unroll and vectorize them; float gets explicit AVX2/AVX-512
+// kernels below when the build targets those instruction sets.
+template <typename Dtype>
+struct Conv3DDirectKernel {
+  // width of the output tile computed by Forward
+  static const int kWidth = 8;
+
+  // Computes a NOut x kWidth tile of the output. in points at the padded
+  // input of channel 0 at the top-left corner of the receptive field of the
+  // first output, weight at the filters of the first output channel.
+  template <int NOut>
+  static void Forward(const Dtype* in, const int channel_size,
+      const int plane, const int row, const Dtype* weight, const int channels,
+      Dtype* out, const int out_size, const int valid) {
+    Dtype acc[NOut][kWidth];
+    for (int o = 0; o < NOut; ++o) {
+      for (int i = 0; i < kWidth; ++i) {
+        acc[o][i] = 0;
+      }
+    }
+    const int weight_size = channels * 27;
+    for (int c = 0; c < channels; ++c) {
+      for (int k = 0; k < 9; ++k) {
+        const Dtype* r = in + c * channel_size + (k / 3) * plane
+            + (k % 3) * row;
+        const Dtype* w = weight + c * 27 + k * 3;
+        for (int kw = 0; kw < 3; ++kw) {
+          for (int o = 0; o < NOut; ++o) {
+            const Dtype wv = w[o * weight_size + kw];
+            for (int i = 0; i < kWidth; ++i) {
+              acc[o][i] += wv * r[kw + i];
+            }
+          }
+        }
+      }
+    }
+    for (int o = 0; o < NOut; ++o) {
+      for (int i = 0; i < valid; ++i) {
+        out[o * out_size + i] = acc[o][i];
+      }
+    }
+  }
+
+  // Accumulates into weight_diff the NOut x 3 gradients of the filter taps
+  // (kd, kh, 0..2) of one input channel. in points at the padded input of
+  // that channel offset by (kd, kh), top at the diff of the first output.
+  template <int NOut>
+  static void WeightGrad(const Dtype* in, const int plane, const int row,
+      const Dtype* top, const int length, const int height, const int width,
+      Dtype* weight_diff, const int weight_size) {
+    Dtype acc[NOut][3];
+    for (int o = 0; o < NOut; ++o) {
+      acc[o][0] = acc[o][1] = acc[o][2] = 0;
+    }
+    const int out_size = length * height * width;
+    for (int l = 0; l < length; ++l) {
+      for (int h = 0; h < height; ++h) {
+        const Dtype* r = in + l * plane + h * row;
+        const Dtype* t = top + (l * height + h) * width;
+        for (int w = 0; w < width; ++w) {
+          for (int o = 0; o < NOut; ++o) {
+            const Dtype tv = t[o * out_size + w];
+            acc[o][0] += tv * r[w];
+            acc[o][1] += tv * r[w + 1];
+            acc[o][2] += tv * r[w + 2];
+          }
+        }
+      }
+    }
+    for (int o = 0; o < NOut; ++o) {
+      for (int kw = 0; kw < 3; ++kw) {
+        weight_diff[o * weight_size + kw] += acc[o][kw];
+      }
+    }
+  }
+};
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+
+#if defined(__AVX512F__)
+typedef __m512 conv3d_vec;
+static const int kLanes = 16;
+inline conv3d_vec conv3d_load(const float* p) { return _mm512_loadu_ps(p); }
+inline void conv3d_store(float* p, conv3d_vec v) { _mm512_storeu_ps(p, v); }
+inline conv3d_vec conv3d_set1(float v) { return _mm512_set1_ps(v); }
+inline conv3d_vec conv3d_zero() { return _mm512_setzero_ps(); }
+inline conv3d_vec conv3d_madd(conv3d_vec a, conv3d_vec b, conv3d_vec c) {
+  return _mm512_fmadd_ps(a, b, c);
+}
+#else
+typedef __m256 conv3d_vec;
+static const int kLanes = 8;
+inline conv3d_vec conv3d_load(const float* p) { return _mm256_loadu_ps(p); }
+inline void conv3d_store(float* p, conv3d_vec v) { _mm256_storeu_ps(p, v); }
+inline conv3d_vec conv3d_set1(float v) { return _mm256_set1_ps(v); }
+inline conv3d_vec conv3d_zero() { return _mm256_setzero_ps(); }
+inline conv3d_vec conv3d_madd(conv3d_vec a, conv3d_vec b, conv3d_vec c) {
+#ifdef __FMA__
+  return _mm256_fmadd_ps(a, b, c);
+#else
+  return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+#endif
+
+inline float conv3d_hsum(conv3d_vec v) {
+  float lanes[kLanes];
+  conv3d_store(lanes, v);
+  float sum = 0;
+  for (int i = 0; i < kLanes; ++i) {
+    sum += lanes[i];
+  }
+  return sum;
+}
+
+template <>
+struct Conv3DDirectKernel<float> {
+  // two vectors per output channel, so that kOutBlock x 2 accumulators stay
+  // in registers
+  static const int kWidth = 2 * kLanes;
+
+  template <int NOut>
+  static void Forward(const float* in, const int channel_size,
+      const int plane, const int row, const float* weight, const int channels,
+      float* out, const int out_size, const int valid) {
+    conv3d_vec acc[NOut][2];
+    for (int o = 0; o < NOut; ++o) {
+      acc[o][0] = acc[o][1] = conv3d_zero();
+    }
+    const int weight_size = channels * 27;
+    for (int c = 0; c < channels; ++c) {
+      for (int k = 0; k < 9; ++k) {
+        const float* r = in + c * channel_size + (k / 3) * plane
+            + (k % 3) * row;
+        const float* w = weight + c * 27 + k * 3;
+        for (int kw = 0; kw < 3; ++kw) {
+          const conv3d_vec r0 = conv3d_load(r + kw);
+          const conv3d_vec r1 = conv3d_load(r + kw + kLanes);
+          for (int o = 0; o < NOut; ++o) {
+            const conv3d_vec wv = conv3d_set1(w[o * weight_size + kw]);
+            acc[o][0] = conv3d_madd(wv, r0, acc[o][0]);
+            acc[o][1] = conv3d_madd(wv, r1, acc[o][1]);
+          }
+        }
+      }
+    }
+    for (int o = 0; o < NOut; ++o) {
+      if (valid == kWidth) {
+        conv3d_store(out + o * out_size, acc[o][0]);
+        conv3d_store(out + o * out_size + kLanes, acc[o][1]);
+      } else {
+        float tile[kWidth];
+        conv3d_store(tile, acc[o][0]);
+        conv3d_store(tile + kLanes, acc[o][1]);
+        memcpy(out + o * out_size, tile, sizeof(float) * valid);
+      }
+    }
+  }
+
+  template <int NOut>
+  static void WeightGrad(const float* in, const int plane, const int row,
+      const float* top, const int length, const int height, const int width,
+      float* weight_diff, const int weight_size) {
+    conv3d_vec acc[NOut][3];
+    float tail[NOut][3];
+    for (int o = 0; o < NOut; ++o) {
+      for (int kw = 0; kw < 3; ++kw) {
+        acc[o][kw] = conv3d_zero();
+        tail[o][kw] = 0;
+      }
+    }
+    const int out_size = length * height * width;
+    const int vec_width = width - width % kLanes;
+    for (int l = 0; l < length; ++l) {
+      for (int h = 0; h < height; ++h) {
+        const float* r = in + l * plane + h * row;
+        const float* t = top + (l * height + h) * width;
+        for (int w = 0; w < vec_width; w += kLanes) {
+          const conv3d_vec r0 = conv3d_load(r + w);
+          const conv3d_vec r1 = conv3d_load(r + w + 1);
+          const conv3d_vec r2 = conv3d_load(r + w + 2);
+          for (int o = 0; o < NOut; ++o) {
+            const conv3d_vec tv = conv3d_load(t + o * out_size + w);
+            acc[o][0] = conv3d_madd(tv, r0, acc[o][0]);
+            acc[o][1] = conv3d_madd(tv, r1, acc[o][1]);
+            acc[o][2] = conv3d_madd(tv, r2, acc[o][2]);
+          }
+        }
+        for (int w = vec_width; w < width; ++w) {
+          for (int o = 0; o < NOut; ++o) {
+            const float tv = t[o * out_size + w];
+            tail[o][0] += tv * r[w];
+            tail[o][1] += tv * r[w + 1];
+            tail[o][2] += tv * r[w + 2];
+          }
+        }
+      }
+    }
+    for (int o = 0; o < NOut; ++o) {
+      for (int kw = 0; kw < 3; ++kw) {
+        weight_diff[o * weight_size + kw] +=
+            conv3d_hsum(acc[o][kw]) + tail[o][kw];
+      }
+    }
+  }
+};
+
+#endif  // __AVX512F__ || __AVX2__
+
+int conv3d_direct_padded_count(const int channels, const int length,
+    const int height, const int width) {
+  return channels * (length + 2) * (height + 2) * (width + 2) + kPadSlack;
+}
+
+template <typename Dtype>
+void conv3d_direct_pad_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, Dtype* data_pad) {
+  const int row = width + 2;
+  const int plane = (height + 2) * row;
+  memset(data_pad, 0, sizeof(Dtype)
+      * conv3d_direct_padded_count(channels, length, height, width));
+  for (int c = 0; c < channels; ++c) {
+    for (int l = 0; l < length; ++l) {
+      for (int h = 0; h < height; ++h) {
+        memcpy(data_pad + ((c * (length + 2) + l + 1) * (height + 2) + h + 1)
+            * row + 1, data_im + ((c * length + l) * height + h) * width,
+            sizeof(Dtype) * width);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void conv3d_direct_forward_cpu(const Dtype* data_pad, const int channels,
+    const int length, const int height, const int width, const Dtype* weight,
+    const int num_output, Dtype* data_out) {
+  typedef Conv3DDirectKernel<Dtype> Kernel;
+  const int row = width + 2;
+  const int plane = (height + 2) * row;
+  const int channel_size = (length + 2) * plane;
+  const int out_size = length * height * width;
+  const int tile_width = Kernel::kWidth;
+  for (int m = 0; m < num_output; m += kOutBlock) {
+    const int outs = std::min(kOutBlock, num_output - m);
+    const Dtype* weight_block = weight + m * channels * 27;
+    for (int l = 0; l < length; ++l) {
+      for (int h = 0; h < height; ++h) {
+        for (int w = 0; w < width; w += tile_width) {
+          const int valid = std::min(tile_width, width - w);
+          const Dtype* in = data_pad + l * plane + h * row + w;
+          Dtype* out = data_out + m * out_size + (l * height + h) * width + w;
+          switch (outs) {
+          case 4:
+            Kernel::template Forward<4>(in, channel_size, plane, row,
+                weight_block, channels, out, out_size, valid);
+            break;
+          case 3:
+            Kernel::template Forward<3>(in, channel_size, plane, row,
+                weight_block, channels, out, out_size, valid);
+            break;
+          case 2:
+            Kernel::template Forward<2>(in, channel_size, plane, row,
+                weight_block, channels, out, out_size, valid);
+            break;
+          default:
+            Kernel::template Forward<1>(in, channel_size, plane, row,
+                weight_block, channels, out, out_size, valid);
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void conv3d_direct_weight_grad_cpu(const Dtype* data_pad, const int channels,
+    const int length, const int height, const int width, const Dtype* top_diff,
+    const int num_output, Dtype* weight_diff) {
+  typedef Conv3DDirectKernel<Dtype> Kernel;
+  const int row = width + 2;
+  const int plane = (height + 2) * row;
+  const int channel_size = (length + 2) * plane;
+  const int out_size = length * height * width;
+  const int weight_size = channels * 27;
+  for (int m = 0; m < num_output; m += kOutBlock) {
+    const int outs = std::min(kOutBlock, num_output - m);
+    const Dtype* top = top_diff + m * out_size;
+    for (int c = 0; c < channels; ++c) {
+      for (int k = 0; k < 9; ++k) {
+        const Dtype* in = data_pad + c * channel_size + (k / 3) * plane
+            + (k % 3) * row;
+        Dtype* diff = weight_diff + m * weight_size + c * 27 + k * 3;
+        switch (outs) {
+        case 4:
+          Kernel::template WeightGrad<4>(in, plane, row, top, length, height,
+              width, diff, weight_size);
+          break;
+        case 3:
+          Kernel::template WeightGrad<3>(in, plane, row, top, length, height,
+              width, diff, weight_size);
+          break;
+        case 2:
+          Kernel::template WeightGrad<2>(in, plane, row, top, length, height,
+              width, diff, weight_size);
+          break;
+        default:
+          Kernel::template WeightGrad<1>(in, plane, row, top, length, height,
+              width, diff, weight_size);
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void conv3d_direct_flip_weight_cpu(const Dtype* weight, const int num_output,
+    const int channels, Dtype* weight_flipped) {
+  for (int m = 0; m < num_output; ++m) {
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* w = weight + (m * channels + c) * 27;
+      Dtype* f = weight_flipped + (c * num_output + m) * 27;
+      for (int k = 0; k < 27; ++k) {
+        f[k] = w[26 - k];
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void conv3d_direct_pad_cpu<float>(const float* data_im,
+    const int channels, const int length, const int height, const int width,
+    float* data_pad);
+template void conv3d_direct_pad_cpu<double>(const double* data_im,
+    const int channels, const int length, const int height, const int width,
+    double* data_pad);
+template void conv3d_direct_forward_cpu<float>(const float* data_pad,
+    const int channels, const int length, const int height, const int width,
+    const float* weight, const int num_output, float* data_out);
+template void conv3d_direct_forward_cpu<double>(const double* data_pad,
+    const int channels, const int length, const int height, const int width,
+    const double* weight, const int num_output, double* data_out);
+template void conv3d_direct_weight_grad_cpu<float>(const float* data_pad,
+    const int channels, const int length, const int height, const int width,
+    const float* top_diff, const int num_output, float* weight_diff);
+template void conv3d_direct_weight_grad_cpu<double>(const double* data_pad,
+    const int channels, const int length, const int height, const int width,
+    const double* top_diff, const int num_output, double* weight_diff);
+template void conv3d_direct_flip_weight_cpu<float>(const float* weight,
+    const int num_output, const int channels, float* weight_flipped);
+template void conv3d_direct_flip_weight_cpu<double>(const double* weight,
+    const int num_output, const int channels, double* weight_flipped);
+
+}  // namespace caffe
@@ -0,0 +1,163 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/conv3d_factorize.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Eigendecomposition of the symmetric size x size matrix a by cyclic Jacobi
+// rotations, which leave the eigenvalues on the diagonal of a and the
+// eigenvectors in the columns of vectors. The Gram matrices factorized here
+// have at most a few thousand rows, and the tool runs offline.
+static void symmetric_eigen(const int size, double* a, double* vectors) {
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < size; ++j) {
+      vectors[i * size + j] = (i == j) ? 1. : 0.;
+    }
+  }
+  double norm = 0;
+  for (int i = 0; i < size * size; ++i) {
+    norm += a[i] * a[i];
+  }
+  for (int sweep = 0; sweep < 100; ++sweep) {
+    double off = 0;
+    for (int p = 0; p < size; ++p) {
+      for (int q = p + 1; q < size; ++q) {
+        off += a[p * size + q] * a[p * size + q];
+      }
+    }
+    if (off <= 1e-30 * norm) {
+      break;
+    }
+    for (int p = 0; p < size; ++p) {
+      for (int q = p + 1; q < size; ++q) {
+        const double apq = a[p * size + q];
+        if (apq == 0) {
+          continue;
+        }
+        // the rotation of the (p, q) plane that zeroes a[p][q]
+        const double theta = (a[q * size + q] - a[p * size + p]) / (2 * apq);
+        const double t = (theta >= 0 ? 1. : -1.) /
+            (std::fabs(theta) + std::sqrt(theta * theta + 1));
+        const double c = 1 / std::sqrt(t * t + 1);
+        const double s = t * c;
+        for (int k = 0; k < size; ++k) {
+          const double x = a[k * size + p];
+          const double y = a[k * size + q];
+          a[k * size + p] = c * x - s * y;
+          a[k * size + q] = s * x + c * y;
+        }
+        for (int k = 0; k < size; ++k) {
+          const double x = a[p * size + k];
+          const double y = a[q * size + k];
+          a[p * size + k] = c * x - s * y;
+          a[q * size + k] = s * x + c * y;
+        }
+        for (int k = 0; k < size; ++k) {
+          const double x = vectors[k * size + p];
+          const double y = vectors[k * size + q];
+          vectors[k * size + p] = c * x - s * y;
+          vectors[k * size + q] = s * x + c * y;
+        }
+      }
+    }
+  }
+}
+
+int conv3d_factorize_max_rank(const int num_output, const int channels,
+    const int kernel_depth, const int kernel_size) {
+  return std::min(num_output * kernel_depth,
+      channels * kernel_size * kernel_size);
+}
+
+template <typename Dtype>
+Dtype conv3d_factorize_cpu(const Dtype* weight, const int num_output,
+    const int channels, const int kernel_depth, const int kernel_size,
+    const int rank, Dtype* spatial_weight, Dtype* temporal_weight) {
+  const int kernel_area = kernel_size * kernel_size;
+  // A, the m x n matrix of the (output, temporal tap) rows and the
+  // (channel, spatial tap) columns of the filters
+  const int m = num_output * kernel_depth;
+  const int n = channels * kernel_area;
+  CHECK_GE(rank, 1);
+  CHECK_LE(rank, std::min(m, n));
+  std::vector<double> matrix(m * n);
+  for (int o = 0; o < num_output; ++o) {
+    for (int c = 0; c < channels; ++c) {
+      for (int t = 0; t < kernel_depth; ++t) {
+        for (int k = 0; k < kernel_area; ++k) {
+          matrix[(o * kernel_depth + t) * n + c * kernel_area + k] =
+              weight[((o * channels + c) * kernel_depth + t) * kernel_area + k];
+        }
+      }
+    }
+  }
+  // the singular vectors of the smaller side are the eigenvectors of its
+  // Gram matrix, those of the other side its projections through A
+  const bool rows = m <= n;
+  const int size = rows ? m : n;
+  std::vector<double> gram(size * size), vectors(size * size);
+  if (rows) {
+    caffe_cpu_gemm<double>(CblasNoTrans, CblasTrans, m, m, n, 1.,
+        &matrix[0], &matrix[0], 0., &gram[0]);
+  } else {
+    caffe_cpu_gemm<double>(CblasTrans, CblasNoTrans, n, n, m, 1.,
+        &matrix[0], &matrix[0], 0., &gram[0]);
+  }
+  symmetric_eigen(size, &gram[0], &vectors[0]);
+  std::vector<std::pair<double, int> > values(size);
+  double total = 0;
+  for (int i = 0; i < size; ++i) {
+    values[i] = std::make_pair(std::max(gram[i * size + i], 0.), i);
+    total += values[i].first;
+  }
+  std::sort(values.begin(), values.end(),
+      std::greater<std::pair<double, int> >());
+
+  std::vector<double> singular(size), projection(rows ? n : m);
+  double kept = 0;
+  for (int r = 0; r < rank; ++r) {
+    kept += values[r].first;
+    for (int i = 0; i < size; ++i) {
+      singular[i] = vectors[i * size + values[r].second];
+    }
+    // A^T u = sigma v for a left singular vector u, A v = sigma u for a right
+    // one
+    caffe_cpu_gemv<double>(rows ? CblasTrans : CblasNoTrans, m, n, 1.,
+        &matrix[0], &singular[0], 0., &projection[0]);
+    const double scale = std::sqrt(std::sqrt(values[r].first));
+    const double projection_scale = scale > 0 ? 1. / scale : 1.;
+    const double* u = rows ? &singular[0] : &projection[0];
+    const double* v = rows ? &projection[0] : &singular[0];
+    const double u_scale = rows ? scale : projection_scale;
+    const double v_scale = rows ? projection_scale : scale;
+    for (int o = 0; o < num_output; ++o) {
+      for (int t = 0; t < kernel_depth; ++t) {
+        temporal_weight[(o * rank + r) * kernel_depth + t] =
+            u[o * kernel_depth + t] * u_scale;
+      }
+    }
+    for (int i = 0; i < n; ++i) {
+      spatial_weight[r * n + i] = v[i] * v_scale;
+    }
+  }
+  return total > 0 ? std::sqrt(std::max(total - kept, 0.) / total) : 0;
+}
+
+template float conv3d_factorize_cpu<float>(const float* weight,
+    const int num_output, const int channels, const int kernel_depth,
+    const int kernel_size, const int rank, float* spatial_weight,
+    float* temporal_weight);
+template double conv3d_factorize_cpu<double>(const double* weight,
+    const int num_output, const int channels, const int kernel_depth,
+    const int kernel_size, const int rank, double* spatial_weight,
+    double* temporal_weight);
+
+}  // namespace caffe
@@ -0,0 +1,276 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/conv3d_fft.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+Conv3DFFT<Dtype>::Conv3DFFT()
+    : num_(0), channels_(0), fft_length_(0), tile_length_(0),
+      filter_source_(NULL), filter_version_(0) {}
+
+template <typename Dtype>
+bool Conv3DFFT<Dtype>::Init(const int num, const int channels,
+    const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int temporal_pad,
+    const int pad, const uint64_t workspace_limit) {
+  num_ = num;
+  channels_ = channels;
+  length_ = length;
+  height_ = height;
+  width_ = width;
+  kernel_depth_ = kernel_depth;
+  kernel_size_ = kernel_size;
+  temporal_pad_ = temporal_pad;
+  pad_ = pad;
+  padded_length_ = length + 2 * temporal_pad;
+  padded_height_ = height + 2 * pad;
+  padded_width_ = width + 2 * pad;
+  small_length_ = padded_length_ - kernel_depth + 1;
+  small_height_ = padded_height_ - kernel_size + 1;
+  small_width_ = padded_width_ - kernel_size + 1;
+  CHECK_GT(small_length_, 0);
+  CHECK_GT(small_height_, 0);
+  CHECK_GT(small_width_, 0);
+  fft_height_ = RealFFT3D<Dtype>::PowerOfTwo(padded_height_);
+  fft_width_ = std::max(RealFFT3D<Dtype>::PowerOfTwo(padded_width_), 2);
+
+  // Halve the FFT length until the spectra fit in the workspace. Each tile
+  // then yields fft_length_ - kernel_depth + 1 rows of the small volume.
+  const int min_length = RealFFT3D<Dtype>::PowerOfTwo(kernel_depth);
+  uint64_t bytes = 0;
+  for (fft_length_ = RealFFT3D<Dtype>::PowerOfTwo(padded_length_); ;
+      fft_length_ /= 2) {
+    const uint64_t spectrum = static_cast<uint64_t>(fft_length_) *
+        fft_height_ * (fft_width_ / 2 + 1) * 2;
+    const uint64_t volume = static_cast<uint64_t>(fft_length_) *
+        fft_height_ * fft_width_;
+    bytes = sizeof(Dtype) * (spectrum * (2 * num * channels + num + channels
+        + 1) + volume);
+    if (bytes <= workspace_limit || fft_length_ <= min_length) {
+      break;
+    }
+  }
+  tile_length_ = fft_length_ - kernel_depth + 1;
+  fft_.Init(fft_length_, fft_height_, fft_width_);
+  const int spectrum_count = 2 * fft_.spectrum_count();
+  filter_spectra_.Reshape(num, channels, 1, 1, spectrum_count);
+  gradient_spectra_.Reshape(num, channels, 1, 1, spectrum_count);
+  large_spectra_.Reshape(1, channels, 1, 1, spectrum_count);
+  small_spectra_.Reshape(1, num, 1, 1, spectrum_count);
+  product_.Reshape(1, 1, 1, 1, spectrum_count);
+  real_.Reshape(1, 1, fft_length_, fft_height_, fft_width_);
+  filter_source_ = NULL;
+  return bytes <= workspace_limit;
+}
+
+template <typename Dtype>
+double Conv3DFFT<Dtype>::EstimatedSavings() const {
+  const double small = static_cast<double>(small_length_) * small_height_
+      * small_width_;
+  const double gemm = 2. * num_ * channels_ * kernel_depth_ * kernel_size_
+      * kernel_size_ * small;
+  const double volume = fft_.count();
+  const double tiles = (small_length_ + tile_length_ - 1) / tile_length_;
+  // a real FFT costs about 2.5 n log2(n) flops, a complex multiply-add 8
+  const double fft = tiles * ((num_ + channels_) * 2.5 * volume
+      * log(volume) / log(2.) + 8. * num_ * channels_ * fft_.spectrum_count());
+  return gemm / fft;
+}
+
+template <typename Dtype>
+void Conv3DFFT<Dtype>::LoadTile(const Dtype* volume, const int length,
+    const int height, const int width, const int first, const int rows,
+    const int offset, Dtype* spectrum) {
+  Dtype* real = real_.mutable_cpu_data();
+  memset(real, 0, sizeof(Dtype) * real_.count());
+  const int begin = std::max(0, -first);
+  const int end = std::min(rows, length - first);
+  for (int j = begin; j < end; ++j) {
+    for (int h = 0; h < height; ++h) {
+      memcpy(real + (j * fft_height_ + h + offset) * fft_width_ + offset,
+          volume + ((first + j) * height + h) * width, sizeof(Dtype) * width);
+    }
+  }
+  fft_.Forward(real, spectrum);
+}
+
+template <typename Dtype>
+void Conv3DFFT<Dtype>::UpdateFilters(const Blob<Dtype>& weight) {
+  const SyncedMemory* source = weight.data().get();
+  if (source == filter_source_ && source->version() == filter_version_) {
+    return;
+  }
+  const Dtype* w = weight.cpu_data();
+  const int kernel_count = kernel_depth_ * kernel_size_ * kernel_size_;
+  Dtype* spectra = filter_spectra_.mutable_cpu_data();
+  for (int i = 0; i < num_ * channels_; ++i) {
+    LoadTile(w + i * kernel_count, kernel_depth_, kernel_size_, kernel_size_,
+        0, kernel_depth_, 0, spectra + i * filter_spectra_.width());
+  }
+  filter_source_ = source;
+  filter_version_ = source->version();
+}
+
+template <typename Dtype>
+void Conv3DFFT<Dtype>::Correlate(const Dtype* large, Dtype* small) {
+  const int spectrum_count = filter_spectra_.width();
+  const int large_size = length_ * height_ * width_;
+  const int small_size = small_length_ * small_height_ * small_width_;
+  const Dtype scale = Dtype(1) / fft_.count();
+  const Dtype* filters = filter_spectra_.cpu_data();
+  Dtype* large_spectra = large_spectra_.mutable_cpu_data();
+  Dtype* product = product_.mutable_cpu_data();
+  Dtype* real = real_.mutable_cpu_data();
+  for (int t = 0; t < small_length_; t += tile_length_) {
+    for (int q = 0; q < channels_; ++q) {
+      LoadTile(large + q * large_size, length_, height_, width_,
+          t - temporal_pad_, fft_length_, pad_,
+          large_spectra + q * spectrum_count);
+    }
+    for (int p = 0; p < num_; ++p) {
+      // product = sum_q large[q] * conj(w[p][q])
+      memset(product, 0, sizeof(Dtype) * spectrum_count);
+      for (int q = 0; q < channels_; ++q) {
+        const Dtype* a = large_spectra + q * spectrum_count;
+        const Dtype* b = filters + (p * channels_ + q) * spectrum_count;
+        for (int f = 0; f < spectrum_count; f += 2) {
+          product[f] += a[f] * b[f] + a[f + 1] * b[f + 1];
+          product[f + 1] += a[f + 1] * b[f] - a[f] * b[f + 1];
+        }
+      }
+      fft_.Inverse(product, real);
+      const int rows = std::min(tile_length_, small_length_ - t);
+      for (int j = 0; j < rows; ++j) {
+        for (int h = 0; h < small_height_; ++h) {
+          Dtype* out = small + p * small_size
+              + ((t + j) * small_height_ + h) * small_width_;
+          const Dtype* in = real + (j * fft_height_ + h) * fft_width_;
+          for (int w = 0; w < small_width_; ++w) {
+            out[w] = in[w] * scale;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Conv3DFFT<Dtype>::Convolve(const Dtype* small, Dtype* large) {
+  const int spectrum_count = filter_spectra_.width();
+  const int large_size = length_ * height_ * width_;
+  const int small_size = small_length_ * small_height_ * small_width_;
+  const Dtype scale = Dtype(1) / fft_.count();
+  const Dtype* filters = filter_spectra_.cpu_data();
+  Dtype* small_spectra = small_spectra_.mutable_cpu_data();
+  Dtype* product = product_.mutable_cpu_data();
+  Dtype* real = real_.mutable_cpu_data();
+  // Each tile produces padded rows [s, s + tile_length_) of the large volume
+  // from small rows [s - kernel_depth_ + 1, s + tile_length_), only the
+  // rows inside the padding are computed.
+  for (int s = temporal_pad_; s < temporal_pad_ + length_;
+      s += tile_length_) {
+    const int first = s - kernel_depth_ + 1;
+    for (int p = 0; p < num_; ++p) {
+      LoadTile(small + p * small_size, small_length_, small_height_,
+          small_width_, first, fft_length_, 0,
+          small_spectra + p * spectrum_count);
+    }
+    for (int q = 0; q < channels_; ++q) {
+      // product = sum_p small[p] * w[p][q]
+      memset(product, 0, sizeof(Dtype) * spectrum_count);
+      for (int p = 0; p < num_; ++p) {
+        const Dtype* a = small_spectra + p * spectrum_count;
+        const Dtype* b = filters + (p * channels_ + q) * spectrum_count;
+        for (int f = 0; f < spectrum_count; f += 2) {
+          product[f] += a[f] * b[f] - a[f + 1] * b[f + 1];
+          product[f + 1] += a[f + 1] * b[f] + a[f] * b[f + 1];
+        }
+      }
+      fft_.Inverse(product, real);
+      const int end = std::min(s + tile_length_, temporal_pad_ + length_);
+      for (int r = s; r < end; ++r) {
+        const int j = r - first;
+        for (int h = 0; h < height_; ++h) {
+          Dtype* out = large + q * large_size
+              + ((r - temporal_pad_) * height_ + h) * width_;
+          const Dtype* in = real + (j * fft_height_ + h + pad_) * fft_width_
+              + pad_;
+          for (int w = 0; w < width_; ++w) {
+            out[w] = in[w] * scale;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Conv3DFFT<Dtype>::AccumulateWeightGradient(const Dtype* small,
+    const Dtype* large) {
+  const int spectrum_count = filter_spectra_.width();
+  const int large_size = length_ * height_ * width_;
+  const int small_size = small_length_ * small_height_ * small_width_;
+  Dtype* large_spectra = large_spectra_.mutable_cpu_data();
+  Dtype* small_spectra = small_spectra_.mutable_cpu_data();
+  Dtype* gradient = gradient_spectra_.mutable_cpu_data();
+  for (int t = 0; t < small_length_; t += tile_length_) {
+    for (int p = 0; p < num_; ++p) {
+      LoadTile(small + p * small_size, small_length_, small_height_,
+          small_width_, t, tile_length_, 0, small_spectra + p * spectrum_count);
+    }
+    for (int q = 0; q < channels_; ++q) {
+      LoadTile(large + q * large_size, length_, height_, width_,
+          t - temporal_pad_, fft_length_, pad_,
+          large_spectra + q * spectrum_count);
+    }
+    // gradient[p][q] += conj(small[p]) * large[q]
+    for (int p = 0; p < num_; ++p) {
+      const Dtype* a = small_spectra + p * spectrum_count;
+      for (int q = 0; q < channels_; ++q) {
+        const Dtype* b = large_spectra + q * spectrum_count;
+        Dtype* g = gradient + (p * channels_ + q) * spectrum_count;
+        for (int f = 0; f < spectrum_count; f += 2) {
+          g[f] += a[f] * b[f] + a[f + 1] * b[f + 1];
+          g[f + 1] += a[f] * b[f + 1] - a[f + 1] * b[f];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Conv3DFFT<Dtype>::AddWeightGradient(Dtype* weight_diff) {
+  const int spectrum_count = filter_spectra_.width();
+  const int kernel_count = kernel_depth_ * kernel_size_ * kernel_size_;
+  const Dtype scale = Dtype(1) / fft_.count();
+  Dtype* gradient = gradient_spectra_.mutable_cpu_data();
+  Dtype* product = product_.mutable_cpu_data();
+  Dtype* real = real_.mutable_cpu_data();
+  for (int i = 0; i < num_ * channels_; ++i) {
+    memcpy(product, gradient + i * spectrum_count,
+        sizeof(Dtype) * spectrum_count);
+    fft_.Inverse(product, real);
+    Dtype* diff = weight_diff + i * kernel_count;
+    for (int l = 0; l < kernel_depth_; ++l) {
+      for (int h = 0; h < kernel_size_; ++h) {
+        for (int w = 0; w < kernel_size_; ++w) {
+          diff[(l * kernel_size_ + h) * kernel_size_ + w] +=
+              real[(l * fft_height_ + h) * fft_width_ + w] * scale;
+        }
+      }
+    }
+  }
+  memset(gradient, 0, sizeof(Dtype) * gradient_spectra_.count());
+}
+
+INSTANTIATE_CLASS(Conv3DFFT);
+
+}  // namespace caffe
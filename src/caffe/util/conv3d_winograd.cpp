@@ -0,0 +1,186 @@
+// Copyright 2014 BVLC and contributors.
+
+#include "caffe/util/conv3d_winograd.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Elements of a transformed 4x4x4 tile.
+static const int kTileSize = 64;
+
+// 1D F(2, 3) transforms applied along one axis of a tile:
+// filter  G   = [1 0 0; 1/2 1/2 1/2; 1/2 -1/2 1/2; 0 0 1]
+// input   B^T = [1 0 -1 0; 0 1 1 0; 0 -1 1 0; 0 1 0 -1]
+// output  A^T = [1 1 1 0; 0 1 -1 -1]
+template <typename Dtype>
+inline void winograd_filter_line(const Dtype* g, const int gs, Dtype* y,
+    const int ys) {
+  y[0] = g[0];
+  y[ys] = (g[0] + g[gs] + g[2 * gs]) / 2;
+  y[2 * ys] = (g[0] - g[gs] + g[2 * gs]) / 2;
+  y[3 * ys] = g[2 * gs];
+}
+
+template <typename Dtype>
+inline void winograd_input_line(Dtype* d, const int s) {
+  const Dtype x0 = d[0];
+  const Dtype x1 = d[s];
+  const Dtype x2 = d[2 * s];
+  const Dtype x3 = d[3 * s];
+  d[0] = x0 - x2;
+  d[s] = x1 + x2;
+  d[2 * s] = x2 - x1;
+  d[3 * s] = x1 - x3;
+}
+
+template <typename Dtype>
+inline void winograd_output_line(const Dtype* x, const int s, Dtype* y,
+    const int ys) {
+  y[0] = x[0] + x[s] + x[2 * s];
+  y[ys] = x[s] - x[2 * s] - x[3 * s];
+}
+
+int conv3d_winograd_filter_count(const int num_output, const int channels) {
+  return kTileSize * num_output * channels;
+}
+
+template <typename Dtype>
+void conv3d_winograd_filter_transform_cpu(const Dtype* weight,
+    const int num_output, const int channels, Dtype* weight_winograd) {
+  Dtype a[36], b[48], u[kTileSize];
+  for (int m = 0; m < num_output; ++m) {
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* g = weight + (m * channels + c) * 27;
+      // width, then height, then length
+      for (int i = 0; i < 9; ++i) {
+        winograd_filter_line(g + i * 3, 1, a + i * 4, 1);
+      }
+      for (int l = 0; l < 3; ++l) {
+        for (int k = 0; k < 4; ++k) {
+          winograd_filter_line(a + l * 12 + k, 4, b + l * 16 + k, 4);
+        }
+      }
+      for (int i = 0; i < 16; ++i) {
+        winograd_filter_line(b + i, 16, u + i, 16);
+      }
+      for (int i = 0; i < kTileSize; ++i) {
+        weight_winograd[(i * num_output + m) * channels + c] = u[i];
+      }
+    }
+  }
+}
+
+int conv3d_winograd_workspace_count(const int channels, const int length,
+    const int height, const int width, const int pad, const int temporal_pad,
+    const int num_output) {
+  const int tiles = ((length + 2 * temporal_pad - 1) / 2)
+      * ((height + 2 * pad - 1) / 2) * ((width + 2 * pad - 1) / 2);
+  return kTileSize * (channels + num_output) * tiles;
+}
+
+template <typename Dtype>
+void conv3d_winograd_forward_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int pad,
+    const int temporal_pad, const Dtype* weight_winograd, const int num_output,
+    Dtype* workspace, Dtype* data_out) {
+  const int length_out = length + 2 * temporal_pad - 2;
+  const int height_out = height + 2 * pad - 2;
+  const int width_out = width + 2 * pad - 2;
+  const int tiles_l = (length_out + 1) / 2;
+  const int tiles_h = (height_out + 1) / 2;
+  const int tiles_w = (width_out + 1) / 2;
+  const int tiles = tiles_l * tiles_h * tiles_w;
+  // transformed input: 64 x channels x tiles
+  Dtype* data_v = workspace;
+  // transformed output: 64 x num_output x tiles
+  Dtype* data_m = workspace + kTileSize * channels * tiles;
+
+  Dtype d[kTileSize];
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* im = data_im + c * length * height * width;
+    for (int t = 0; t < tiles; ++t) {
+      const int l0 = (t / (tiles_h * tiles_w)) * 2 - temporal_pad;
+      const int h0 = ((t / tiles_w) % tiles_h) * 2 - pad;
+      const int w0 = (t % tiles_w) * 2 - pad;
+      for (int i = 0; i < kTileSize; ++i) {
+        const int l = l0 + i / 16;
+        const int h = h0 + (i / 4) % 4;
+        const int w = w0 + i % 4;
+        d[i] = (l >= 0 && l < length && h >= 0 && h < height && w >= 0
+            && w < width) ? im[(l * height + h) * width + w] : 0;
+      }
+      for (int i = 0; i < 16; ++i) {
+        winograd_input_line(d + i * 4, 1);
+      }
+      for (int l = 0; l < 4; ++l) {
+        for (int k = 0; k < 4; ++k) {
+          winograd_input_line(d + l * 16 + k, 4);
+        }
+      }
+      for (int i = 0; i < 16; ++i) {
+        winograd_input_line(d + i, 16);
+      }
+      for (int i = 0; i < kTileSize; ++i) {
+        data_v[(i * channels + c) * tiles + t] = d[i];
+      }
+    }
+  }
+
+  // one num_output x tiles GEMM per transformed element
+  for (int i = 0; i < kTileSize; ++i) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output, tiles,
+        channels, (Dtype)1., weight_winograd + i * num_output * channels,
+        data_v + i * channels * tiles, (Dtype)0.,
+        data_m + i * num_output * tiles);
+  }
+
+  Dtype a[32], b[16], y[8];
+  for (int m = 0; m < num_output; ++m) {
+    Dtype* out = data_out + m * length_out * height_out * width_out;
+    for (int t = 0; t < tiles; ++t) {
+      for (int i = 0; i < kTileSize; ++i) {
+        d[i] = data_m[(i * num_output + m) * tiles + t];
+      }
+      // width, then height, then length
+      for (int i = 0; i < 16; ++i) {
+        winograd_output_line(d + i * 4, 1, a + i * 2, 1);
+      }
+      for (int l = 0; l < 4; ++l) {
+        for (int k = 0; k < 2; ++k) {
+          winograd_output_line(a + l * 8 + k, 2, b + l * 4 + k, 2);
+        }
+      }
+      for (int i = 0; i < 4; ++i) {
+        winograd_output_line(b + i, 4, y + i, 4);
+      }
+      const int l0 = (t / (tiles_h * tiles_w)) * 2;
+      const int h0 = ((t / tiles_w) % tiles_h) * 2;
+      const int w0 = (t % tiles_w) * 2;
+      for (int i = 0; i < 8; ++i) {
+        const int l = l0 + i / 4;
+        const int h = h0 + (i / 2) % 2;
+        const int w = w0 + i % 2;
+        if (l < length_out && h < height_out && w < width_out) {
+          out[(l * height_out + h) * width_out + w] = y[i];
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void conv3d_winograd_filter_transform_cpu<float>(const float* weight,
+    const int num_output, const int channels, float* weight_winograd);
+template void conv3d_winograd_filter_transform_cpu<double>(
+    const double* weight, const int num_output, const int channels,
+    double* weight_winograd);
+template void conv3d_winograd_forward_cpu<float>(const float* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int pad, const int temporal_pad, const float* weight_winograd,
+    const int num_output, float* workspace, float* data_out);
+template void conv3d_winograd_forward_cpu<double>(const double* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int pad, const int temporal_pad, const double* weight_winograd,
+    const int num_output, double* workspace, double* data_out);
+
+}  // namespace caffe
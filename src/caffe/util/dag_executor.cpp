@@ -0,0 +1,73 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "caffe/util/dag_executor.hpp"
+#include "caffe/util/numa.hpp"
+
+namespace caffe {
+
+DagExecutor::DagExecutor(const std::vector<std::vector<int> >& predecessors,
+    const int num_threads)
+    : successors_(predecessors.size()),
+      num_predecessors_(predecessors.size()),
+      pool_(num_threads, NumaThreadNode()), finished_(0) {
+  for (int i = 0; i < predecessors.size(); ++i) {
+    num_predecessors_[i] = predecessors[i].size();
+    for (int j = 0; j < predecessors[i].size(); ++j) {
+      CHECK_GE(predecessors[i][j], 0);
+      CHECK_LT(predecessors[i][j], i) << "Task " << i << " depends on a "
+          << "later task";
+      successors_[predecessors[i][j]].push_back(i);
+    }
+  }
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+  CHECK_EQ(pthread_cond_init(&cond_, NULL), 0);
+}
+
+DagExecutor::~DagExecutor() {
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void DagExecutor::Run(const boost::function<void(int)>& task) {
+  waiting_ = num_predecessors_;
+  finished_ = 0;
+  for (int i = 0; i < waiting_.size(); ++i) {
+    if (waiting_[i] == 0) {
+      ready_.push(i);
+    }
+  }
+  pool_.Run(boost::bind(&DagExecutor::Worker, this, &task, _1));
+  CHECK_EQ(finished_, num_tasks());
+}
+
+void DagExecutor::Worker(const boost::function<void(int)>* task,
+    const int thread_id) {
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    while (ready_.empty() && finished_ < num_tasks()) {
+      pthread_cond_wait(&cond_, &mutex_);
+    }
+    if (ready_.empty()) {
+      break;
+    }
+    const int i = ready_.top();
+    ready_.pop();
+    pthread_mutex_unlock(&mutex_);
+    (*task)(i);
+    pthread_mutex_lock(&mutex_);
+    ++finished_;
+    for (int j = 0; j < successors_[i].size(); ++j) {
+      if (--waiting_[successors_[i][j]] == 0) {
+        ready_.push(successors_[i][j]);
+      }
+    }
+    pthread_cond_broadcast(&cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+}  // namespace caffe
@@ -0,0 +1,217 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/deconv3d_phase.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// floor(a / b) for b > 0 and any a.
+static inline int floor_div(const int a, const int b) {
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+template <typename Dtype>
+Deconv3DPhase<Dtype>::Deconv3DPhase()
+    : channels_(0), num_output_(0), filter_group_(1), buffer_count_(0),
+      filter_source_(NULL), filter_version_(0) {}
+
+template <typename Dtype>
+void Deconv3DPhase<Dtype>::Init(const int channels, const int num_output,
+    const int filter_group, const int length, const int height,
+    const int width, const int kernel_depth, const int kernel_size,
+    const int temporal_pad, const int pad, const int temporal_stride,
+    const int stride) {
+  channels_ = channels;
+  num_output_ = num_output;
+  filter_group_ = filter_group;
+  const int input[3] = {length, height, width};
+  const int kernel[3] = {kernel_depth, kernel_size, kernel_size};
+  const int pads[3] = {temporal_pad, pad, pad};
+  const int strides[3] = {temporal_stride, stride, stride};
+  for (int d = 0; d < 3; ++d) {
+    input_[d] = input[d];
+    kernel_[d] = kernel[d];
+    stride_[d] = strides[d];
+    output_[d] = strides[d] * (input[d] - 1) + kernel[d] - 2 * pads[d];
+    CHECK_GT(output_[d], 0);
+  }
+  phases_.clear();
+  int filter_count = 0;
+  buffer_count_ = 0;
+  for (int rl = 0; rl < strides[0]; ++rl) {
+    for (int rh = 0; rh < strides[1]; ++rh) {
+      for (int rw = 0; rw < strides[2]; ++rw) {
+        const int r[3] = {rl, rh, rw};
+        Phase phase;
+        int taps_volume = 1, positions = 1;
+        phase.identity = true;
+        for (int d = 0; d < 3; ++d) {
+          // outputs x = q * stride + r - pad in [0, output)
+          const int q_begin = floor_div(pads[d] - r[d] + strides[d] - 1,
+              strides[d]);
+          const int q_end = floor_div(output_[d] - 1 + pads[d] - r[d],
+              strides[d]) + 1;
+          phase.residue[d] = r[d];
+          phase.taps[d] = (r[d] < kernel[d]) ?
+              (kernel[d] - r[d] + strides[d] - 1) / strides[d] : 0;
+          phase.first[d] = q_begin;
+          phase.count[d] = std::max(0, q_end - q_begin);
+          phase.output[d] = q_begin * strides[d] + r[d] - pads[d];
+          taps_volume *= phase.taps[d];
+          positions *= phase.count[d];
+          phase.identity = phase.identity && phase.taps[d] == 1 &&
+              phase.first[d] == 0 && phase.count[d] == input[d];
+        }
+        if (positions == 0) {
+          continue;
+        }
+        phase.filter_offset = filter_count;
+        filter_count += num_output_ * channels_ / filter_group_ *
+            taps_volume;
+        // the gathered patches, unless they are the input, and the outputs
+        buffer_count_ = std::max(buffer_count_, static_cast<size_t>(
+            (phase.identity ? 0 : channels_ * taps_volume * positions) +
+            num_output_ * positions));
+        phases_.push_back(phase);
+      }
+    }
+  }
+  filters_.resize(filter_count);
+  filter_source_ = NULL;
+}
+
+template <typename Dtype>
+void Deconv3DPhase<Dtype>::UpdateFilters(const Blob<Dtype>& weight) {
+  const SyncedMemory* source = weight.data().get();
+  if (source == filter_source_ && source->version() == filter_version_) {
+    return;
+  }
+  const Dtype* w = weight.cpu_data();
+  const int group_channels = channels_ / filter_group_;
+  const int group_outputs = num_output_ / filter_group_;
+  const int kernel_volume = kernel_[0] * kernel_[1] * kernel_[2];
+  for (int p = 0; p < phases_.size(); ++p) {
+    // group_outputs x (group_channels x taps) filters per group, tap m of
+    // the phase being kernel tap r + stride * m
+    const Phase& phase = phases_[p];
+    Dtype* filters = filters_.empty() ? NULL :
+        &filters_[0] + phase.filter_offset;
+    for (int g = 0; g < filter_group_; ++g) {
+      for (int o = 0; o < group_outputs; ++o) {
+        for (int c = 0; c < group_channels; ++c) {
+          const Dtype* w_co = w + ((g * group_channels + c) * group_outputs +
+              o) * kernel_volume;
+          for (int ml = 0; ml < phase.taps[0]; ++ml) {
+            const int tl = phase.residue[0] + stride_[0] * ml;
+            for (int mh = 0; mh < phase.taps[1]; ++mh) {
+              const int th = phase.residue[1] + stride_[1] * mh;
+              for (int mw = 0; mw < phase.taps[2]; ++mw) {
+                const int tw = phase.residue[2] + stride_[2] * mw;
+                *filters++ = w_co[(tl * kernel_[1] + th) * kernel_[2] + tw];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  filter_source_ = source;
+  filter_version_ = source->version();
+}
+
+template <typename Dtype>
+void Deconv3DPhase<Dtype>::Forward(const Dtype* bottom, Dtype* buffer,
+    Dtype* top) const {
+  const int input_volume = input_[0] * input_[1] * input_[2];
+  const int group_channels = channels_ / filter_group_;
+  const int group_outputs = num_output_ / filter_group_;
+  for (int p = 0; p < phases_.size(); ++p) {
+    const Phase& phase = phases_[p];
+    const int taps_volume = phase.taps[0] * phase.taps[1] * phase.taps[2];
+    const int plane = phase.count[1] * phase.count[2];
+    const int positions = phase.count[0] * plane;
+    Dtype* output = buffer;
+    if (taps_volume == 0) {
+      // a kernel smaller than the stride never reaches these outputs
+      memset(output, 0, sizeof(Dtype) * num_output_ * positions);
+    } else {
+      // Gather the (channels x taps) x positions patches of the phase:
+      // row (c, m) holds input q - m for the outputs q of the phase.
+      const Dtype* patches = bottom;
+      if (!phase.identity) {
+        Dtype* row = buffer;
+        output = buffer + channels_ * taps_volume * positions;
+        for (int c = 0; c < channels_; ++c) {
+          const Dtype* im = bottom + c * input_volume;
+          for (int ml = 0; ml < phase.taps[0]; ++ml) {
+            for (int mh = 0; mh < phase.taps[1]; ++mh) {
+              for (int mw = 0; mw < phase.taps[2]; ++mw, row += positions) {
+                // the outputs d of a row read inputs first + d - mw, valid
+                // for d in [d_begin, d_end)
+                const int w_shift = phase.first[2] - mw;
+                const int d_end = std::min(phase.count[2],
+                    input_[2] - w_shift);
+                const int d_begin = std::min(std::max(0, -w_shift),
+                    std::max(d_end, 0));
+                Dtype* col = row;
+                for (int a = 0; a < phase.count[0]; ++a) {
+                  const int l = phase.first[0] + a - ml;
+                  if (l < 0 || l >= input_[0] || d_end <= d_begin) {
+                    memset(col, 0, sizeof(Dtype) * plane);
+                    col += plane;
+                    continue;
+                  }
+                  for (int b = 0; b < phase.count[1]; ++b,
+                      col += phase.count[2]) {
+                    const int h = phase.first[1] + b - mh;
+                    if (h < 0 || h >= input_[1]) {
+                      memset(col, 0, sizeof(Dtype) * phase.count[2]);
+                      continue;
+                    }
+                    memset(col, 0, sizeof(Dtype) * d_begin);
+                    memcpy(col + d_begin, im + (l * input_[1] + h) *
+                        input_[2] + w_shift + d_begin,
+                        sizeof(Dtype) * (d_end - d_begin));
+                    memset(col + d_end, 0,
+                        sizeof(Dtype) * (phase.count[2] - d_end));
+                  }
+                }
+              }
+            }
+          }
+        }
+        patches = buffer;
+      }
+      const int filter_dim = group_channels * taps_volume;
+      for (int g = 0; g < filter_group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, group_outputs,
+            positions, filter_dim, (Dtype)1., &filters_[phase.filter_offset] +
+            g * group_outputs * filter_dim,
+            patches + g * filter_dim * positions, (Dtype)0.,
+            output + g * group_outputs * positions);
+      }
+    }
+    // interleave the outputs of the phase into top
+    const Dtype* src = output;
+    for (int o = 0; o < num_output_; ++o) {
+      for (int a = 0; a < phase.count[0]; ++a) {
+        for (int b = 0; b < phase.count[1]; ++b, src += phase.count[2]) {
+          Dtype* dst = top + ((o * output_[0] + phase.output[0] +
+              a * stride_[0]) * output_[1] + phase.output[1] +
+              b * stride_[1]) * output_[2] + phase.output[2];
+          for (int d = 0; d < phase.count[2]; ++d) {
+            dst[d * stride_[2]] = src[d];
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(Deconv3DPhase);
+
+}  // namespace caffe
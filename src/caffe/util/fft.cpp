@@ -0,0 +1,182 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fft.hpp"
+
+namespace caffe {
+
+static const double kPi = 3.14159265358979323846;
+
+template <typename Dtype>
+void FFTPlan<Dtype>::Init(const int size) {
+  CHECK_GT(size, 0);
+  CHECK_EQ(size & (size - 1), 0) << "FFT size must be a power of two";
+  size_ = size;
+  twiddle_.resize(size);
+  for (int k = 0; k < size / 2; ++k) {
+    const double angle = -2. * kPi * k / size;
+    twiddle_[2 * k] = cos(angle);
+    twiddle_[2 * k + 1] = sin(angle);
+  }
+  bit_reverse_.resize(size);
+  int bits = 0;
+  while ((1 << bits) < size) {
+    ++bits;
+  }
+  for (int i = 0; i < size; ++i) {
+    int r = 0;
+    for (int b = 0; b < bits; ++b) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    bit_reverse_[i] = r;
+  }
+}
+
+template <typename Dtype>
+void FFTPlan<Dtype>::Transform(Dtype* data, const int stride,
+    const bool inverse) const {
+  const int s = 2 * stride;
+  for (int i = 0; i < size_; ++i) {
+    const int j = bit_reverse_[i];
+    if (i < j) {
+      std::swap(data[i * s], data[j * s]);
+      std::swap(data[i * s + 1], data[j * s + 1]);
+    }
+  }
+  const Dtype sign = inverse ? -1 : 1;
+  for (int len = 2; len <= size_; len <<= 1) {
+    const int half = len / 2;
+    const int step = size_ / len;
+    for (int i = 0; i < size_; i += len) {
+      for (int j = 0; j < half; ++j) {
+        const Dtype wr = twiddle_[2 * j * step];
+        const Dtype wi = sign * twiddle_[2 * j * step + 1];
+        Dtype* u = data + (i + j) * s;
+        Dtype* v = data + (i + j + half) * s;
+        const Dtype vr = v[0] * wr - v[1] * wi;
+        const Dtype vi = v[0] * wi + v[1] * wr;
+        v[0] = u[0] - vr;
+        v[1] = u[1] - vi;
+        u[0] += vr;
+        u[1] += vi;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+int RealFFT3D<Dtype>::PowerOfTwo(const int n) {
+  int p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+template <typename Dtype>
+void RealFFT3D<Dtype>::Init(const int length, const int height,
+    const int width) {
+  CHECK_GE(width, 2) << "The width of a real FFT must be at least 2";
+  length_ = length;
+  height_ = height;
+  width_ = width;
+  plan_l_.Init(length);
+  plan_h_.Init(height);
+  plan_w_.Init(width);
+  row_.resize(2 * width);
+}
+
+template <typename Dtype>
+void RealFFT3D<Dtype>::Forward(const Dtype* data, Dtype* spectrum) {
+  const int columns = width_ / 2 + 1;
+  const int rows = length_ * height_;
+  Dtype* z = &row_[0];
+  // rows: transform rows a and b as z = a + i b, then split
+  // A[k] = (Z[k] + conj(Z[n - k])) / 2, B[k] = (Z[k] - conj(Z[n - k])) / 2i
+  for (int r = 0; r < rows; r += 2) {
+    const Dtype* a = data + r * width_;
+    const Dtype* b = (r + 1 < rows) ? a + width_ : NULL;
+    for (int w = 0; w < width_; ++w) {
+      z[2 * w] = a[w];
+      z[2 * w + 1] = b ? b[w] : 0;
+    }
+    plan_w_.Transform(z, 1, false);
+    Dtype* sa = spectrum + 2 * r * columns;
+    Dtype* sb = sa + 2 * columns;
+    for (int k = 0; k < columns; ++k) {
+      const int nk = (width_ - k) % width_;
+      const Dtype zr = z[2 * k], zi = z[2 * k + 1];
+      const Dtype cr = z[2 * nk], ci = -z[2 * nk + 1];
+      sa[2 * k] = (zr + cr) / 2;
+      sa[2 * k + 1] = (zi + ci) / 2;
+      if (b) {
+        sb[2 * k] = (zi - ci) / 2;
+        sb[2 * k + 1] = -(zr - cr) / 2;
+      }
+    }
+  }
+  // columns along height, then along length
+  for (int l = 0; l < length_; ++l) {
+    for (int k = 0; k < columns; ++k) {
+      plan_h_.Transform(spectrum + 2 * (l * height_ * columns + k), columns,
+          false);
+    }
+  }
+  for (int i = 0; i < height_ * columns; ++i) {
+    plan_l_.Transform(spectrum + 2 * i, height_ * columns, false);
+  }
+}
+
+template <typename Dtype>
+void RealFFT3D<Dtype>::Inverse(Dtype* spectrum, Dtype* data) {
+  const int columns = width_ / 2 + 1;
+  const int rows = length_ * height_;
+  for (int i = 0; i < height_ * columns; ++i) {
+    plan_l_.Transform(spectrum + 2 * i, height_ * columns, true);
+  }
+  for (int l = 0; l < length_; ++l) {
+    for (int k = 0; k < columns; ++k) {
+      plan_h_.Transform(spectrum + 2 * (l * height_ * columns + k), columns,
+          true);
+    }
+  }
+  // rows: rebuild Z = A + i B from the Hermitian half spectra of rows a and
+  // b, so that one inverse complex FFT yields a as real and b as imaginary
+  // part
+  Dtype* z = &row_[0];
+  for (int r = 0; r < rows; r += 2) {
+    const Dtype* sa = spectrum + 2 * r * columns;
+    const Dtype* sb = (r + 1 < rows) ? sa + 2 * columns : NULL;
+    for (int k = 0; k < width_; ++k) {
+      // X[k] for k > width_ / 2 is conj(X[width_ - k])
+      const bool mirror = k >= columns;
+      const int j = mirror ? width_ - k : k;
+      const Dtype ar = sa[2 * j];
+      const Dtype ai = mirror ? -sa[2 * j + 1] : sa[2 * j + 1];
+      const Dtype br = sb ? sb[2 * j] : 0;
+      const Dtype bi = sb ? (mirror ? -sb[2 * j + 1] : sb[2 * j + 1]) : 0;
+      z[2 * k] = ar - bi;
+      z[2 * k + 1] = ai + br;
+    }
+    plan_w_.Transform(z, 1, true);
+    Dtype* a = data + r * width_;
+    for (int w = 0; w < width_; ++w) {
+      a[w] = z[2 * w];
+    }
+    if (sb) {
+      Dtype* b = a + width_;
+      for (int w = 0; w < width_; ++w) {
+        b[w] = z[2 * w + 1];
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(FFTPlan);
+INSTANTIATE_CLASS(RealFFT3D);
+
+}  // namespace caffe
@@ -0,0 +1,81 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+using std::map;
+using std::set;
+using std::string;
+
+namespace caffe {
+
+static bool IsInPlaceReLU(const LayerParameter& layer_param,
+    const string& blob_name) {
+  return layer_param.type() == LayerParameter_LayerType_RELU &&
+      layer_param.bottom_size() == 1 && layer_param.top_size() == 1 &&
+      layer_param.bottom(0) == blob_name && layer_param.top(0) == blob_name;
+}
+
+static bool IsFusablePooling(const LayerParameter& layer_param,
+    const string& blob_name) {
+  return layer_param.type() == LayerParameter_LayerType_POOLING3D &&
+      layer_param.bottom_size() == 1 && layer_param.top_size() == 1 &&
+      layer_param.bottom(0) == blob_name &&
+      layer_param.top(0) != blob_name &&
+      layer_param.pooling_param().pool() == PoolingParameter_PoolMethod_MAX &&
+      layer_param.pooling_param().pad() == 0;
+}
+
+void FuseConvolution3D(const NetParameter& param, NetParameter* param_fused) {
+  param_fused->CopyFrom(param);
+  param_fused->clear_layers();
+  // number of layers reading each blob
+  map<string, int> readers;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    for (int j = 0; j < param.layers(i).bottom_size(); ++j) {
+      ++readers[param.layers(i).bottom(j)];
+    }
+  }
+  // blobs the caller reads after Forward, which pooling must not replace
+  const set<string> keep_blobs(param.keep_blob().begin(),
+      param.keep_blob().end());
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    LayerParameter* fused_param = param_fused->add_layers();
+    fused_param->CopyFrom(layer_param);
+    if (layer_param.type() != LayerParameter_LayerType_CONVOLUTION3D ||
+        layer_param.top_size() != 1 ||
+        layer_param.convolution_param().fused_relu() ||
+        layer_param.convolution_param().fused_pooling()) {
+      continue;
+    }
+    const string& blob_name = layer_param.top(0);
+    int blob_readers = readers[blob_name];
+    if (i + 1 < param.layers_size() &&
+        IsInPlaceReLU(param.layers(i + 1), blob_name)) {
+      fused_param->mutable_convolution_param()->set_fused_relu(true);
+      LOG(INFO) << "Fusing " << param.layers(i + 1).name() << " into "
+          << layer_param.name();
+      --blob_readers;
+      ++i;
+    }
+    if (!param.channels_last() && blob_readers == 1 &&
+        !keep_blobs.count(blob_name) &&
+        i + 1 < param.layers_size() &&
+        IsFusablePooling(param.layers(i + 1), blob_name)) {
+      fused_param->mutable_convolution_param()->set_fused_pooling(true);
+      fused_param->mutable_pooling_param()->CopyFrom(
+          param.layers(i + 1).pooling_param());
+      fused_param->set_top(0, param.layers(i + 1).top(0));
+      LOG(INFO) << "Fusing " << param.layers(i + 1).name() << " into "
+          << layer_param.name();
+      ++i;
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,180 @@
+// Copyright 2014 BVLC and contributors.
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+#include "caffe/util/numa.hpp"
+
+namespace caffe {
+
+static const size_t kHostAlignment = 64;
+static const size_t kPageSize = 4096;
+static const size_t kHugePageSize = 2 << 20;
+static const size_t kDefaultCacheLimit = static_cast<size_t>(1) << 30;
+
+static bool EnvironmentFlag(const char* name) {
+  const char* value = getenv(name);
+  return value != NULL && atoi(value) != 0;
+}
+
+static void* SystemAllocate(const size_t size, const size_t alignment,
+    const bool huge_pages) {
+#if defined(_MSC_VER)
+  void* ptr = _aligned_malloc(size, alignment);
+#else
+  void* ptr = NULL;
+  if (posix_memalign(&ptr, alignment, size) != 0) {
+    ptr = NULL;
+  }
+#endif
+  CHECK(ptr) << "Cannot allocate " << size << " bytes of host memory";
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (huge_pages) {
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif
+  return ptr;
+}
+
+static void SystemFree(void* ptr) {
+#if defined(_MSC_VER)
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+HostAllocator& HostAllocator::Get() {
+  // never destroyed, as blobs may be freed by static destructors
+  static HostAllocator* allocator = new HostAllocator();
+  return *allocator;
+}
+
+HostAllocator::HostAllocator()
+    : use_malloc_(EnvironmentFlag("CAFFE_HOST_MALLOC")),
+      huge_pages_(EnvironmentFlag("CAFFE_HOST_HUGE_PAGES")),
+      cache_limit_(kDefaultCacheLimit) {
+  pthread_mutex_init(&mutex_, NULL);
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+size_t HostAllocator::BlockSize(const size_t size) const {
+  if (huge_pages_ && size >= kHugePageSize) {
+    return (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  }
+  // four size classes per power of two, at most a quarter of the size apart
+  size_t step = kHostAlignment;
+  while (step * 8 < size) {
+    step *= 2;
+  }
+  return std::max(kHostAlignment, (size + step - 1) / step * step);
+}
+
+void* HostAllocator::Allocate(const size_t size) {
+  if (use_malloc_) {
+    return malloc(size);
+  }
+  const size_t block_size = BlockSize(size);
+  const int node = NumaThreadNode();
+  const BlockKey key(block_size, node);
+  void* ptr = NULL;
+  pthread_mutex_lock(&mutex_);
+  ++stats_.allocations;
+  std::map<BlockKey, std::vector<void*> >::iterator cached = cache_.find(key);
+  if (cached != cache_.end() && !cached->second.empty()) {
+    ptr = cached->second.back();
+    cached->second.pop_back();
+    stats_.bytes_cached -= block_size;
+    ++stats_.cache_hits;
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (ptr == NULL) {
+    const bool huge = huge_pages_ && block_size >= kHugePageSize;
+    // whole pages, so that they can be moved to the node
+    const bool pages = node >= 0 && block_size >= kPageSize;
+    ptr = SystemAllocate(block_size, huge ? kHugePageSize :
+        (pages ? kPageSize : kHostAlignment), huge);
+    NumaMoveMemory(ptr, block_size, node);
+  }
+  pthread_mutex_lock(&mutex_);
+  blocks_[ptr] = key;
+  stats_.bytes_in_use += block_size;
+  stats_.peak_bytes_in_use = std::max(stats_.peak_bytes_in_use,
+      stats_.bytes_in_use);
+  pthread_mutex_unlock(&mutex_);
+  return ptr;
+}
+
+void HostAllocator::Free(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  std::map<void*, BlockKey>::iterator block = blocks_.find(ptr);
+  if (block == blocks_.end()) {
+    // allocated with use_malloc
+    pthread_mutex_unlock(&mutex_);
+    free(ptr);
+    return;
+  }
+  const BlockKey key = block->second;
+  const size_t block_size = key.first;
+  blocks_.erase(block);
+  stats_.bytes_in_use -= block_size;
+  const bool cache = !use_malloc_ &&
+      stats_.bytes_cached + block_size <= cache_limit_;
+  if (cache) {
+    cache_[key].push_back(ptr);
+    stats_.bytes_cached += block_size;
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (!cache) {
+    SystemFree(ptr);
+  }
+}
+
+void HostAllocator::TrimCache(const size_t limit) {
+  std::map<BlockKey, std::vector<void*> >::reverse_iterator it =
+      cache_.rbegin();
+  // the largest blocks go first
+  for (; it != cache_.rend() && stats_.bytes_cached > limit; ++it) {
+    while (!it->second.empty() && stats_.bytes_cached > limit) {
+      SystemFree(it->second.back());
+      it->second.pop_back();
+      stats_.bytes_cached -= it->first.first;
+    }
+  }
+}
+
+void HostAllocator::ReleaseCache() {
+  pthread_mutex_lock(&mutex_);
+  TrimCache(0);
+  cache_.clear();
+  pthread_mutex_unlock(&mutex_);
+}
+
+void HostAllocator::set_cache_limit(const size_t cache_limit) {
+  pthread_mutex_lock(&mutex_);
+  cache_limit_ = cache_limit;
+  TrimCache(cache_limit);
+  pthread_mutex_unlock(&mutex_);
+}
+
+HostAllocatorStats HostAllocator::stats() {
+  pthread_mutex_lock(&mutex_);
+  const HostAllocatorStats stats = stats_;
+  pthread_mutex_unlock(&mutex_);
+  return stats;
+}
+
+}  // namespace caffe
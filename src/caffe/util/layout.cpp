@@ -0,0 +1,163 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/layout.hpp"
+
+using std::map;
+using std::ostringstream;
+using std::set;
+using std::string;
+
+namespace caffe {
+
+// Side of the square blocks of the transpose, small enough for a block of
+// the source and of the destination to stay in L1.
+static const int kTransposeBlock = 16;
+
+template <typename Dtype>
+void convert_layout_cpu(const Dtype* data, const int num, const int channels,
+    const int spatial, const Layout from, Dtype* out) {
+  // every clip is a rows x cols matrix transposed into cols x rows
+  const int rows = (from == NCLHW) ? channels : spatial;
+  const int cols = (from == NCLHW) ? spatial : channels;
+  for (int n = 0; n < num; ++n) {
+    const Dtype* src = data + n * channels * spatial;
+    Dtype* dst = out + n * channels * spatial;
+    for (int r0 = 0; r0 < rows; r0 += kTransposeBlock) {
+      const int r1 = std::min(r0 + kTransposeBlock, rows);
+      for (int c0 = 0; c0 < cols; c0 += kTransposeBlock) {
+        const int c1 = std::min(c0 + kTransposeBlock, cols);
+        for (int r = r0; r < r1; ++r) {
+          for (int c = c0; c < c1; ++c) {
+            dst[c * rows + r] = src[r * cols + c];
+          }
+        }
+      }
+    }
+  }
+}
+
+template void convert_layout_cpu<float>(const float* data, const int num,
+    const int channels, const int spatial, const Layout from, float* out);
+template void convert_layout_cpu<double>(const double* data, const int num,
+    const int channels, const int spatial, const Layout from, double* out);
+
+bool LayerSupportsChannelsLast(const LayerParameter& layer_param) {
+  switch (layer_param.type()) {
+  case LayerParameter_LayerType_CONVOLUTION3D:
+    // grouped convolutions run on NCLHW columns only
+    return layer_param.convolution_param().group() == 1;
+  case LayerParameter_LayerType_POOLING3D:
+  case LayerParameter_LayerType_CROP3D:
+  case LayerParameter_LayerType_RELU:
+  case LayerParameter_LayerType_CONCAT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Convolution3D and Pooling3D are worth converting for. The other layers
+// that support NLHWC just run in the layout of their first bottom.
+static bool PrefersChannelsLast(const LayerParameter& layer_param) {
+  return layer_param.type() == LayerParameter_LayerType_CONVOLUTION3D ||
+      layer_param.type() == LayerParameter_LayerType_POOLING3D;
+}
+
+static const char* LayoutSuffix(const Layout layout) {
+  return (layout == NLHWC) ? "_nlhwc" : "_nclhw";
+}
+
+void InsertLayoutConversions(const NetParameter& param,
+    NetParameter* param_converted) {
+  param_converted->CopyFrom(param);
+  param_converted->clear_layers();
+  // For every blob name of param: the name of the blob that currently holds
+  // its value, the layout of that blob, and the name of an up to date copy
+  // in the other layout, if any.
+  map<string, string> current_name;
+  map<string, Layout> current_layout;
+  map<string, string> copy_name;
+  set<string> used_names;
+  for (int i = 0; i < param.input_size(); ++i) {
+    current_name[param.input(i)] = param.input(i);
+    current_layout[param.input(i)] = NCLHW;
+    used_names.insert(param.input(i));
+  }
+  for (int i = 0; i < param.layers_size(); ++i) {
+    for (int j = 0; j < param.layers(i).top_size(); ++j) {
+      used_names.insert(param.layers(i).top(j));
+    }
+  }
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    Layout layout = NCLHW;
+    if (layer_param.type() == LayerParameter_LayerType_LAYOUT) {
+      layout = layer_param.layout_param().layout();
+    } else if (param.channels_last() &&
+        LayerSupportsChannelsLast(layer_param)) {
+      if (PrefersChannelsLast(layer_param)) {
+        layout = NLHWC;
+      } else if (layer_param.bottom_size() > 0 &&
+          current_layout.count(layer_param.bottom(0))) {
+        layout = current_layout[layer_param.bottom(0)];
+      }
+    }
+    LayerParameter converted_param(layer_param);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      if (current_name.find(blob_name) == current_name.end()) {
+        LOG(FATAL) << "Unknown blob input " << blob_name << " to layer "
+            << layer_param.name();
+      }
+      // Layout layers take any layout, and the second bottom of Crop3D only
+      // provides the shape
+      const bool any_layout =
+          layer_param.type() == LayerParameter_LayerType_LAYOUT ||
+          (layer_param.type() == LayerParameter_LayerType_CROP3D && j == 1);
+      if (any_layout || current_layout[blob_name] == layout) {
+        converted_param.set_bottom(j, current_name[blob_name]);
+        continue;
+      }
+      if (copy_name.find(blob_name) == copy_name.end()) {
+        string top_name = current_name[blob_name] + LayoutSuffix(layout);
+        for (int k = 1; used_names.count(top_name); ++k) {
+          ostringstream unique_name;
+          unique_name << current_name[blob_name] << LayoutSuffix(layout)
+              << "_" << k;
+          top_name = unique_name.str();
+        }
+        used_names.insert(top_name);
+        LayerParameter* layout_param = param_converted->add_layers();
+        layout_param->set_name(top_name);
+        layout_param->set_type(LayerParameter_LayerType_LAYOUT);
+        layout_param->add_bottom(current_name[blob_name]);
+        layout_param->add_top(top_name);
+        layout_param->mutable_layout_param()->set_layout(layout);
+        copy_name[blob_name] = top_name;
+      }
+      converted_param.set_bottom(j, copy_name[blob_name]);
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      const string& blob_name = layer_param.top(j);
+      if (j < layer_param.bottom_size() && blob_name == layer_param.bottom(j)) {
+        // in-place: the (possibly converted) bottom now holds the value
+        converted_param.set_top(j, converted_param.bottom(j));
+        current_name[blob_name] = converted_param.bottom(j);
+      } else {
+        current_name[blob_name] = blob_name;
+      }
+      current_layout[blob_name] = layout;
+      copy_name.erase(blob_name);
+    }
+    param_converted->add_layers()->CopyFrom(converted_param);
+  }
+}
+
+}  // namespace caffe
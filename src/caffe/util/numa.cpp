@@ -0,0 +1,205 @@
+// Copyright 2014 BVLC and contributors.
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <pthread.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/numa.hpp"
+
+namespace caffe {
+
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static pthread_key_t numa_thread_node_key;
+static int numa_node_count = 1;
+
+#if defined(__linux__)
+
+// The memory policies of <numaif.h>, which is part of libnuma
+static const int kMpolDefault = 0;
+static const int kMpolPreferred = 1;
+static const unsigned int kMpolMfMove = 1 << 1;
+static const int kMaxNumaNodes = 1024;
+static const int kBitsPerLong = 8 * sizeof(unsigned long);  // NOLINT
+
+// Parses a list like "0-3,8-11" of /sys/devices/system into values.
+static void ParseSysList(const std::string& path, std::vector<int>* values) {
+  values->clear();
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    return;
+  }
+  char line[4096];
+  if (fgets(line, sizeof(line), file) != NULL) {
+    const char* p = line;
+    while (*p >= '0' && *p <= '9') {
+      char* end;
+      const int first = strtol(p, &end, 10);
+      int last = first;
+      if (*end == '-') {
+        last = strtol(end + 1, &end, 10);
+      }
+      for (int value = first; value <= last; ++value) {
+        values->push_back(value);
+      }
+      p = (*end == ',') ? end + 1 : end;
+    }
+  }
+  fclose(file);
+}
+
+// Sets the node mask of the Linux memory policy calls to just node.
+static void NodeMask(const int node,
+    std::vector<unsigned long>* mask) {  // NOLINT
+  CHECK_LT(node, kMaxNumaNodes);
+  mask->assign(kMaxNumaNodes / kBitsPerLong, 0);
+  (*mask)[node / kBitsPerLong] = 1UL << (node % kBitsPerLong);
+}
+
+#endif
+
+static void NumaInit() {
+  CHECK_EQ(pthread_key_create(&numa_thread_node_key, NULL), 0);
+#if defined(_MSC_VER)
+  ULONG highest_node;
+  if (GetNumaHighestNodeNumber(&highest_node)) {
+    numa_node_count = highest_node + 1;
+  }
+#elif defined(__linux__)
+  std::vector<int> nodes;
+  ParseSysList("/sys/devices/system/node/online", &nodes);
+  for (int i = 0; i < nodes.size(); ++i) {
+    numa_node_count = std::max(numa_node_count, nodes[i] + 1);
+  }
+#endif
+}
+
+int NumaNodeCount() {
+  pthread_once(&numa_once, NumaInit);
+  return numa_node_count;
+}
+
+void NumaNodeCpus(const int node, std::vector<int>* cpus) {
+  CHECK_GE(node, 0);
+  CHECK_LT(node, NumaNodeCount());
+  cpus->clear();
+#if defined(_MSC_VER)
+  ULONGLONG mask = 0;
+  GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask);
+  for (int cpu = 0; cpu < 64; ++cpu) {
+    if (mask & (1ULL << cpu)) {
+      cpus->push_back(cpu);
+    }
+  }
+#elif defined(__linux__)
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+      node);
+  ParseSysList(path, cpus);
+  if (cpus->empty() && NumaNodeCount() == 1) {
+    // no NUMA support in the kernel
+    for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); ++cpu) {
+      cpus->push_back(cpu);
+    }
+  }
+#endif
+}
+
+void NumaBindThread(const int node) {
+  pthread_once(&numa_once, NumaInit);
+  CHECK_GE(node, -1);
+  CHECK_LT(node, NumaNodeCount());
+  std::vector<int> cpus;
+  if (node >= 0) {
+    NumaNodeCpus(node, &cpus);
+    CHECK(!cpus.empty()) << "NUMA node " << node << " has no CPUs";
+  }
+#if defined(_MSC_VER)
+  DWORD_PTR mask = 0;
+  if (node >= 0) {
+    for (int i = 0; i < cpus.size(); ++i) {
+      mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+    }
+  } else {
+    DWORD_PTR system_mask;
+    GetProcessAffinityMask(GetCurrentProcess(), &mask, &system_mask);
+  }
+  CHECK(SetThreadAffinityMask(GetCurrentThread(), mask))
+      << "Cannot bind the thread to NUMA node " << node;
+#elif defined(__linux__)
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (node >= 0) {
+    for (int i = 0; i < cpus.size(); ++i) {
+      CPU_SET(cpus[i], &cpu_set);
+    }
+  } else {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  CHECK_EQ(sched_setaffinity(0, sizeof(cpu_set), &cpu_set), 0)
+      << "Cannot bind the thread to NUMA node " << node << ": "
+      << strerror(errno);
+  // Preferred rather than strict binding, so that a full node spills over
+  // to the others instead of failing the allocation.
+  long result;  // NOLINT
+  if (node >= 0) {
+    std::vector<unsigned long> mask;  // NOLINT
+    NodeMask(node, &mask);
+    result = syscall(SYS_set_mempolicy, kMpolPreferred, &mask[0],
+        kMaxNumaNodes + 1);
+  } else {
+    result = syscall(SYS_set_mempolicy, kMpolDefault, NULL, 0);
+  }
+  LOG_IF(WARNING, result != 0 && NumaNodeCount() > 1)
+      << "Cannot set the memory policy of NUMA node " << node << ": "
+      << strerror(errno);
+#endif
+  pthread_setspecific(numa_thread_node_key,
+      reinterpret_cast<void*>(static_cast<intptr_t>(node + 1)));
+}
+
+int NumaThreadNode() {
+  pthread_once(&numa_once, NumaInit);
+  return static_cast<int>(reinterpret_cast<intptr_t>(
+      pthread_getspecific(numa_thread_node_key))) - 1;
+}
+
+void NumaMoveMemory(void* ptr, const size_t size, const int node) {
+#if defined(__linux__)
+  if (node < 0 || NumaNodeCount() == 1) {
+    return;
+  }
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + page - 1)
+      / page * page;
+  const uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + size) / page
+      * page;
+  if (end > begin) {
+    std::vector<unsigned long> mask;  // NOLINT
+    NodeMask(node, &mask);
+    // best effort: pages that cannot move stay where they are
+    syscall(SYS_mbind, begin, end - begin, kMpolPreferred, &mask[0],
+        kMaxNumaNodes + 1, kMpolMfMove);
+  }
+#endif
+}
+
+}  // namespace caffe
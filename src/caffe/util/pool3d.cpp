@@ -0,0 +1,501 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/pool3d.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+using std::max;
+using std::min;
+
+namespace caffe {
+
+// Pooling problems reading fewer values than this run on the calling thread.
+static const int kParallelPool3dSize = 1 << 16;
+
+// Sizes of the planes of a pooling problem.
+struct Pool3dShape {
+  Pool3dShape(const int length, const int height, const int width,
+      const int kernel_depth, const int kernel_size,
+      const int temporal_stride, const int stride, const int pad,
+      const int pooled_length, const int pooled_height,
+      const int pooled_width)
+      : length(length), height(height), width(width),
+        kernel_depth(kernel_depth), kernel_size(kernel_size),
+        temporal_stride(temporal_stride), stride(stride), pad(pad),
+        pooled_length(pooled_length), pooled_height(pooled_height),
+        pooled_width(pooled_width) {}
+  inline int volume() const { return length * height * width; }
+  inline int pooled_volume() const {
+    return pooled_length * pooled_height * pooled_width;
+  }
+
+  int length, height, width, kernel_depth, kernel_size, temporal_stride;
+  int stride, pad, pooled_length, pooled_height, pooled_width;
+};
+
+static void pool3d_planes_thread(
+    const boost::function<void(int, int)>* planes_job, const int planes,
+    const int num_threads, const int thread_id) {
+  if (thread_id >= num_threads) {
+    return;
+  }
+  (*planes_job)(planes * thread_id / num_threads,
+      planes * (thread_id + 1) / num_threads);
+}
+
+// Calls planes_job(plane_begin, plane_end) on ranges covering [0, planes),
+// one per thread for a problem of shape large enough.
+static void pool3d_parallel(const int planes, const Pool3dShape& shape,
+    const boost::function<void(int, int)>& planes_job) {
+  int num_threads = 1;
+  if (static_cast<double>(planes) * shape.volume() >= kParallelPool3dSize) {
+    num_threads = max(1, min(Caffe::cpu_threads(), planes));
+  }
+  if (num_threads == 1) {
+    planes_job(0, planes);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(&pool3d_planes_thread, &planes_job,
+        planes, num_threads, _1));
+  }
+}
+
+// The maxima of the full 2 x 2 (x 2) windows of an output row, whose kRows
+// input rows start at plane + offsets[r]: pairs of values of the rows are
+// reduced together, so that the loop runs across the width without bounds.
+// Unless mask is NULL, the index of the first maximum is recorded as by
+// pool3d_max_planes.
+template <typename Dtype, int kRows>
+inline void pool3d_max_2x2_row(const Dtype* plane, const int* offsets,
+    const int pairs, Dtype* out, int* mask) {
+  const Dtype* row[kRows];
+  for (int r = 0; r < kRows; ++r) {
+    row[r] = plane + offsets[r];
+  }
+  if (!mask) {
+    for (int pw = 0; pw < pairs; ++pw) {
+      Dtype value = -FLT_MAX;
+      for (int r = 0; r < kRows; ++r) {
+        value = max(max(row[r][2 * pw], row[r][2 * pw + 1]), value);
+      }
+      out[pw] = value;
+    }
+    return;
+  }
+  for (int pw = 0; pw < pairs; ++pw) {
+    // a compare and a max per value, which compile to a select and a max
+    // instead of a branch
+    Dtype value = -FLT_MAX;
+    int index = offsets[0] + 2 * pw;
+    for (int r = 0; r < kRows; ++r) {
+      const Dtype a = row[r][2 * pw];
+      const Dtype b = row[r][2 * pw + 1];
+      const int i = offsets[r] + 2 * pw;
+      if (a > value) {
+        index = i;
+      }
+      value = max(a, value);
+      if (b > value) {
+        index = i + 1;
+      }
+      value = max(b, value);
+    }
+    out[pw] = value;
+    mask[pw] = index;
+  }
+}
+
+// Max pooling of the 2 x 2 (x 2) windows of stride 2 of planes
+// [plane_begin, plane_end), by output rows; the window cut short by an odd
+// width is left to the scan of pool3d_max_planes.
+template <typename Dtype>
+static void pool3d_max_2x2_planes(const Pool3dShape* s, const Dtype* data,
+    Dtype* pooled, int* mask, const int plane_begin, const int plane_end) {
+  const int pairs = min(s->pooled_width, s->width / 2);
+  for (int c = plane_begin; c < plane_end; ++c) {
+    const Dtype* plane = data + static_cast<size_t>(c) * s->volume();
+    const size_t p_offset = static_cast<size_t>(c) * s->pooled_volume();
+    for (int pl = 0; pl < s->pooled_length; ++pl) {
+      int lstart, lend;
+      pool3d_max_window(pl, s->kernel_depth, s->temporal_stride, 0,
+          s->length, &lstart, &lend);
+      for (int ph = 0; ph < s->pooled_height; ++ph) {
+        int hstart, hend;
+        pool3d_max_window(ph, 2, 2, 0, s->height, &hstart, &hend);
+        // the rows of the windows, in the order of the scan
+        int offsets[4];
+        int num_rows = 0;
+        for (int l = lstart; l < lend; ++l) {
+          for (int h = hstart; h < hend; ++h) {
+            offsets[num_rows++] = (l * s->height + h) * s->width;
+          }
+        }
+        const size_t p = p_offset +
+            (pl * s->pooled_height + ph) * s->pooled_width;
+        Dtype* out = pooled + p;
+        int* out_mask = mask ? mask + p : NULL;
+        switch (num_rows) {
+        case 1:
+          pool3d_max_2x2_row<Dtype, 1>(plane, offsets, pairs, out, out_mask);
+          break;
+        case 2:
+          pool3d_max_2x2_row<Dtype, 2>(plane, offsets, pairs, out, out_mask);
+          break;
+        default:
+          pool3d_max_2x2_row<Dtype, 4>(plane, offsets, pairs, out, out_mask);
+        }
+        for (int pw = pairs; pw < s->pooled_width; ++pw) {
+          const int w = min(2 * pw, s->width - 1);
+          Dtype value = -FLT_MAX;
+          int index = offsets[0] + w;
+          for (int r = 0; r < num_rows; ++r) {
+            if (plane[offsets[r] + w] > value) {
+              value = plane[offsets[r] + w];
+              index = offsets[r] + w;
+            }
+          }
+          out[pw] = value;
+          if (out_mask) {
+            out_mask[pw] = index;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Whether pool3d_max_2x2_planes ran for the problem, only possible when the
+// input and output are stored as the compute type.
+template <typename Dtype, typename Itype, typename Otype>
+inline bool pool3d_max_2x2(const int channels, const Pool3dShape& s,
+    const Itype* data, Otype* pooled, int* mask) {
+  return false;
+}
+
+template <typename Dtype>
+inline bool pool3d_max_2x2(const int channels, const Pool3dShape& s,
+    const Dtype* data, Dtype* pooled, int* mask) {
+  if (s.kernel_size != 2 || s.stride != 2 || s.pad != 0 ||
+      s.kernel_depth > 2 || s.temporal_stride != s.kernel_depth) {
+    return false;
+  }
+  pool3d_parallel(channels, s, boost::bind(&pool3d_max_2x2_planes<Dtype>, &s,
+      data, pooled, mask, _1, _2));
+  return true;
+}
+
+template <typename Dtype, typename Itype, typename Otype>
+static void pool3d_max_planes(const Pool3dShape* s, const Itype* data,
+    Otype* pooled, int* mask, const int plane_begin, const int plane_end) {
+  for (int c = plane_begin; c < plane_end; ++c) {
+    const Itype* plane = data + static_cast<size_t>(c) * s->volume();
+    const size_t p_offset = static_cast<size_t>(c) * s->pooled_volume();
+    for (int pl = 0; pl < s->pooled_length; ++pl) {
+      int lstart, lend;
+      pool3d_max_window(pl, s->kernel_depth, s->temporal_stride, 0,
+          s->length, &lstart, &lend);
+      for (int ph = 0; ph < s->pooled_height; ++ph) {
+        int hstart, hend;
+        pool3d_max_window(ph, s->kernel_size, s->stride, s->pad, s->height,
+            &hstart, &hend);
+        for (int pw = 0; pw < s->pooled_width; ++pw) {
+          int wstart, wend;
+          pool3d_max_window(pw, s->kernel_size, s->stride, s->pad, s->width,
+              &wstart, &wend);
+          Dtype value = -FLT_MAX;
+          int index = (lstart * s->height + hstart) * s->width + wstart;
+          for (int l = lstart; l < lend; ++l) {
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                const int i = (l * s->height + h) * s->width + w;
+                const Dtype v = storage_value(plane[i]);
+                if (v > value) {
+                  value = v;
+                  index = i;
+                }
+              }
+            }
+          }
+          const size_t p = p_offset +
+              (pl * s->pooled_height + ph) * s->pooled_width + pw;
+          storage_store(value, &pooled[p]);
+          if (mask) {
+            mask[p] = index;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype, typename Itype, typename Otype>
+void pool3d_max_cpu(const Itype* data, const int channels, const int length,
+    const int height, const int width, const int kernel_depth,
+    const int kernel_size, const int temporal_stride, const int stride,
+    const int pad, const int pooled_length, const int pooled_height,
+    const int pooled_width, Otype* pooled, int* mask) {
+  const Pool3dShape shape(length, height, width, kernel_depth, kernel_size,
+      temporal_stride, stride, pad, pooled_length, pooled_height,
+      pooled_width);
+  if (pool3d_max_2x2<Dtype>(channels, shape, data, pooled, mask)) {
+    return;
+  }
+  pool3d_parallel(channels, shape, boost::bind(
+      &pool3d_max_planes<Dtype, Itype, Otype>, &shape, data, pooled, mask, _1,
+      _2));
+}
+
+template <typename Dtype>
+static void pool3d_max_backward_planes(const Pool3dShape* s,
+    const Dtype* top_diff, const int* mask, Dtype* bottom_diff,
+    const int plane_begin, const int plane_end) {
+  for (int c = plane_begin; c < plane_end; ++c) {
+    const size_t p_offset = static_cast<size_t>(c) * s->pooled_volume();
+    Dtype* diff = bottom_diff + static_cast<size_t>(c) * s->volume();
+    memset(diff, 0, sizeof(Dtype) * s->volume());
+    for (int p = 0; p < s->pooled_volume(); ++p) {
+      diff[mask[p_offset + p]] += top_diff[p_offset + p];
+    }
+  }
+}
+
+template <typename Dtype>
+void pool3d_max_backward_cpu(const Dtype* top_diff, const int* mask,
+    const int channels, const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int temporal_stride,
+    const int stride, const int pad, const int pooled_length,
+    const int pooled_height, const int pooled_width, Dtype* bottom_diff) {
+  const Pool3dShape shape(length, height, width, kernel_depth, kernel_size,
+      temporal_stride, stride, pad, pooled_length, pooled_height,
+      pooled_width);
+  pool3d_parallel(channels, shape, boost::bind(
+      &pool3d_max_backward_planes<Dtype>, &shape, top_diff, mask, bottom_diff,
+      _1, _2));
+}
+
+// Arguments of a pool3d_max_rescan_backward_cpu call shared by the threads.
+template <typename Dtype>
+struct Pool3dRescanArgs {
+  const Dtype* bottom_data;
+  const Dtype* top_data;
+  const Dtype* top_diff;
+  Dtype* bottom_diff;
+};
+
+template <typename Dtype>
+static void pool3d_max_rescan_backward_planes(const Pool3dShape* s,
+    const Pool3dRescanArgs<Dtype>* args, const int plane_begin,
+    const int plane_end) {
+  for (int c = plane_begin; c < plane_end; ++c) {
+    const size_t offset = static_cast<size_t>(c) * s->volume();
+    const size_t p_offset = static_cast<size_t>(c) * s->pooled_volume();
+    const Dtype* bottom_data = args->bottom_data + offset;
+    const Dtype* top_data = args->top_data + p_offset;
+    const Dtype* top_diff = args->top_diff + p_offset;
+    Dtype* bottom_diff = args->bottom_diff + offset;
+    memset(bottom_diff, 0, sizeof(Dtype) * s->volume());
+    for (int pl = 0; pl < s->pooled_length; ++pl) {
+      int lstart, lend;
+      pool3d_max_window(pl, s->kernel_depth, s->temporal_stride, 0,
+          s->length, &lstart, &lend);
+      for (int ph = 0; ph < s->pooled_height; ++ph) {
+        int hstart, hend;
+        pool3d_max_window(ph, s->kernel_size, s->stride, s->pad, s->height,
+            &hstart, &hend);
+        for (int pw = 0; pw < s->pooled_width; ++pw) {
+          int wstart, wend;
+          pool3d_max_window(pw, s->kernel_size, s->stride, s->pad, s->width,
+              &wstart, &wend);
+          const int p = (pl * s->pooled_height + ph) * s->pooled_width + pw;
+          for (int l = lstart; l < lend; ++l) {
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                const int i = (l * s->height + h) * s->width + w;
+                bottom_diff[i] += top_diff[p] * (bottom_data[i] == top_data[p]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void pool3d_max_rescan_backward_cpu(const Dtype* bottom_data,
+    const Dtype* top_data, const Dtype* top_diff, const int channels,
+    const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int temporal_stride,
+    const int stride, const int pad, const int pooled_length,
+    const int pooled_height, const int pooled_width, Dtype* bottom_diff) {
+  const Pool3dShape shape(length, height, width, kernel_depth, kernel_size,
+      temporal_stride, stride, pad, pooled_length, pooled_height,
+      pooled_width);
+  Pool3dRescanArgs<Dtype> args;
+  args.bottom_data = bottom_data;
+  args.top_data = top_data;
+  args.top_diff = top_diff;
+  args.bottom_diff = bottom_diff;
+  pool3d_parallel(channels, shape, boost::bind(
+      &pool3d_max_rescan_backward_planes<Dtype>, &shape, &args, _1, _2));
+}
+
+template <typename Dtype, typename Itype, typename Otype>
+static void pool3d_ave_planes(const Pool3dShape* s, const Itype* data,
+    Otype* pooled, const int plane_begin, const int plane_end) {
+  for (int c = plane_begin; c < plane_end; ++c) {
+    const Itype* plane = data + static_cast<size_t>(c) * s->volume();
+    Otype* out = pooled + static_cast<size_t>(c) * s->pooled_volume();
+    for (int pl = 0; pl < s->pooled_length; ++pl) {
+      for (int ph = 0; ph < s->pooled_height; ++ph) {
+        for (int pw = 0; pw < s->pooled_width; ++pw) {
+          const int hstart = min(max(ph * s->stride - s->pad, 0),
+              s->height - 1);
+          const int wstart = min(max(pw * s->stride - s->pad, 0),
+              s->width - 1);
+          const int lstart = pl * s->temporal_stride;
+          int hend = min(hstart + s->kernel_size, s->height + s->pad);
+          int wend = min(wstart + s->kernel_size, s->width + s->pad);
+          const int lend = min(lstart + s->kernel_depth, s->length);
+          const int pool_size =
+              (hend - hstart) * (wend - wstart) * (lend - lstart);
+          hend = min(hend, s->height);
+          wend = min(wend, s->width);
+          Dtype sum = 0;
+          for (int l = lstart; l < lend; ++l) {
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                sum += storage_value(plane[(l * s->height + h) * s->width +
+                    w]);
+              }
+            }
+          }
+          storage_store(sum / pool_size,
+              &out[(pl * s->pooled_height + ph) * s->pooled_width + pw]);
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype, typename Itype, typename Otype>
+void pool3d_ave_cpu(const Itype* data, const int channels, const int length,
+    const int height, const int width, const int kernel_depth,
+    const int kernel_size, const int temporal_stride, const int stride,
+    const int pad, const int pooled_length, const int pooled_height,
+    const int pooled_width, Otype* pooled) {
+  const Pool3dShape shape(length, height, width, kernel_depth, kernel_size,
+      temporal_stride, stride, pad, pooled_length, pooled_height,
+      pooled_width);
+  pool3d_parallel(channels, shape, boost::bind(
+      &pool3d_ave_planes<Dtype, Itype, Otype>, &shape, data, pooled, _1,
+      _2));
+}
+
+template <typename Dtype>
+static void pool3d_ave_backward_planes(const Pool3dShape* s,
+    const Dtype* top_diff, Dtype* bottom_diff, const int plane_begin,
+    const int plane_end) {
+  for (int c = plane_begin; c < plane_end; ++c) {
+    const Dtype* top = top_diff + static_cast<size_t>(c) * s->pooled_volume();
+    Dtype* diff = bottom_diff + static_cast<size_t>(c) * s->volume();
+    memset(diff, 0, sizeof(Dtype) * s->volume());
+    for (int pl = 0; pl < s->pooled_length; ++pl) {
+      for (int ph = 0; ph < s->pooled_height; ++ph) {
+        for (int pw = 0; pw < s->pooled_width; ++pw) {
+          int hstart = ph * s->stride - s->pad;
+          int wstart = pw * s->stride - s->pad;
+          const int lstart = pl * s->temporal_stride;
+          int hend = min(hstart + s->kernel_size, s->height + s->pad);
+          int wend = min(wstart + s->kernel_size, s->width + s->pad);
+          const int lend = min(lstart + s->kernel_depth, s->length);
+          const int pool_size =
+              (hend - hstart) * (wend - wstart) * (lend - lstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, s->height);
+          wend = min(wend, s->width);
+          const Dtype value =
+              top[(pl * s->pooled_height + ph) * s->pooled_width + pw] /
+              pool_size;
+          for (int l = lstart; l < lend; ++l) {
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                diff[(l * s->height + h) * s->width + w] += value;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void pool3d_ave_backward_cpu(const Dtype* top_diff, const int channels,
+    const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int temporal_stride,
+    const int stride, const int pad, const int pooled_length,
+    const int pooled_height, const int pooled_width, Dtype* bottom_diff) {
+  const Pool3dShape shape(length, height, width, kernel_depth, kernel_size,
+      temporal_stride, stride, pad, pooled_length, pooled_height,
+      pooled_width);
+  pool3d_parallel(channels, shape, boost::bind(
+      &pool3d_ave_backward_planes<Dtype>, &shape, top_diff, bottom_diff, _1,
+      _2));
+}
+
+#define INSTANTIATE_POOL3D(Dtype, Itype, Otype) \
+  template void pool3d_max_cpu<Dtype, Itype, Otype>(const Itype* data, \
+      const int channels, const int length, const int height, \
+      const int width, const int kernel_depth, const int kernel_size, \
+      const int temporal_stride, const int stride, const int pad, \
+      const int pooled_length, const int pooled_height, \
+      const int pooled_width, Otype* pooled, int* mask); \
+  template void pool3d_ave_cpu<Dtype, Itype, Otype>(const Itype* data, \
+      const int channels, const int length, const int height, \
+      const int width, const int kernel_depth, const int kernel_size, \
+      const int temporal_stride, const int stride, const int pad, \
+      const int pooled_length, const int pooled_height, \
+      const int pooled_width, Otype* pooled)
+
+INSTANTIATE_POOL3D(float, float, float);
+INSTANTIATE_POOL3D(float, float, bfloat16);
+INSTANTIATE_POOL3D(float, bfloat16, float);
+INSTANTIATE_POOL3D(float, bfloat16, bfloat16);
+INSTANTIATE_POOL3D(double, double, double);
+INSTANTIATE_POOL3D(double, double, bfloat16);
+INSTANTIATE_POOL3D(double, bfloat16, double);
+INSTANTIATE_POOL3D(double, bfloat16, bfloat16);
+
+#define INSTANTIATE_POOL3D_BACKWARD(Dtype) \
+  template void pool3d_max_backward_cpu<Dtype>(const Dtype* top_diff, \
+      const int* mask, const int channels, const int length, \
+      const int height, const int width, const int kernel_depth, \
+      const int kernel_size, const int temporal_stride, const int stride, \
+      const int pad, const int pooled_length, const int pooled_height, \
+      const int pooled_width, Dtype* bottom_diff); \
+  template void pool3d_max_rescan_backward_cpu<Dtype>( \
+      const Dtype* bottom_data, const Dtype* top_data, \
+      const Dtype* top_diff, const int channels, const int length, \
+      const int height, const int width, const int kernel_depth, \
+      const int kernel_size, const int temporal_stride, const int stride, \
+      const int pad, const int pooled_length, const int pooled_height, \
+      const int pooled_width, Dtype* bottom_diff); \
+  template void pool3d_ave_backward_cpu<Dtype>(const Dtype* top_diff, \
+      const int channels, const int length, const int height, \
+      const int width, const int kernel_depth, const int kernel_size, \
+      const int temporal_stride, const int stride, const int pad, \
+      const int pooled_length, const int pooled_height, \
+      const int pooled_width, Dtype* bottom_diff)
+
+INSTANTIATE_POOL3D_BACKWARD(float);
+INSTANTIATE_POOL3D_BACKWARD(double);
+
+}  // namespace caffe
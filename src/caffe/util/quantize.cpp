@@ -0,0 +1,214 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// Products with fewer multiply-adds than this run on the calling thread.
+static const double kParallelInt8GemmSize = 1 << 20;
+// Columns of C computed together, so that the rows of B they read stay in
+// cache while every row of A goes by.
+static const int kInt8GemmBlock = 256;
+
+template <typename Dtype>
+void quantize_cpu(const int n, const Dtype* x, const Dtype scale,
+    int8_t* quantized) {
+  const Dtype inv_scale = Dtype(1) / scale;
+  for (int i = 0; i < n; ++i) {
+    const Dtype v = std::min(std::max(x[i] * inv_scale, Dtype(-127)),
+        Dtype(127));
+    quantized[i] = static_cast<int8_t>(v >= 0 ? v + Dtype(0.5) :
+        v - Dtype(0.5));
+  }
+}
+
+template void quantize_cpu<float>(const int n, const float* x,
+    const float scale, int8_t* quantized);
+template void quantize_cpu<double>(const int n, const double* x,
+    const double scale, int8_t* quantized);
+
+template <typename Dtype>
+void quantize_rows_cpu(const int rows, const int cols, const Dtype* x,
+    int8_t* quantized, Dtype* scale) {
+  for (int i = 0; i < rows; ++i) {
+    const Dtype* row = x + static_cast<size_t>(i) * cols;
+    Dtype range = 0;
+    for (int j = 0; j < cols; ++j) {
+      range = std::max(range, static_cast<Dtype>(std::fabs(row[j])));
+    }
+    scale[i] = range > 0 ? range / Dtype(127) : Dtype(1);
+    quantize_cpu(cols, row, scale[i],
+        quantized + static_cast<size_t>(i) * cols);
+  }
+}
+
+template void quantize_rows_cpu<float>(const int rows, const int cols,
+    const float* x, int8_t* quantized, float* scale);
+template void quantize_rows_cpu<double>(const int rows, const int cols,
+    const double* x, int8_t* quantized, double* scale);
+
+// C[:, n_begin:n_end) = A * B[:, n_begin:n_end) for a K x N matrix B. Four
+// rows of C are accumulated together so that every int8 value of B loaded
+// is used four times.
+static void int8_gemm_nn(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C, const int n_begin,
+    const int n_end) {
+  for (int j0 = n_begin; j0 < n_end; j0 += kInt8GemmBlock) {
+    const int width = std::min(kInt8GemmBlock, n_end - j0);
+    int m = 0;
+    for (; m + 4 <= M; m += 4) {
+      int32_t* c0 = C + m * N + j0;
+      int32_t* c1 = c0 + N;
+      int32_t* c2 = c1 + N;
+      int32_t* c3 = c2 + N;
+      memset(c0, 0, sizeof(int32_t) * width);
+      memset(c1, 0, sizeof(int32_t) * width);
+      memset(c2, 0, sizeof(int32_t) * width);
+      memset(c3, 0, sizeof(int32_t) * width);
+      const int8_t* a = A + m * K;
+      for (int k = 0; k < K; ++k) {
+        const int32_t a0 = a[k];
+        const int32_t a1 = a[K + k];
+        const int32_t a2 = a[2 * K + k];
+        const int32_t a3 = a[3 * K + k];
+        const int8_t* b = B + k * N + j0;
+        for (int j = 0; j < width; ++j) {
+          const int32_t bj = b[j];
+          c0[j] += a0 * bj;
+          c1[j] += a1 * bj;
+          c2[j] += a2 * bj;
+          c3[j] += a3 * bj;
+        }
+      }
+    }
+    for (; m < M; ++m) {
+      int32_t* c = C + m * N + j0;
+      memset(c, 0, sizeof(int32_t) * width);
+      const int8_t* a = A + m * K;
+      for (int k = 0; k < K; ++k) {
+        const int32_t ak = a[k];
+        const int8_t* b = B + k * N + j0;
+        for (int j = 0; j < width; ++j) {
+          c[j] += ak * b[j];
+        }
+      }
+    }
+  }
+}
+
+// C[:, n_begin:n_end) = A * B^T for an N x K matrix B, as dot products of
+// rows of A and B.
+static void int8_gemm_nt(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C, const int n_begin,
+    const int n_end) {
+  for (int j = n_begin; j < n_end; ++j) {
+    const int8_t* b = B + static_cast<size_t>(j) * K;
+    for (int m = 0; m < M; ++m) {
+      const int8_t* a = A + static_cast<size_t>(m) * K;
+      int32_t sum = 0;
+      for (int k = 0; k < K; ++k) {
+        sum += static_cast<int32_t>(a[k]) * b[k];
+      }
+      C[m * N + j] = sum;
+    }
+  }
+}
+
+// Arguments of an int8_gemm_cpu call shared by the threads.
+struct Int8GemmArgs {
+  CBLAS_TRANSPOSE TransB;
+  int M, N, K;
+  const int8_t* A;
+  const int8_t* B;
+  int32_t* C;
+};
+
+static void int8_gemm_thread(const Int8GemmArgs* args, const int num_threads,
+    const int thread_id) {
+  if (thread_id >= num_threads) {
+    return;
+  }
+  const int n_begin = args->N * thread_id / num_threads;
+  const int n_end = args->N * (thread_id + 1) / num_threads;
+  if (args->TransB == CblasNoTrans) {
+    int8_gemm_nn(args->M, args->N, args->K, args->A, args->B, args->C,
+        n_begin, n_end);
+  } else {
+    int8_gemm_nt(args->M, args->N, args->K, args->A, args->B, args->C,
+        n_begin, n_end);
+  }
+}
+
+void int8_gemm_cpu(const CBLAS_TRANSPOSE TransB, const int M, const int N,
+    const int K, const int8_t* A, const int8_t* B, int32_t* C) {
+  CHECK_LT(K, 1 << 17) << "int8 GEMM accumulators could overflow";
+  Int8GemmArgs args;
+  args.TransB = TransB;
+  args.M = M;
+  args.N = N;
+  args.K = K;
+  args.A = A;
+  args.B = B;
+  args.C = C;
+  int num_threads = 1;
+  if (static_cast<double>(M) * N * K >= kParallelInt8GemmSize) {
+    // whole column blocks per thread
+    num_threads = std::max(1, std::min(Caffe::cpu_threads(),
+        N / kInt8GemmBlock));
+  }
+  if (num_threads == 1) {
+    int8_gemm_thread(&args, 1, 0);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(&int8_gemm_thread, &args,
+        num_threads, _1));
+  }
+}
+
+template <typename Dtype>
+void dequantize_rows_cpu(const int M, const int N, const int32_t* C,
+    const Dtype* row_scale, const Dtype scale, const Dtype* bias, Dtype* y) {
+  for (int i = 0; i < M; ++i) {
+    const Dtype s = row_scale[i] * scale;
+    const Dtype b = bias ? bias[i] : Dtype(0);
+    const int32_t* c = C + static_cast<size_t>(i) * N;
+    Dtype* y_row = y + static_cast<size_t>(i) * N;
+    for (int j = 0; j < N; ++j) {
+      y_row[j] = c[j] * s + b;
+    }
+  }
+}
+
+template void dequantize_rows_cpu<float>(const int M, const int N,
+    const int32_t* C, const float* row_scale, const float scale,
+    const float* bias, float* y);
+template void dequantize_rows_cpu<double>(const int M, const int N,
+    const int32_t* C, const double* row_scale, const double scale,
+    const double* bias, double* y);
+
+template <typename Dtype>
+void QuantizedWeights<Dtype>::Update(const Blob<Dtype>& weight,
+    const int rows) {
+  const SyncedMemory* source = weight.data().get();
+  if (source == source_ && source->version() == version_ &&
+      scale_.size() == rows) {
+    return;
+  }
+  data_.resize(weight.count());
+  scale_.resize(rows);
+  quantize_rows_cpu(rows, weight.count() / rows, weight.cpu_data(),
+      &data_[0], &scale_[0]);
+  source_ = source;
+  version_ = source->version();
+}
+
+INSTANTIATE_CLASS(QuantizedWeights);
+
+}  // namespace caffe
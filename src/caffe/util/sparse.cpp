@@ -0,0 +1,156 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/sparse.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// Products with fewer nonzero multiply-adds than this run on one thread.
+static const double kParallelSparseGemmSize = 1 << 20;
+
+template <typename Dtype>
+void csr_gemm_cpu(const int M, const int N, const int* row_ptr,
+    const int* col_index, const Dtype* values, const Dtype* B, Dtype* C) {
+  // every nonzero adds a scaled row of B to its row of C, so that the inner
+  // loop runs over contiguous rows
+  for (int i = 0; i < M; ++i) {
+    Dtype* c = C + static_cast<size_t>(i) * N;
+    memset(c, 0, sizeof(Dtype) * N);
+    for (int j = row_ptr[i]; j < row_ptr[i + 1]; ++j) {
+      const Dtype a = values[j];
+      const Dtype* b = B + static_cast<size_t>(col_index[j]) * N;
+      for (int k = 0; k < N; ++k) {
+        c[k] += a * b[k];
+      }
+    }
+  }
+}
+
+// Arguments of a csr_gemm_trans_cpu call shared by the threads.
+template <typename Dtype>
+struct CsrGemmTransArgs {
+  int M, N, K;
+  const Dtype* B;
+  const int* row_ptr;
+  const int* col_index;
+  const Dtype* values;
+  Dtype* C;
+};
+
+template <typename Dtype>
+static void csr_gemm_trans_thread(const CsrGemmTransArgs<Dtype>* args,
+    const int num_threads, const int thread_id) {
+  if (thread_id >= num_threads) {
+    return;
+  }
+  const int n_begin = args->N * thread_id / num_threads;
+  const int n_end = args->N * (thread_id + 1) / num_threads;
+  // a sparse row of A is applied to every row of B while it is in cache
+  for (int n = n_begin; n < n_end; ++n) {
+    const int begin = args->row_ptr[n];
+    const int end = args->row_ptr[n + 1];
+    for (int m = 0; m < args->M; ++m) {
+      const Dtype* b = args->B + static_cast<size_t>(m) * args->K;
+      Dtype sum = 0;
+      for (int j = begin; j < end; ++j) {
+        sum += args->values[j] * b[args->col_index[j]];
+      }
+      args->C[static_cast<size_t>(m) * args->N + n] = sum;
+    }
+  }
+}
+
+template <typename Dtype>
+void csr_gemm_trans_cpu(const int M, const int N, const int K,
+    const Dtype* B, const int* row_ptr, const int* col_index,
+    const Dtype* values, Dtype* C) {
+  CsrGemmTransArgs<Dtype> args;
+  args.M = M;
+  args.N = N;
+  args.K = K;
+  args.B = B;
+  args.row_ptr = row_ptr;
+  args.col_index = col_index;
+  args.values = values;
+  args.C = C;
+  int num_threads = 1;
+  if (static_cast<double>(M) * (row_ptr[N] - row_ptr[0]) >=
+      kParallelSparseGemmSize) {
+    num_threads = std::max(1, std::min(Caffe::cpu_threads(), N));
+  }
+  if (num_threads == 1) {
+    csr_gemm_trans_thread(&args, 1, 0);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(&csr_gemm_trans_thread<Dtype>,
+        &args, num_threads, _1));
+  }
+}
+
+template void csr_gemm_cpu<float>(const int M, const int N,
+    const int* row_ptr, const int* col_index, const float* values,
+    const float* B, float* C);
+template void csr_gemm_cpu<double>(const int M, const int N,
+    const int* row_ptr, const int* col_index, const double* values,
+    const double* B, double* C);
+template void csr_gemm_trans_cpu<float>(const int M, const int N,
+    const int K, const float* B, const int* row_ptr, const int* col_index,
+    const float* values, float* C);
+template void csr_gemm_trans_cpu<double>(const int M, const int N,
+    const int K, const double* B, const int* row_ptr, const int* col_index,
+    const double* values, double* C);
+
+template <typename Dtype>
+void SparseWeights<Dtype>::Update(Blob<Dtype>* weight, const int rows,
+    const Dtype threshold) {
+  const SyncedMemory* source = weight->data().get();
+  if (source == source_ && source->version() == version_ && rows_ == rows) {
+    return;
+  }
+  const int count = weight->count();
+  const int cols = count / rows;
+  if (threshold > 0) {
+    const Dtype* data = weight->cpu_data();
+    bool pruned = false;
+    for (int i = 0; i < count && !pruned; ++i) {
+      pruned = data[i] != 0 && std::fabs(data[i]) <= threshold;
+    }
+    if (pruned) {
+      Dtype* mutable_data = weight->mutable_cpu_data();
+      for (int i = 0; i < count; ++i) {
+        if (std::fabs(mutable_data[i]) <= threshold) {
+          mutable_data[i] = 0;
+        }
+      }
+    }
+  }
+  const Dtype* data = weight->cpu_data();
+  row_ptr_.resize(rows + 1);
+  col_index_.clear();
+  values_.clear();
+  row_ptr_[0] = 0;
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      const Dtype value = data[static_cast<size_t>(i) * cols + j];
+      if (value != 0) {
+        col_index_.push_back(j);
+        values_.push_back(value);
+      }
+    }
+    row_ptr_[i + 1] = values_.size();
+  }
+  density_ = count > 0 ? static_cast<float>(values_.size()) / count : 1;
+  rows_ = rows;
+  source_ = source;
+  version_ = source->version();
+}
+
+INSTANTIATE_CLASS(SparseWeights);
+
+}  // namespace caffe
@@ -0,0 +1,92 @@
+// Copyright 2014 BVLC and contributors.
+
+#include "caffe/util/numa.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+ThreadPool::ThreadPool(const int num_threads, const int numa_node)
+    : num_threads_(num_threads), numa_node_(numa_node), job_(NULL),
+      generation_(0), started_(0), pending_(0), stop_(false) {
+  CHECK_GE(num_threads, 1);
+  CHECK_EQ(pthread_mutex_init(&run_mutex_, NULL), 0);
+  CHECK_EQ(pthread_mutex_init(&mutex_, NULL), 0);
+  CHECK_EQ(pthread_cond_init(&start_cond_, NULL), 0);
+  CHECK_EQ(pthread_cond_init(&done_cond_, NULL), 0);
+  workers_.resize(num_threads - 1);
+  for (int i = 0; i < workers_.size(); ++i) {
+    CHECK(!pthread_create(&workers_[i], NULL, WorkerEntry, this))
+        << "Pthread execution failed.";
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  pthread_mutex_lock(&mutex_);
+  stop_ = true;
+  pthread_cond_broadcast(&start_cond_);
+  pthread_mutex_unlock(&mutex_);
+  for (int i = 0; i < workers_.size(); ++i) {
+    CHECK(!pthread_join(workers_[i], NULL)) << "Pthread joining failed.";
+  }
+  pthread_cond_destroy(&done_cond_);
+  pthread_cond_destroy(&start_cond_);
+  pthread_mutex_destroy(&mutex_);
+  pthread_mutex_destroy(&run_mutex_);
+}
+
+void* ThreadPool::WorkerEntry(void* pool) {
+  reinterpret_cast<ThreadPool*>(pool)->Worker();
+  return NULL;
+}
+
+void ThreadPool::Worker() {
+  if (numa_node_ >= 0) {
+    NumaBindThread(numa_node_);
+  }
+  pthread_mutex_lock(&mutex_);
+  const int thread_id = ++started_;
+  // the pool is constructed before any Run, so generation 0 is never a job
+  unsigned int generation = 0;
+  while (true) {
+    while (!stop_ && generation_ == generation) {
+      pthread_cond_wait(&start_cond_, &mutex_);
+    }
+    if (stop_) {
+      break;
+    }
+    generation = generation_;
+    const boost::function<void(int)>* job = job_;
+    pthread_mutex_unlock(&mutex_);
+    (*job)(thread_id);
+    pthread_mutex_lock(&mutex_);
+    if (--pending_ == 0) {
+      pthread_cond_signal(&done_cond_);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void ThreadPool::Run(const boost::function<void(int)>& job) {
+  if (workers_.empty() || pthread_mutex_trylock(&run_mutex_) != 0) {
+    for (int thread_id = 0; thread_id < num_threads_; ++thread_id) {
+      job(thread_id);
+    }
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  job_ = &job;
+  pending_ = workers_.size();
+  ++generation_;
+  pthread_cond_broadcast(&start_cond_);
+  pthread_mutex_unlock(&mutex_);
+  job(0);
+  pthread_mutex_lock(&mutex_);
+  while (pending_ > 0) {
+    pthread_cond_wait(&done_cond_, &mutex_);
+  }
+  job_ = NULL;
+  pthread_mutex_unlock(&mutex_);
+  pthread_mutex_unlock(&run_mutex_);
+}
+
+}  // namespace caffe
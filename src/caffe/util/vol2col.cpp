@@ -14,14 +14,284 @@
  *
  */
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <stdint.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
 
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/vol2col.hpp"
 
 namespace caffe {
 
+// Column matrices smaller than this many elements are unrolled on the
+// calling thread, as waking up the thread pool would cost more than it saves.
+static const int kParallelVol2colSize = 1 << 16;
+
+// Sizes of a vol2col / col2vol problem.
+struct Vol2colShape {
+  Vol2colShape(const int channels, const int length, const int height,
+      const int width, const int ksize, const int kdepth, const int pad,
+      const int temporal_pad, const int stride, const int temporal_stride,
+      const int col_stride)
+      : channels(channels), length(length), height(height), width(width),
+        ksize(ksize), kdepth(kdepth), pad(pad), temporal_pad(temporal_pad),
+        stride(stride), temporal_stride(temporal_stride),
+        col_stride(col_stride) {
+    length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride + 1;
+    height_col = (height + 2 * pad - ksize) / stride + 1;
+    width_col = (width + 2 * pad - ksize) / stride + 1;
+  }
+  inline int kernel_rows() const { return kdepth * ksize * ksize; }
+  inline int rows() const { return channels * kernel_rows(); }
+  // Output columns [*w_begin, *w_end) of a row with kernel offset w_offset
+  // read the input row, the ones before and after read the padding.
+  inline void valid_columns(const int w_offset, int* w_begin,
+      int* w_end) const {
+    const int first = (pad > w_offset) ? (pad - w_offset + stride - 1) / stride
+        : 0;
+    const int last = width + pad - w_offset - 1;
+    *w_end = (last >= 0) ? std::min(width_col, last / stride + 1) : 0;
+    *w_begin = std::min(first, *w_end);
+  }
+
+  int channels, length, height, width, ksize, kdepth, pad, temporal_pad;
+  int stride, temporal_stride, col_stride;
+  int length_col, height_col, width_col;
+};
+
+// y[i] += x[i] for the contiguous runs of col2vol with stride 1.
+template <typename Dtype>
+inline void vol2col_accumulate(const int n, const Dtype* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] += x[i];
+  }
+}
+
+#if defined(__AVX__)
+template <>
+inline void vol2col_accumulate<float>(const int n, const float* x, float* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i,
+        _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_loadu_ps(x + i)));
+  }
+  for (; i < n; ++i) {
+    y[i] += x[i];
+  }
+}
+
+template <>
+inline void vol2col_accumulate<double>(const int n, const double* x,
+    double* y) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(y + i,
+        _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_loadu_pd(x + i)));
+  }
+  for (; i < n; ++i) {
+    y[i] += x[i];
+  }
+}
+#endif  // __AVX__
+
+// y[i] = x[i] for the contiguous runs of vol2col with stride 1: a memcpy,
+// or a conversion for a bfloat16 input.
+template <typename Dtype>
+inline void vol2col_copy(const int n, const Dtype* x, Dtype* y) {
+  memcpy(y, x, sizeof(Dtype) * n);
+}
+
+template <typename Dtype>
+inline void vol2col_copy(const int n, const bfloat16* x, Dtype* y) {
+  bfloat16_decode_cpu(n, x, y);
+}
+
+// Unrolls column rows [row_begin, row_end). The bounds of a row are worked
+// out once: every (l, h) line of the row is either all padding or a run of
+// input values with padding at the ends, copied in one go for stride 1.
+template <typename Itype, typename Dtype>
+static void vol2col_rows(const Itype* data_im, const Vol2colShape& s,
+    const int row_begin, const int row_end, Dtype* data_col) {
+  const int volume = s.length * s.height * s.width;
+  const int spatial_col = s.height_col * s.width_col;
+  for (int c = row_begin; c < row_end; ++c) {
+    const int w_offset = c % s.ksize;
+    const int h_offset = (c / s.ksize) % s.ksize;
+    const int l_offset = (c / s.ksize / s.ksize) % s.kdepth;
+    const int c_im = c / s.kernel_rows();
+    int w_begin, w_end;
+    s.valid_columns(w_offset, &w_begin, &w_end);
+    const int run = w_end - w_begin;
+    const Itype* im = data_im + c_im * volume;
+    Dtype* col = data_col + c * s.col_stride;
+    for (int l = 0; l < s.length_col; ++l, col += spatial_col) {
+      const int l_pad = l * s.temporal_stride - s.temporal_pad + l_offset;
+      if (l_pad < 0 || l_pad >= s.length || run == 0) {
+        memset(col, 0, sizeof(Dtype) * spatial_col);
+        continue;
+      }
+      Dtype* col_row = col;
+      for (int h = 0; h < s.height_col; ++h, col_row += s.width_col) {
+        const int h_pad = h * s.stride - s.pad + h_offset;
+        if (h_pad < 0 || h_pad >= s.height) {
+          memset(col_row, 0, sizeof(Dtype) * s.width_col);
+          continue;
+        }
+        const Itype* im_row = im + (l_pad * s.height + h_pad) * s.width
+            + w_begin * s.stride - s.pad + w_offset;
+        memset(col_row, 0, sizeof(Dtype) * w_begin);
+        if (s.stride == 1) {
+          vol2col_copy(run, im_row, col_row + w_begin);
+        } else {
+          for (int w = 0; w < run; ++w) {
+            col_row[w_begin + w] = storage_value(im_row[w * s.stride]);
+          }
+        }
+        memset(col_row + w_end, 0, sizeof(Dtype) * (s.width_col - w_end));
+      }
+    }
+  }
+}
+
+// Accumulates into frames [l_begin, l_end) of input channels
+// [channel_begin, channel_end) of data_im, which it clears first, the column
+// entries that land there. Every element is written by the block that owns
+// it only, so blocks can be processed concurrently.
+template <typename Dtype>
+static void col2vol_block(const Dtype* data_col, const Vol2colShape& s,
+    const int channel_begin, const int channel_end, const int l_begin,
+    const int l_end, Dtype* data_im) {
+  const int frame = s.height * s.width;
+  const int volume = s.length * frame;
+  const int spatial_col = s.height_col * s.width_col;
+  for (int c = channel_begin; c < channel_end; ++c) {
+    memset(data_im + c * volume + l_begin * frame, 0,
+        sizeof(Dtype) * (l_end - l_begin) * frame);
+  }
+  for (int c = channel_begin * s.kernel_rows();
+      c < channel_end * s.kernel_rows(); ++c) {
+    const int w_offset = c % s.ksize;
+    const int h_offset = (c / s.ksize) % s.ksize;
+    const int l_offset = (c / s.ksize / s.ksize) % s.kdepth;
+    const int c_im = c / s.kernel_rows();
+    int w_begin, w_end;
+    s.valid_columns(w_offset, &w_begin, &w_end);
+    const int run = w_end - w_begin;
+    if (run == 0) {
+      continue;
+    }
+    // the column frames whose frame l_pad falls in [l_begin, l_end)
+    const int l_shift = s.temporal_pad - l_offset;
+    const int l_col_begin = std::max(0, (l_begin + l_shift +
+        s.temporal_stride - 1 + s.temporal_stride * s.kdepth) /
+        s.temporal_stride - s.kdepth);
+    const int l_col_end = std::min(s.length_col, (l_end + l_shift +
+        s.temporal_stride - 1 + s.temporal_stride * s.kdepth) /
+        s.temporal_stride - s.kdepth);
+    Dtype* im = data_im + c_im * volume;
+    const Dtype* col = data_col + c * s.col_stride + l_col_begin * spatial_col;
+    for (int l = l_col_begin; l < l_col_end; ++l, col += spatial_col) {
+      const int l_pad = l * s.temporal_stride - s.temporal_pad + l_offset;
+      const Dtype* col_row = col + w_begin;
+      for (int h = 0; h < s.height_col; ++h, col_row += s.width_col) {
+        const int h_pad = h * s.stride - s.pad + h_offset;
+        if (h_pad < 0 || h_pad >= s.height) {
+          continue;
+        }
+        Dtype* im_row = im + (l_pad * s.height + h_pad) * s.width
+            + w_begin * s.stride - s.pad + w_offset;
+        if (s.stride == 1) {
+          vol2col_accumulate(run, col_row, im_row);
+        } else {
+          for (int w = 0; w < run; ++w) {
+            im_row[w * s.stride] += col_row[w];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Itype, typename Dtype>
+static void vol2col_thread(const Itype* data_im, const Vol2colShape* s,
+    Dtype* data_col, const int num_threads, const int thread_id) {
+  // the pool may have more threads than there are rows to split
+  if (thread_id >= num_threads) {
+    return;
+  }
+  const int rows = s->rows();
+  vol2col_rows(data_im, *s, rows * thread_id / num_threads,
+      rows * (thread_id + 1) / num_threads, data_col);
+}
+
+// The output of col2vol is split into channels x slabs blocks of frames.
+template <typename Dtype>
+static void col2vol_thread(const Dtype* data_col, const Vol2colShape* s,
+    const int slabs, Dtype* data_im, const int num_threads,
+    const int thread_id) {
+  if (thread_id >= num_threads) {
+    return;
+  }
+  const int blocks = s->channels * slabs;
+  const int block_begin = blocks * thread_id / num_threads;
+  const int block_end = blocks * (thread_id + 1) / num_threads;
+  for (int b = block_begin; b < block_end; ++b) {
+    const int slab = b % slabs;
+    col2vol_block(data_col, *s, b / slabs, b / slabs + 1,
+        s->length * slab / slabs, s->length * (slab + 1) / slabs, data_im);
+  }
+}
+
+// Number of threads to split a column matrix of the given shape over.
+static int vol2col_threads(const Vol2colShape& s, const int max_rows) {
+  const int size = s.rows() * s.length_col * s.height_col * s.width_col;
+  if (size < kParallelVol2colSize) {
+    return 1;
+  }
+  return std::max(1, std::min(Caffe::cpu_threads(), max_rows));
+}
+
+template <typename Dtype>
+void vol2col_cpu(const Dtype* data_im, const int channels, const int length,
+	    const int height, const int width, const int ksize, const int kdepth, const int pad,
+	    const int temporal_pad, const int stride, const int temporal_stride,
+	    const int col_stride, Dtype* data_col) {
+  const Vol2colShape s(channels, length, height, width, ksize, kdepth, pad,
+      temporal_pad, stride, temporal_stride, col_stride);
+  const int num_threads = vol2col_threads(s, s.rows());
+  if (num_threads == 1) {
+    vol2col_rows(data_im, s, 0, s.rows(), data_col);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(&vol2col_thread<Dtype, Dtype>,
+        data_im, &s, data_col, num_threads, _1));
+  }
+}
+
+template <typename Dtype>
+void vol2col_cpu(const bfloat16* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int col_stride, Dtype* data_col) {
+  const Vol2colShape s(channels, length, height, width, ksize, kdepth, pad,
+      temporal_pad, stride, temporal_stride, col_stride);
+  const int num_threads = vol2col_threads(s, s.rows());
+  if (num_threads == 1) {
+    vol2col_rows(data_im, s, 0, s.rows(), data_col);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(&vol2col_thread<bfloat16, Dtype>,
+        data_im, &s, data_col, num_threads, _1));
+  }
+}
+
 template <typename Dtype>
 void vol2col_cpu(const Dtype* data_im, const int channels, const int length,
 	    const int height, const int width, const int ksize, const int kdepth, const int pad,
@@ -29,30 +299,9 @@ void vol2col_cpu(const Dtype* data_im, const int channels, const int length,
   int length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride + 1;
   int height_col = (height + 2 * pad - ksize) / stride + 1;
   int width_col = (width + 2 * pad - ksize) / stride + 1;
-
-  int channels_col = channels * kdepth * ksize * ksize;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % ksize;
-    int h_offset = (c / ksize) % ksize;
-    int l_offset = (c / ksize / ksize) % kdepth;
-    int c_im = c / ksize / ksize / kdepth;
-    for (int l=0; l < length_col; ++l) {
-      for (int h = 0; h < height_col; ++h) {
-        for (int w = 0; w < width_col; ++w) {
-          int l_pad = l * temporal_stride - temporal_pad + l_offset;
-          int h_pad = h * stride - pad + h_offset;
-          int w_pad = w * stride - pad + w_offset;
-
-          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width
-        		  && l_pad >=0 && l_pad < length)
-            data_col[((c * length_col + l) * height_col + h) * width_col + w] =
-              data_im[((c_im * length + l_pad) * height + h_pad) * width + w_pad];
-          else
-            data_col[((c * length_col + l) * height_col + h) * width_col + w] = 0;
-        }
-      }
-    }
-  }
+  vol2col_cpu(data_im, channels, length, height, width, ksize, kdepth, pad,
+      temporal_pad, stride, temporal_stride, length_col * height_col * width_col,
+      data_col);
 }
 
 // Explicit instantiation
@@ -62,35 +311,60 @@ template void vol2col_cpu<float>(const float* data_im, const int channels, const
 template void vol2col_cpu<double>(const double* data_im, const int channels,const int length,
 	    const int height, const int width, const int ksize, const int kdepth, const int pad,
 	    const int temporal_pad, const int stride, const int temporal_stride, double* data_col);
+template void vol2col_cpu<float>(const float* data_im, const int channels, const int length,
+    const int height, const int width, const int ksize, const int kdepth, const int pad,
+    const int temporal_pad, const int stride, const int temporal_stride,
+    const int col_stride, float* data_col);
+template void vol2col_cpu<double>(const double* data_im, const int channels,const int length,
+	    const int height, const int width, const int ksize, const int kdepth, const int pad,
+	    const int temporal_pad, const int stride, const int temporal_stride,
+	    const int col_stride, double* data_col);
+// the quantized bottom of INT8 Convolution3D layers
+template void vol2col_cpu<int8_t>(const int8_t* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int col_stride, int8_t* data_col);
+// the bfloat16 bottom of Convolution3D layers
+template void vol2col_cpu<float>(const bfloat16* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int col_stride, float* data_col);
+template void vol2col_cpu<double>(const bfloat16* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, const int col_stride, double* data_col);
+
+template <typename Dtype>
+void col2vol_cpu(const Dtype* data_col, const int channels, const int length,
+    const int height, const int width, const int ksize, const int kdepth, const int pad,
+    const int temporal_pad, const int stride, const int temporal_stride,
+    const int col_stride, Dtype* data_im) {
+  const Vol2colShape s(channels, length, height, width, ksize, kdepth, pad,
+      temporal_pad, stride, temporal_stride, col_stride);
+  // With fewer channels than threads, as in the few score maps of an
+  // upsampling Deconvolution3DLayer, the channels are also split into slabs
+  // of frames, each thread gathering the column entries of its own frames.
+  const int slabs = std::min(length,
+      (Caffe::cpu_threads() + channels - 1) / channels);
+  const int num_threads = vol2col_threads(s, channels * slabs);
+  if (num_threads == 1) {
+    col2vol_block(data_col, s, 0, channels, 0, length, data_im);
+  } else {
+    Caffe::thread_pool().Run(boost::bind(&col2vol_thread<Dtype>, data_col, &s,
+        slabs, data_im, num_threads, _1));
+  }
+}
 
 template <typename Dtype>
 void col2vol_cpu(const Dtype* data_col, const int channels, const int length,
     const int height, const int width, const int ksize, const int kdepth, const int pad,
     const int temporal_pad, const int stride, const int temporal_stride, Dtype* data_im) {
-  memset(data_im, 0, sizeof(Dtype) * length * height * width * channels);
   int length_col = (length + 2* temporal_pad - kdepth) / temporal_stride + 1;
   int height_col = (height + 2 * pad - ksize) / stride + 1;
   int width_col = (width + 2 * pad - ksize) / stride + 1;
-  int channels_col = channels * ksize * ksize;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % ksize;
-    int h_offset = (c / ksize) % ksize;
-    int l_offset = (c / ksize / ksize) % kdepth;
-    int c_im = c / ksize / ksize / kdepth;
-    for (int l=0; l < length_col; ++l) {
-      for (int h = 0; h < height_col; ++h) {
-        for (int w = 0; w < width_col; ++w) {
-          int l_pad = l * temporal_stride - temporal_pad + l_offset;
-          int h_pad = h * stride - pad + h_offset;
-          int w_pad = w * stride - pad + w_offset;
-          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width
-        		  && l_pad >= 0 && l_pad < length)
-            data_im[((c_im * length + l_pad) * height + h_pad) * width + w_pad] +=
-                data_col[((c * length_col + l) * height_col + h) * width_col + w];
-        }
-      }
-    }
-  }
+  col2vol_cpu(data_col, channels, length, height, width, ksize, kdepth, pad,
+      temporal_pad, stride, temporal_stride, length_col * height_col * width_col,
+      data_im);
 }
 
 // Explicit instantiation
@@ -100,5 +374,102 @@ template void col2vol_cpu<float>(const float* data_col, const int channels, cons
 template void col2vol_cpu<double>(const double* data_col, const int channels, const int length,
 	    const int height, const int width, const int ksize, const int kdepth, const int pad,
 	    const int temporal_pad, const int stride, const int temporal_stride, double* data_im);
+template void col2vol_cpu<float>(const float* data_col, const int channels, const int length,
+	    const int height, const int width, const int ksize, const int kdepth, const int pad,
+	    const int temporal_pad, const int stride, const int temporal_stride,
+	    const int col_stride, float* data_im);
+template void col2vol_cpu<double>(const double* data_col, const int channels, const int length,
+	    const int height, const int width, const int ksize, const int kdepth, const int pad,
+	    const int temporal_pad, const int stride, const int temporal_stride,
+	    const int col_stride, double* data_im);
+
+template <typename Dtype>
+void vol2col_nlhwc_cpu(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, Dtype* data_col) {
+  const int length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride
+      + 1;
+  const int height_col = (height + 2 * pad - ksize) / stride + 1;
+  const int width_col = (width + 2 * pad - ksize) / stride + 1;
+  for (int l = 0; l < length_col; ++l) {
+    for (int h = 0; h < height_col; ++h) {
+      for (int w = 0; w < width_col; ++w) {
+        for (int kl = 0; kl < kdepth; ++kl) {
+          const int l_pad = l * temporal_stride - temporal_pad + kl;
+          for (int kh = 0; kh < ksize; ++kh) {
+            const int h_pad = h * stride - pad + kh;
+            for (int kw = 0; kw < ksize; ++kw) {
+              const int w_pad = w * stride - pad + kw;
+              if (l_pad >= 0 && l_pad < length && h_pad >= 0 && h_pad < height
+                  && w_pad >= 0 && w_pad < width) {
+                memcpy(data_col, data_im
+                    + ((l_pad * height + h_pad) * width + w_pad) * channels,
+                    sizeof(Dtype) * channels);
+              } else {
+                memset(data_col, 0, sizeof(Dtype) * channels);
+              }
+              data_col += channels;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void col2vol_nlhwc_cpu(const Dtype* data_col, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, Dtype* data_im) {
+  memset(data_im, 0, sizeof(Dtype) * length * height * width * channels);
+  const int length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride
+      + 1;
+  const int height_col = (height + 2 * pad - ksize) / stride + 1;
+  const int width_col = (width + 2 * pad - ksize) / stride + 1;
+  for (int l = 0; l < length_col; ++l) {
+    for (int h = 0; h < height_col; ++h) {
+      for (int w = 0; w < width_col; ++w) {
+        for (int kl = 0; kl < kdepth; ++kl) {
+          const int l_pad = l * temporal_stride - temporal_pad + kl;
+          for (int kh = 0; kh < ksize; ++kh) {
+            const int h_pad = h * stride - pad + kh;
+            for (int kw = 0; kw < ksize; ++kw) {
+              const int w_pad = w * stride - pad + kw;
+              if (l_pad >= 0 && l_pad < length && h_pad >= 0 && h_pad < height
+                  && w_pad >= 0 && w_pad < width) {
+                Dtype* im = data_im
+                    + ((l_pad * height + h_pad) * width + w_pad) * channels;
+                for (int c = 0; c < channels; ++c) {
+                  im[c] += data_col[c];
+                }
+              }
+              data_col += channels;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void vol2col_nlhwc_cpu<float>(const float* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, float* data_col);
+template void vol2col_nlhwc_cpu<double>(const double* data_im,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, double* data_col);
+template void col2vol_nlhwc_cpu<float>(const float* data_col,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, float* data_im);
+template void col2vol_nlhwc_cpu<double>(const double* data_col,
+    const int channels, const int length, const int height, const int width,
+    const int ksize, const int kdepth, const int pad, const int temporal_pad,
+    const int stride, const int temporal_stride, double* data_im);
 
 }  // namespace caffe
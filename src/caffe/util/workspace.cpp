@@ -0,0 +1,24 @@
+// Copyright 2014 BVLC and contributors.
+
+#include "caffe/util/workspace.hpp"
+
+namespace caffe {
+
+void Workspace::Reserve(const size_t size) {
+  if (size > size_) {
+    size_ = size;
+    memory_.reset(new SyncedMemory(size_));
+  }
+}
+
+void* Workspace::mutable_cpu_data(const size_t size) {
+  Reserve(size);
+  return memory_ ? memory_->mutable_cpu_data() : NULL;
+}
+
+void* Workspace::mutable_gpu_data(const size_t size) {
+  Reserve(size);
+  return memory_ ? memory_->mutable_gpu_data() : NULL;
+}
+
+}  // namespace caffe
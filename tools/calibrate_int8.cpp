@@ -0,0 +1,204 @@
+// Copyright 2014 BVLC and contributors.
+//
+// Calibrates the INT8 inference path of Convolution3D and InnerProduct
+// layers (see QuantizationParameter). The calibration net is run over sample
+// clips to record the largest absolute value of the bottom of every such
+// layer. The held-out net is then written out with these ranges, with the
+// selected layers switched to INT8, and run both in FP32 and with the
+// selected layers in INT8 to report how much the outputs move.
+// Usage:
+//    calibrate_int8 pretrained_net_param calibration_net_proto
+//        calibration_iterations held_out_net_proto held_out_iterations
+//        output_net_proto [all|layer1,layer2,...]
+// Both nets run in the TEST phase on the CPU. The INT8 copy of the held-out
+// net takes the outputs of the data layers of the FP32 one, so both see the
+// same clips.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+static bool IsQuantizable(const LayerParameter& param) {
+  return param.type() == LayerParameter_LayerType_CONVOLUTION3D ||
+      param.type() == LayerParameter_LayerType_INNER_PRODUCT;
+}
+
+// Runs the layers of net one by one, the data layers only if run_data.
+// Before a quantizable layer runs, the largest absolute value of its bottom
+// is merged into ranges, if given.
+static void ForwardLayers(Net<float>* net, const bool run_data,
+    std::map<string, float>* ranges) {
+  for (int i = 0; i < net->layers().size(); ++i) {
+    vector<Blob<float>*>& bottom = net->bottom_vecs()[i];
+    if (bottom.empty() && !run_data) {
+      continue;
+    }
+    const LayerParameter& param = net->layers()[i]->layer_param();
+    if (ranges && IsQuantizable(param)) {
+      float& range = (*ranges)[param.name()];
+      const float* data = bottom[0]->cpu_data();
+      for (int j = 0; j < bottom[0]->count(); ++j) {
+        range = std::max(range, std::fabs(data[j]));
+      }
+    }
+    net->layers()[i]->Forward(bottom, &net->top_vecs()[i]);
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc < 7) {
+    LOG(ERROR) << "Usage: calibrate_int8 pretrained_net_param "
+        << "calibration_net_proto calibration_iterations held_out_net_proto "
+        << "held_out_iterations output_net_proto [all|layer1,layer2,...]";
+    return 1;
+  }
+  const string pretrained_net_param(argv[1]);
+  const string calibration_net_proto(argv[2]);
+  const int calibration_iterations = atoi(argv[3]);
+  const string held_out_net_proto(argv[4]);
+  const int held_out_iterations = atoi(argv[5]);
+  const string output_net_proto(argv[6]);
+  const string selection = argc > 7 ? argv[7] : "all";
+  std::set<string> selected;
+  if (selection != "all") {
+    vector<string> names;
+    boost::split(names, selection, boost::is_any_of(","));
+    selected.insert(names.begin(), names.end());
+  }
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+
+  // record the bottom ranges
+  std::map<string, float> ranges;
+  {
+    Net<float> calibration_net(calibration_net_proto);
+    calibration_net.CopyTrainedLayersFrom(pretrained_net_param);
+    for (int iter = 0; iter < calibration_iterations; ++iter) {
+      ForwardLayers(&calibration_net, true, &ranges);
+      LOG(ERROR) << "Calibrated on " << iter + 1 << " batches";
+    }
+  }
+  for (std::map<string, float>::const_iterator it = ranges.begin();
+      it != ranges.end(); ++it) {
+    LOG(ERROR) << it->first << ": bottom range " << it->second;
+  }
+
+  // the held-out net with the ranges, selected layers in INT8
+  NetParameter fp32_param, int8_param;
+  ReadNetParamsFromTextFileOrDie(held_out_net_proto, &fp32_param);
+  int8_param = fp32_param;
+  for (int i = 0; i < int8_param.layers_size(); ++i) {
+    LayerParameter* layer = int8_param.mutable_layers(i);
+    if (!IsQuantizable(*layer)) {
+      continue;
+    }
+    const bool quantize = selection == "all" || selected.count(layer->name());
+    selected.erase(layer->name());
+    if (!ranges.count(layer->name())) {
+      CHECK(!quantize || selection == "all") << "Layer " << layer->name()
+          << " is not in the calibration net.";
+      LOG(ERROR) << "Layer " << layer->name()
+          << " is not in the calibration net, keeping it in FP32.";
+      continue;
+    }
+    layer->mutable_quantization_param()->set_bottom_range(
+        ranges[layer->name()]);
+    if (quantize) {
+      layer->mutable_quantization_param()->set_precision(
+          QuantizationParameter_Precision_INT8);
+      LOG(ERROR) << "Quantizing " << layer->name();
+    }
+  }
+  CHECK(selected.empty()) << "Unknown Convolution3D or InnerProduct layer "
+      << *selected.begin() << " in " << held_out_net_proto;
+  WriteProtoToTextFile(int8_param, output_net_proto);
+  LOG(ERROR) << "Wrote " << output_net_proto;
+
+  // accuracy delta on the held-out clips
+  Net<float> fp32_net(fp32_param);
+  fp32_net.CopyTrainedLayersFrom(pretrained_net_param);
+  Net<float> int8_net(int8_param);
+  int8_net.CopyTrainedLayersFrom(pretrained_net_param);
+  const int num_outputs = fp32_net.num_outputs();
+  // per output: sums over the batches for scalars (e.g. accuracy), squared
+  // error and squared norm, and the clips whose argmax agrees, otherwise
+  vector<double> fp32_sum(num_outputs, 0), int8_sum(num_outputs, 0);
+  vector<double> squared_error(num_outputs, 0), squared_norm(num_outputs, 0);
+  vector<int> agree(num_outputs, 0), clips(num_outputs, 0);
+  for (int iter = 0; iter < held_out_iterations; ++iter) {
+    ForwardLayers(&fp32_net, true, NULL);
+    for (int i = 0; i < fp32_net.layers().size(); ++i) {
+      if (!fp32_net.bottom_vecs()[i].empty()) {
+        continue;
+      }
+      for (int j = 0; j < fp32_net.top_vecs()[i].size(); ++j) {
+        const string& name = fp32_net.layers()[i]->layer_param().top(j);
+        int8_net.blob_by_name(name)->CopyFrom(*fp32_net.top_vecs()[i][j]);
+      }
+    }
+    ForwardLayers(&int8_net, false, NULL);
+    for (int j = 0; j < num_outputs; ++j) {
+      const Blob<float>* fp32_output = fp32_net.output_blobs()[j];
+      const Blob<float>* int8_output = int8_net.output_blobs()[j];
+      const float* fp32_data = fp32_output->cpu_data();
+      const float* int8_data = int8_output->cpu_data();
+      if (fp32_output->count() == 1) {
+        fp32_sum[j] += fp32_data[0];
+        int8_sum[j] += int8_data[0];
+        continue;
+      }
+      for (int k = 0; k < fp32_output->count(); ++k) {
+        squared_error[j] += (int8_data[k] - fp32_data[k]) *
+            (int8_data[k] - fp32_data[k]);
+        squared_norm[j] += fp32_data[k] * fp32_data[k];
+      }
+      const int dim = fp32_output->count() / fp32_output->num();
+      for (int n = 0; n < fp32_output->num(); ++n) {
+        int fp32_argmax = 0, int8_argmax = 0;
+        for (int k = 1; k < dim; ++k) {
+          if (fp32_data[n * dim + k] > fp32_data[n * dim + fp32_argmax]) {
+            fp32_argmax = k;
+          }
+          if (int8_data[n * dim + k] > int8_data[n * dim + int8_argmax]) {
+            int8_argmax = k;
+          }
+        }
+        agree[j] += fp32_argmax == int8_argmax;
+        ++clips[j];
+      }
+    }
+    LOG(ERROR) << "Compared " << iter + 1 << " held-out batches";
+  }
+  for (int j = 0; j < num_outputs; ++j) {
+    const string& name =
+        fp32_net.blob_names()[fp32_net.output_blob_indices()[j]];
+    if (fp32_net.output_blobs()[j]->count() == 1) {
+      const double fp32_mean = fp32_sum[j] / held_out_iterations;
+      const double int8_mean = int8_sum[j] / held_out_iterations;
+      LOG(ERROR) << name << ": FP32 " << fp32_mean << ", INT8 " << int8_mean
+          << ", delta " << int8_mean - fp32_mean;
+    } else {
+      LOG(ERROR) << name << ": relative error "
+          << sqrt(squared_error[j] / squared_norm[j])
+          << ", argmax agreement " << static_cast<double>(agree[j]) /
+          clips[j] << " over " << clips[j] << " clips";
+    }
+  }
+  return 0;
+}
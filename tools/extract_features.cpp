@@ -11,7 +11,10 @@
 #include "caffe/common.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/bfloat16.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 #include "caffe/vision_layers.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
@@ -92,14 +95,22 @@ int feature_extraction_pipeline(int argc, char** argv) {
    }
    */
   string feature_extraction_proto(argv[++arg_pos]);
-  shared_ptr<Net<Dtype> > feature_extraction_net(
-      new Net<Dtype>(feature_extraction_proto));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
-
   string extract_feature_blob_names(argv[++arg_pos]);
   vector<string> blob_names;
   boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
 
+  // The feature blobs are read after Forward, so a net with plan_memory must
+  // not reuse their memory.
+  NetParameter feature_extraction_param;
+  ReadNetParamsFromTextFileOrDie(feature_extraction_proto,
+      &feature_extraction_param);
+  for (size_t i = 0; i < blob_names.size(); ++i) {
+    feature_extraction_param.add_keep_blob(blob_names[i]);
+  }
+  shared_ptr<Net<Dtype> > feature_extraction_net(
+      new Net<Dtype>(feature_extraction_param));
+  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+
   string save_feature_leveldb_names(argv[++arg_pos]);
   vector<string> leveldb_names;
   boost::split(leveldb_names, save_feature_leveldb_names,
@@ -149,14 +160,30 @@ int feature_extraction_pipeline(int argc, char** argv) {
       int batch_size = feature_blob->num();
       int dim_features = feature_blob->count() / batch_size;
       Dtype* feature_blob_data;
+      // features are always stored in NCLHW order and in full precision
+      vector<Dtype> converted, decoded;
       for (int n = 0; n < batch_size; ++n) {
         datum.set_height(dim_features);
         datum.set_width(1);
         datum.set_channels(1);
         datum.clear_data();
         datum.clear_float_data();
-        feature_blob_data = feature_blob->mutable_cpu_data() +
-            feature_blob->offset(n);
+        if (feature_blob->bfloat16_storage()) {
+          decoded.resize(dim_features);
+          bfloat16_decode_cpu(dim_features, feature_blob->cpu_bfloat16_data()
+              + feature_blob->offset(n), &decoded[0]);
+          feature_blob_data = &decoded[0];
+        } else {
+          feature_blob_data = feature_blob->mutable_cpu_data() +
+              feature_blob->offset(n);
+        }
+        if (feature_blob->layout() == NLHWC) {
+          converted.resize(dim_features);
+          convert_layout_cpu<Dtype>(feature_blob_data, 1,
+              feature_blob->channels(), dim_features / feature_blob->channels(),
+              NLHWC, &converted[0]);
+          feature_blob_data = &converted[0];
+        }
         for (int d = 0; d < dim_features; ++d) {
           datum.add_float_data(feature_blob_data[d]);
         }
@@ -0,0 +1,282 @@
+// Copyright 2014 BVLC and contributors.
+//
+// Factorizes trained Convolution3D layers into a spatial 1 x k x k
+// convolution to a lower number of channels followed by a temporal kd x 1 x 1
+// convolution ((2+1)D), with the truncated SVD of conv3d_factorize_cpu. The
+// net and its weights are rewritten with every selected layer replaced by
+// <name>_spatial and <name>_temporal, the latter keeping the original top
+// and bias. For each layer the tool reports the rank, the relative error of
+// the factorized filters, the FLOPs per clip of the original and factorized
+// layers, and, over the given number of batches of the net, the relative
+// error of the layer output on its actual input.
+// Usage:
+//    factorize_convolution3d pretrained_net_param net_proto
+//        output_net_proto output_net_param rank
+//        [all|layer1[:rank1],layer2[:rank2],...] [iterations=0]
+// Layers without their own rank use rank; ranks are capped at the exact
+// one. Layers with group or filter_group, or with a 1 x k x k or kd x 1 x 1
+// kernel, are kept. The net runs in the TEST phase on the CPU.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "boost/shared_ptr.hpp"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/conv3d_factorize.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+#include "caffe/video_3d_layers.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+// A factorized layer: its index in the net, and the spatial and temporal
+// layers with the factors, set up on its bottom.
+struct Factorization {
+  int layer_id;
+  LayerParameter spatial_param;
+  LayerParameter temporal_param;
+  shared_ptr<Convolution3DLayer<float> > spatial;
+  shared_ptr<Convolution3DLayer<float> > temporal;
+  shared_ptr<Blob<float> > middle;
+  shared_ptr<Blob<float> > top;
+  double squared_error;
+  double squared_norm;
+};
+
+// The two layers replacing param, a spatial convolution to rank channels
+// without bias and a temporal one with the outputs, top and bias of param.
+static void FactorizedParams(const LayerParameter& param, const int rank,
+    LayerParameter* spatial, LayerParameter* temporal) {
+  const string& name = param.name();
+  *spatial = param;
+  spatial->set_name(name + "_spatial");
+  spatial->clear_top();
+  spatial->add_top(name + "_spatial");
+  spatial->clear_blobs();
+  ConvolutionParameter* spatial_conv = spatial->mutable_convolution_param();
+  spatial_conv->set_num_output(rank);
+  spatial_conv->set_kernel_depth(1);
+  spatial_conv->set_temporal_pad(0);
+  spatial_conv->set_temporal_stride(1);
+  spatial_conv->set_bias_term(false);
+  spatial_conv->clear_bias_filler();
+  // learning rate and decay of the weights only
+  if (spatial->blobs_lr_size() > 1) {
+    const float blobs_lr = spatial->blobs_lr(0);
+    spatial->clear_blobs_lr();
+    spatial->add_blobs_lr(blobs_lr);
+  }
+  if (spatial->weight_decay_size() > 1) {
+    const float weight_decay = spatial->weight_decay(0);
+    spatial->clear_weight_decay();
+    spatial->add_weight_decay(weight_decay);
+  }
+  *temporal = param;
+  temporal->set_name(name + "_temporal");
+  temporal->clear_bottom();
+  temporal->add_bottom(name + "_spatial");
+  temporal->clear_blobs();
+  // the bottom range of an INT8 layer is that of the spatial convolution
+  temporal->clear_quantization_param();
+  ConvolutionParameter* temporal_conv = temporal->mutable_convolution_param();
+  temporal_conv->set_kernel_size(1);
+  temporal_conv->set_pad(0);
+  temporal_conv->set_stride(1);
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc < 6) {
+    LOG(ERROR) << "Usage: factorize_convolution3d pretrained_net_param "
+        << "net_proto output_net_proto output_net_param rank "
+        << "[all|layer1[:rank1],layer2[:rank2],...] [iterations=0]";
+    return 1;
+  }
+  const string pretrained_net_param(argv[1]);
+  const string net_proto(argv[2]);
+  const string output_net_proto(argv[3]);
+  const string output_net_param(argv[4]);
+  const int default_rank = atoi(argv[5]);
+  const string selection = argc > 6 ? argv[6] : "all";
+  const int iterations = argc > 7 ? atoi(argv[7]) : 0;
+  CHECK_GT(default_rank, 0);
+  std::map<string, int> selected;
+  if (selection != "all") {
+    vector<string> names;
+    boost::split(names, selection, boost::is_any_of(","));
+    for (int i = 0; i < names.size(); ++i) {
+      vector<string> name_rank;
+      boost::split(name_rank, names[i], boost::is_any_of(":"));
+      selected[name_rank[0]] =
+          name_rank.size() > 1 ? atoi(name_rank[1].c_str()) : default_rank;
+    }
+  }
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+
+  // the net as given, without the rewrites of Net::Init that change its
+  // layers or blobs, for the shapes and the output errors
+  NetParameter net_param, trained_param;
+  ReadNetParamsFromTextFileOrDie(net_proto, &net_param);
+  ReadNetParamsFromBinaryFileOrDie(pretrained_net_param, &trained_param);
+  NetParameter plain_param(net_param);
+  plain_param.set_channels_last(false);
+  plain_param.set_fuse_convolution3d(false);
+  plain_param.set_bfloat16_storage(false);
+  plain_param.set_autotune_convolution(false);
+  Net<float> net(plain_param);
+  net.CopyTrainedLayersFrom(trained_param);
+
+  std::map<string, Factorization> factorizations;
+  NetParameter output_param(net_param);
+  output_param.clear_layers();
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    const LayerParameter& param = net_param.layers(i);
+    const ConvolutionParameter& conv_param = param.convolution_param();
+    const bool requested = param.type() ==
+        LayerParameter_LayerType_CONVOLUTION3D &&
+        (selection == "all" || selected.count(param.name()));
+    const int rank = selected.count(param.name()) ?
+        selected[param.name()] : default_rank;
+    if (!requested) {
+      *output_param.add_layers() = param;
+      continue;
+    }
+    selected.erase(param.name());
+    if (conv_param.group() > 1 || conv_param.filter_group() > 1 ||
+        conv_param.kernel_depth() == 1 || conv_param.kernel_size() == 1) {
+      LOG(ERROR) << "Keeping " << param.name() << ": only ungrouped "
+          << "kd x k x k convolutions with kd, k > 1 are factorized.";
+      *output_param.add_layers() = param;
+      continue;
+    }
+    CHECK(net.has_layer(param.name())) << "Layer " << param.name()
+        << " is not in the TEST net.";
+    const int layer_id = std::find(net.layer_names().begin(),
+        net.layer_names().end(), param.name()) - net.layer_names().begin();
+    const Blob<float>& weight = *net.layers()[layer_id]->blobs()[0];
+    const int num_output = weight.num();
+    const int channels = weight.channels();
+    const int kernel_depth = weight.length();
+    const int kernel_size = weight.height();
+    const int max_rank = conv3d_factorize_max_rank(num_output, channels,
+        kernel_depth, kernel_size);
+    Factorization& factorization = factorizations[param.name()];
+    factorization.layer_id = layer_id;
+    FactorizedParams(param, std::min(rank, max_rank),
+        &factorization.spatial_param, &factorization.temporal_param);
+    *output_param.add_layers() = factorization.spatial_param;
+    *output_param.add_layers() = factorization.temporal_param;
+
+    // the factors, in layers set up on the bottom of the original
+    factorization.spatial.reset(
+        new Convolution3DLayer<float>(factorization.spatial_param));
+    factorization.temporal.reset(
+        new Convolution3DLayer<float>(factorization.temporal_param));
+    factorization.middle.reset(new Blob<float>());
+    factorization.top.reset(new Blob<float>());
+    vector<Blob<float>*> middle(1, factorization.middle.get());
+    vector<Blob<float>*> top(1, factorization.top.get());
+    factorization.spatial->SetUp(net.bottom_vecs()[layer_id], &middle);
+    factorization.temporal->SetUp(middle, &top);
+    const float error = conv3d_factorize_cpu(weight.cpu_data(), num_output,
+        channels, kernel_depth, kernel_size, std::min(rank, max_rank),
+        factorization.spatial->blobs()[0]->mutable_cpu_data(),
+        factorization.temporal->blobs()[0]->mutable_cpu_data());
+    if (conv_param.bias_term()) {
+      factorization.temporal->blobs()[1]->CopyFrom(
+          *net.layers()[layer_id]->blobs()[1]);
+    }
+    factorization.squared_error = 0;
+    factorization.squared_norm = 0;
+
+    // multiply-adds per clip, counted twice
+    const Blob<float>& original_top = *net.top_vecs()[layer_id][0];
+    const double original_flops = 2. * original_top.count() /
+        original_top.num() * channels * kernel_depth * kernel_size *
+        kernel_size;
+    const double factorized_flops = 2. * factorization.middle->count() /
+        factorization.middle->num() * channels * kernel_size * kernel_size +
+        2. * factorization.top->count() / factorization.top->num() *
+        std::min(rank, max_rank) * kernel_depth;
+    LOG(ERROR) << param.name() << ": rank " << std::min(rank, max_rank)
+        << " of " << max_rank << ", filter error " << error << ", "
+        << original_flops / 1e6 << " -> " << factorized_flops / 1e6
+        << " MFLOP per clip (" << original_flops / factorized_flops << "x)";
+  }
+  CHECK(selected.empty()) << "Unknown Convolution3D layer "
+      << selected.begin()->first << " in " << net_proto;
+  WriteProtoToTextFile(output_param, output_net_proto);
+  LOG(ERROR) << "Wrote " << output_net_proto;
+
+  // the weights, with the factors in place of the factorized layers
+  NetParameter output_weights(trained_param);
+  output_weights.clear_layers();
+  int written = 0;
+  for (int i = 0; i < trained_param.layers_size(); ++i) {
+    const LayerParameter& layer = trained_param.layers(i);
+    std::map<string, Factorization>::iterator it =
+        factorizations.find(layer.name());
+    if (it == factorizations.end()) {
+      *output_weights.add_layers() = layer;
+      continue;
+    }
+    const Factorization& factorization = it->second;
+    ++written;
+    LayerParameter* spatial = output_weights.add_layers();
+    *spatial = factorization.spatial_param;
+    factorization.spatial->blobs()[0]->ToProto(spatial->add_blobs());
+    LayerParameter* temporal = output_weights.add_layers();
+    *temporal = factorization.temporal_param;
+    for (int j = 0; j < factorization.temporal->blobs().size(); ++j) {
+      factorization.temporal->blobs()[j]->ToProto(temporal->add_blobs());
+    }
+  }
+  CHECK_EQ(written, factorizations.size()) << "Factorized layers without "
+      << "weights in " << pretrained_net_param;
+  WriteProtoToBinaryFile(output_weights, output_net_param);
+  LOG(ERROR) << "Wrote " << output_net_param;
+
+  // output errors: every factorized layer is compared right after the
+  // original runs, before an in-place layer overwrites its top
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (int i = 0; i < net.layers().size(); ++i) {
+      net.layers()[i]->Forward(net.bottom_vecs()[i], &net.top_vecs()[i]);
+      std::map<string, Factorization>::iterator it =
+          factorizations.find(net.layer_names()[i]);
+      if (it == factorizations.end()) {
+        continue;
+      }
+      Factorization& factorization = it->second;
+      vector<Blob<float>*> middle(1, factorization.middle.get());
+      vector<Blob<float>*> top(1, factorization.top.get());
+      factorization.spatial->Forward(net.bottom_vecs()[i], &middle);
+      factorization.temporal->Forward(middle, &top);
+      const float* original_data = net.top_vecs()[i][0]->cpu_data();
+      const float* factorized_data = factorization.top->cpu_data();
+      for (int j = 0; j < factorization.top->count(); ++j) {
+        const double difference = factorized_data[j] - original_data[j];
+        factorization.squared_error += difference * difference;
+        factorization.squared_norm += original_data[j] * original_data[j];
+      }
+    }
+    LOG(ERROR) << "Compared " << iter + 1 << " batches";
+  }
+  if (iterations > 0) {
+    for (std::map<string, Factorization>::const_iterator it =
+        factorizations.begin(); it != factorizations.end(); ++it) {
+      LOG(ERROR) << it->first << ": relative output error "
+          << sqrt(it->second.squared_error / it->second.squared_norm);
+    }
+  }
+  return 0;
+}
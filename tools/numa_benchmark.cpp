@@ -0,0 +1,157 @@
+// Copyright 2014 BVLC and contributors.
+//
+// Compares the CPU inference throughput of one Net spanning the machine with
+// that of one replica per NUMA node. First a single unbound replica runs
+// with cpu_threads x nodes threads. Then one replica per node is constructed
+// and run on a thread bound to its node (see NumaBindThread), so that its
+// weights, activations and worker threads stay on that node, and all
+// replicas run concurrently. Reports the forward passes and clips per second
+// of every replica and in total.
+// Usage:
+//    numa_benchmark net_proto [iterations] [cpu_threads] [nodes]
+//        [pretrained_net_param]
+// cpu_threads is per replica and defaults to the CPUs of node 0, nodes to
+// all nodes. The net runs in the TEST phase; input blobs are filled with a
+// fixed pattern, data layers read their sources as usual.
+
+#include <pthread.h>
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/numa.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+struct NumaReplica {
+  // -1 for the unbound replica
+  int node;
+  string net_proto;
+  string pretrained;
+  int iterations;
+  shared_ptr<Net<float> > net;
+  float milliseconds;
+};
+
+// Constructs the net of the replica on its node and runs it once, so that
+// the activations are allocated and first touched there too.
+static void* ConstructReplica(void* arg) {
+  NumaReplica* replica = reinterpret_cast<NumaReplica*>(arg);
+  NumaBindThread(replica->node);
+  replica->net.reset(new Net<float>(replica->net_proto));
+  if (!replica->pretrained.empty()) {
+    replica->net->CopyTrainedLayersFrom(replica->pretrained);
+  }
+  const vector<Blob<float>*>& inputs = replica->net->input_blobs();
+  for (int i = 0; i < inputs.size(); ++i) {
+    float* data = inputs[i]->mutable_cpu_data();
+    for (int j = 0; j < inputs[i]->count(); ++j) {
+      data[j] = (j % 255) / 255.f;
+    }
+  }
+  replica->net->ForwardPrefilled();
+  return NULL;
+}
+
+static void* RunReplica(void* arg) {
+  NumaReplica* replica = reinterpret_cast<NumaReplica*>(arg);
+  NumaBindThread(replica->node);
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < replica->iterations; ++i) {
+    replica->net->ForwardPrefilled();
+  }
+  replica->milliseconds = timer.MilliSeconds();
+  return NULL;
+}
+
+// Constructs the replicas one after the other, as the layer setup draws from
+// the shared random generator, then runs them all concurrently.
+static void RunReplicas(vector<NumaReplica>* replicas) {
+  vector<pthread_t> threads(replicas->size());
+  for (int i = 0; i < replicas->size(); ++i) {
+    CHECK(!pthread_create(&threads[i], NULL, ConstructReplica,
+        &(*replicas)[i])) << "Pthread execution failed.";
+    CHECK(!pthread_join(threads[i], NULL)) << "Pthread joining failed.";
+  }
+  for (int i = 0; i < replicas->size(); ++i) {
+    CHECK(!pthread_create(&threads[i], NULL, RunReplica, &(*replicas)[i]))
+        << "Pthread execution failed.";
+  }
+  for (int i = 0; i < replicas->size(); ++i) {
+    CHECK(!pthread_join(threads[i], NULL)) << "Pthread joining failed.";
+  }
+}
+
+// Logs the throughput of every replica and in total.
+static void Report(const vector<NumaReplica>& replicas) {
+  float total_passes = 0, total_clips = 0;
+  for (int i = 0; i < replicas.size(); ++i) {
+    const NumaReplica& replica = replicas[i];
+    const vector<Blob<float>*>& inputs = replica.net->input_blobs();
+    const int batch = inputs.empty() ?
+        replica.net->blobs()[0]->num() : inputs[0]->num();
+    const float passes = replica.iterations * 1000. / replica.milliseconds;
+    total_passes += passes;
+    total_clips += passes * batch;
+    std::ostringstream name;
+    if (replica.node < 0) {
+      name << "unbound";
+    } else {
+      name << "node " << replica.node;
+    }
+    LOG(INFO) << "  " << name.str() << ": "
+        << replica.milliseconds / replica.iterations << " ms per pass, "
+        << passes << " passes/s, " << passes * batch << " clips/s";
+  }
+  LOG(INFO) << "  total: " << total_passes << " passes/s, " << total_clips
+      << " clips/s";
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc < 2) {
+    LOG(ERROR) << "Usage: numa_benchmark net_proto [iterations] "
+        << "[cpu_threads] [nodes] [pretrained_net_param]";
+    return 1;
+  }
+  vector<int> cpus;
+  NumaNodeCpus(0, &cpus);
+  const int iterations = (argc > 2) ? atoi(argv[2]) : 50;
+  const int cpu_threads = (argc > 3) ? atoi(argv[3]) : cpus.size();
+  const int nodes = (argc > 4) ? atoi(argv[4]) : NumaNodeCount();
+  CHECK_GE(nodes, 1);
+  CHECK_LE(nodes, NumaNodeCount());
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  LOG(INFO) << NumaNodeCount() << " NUMA nodes, " << iterations
+      << " iterations";
+
+  NumaReplica replica;
+  replica.node = -1;
+  replica.net_proto = argv[1];
+  replica.pretrained = (argc > 5) ? argv[5] : "";
+  replica.iterations = iterations;
+  vector<NumaReplica> unbound(1, replica);
+  Caffe::set_cpu_threads(cpu_threads * nodes);
+  RunReplicas(&unbound);
+  LOG(INFO) << "One unbound replica, " << cpu_threads * nodes << " threads:";
+  Report(unbound);
+  unbound.clear();
+
+  vector<NumaReplica> bound(nodes, replica);
+  for (int i = 0; i < nodes; ++i) {
+    bound[i].node = i;
+  }
+  Caffe::set_cpu_threads(cpu_threads);
+  RunReplicas(&bound);
+  LOG(INFO) << "One replica per node, " << cpu_threads << " threads each:";
+  Report(bound);
+  return 0;
+}
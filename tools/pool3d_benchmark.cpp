@@ -0,0 +1,175 @@
+// Copyright 2014 BVLC and contributors.
+//
+// Times the max pooling of Pooling3DLayer (pool3d_max_cpu without its mask
+// at TEST and with it at TRAIN, and pool3d_max_backward_cpu) against the
+// single-threaded window by window loops they replaced, on the pooling shapes
+// of C3D for a batch of 16 x 112 x 112 clips.
+// Usage:
+//    pool3d_benchmark [iterations] [cpu_threads] [batch]
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/pool3d.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::FillerParameter;
+using caffe::GaussianFiller;
+using caffe::Timer;
+
+// The pool3d_max_cpu loop before the row kernels and the threads.
+void reference_pool3d_max(const float* data, const int channels,
+    const int length, const int height, const int width,
+    const int kernel_depth, const int kernel_size, const int pooled_length,
+    const int pooled_height, const int pooled_width, float* pooled,
+    int* mask) {
+  for (int c = 0; c < channels; ++c) {
+    for (int pl = 0; pl < pooled_length; ++pl) {
+      for (int ph = 0; ph < pooled_height; ++ph) {
+        for (int pw = 0; pw < pooled_width; ++pw) {
+          const int lstart = pl * kernel_depth;
+          const int hstart = std::min(ph * kernel_size, height - 1);
+          const int wstart = std::min(pw * kernel_size, width - 1);
+          const int lend = std::min(lstart + kernel_depth, length);
+          const int hend = std::min(hstart + kernel_size, height);
+          const int wend = std::min(wstart + kernel_size, width);
+          float value = -FLT_MAX;
+          int index = (lstart * height + hstart) * width + wstart;
+          for (int l = lstart; l < lend; ++l) {
+            for (int h = hstart; h < hend; ++h) {
+              for (int w = wstart; w < wend; ++w) {
+                const float v = data[(l * height + h) * width + w];
+                if (v > value) {
+                  value = v;
+                  index = (l * height + h) * width + w;
+                }
+              }
+            }
+          }
+          const int p = (pl * pooled_height + ph) * pooled_width + pw;
+          pooled[p] = value;
+          if (mask) {
+            mask[p] = index;
+          }
+        }
+      }
+    }
+    data += length * height * width;
+    pooled += pooled_length * pooled_height * pooled_width;
+    if (mask) {
+      mask += pooled_length * pooled_height * pooled_width;
+    }
+  }
+}
+
+// The scatter of the mask after clearing the whole bottom diff.
+void reference_pool3d_max_backward(const float* top_diff, const int* mask,
+    const int channels, const int volume, const int pooled_volume,
+    float* bottom_diff) {
+  memset(bottom_diff, 0, sizeof(float) * channels * volume);
+  for (int c = 0; c < channels; ++c) {
+    for (int p = 0; p < pooled_volume; ++p) {
+      bottom_diff[mask[p]] += top_diff[p];
+    }
+    top_diff += pooled_volume;
+    mask += pooled_volume;
+    bottom_diff += volume;
+  }
+}
+
+struct Pool3dBenchmarkShape {
+  const char* name;
+  int channels, length, size, kernel_depth;
+};
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 10;
+  const int cpu_threads = (argc > 2) ? atoi(argv[2]) : 1;
+  const int batch = (argc > 3) ? atoi(argv[3]) : 10;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(cpu_threads);
+  // bottoms of the 2 x 2 (x 2) stride 2 max poolings of C3D
+  const Pool3dBenchmarkShape shapes[] = {
+    {"pool1", 64, 16, 112, 1},
+    {"pool2", 128, 16, 56, 2},
+    {"pool3", 256, 8, 28, 2},
+    {"pool4", 512, 4, 14, 2},
+    {"pool5", 512, 2, 7, 2}
+  };
+  LOG(INFO) << "max pooling Forward / Backward, " << iterations
+      << " iterations, " << cpu_threads << " threads, batch " << batch;
+  for (int i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    const Pool3dBenchmarkShape& s = shapes[i];
+    const int planes = batch * s.channels;
+    const int pooled_length = (s.length - 1) / s.kernel_depth + 1;
+    const int pooled_size = (s.size - 1) / 2 + 1;
+    Blob<float> bottom(batch, s.channels, s.length, s.size, s.size);
+    Blob<float> top(batch, s.channels, pooled_length, pooled_size,
+        pooled_size);
+    Blob<int> mask(batch, s.channels, pooled_length, pooled_size,
+        pooled_size);
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(&bottom);
+    filler.Fill(&top);
+    const float* bottom_data = bottom.cpu_data();
+    float* bottom_diff = bottom.mutable_cpu_diff();
+    float* top_data = top.mutable_cpu_data();
+    const float* top_diff = top.cpu_data();
+    int* mask_data = mask.mutable_cpu_data();
+    Timer timer;
+    float elapsed[6];
+    for (int kernel = 0; kernel < 6; ++kernel) {
+      // the Forward at TEST does not record the mask
+      int* forward_mask = (kernel < 2) ? NULL : mask_data;
+      // a first untimed call touches the outputs
+      for (int iter = -1; iter < iterations; ++iter) {
+        if (iter == 0) {
+          timer.Start();
+        }
+        switch (kernel) {
+        case 0:
+        case 2:
+          reference_pool3d_max(bottom_data, planes, s.length, s.size, s.size,
+              s.kernel_depth, 2, pooled_length, pooled_size, pooled_size,
+              top_data, forward_mask);
+          break;
+        case 1:
+        case 3:
+          caffe::pool3d_max_cpu<float>(bottom_data, planes, s.length, s.size,
+              s.size, s.kernel_depth, 2, s.kernel_depth, 2, 0, pooled_length,
+              pooled_size, pooled_size, top_data, forward_mask);
+          break;
+        case 4:
+          reference_pool3d_max_backward(top_diff, mask_data, planes,
+              s.length * s.size * s.size,
+              pooled_length * pooled_size * pooled_size, bottom_diff);
+          break;
+        case 5:
+          caffe::pool3d_max_backward_cpu(top_diff, mask_data, planes,
+              s.length, s.size, s.size, s.kernel_depth, 2, s.kernel_depth, 2,
+              0, pooled_length, pooled_size, pooled_size, bottom_diff);
+          break;
+        }
+      }
+      elapsed[kernel] = timer.MilliSeconds() / iterations;
+    }
+    LOG(INFO) << s.name << " (" << s.channels << "x" << s.length << "x"
+        << s.size << "x" << s.size << ", " << s.kernel_depth << "x2x2)"
+        << "\tTEST Forward: " << elapsed[0] << " -> " << elapsed[1] << " ms ("
+        << elapsed[0] / elapsed[1] << "x)"
+        << "\tTRAIN Forward: " << elapsed[2] << " -> " << elapsed[3]
+        << " ms (" << elapsed[2] / elapsed[3] << "x)"
+        << "\tBackward: " << elapsed[4] << " -> " << elapsed[5] << " ms ("
+        << elapsed[4] / elapsed[5] << "x)";
+  }
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Copyright 2014 BVLC and contributors.
+//
+// Times the sparse Forward products of pruned weights (csr_gemm_cpu for
+// Convolution3D, csr_gemm_trans_cpu for InnerProduct) against the dense
+// caffe_cpu_gemm, on the GEMM shapes of C3D for a batch of 16 x 112 x 112
+// clips, with the weights randomly pruned to several densities. Also prints
+// the size of the weights in a dense and in a sparse snapshot.
+// Usage:
+//    sparse_benchmark [iterations] [cpu_threads] [batch]
+
+#include <cstdlib>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/sparse.hpp"
+
+using caffe::Blob;
+using caffe::BlobProto;
+using caffe::Caffe;
+using caffe::FillerParameter;
+using caffe::GaussianFiller;
+using caffe::SparseWeights;
+using caffe::Timer;
+
+struct SparseBenchmarkShape {
+  const char* name;
+  // the weights are rows x cols, multiplied with cols x columns columns of a
+  // clip (convolution) or with the batch (inner product, columns 0)
+  int rows, cols, columns;
+};
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 10;
+  const int cpu_threads = (argc > 2) ? atoi(argv[2]) : 1;
+  const int batch = (argc > 3) ? atoi(argv[3]) : 10;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(cpu_threads);
+  const SparseBenchmarkShape shapes[] = {
+    {"conv3b", 256, 256 * 27, 8 * 28 * 28},
+    {"conv4b", 512, 512 * 27, 4 * 14 * 14},
+    {"conv5b", 512, 512 * 27, 2 * 7 * 7},
+    {"fc6", 4096, 8192, 0},
+    {"fc7", 4096, 4096, 0}
+  };
+  const float densities[] = {1, 0.5, 0.3, 0.2, 0.1, 0.05};
+  LOG(INFO) << "dense / sparse Forward, " << iterations << " iterations, "
+      << cpu_threads << " threads, batch " << batch;
+  for (int i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    const SparseBenchmarkShape& s = shapes[i];
+    const bool inner_product = s.columns == 0;
+    Blob<float> weight(1, 1, 1, s.rows, s.cols);
+    Blob<float> input(1, 1, 1, s.cols, inner_product ? batch : s.columns);
+    Blob<float> output(1, 1, 1, s.rows, inner_product ? batch : s.columns);
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(&input);
+    for (int d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d) {
+      // keep a random densities[d] of the weights
+      filler.Fill(&weight);
+      std::vector<float> keep(weight.count());
+      caffe::caffe_rng_uniform<float>(weight.count(), 0, 1, &keep[0]);
+      float* weight_data = weight.mutable_cpu_data();
+      for (int j = 0; j < weight.count(); ++j) {
+        if (keep[j] >= densities[d]) {
+          weight_data[j] = 0;
+        }
+      }
+      SparseWeights<float> sparse_weight;
+      sparse_weight.Update(&weight, s.rows, 0);
+      Timer timer;
+      float elapsed[2];
+      for (int kernel = 0; kernel < 2; ++kernel) {
+        timer.Start();
+        for (int iter = 0; iter < iterations; ++iter) {
+          // one GEMM per clip of the batch for the convolutions
+          const int products = inner_product ? 1 : batch;
+          for (int p = 0; p < products; ++p) {
+            if (kernel == 0 && inner_product) {
+              caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, batch,
+                  s.rows, s.cols, 1., input.cpu_data(), weight.cpu_data(), 0.,
+                  output.mutable_cpu_data());
+            } else if (kernel == 0) {
+              caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, s.rows,
+                  s.columns, s.cols, 1., weight.cpu_data(), input.cpu_data(),
+                  0., output.mutable_cpu_data());
+            } else if (inner_product) {
+              caffe::csr_gemm_trans_cpu(batch, s.rows, s.cols,
+                  input.cpu_data(), sparse_weight.row_ptr(),
+                  sparse_weight.col_index(), sparse_weight.values(),
+                  output.mutable_cpu_data());
+            } else {
+              caffe::csr_gemm_cpu(s.rows, s.columns, sparse_weight.row_ptr(),
+                  sparse_weight.col_index(), sparse_weight.values(),
+                  input.cpu_data(), output.mutable_cpu_data());
+            }
+          }
+        }
+        elapsed[kernel] = timer.MilliSeconds() / iterations;
+      }
+      BlobProto dense_proto, sparse_proto;
+      weight.ToProto(&dense_proto);
+      weight.ToProto(&sparse_proto, false, true);
+      LOG(INFO) << s.name << " (" << s.rows << "x" << s.cols << ") density "
+          << sparse_weight.density() << "\tdense " << elapsed[0]
+          << " ms, sparse " << elapsed[1] << " ms ("
+          << elapsed[0] / elapsed[1] << "x)\tsnapshot "
+          << dense_proto.ByteSize() / 1048576. << " -> "
+          << sparse_proto.ByteSize() / 1048576. << " MB";
+    }
+  }
+  return 0;
+}
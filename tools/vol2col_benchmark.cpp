@@ -0,0 +1,158 @@
+// Copyright 2014 BVLC and contributors.
+//
+// Times vol2col_cpu / col2vol_cpu against the element by element versions
+// they replaced, on the convolution shapes of C3D for a 16 x 112 x 112 clip.
+// Usage:
+//    vol2col_benchmark [iterations] [cpu_threads]
+
+#include <cstdlib>
+#include <cstring>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/vol2col.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::FillerParameter;
+using caffe::GaussianFiller;
+using caffe::Timer;
+
+// The vol2col_cpu / col2vol_cpu kernels before the run-length rewrite.
+template <typename Dtype>
+void reference_vol2col(const Dtype* data_im, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, Dtype* data_col) {
+  int length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride + 1;
+  int height_col = (height + 2 * pad - ksize) / stride + 1;
+  int width_col = (width + 2 * pad - ksize) / stride + 1;
+  int col_stride = length_col * height_col * width_col;
+  int channels_col = channels * kdepth * ksize * ksize;
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % ksize;
+    int h_offset = (c / ksize) % ksize;
+    int l_offset = (c / ksize / ksize) % kdepth;
+    int c_im = c / ksize / ksize / kdepth;
+    for (int l = 0; l < length_col; ++l) {
+      for (int h = 0; h < height_col; ++h) {
+        for (int w = 0; w < width_col; ++w) {
+          int l_pad = l * temporal_stride - temporal_pad + l_offset;
+          int h_pad = h * stride - pad + h_offset;
+          int w_pad = w * stride - pad + w_offset;
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width
+              && l_pad >= 0 && l_pad < length)
+            data_col[c * col_stride + (l * height_col + h) * width_col + w] =
+              data_im[((c_im * length + l_pad) * height + h_pad) * width +
+              w_pad];
+          else
+            data_col[c * col_stride + (l * height_col + h) * width_col + w] =
+              0;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void reference_col2vol(const Dtype* data_col, const int channels,
+    const int length, const int height, const int width, const int ksize,
+    const int kdepth, const int pad, const int temporal_pad, const int stride,
+    const int temporal_stride, Dtype* data_im) {
+  memset(data_im, 0, sizeof(Dtype) * length * height * width * channels);
+  int length_col = (length + 2 * temporal_pad - kdepth) / temporal_stride + 1;
+  int height_col = (height + 2 * pad - ksize) / stride + 1;
+  int width_col = (width + 2 * pad - ksize) / stride + 1;
+  int col_stride = length_col * height_col * width_col;
+  int channels_col = channels * kdepth * ksize * ksize;
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % ksize;
+    int h_offset = (c / ksize) % ksize;
+    int l_offset = (c / ksize / ksize) % kdepth;
+    int c_im = c / ksize / ksize / kdepth;
+    for (int l = 0; l < length_col; ++l) {
+      for (int h = 0; h < height_col; ++h) {
+        for (int w = 0; w < width_col; ++w) {
+          int l_pad = l * temporal_stride - temporal_pad + l_offset;
+          int h_pad = h * stride - pad + h_offset;
+          int w_pad = w * stride - pad + w_offset;
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width
+              && l_pad >= 0 && l_pad < length)
+            data_im[((c_im * length + l_pad) * height + h_pad) * width +
+                w_pad] += data_col[c * col_stride +
+                (l * height_col + h) * width_col + w];
+        }
+      }
+    }
+  }
+}
+
+struct Vol2colBenchmarkShape {
+  const char* name;
+  int channels, length, size;
+};
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 10;
+  const int cpu_threads = (argc > 2) ? atoi(argv[2]) : 1;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_cpu_threads(cpu_threads);
+  // bottoms of the 3x3x3, pad 1 convolutions of C3D
+  const Vol2colBenchmarkShape shapes[] = {
+    {"conv1a", 3, 16, 112},
+    {"conv2a", 64, 16, 56},
+    {"conv3a", 128, 8, 28},
+    {"conv3b", 256, 8, 28},
+    {"conv4a", 256, 4, 14},
+    {"conv5a", 512, 2, 7}
+  };
+  LOG(INFO) << "vol2col / col2vol, " << iterations << " iterations, "
+      << cpu_threads << " threads";
+  for (int i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    const Vol2colBenchmarkShape& s = shapes[i];
+    Blob<float> im(1, s.channels, s.length, s.size, s.size);
+    Blob<float> col(1, s.channels * 27, s.length, s.size, s.size);
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(&im);
+    filler.Fill(&col);
+    float* im_data = im.mutable_cpu_data();
+    float* col_data = col.mutable_cpu_data();
+    Timer timer;
+    float elapsed[4];
+    for (int kernel = 0; kernel < 4; ++kernel) {
+      timer.Start();
+      for (int iter = 0; iter < iterations; ++iter) {
+        switch (kernel) {
+        case 0:
+          reference_vol2col(im_data, s.channels, s.length, s.size, s.size, 3,
+              3, 1, 1, 1, 1, col_data);
+          break;
+        case 1:
+          caffe::vol2col_cpu(im_data, s.channels, s.length, s.size, s.size, 3,
+              3, 1, 1, 1, 1, col_data);
+          break;
+        case 2:
+          reference_col2vol(col_data, s.channels, s.length, s.size, s.size, 3,
+              3, 1, 1, 1, 1, im_data);
+          break;
+        case 3:
+          caffe::col2vol_cpu(col_data, s.channels, s.length, s.size, s.size, 3,
+              3, 1, 1, 1, 1, im_data);
+          break;
+        }
+      }
+      elapsed[kernel] = timer.MilliSeconds() / iterations;
+    }
+    LOG(INFO) << s.name << " (" << s.channels << "x" << s.length << "x"
+        << s.size << "x" << s.size << ")"
+        << "\tvol2col: " << elapsed[0] << " -> " << elapsed[1] << " ms ("
+        << elapsed[0] / elapsed[1] << "x)"
+        << "\tcol2vol: " << elapsed[2] << " -> " << elapsed[3] << " ms ("
+        << elapsed[2] / elapsed[3] << "x)";
+  }
+  return 0;
+}